@@ -0,0 +1,20 @@
+#
+# Find the Zstandard compression library.
+#
+#  Zstd_FOUND        - system has zstd
+#  Zstd_INCLUDE_DIRS - the zstd include directory
+#  Zstd_LIBRARIES    - link these to use zstd
+#
+
+find_path(Zstd_INCLUDE_DIR NAMES zstd.h zdict.h)
+find_library(Zstd_LIBRARY NAMES zstd)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd DEFAULT_MSG Zstd_LIBRARY Zstd_INCLUDE_DIR)
+
+if(Zstd_FOUND)
+  set(Zstd_INCLUDE_DIRS ${Zstd_INCLUDE_DIR})
+  set(Zstd_LIBRARIES ${Zstd_LIBRARY})
+endif(Zstd_FOUND)
+
+mark_as_advanced(Zstd_INCLUDE_DIR Zstd_LIBRARY)
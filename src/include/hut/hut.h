@@ -0,0 +1,402 @@
+#ifndef HUT_H
+#define HUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Status codes. Every fallible hut function returns one of these, with
+ * HUT_OK being zero and every error being negative.
+ */
+
+#define HUT_OK              0
+#define HUT_ERR_NOMEM      -1
+#define HUT_ERR_IO         -2
+#define HUT_ERR_CORRUPT    -3
+#define HUT_ERR_INVALID    -4
+#define HUT_ERR_NOTSUP     -5
+#define HUT_ERR_NOTFOUND   -6
+#define HUT_ERR_FULL       -7
+#define HUT_ERR_BUSY       -8
+
+/*
+ * Value compression codecs, applied to sealed segments only. Segments
+ * that are still being appended to are always kept uncompressed so that
+ * reads of hot data stay zero-copy.
+ */
+
+typedef enum hut_compression_e {
+  HUT_COMPRESSION_NONE = 0,
+  HUT_COMPRESSION_LZ4  = 1,
+  HUT_COMPRESSION_ZSTD = 2
+} hut_compression_t;
+
+typedef struct hut_compression_options_s {
+  hut_compression_t codec;
+  int level;            /* codec specific, 0 selects the codec default */
+  size_t block_size;    /* raw bytes per compressed block, 0 for per-value */
+  size_t dict_size;     /* trained dictionary size (zstd only), 0 to disable */
+} hut_compression_options_t;
+
+/*
+ * I/O backends. By default reads go through the memory maps and block on
+ * page faults. With io_uring, hut_get_async() reads records that are not
+ * in memory without blocking, so that a single thread can keep hundreds
+ * of reads in flight.
+ */
+
+typedef enum hut_io_backend_e {
+  HUT_IO_MMAP  = 0,
+  HUT_IO_URING = 1
+} hut_io_backend_t;
+
+typedef struct hut_io_options_s {
+  hut_io_backend_t backend;
+  unsigned queue_depth;         /* submission queue entries per thread */
+  int sqpoll;                   /* submit through a kernel polling thread */
+  unsigned sqpoll_idle;         /* ms before the polling thread sleeps */
+  unsigned buffer_count;        /* registered buffers per thread */
+  size_t buffer_size;
+} hut_io_options_t;
+
+/*
+ * Zoned placement. Sealed segments are written one per zone of a zoned
+ * device, sequentially and without ever being rewritten, and compaction
+ * frees them by resetting their zones; active segments stay in files.
+ * The device is emulated by a file in the database directory. Segments
+ * are shrunk as needed to fit a zone, and writes fail with HUT_ERR_FULL
+ * while only the couple of zones held back for compaction are left.
+ */
+
+typedef struct hut_zone_options_s {
+  uint64_t zone_size;
+  uint32_t zone_count;          /* 0 to keep sealed segments in files */
+  uint32_t max_open;            /* zones open for writing at once */
+} hut_zone_options_t;
+
+/*
+ * Huge pages for the index and the segment maps. With either mode segment
+ * files are also sized in whole 2 MiB pages. Hugetlbfs pages must have been
+ * reserved up front and only back memory that is not file backed; where
+ * none are left, transparent huge pages are used instead.
+ */
+
+typedef enum hut_huge_pages_e {
+  HUT_HUGE_PAGES_NONE        = 0,
+  HUT_HUGE_PAGES_TRANSPARENT = 1,
+  HUT_HUGE_PAGES_HUGETLB     = 2
+} hut_huge_pages_t;
+
+/*
+ * Execution runtimes. By default calling threads work on the index and
+ * segments of a shard themselves, under the shard's lock. In thread-per-
+ * core mode each shard is owned by a thread pinned to a core of its own,
+ * and callers hand it requests through lock-free rings instead, waiting
+ * for the answer or, with hut_get_async(), getting called back from
+ * hut_poll(). Unless set, shards then default to one per core, or to as
+ * many as the database was created with.
+ *
+ * In between, with a write queue, only writes are handed over, to an
+ * appender thread per shard, which applies whatever has queued up under
+ * one hold of the lock and, with `sync`, flushes the whole batch at once.
+ */
+
+typedef enum hut_runtime_e {
+  HUT_RUNTIME_SHARED          = 0,
+  HUT_RUNTIME_THREAD_PER_CORE = 1
+} hut_runtime_t;
+
+/*
+ * Bloom filters. Sealed segments can carry one of their keys, at
+ * `bloom_bits_per_key`, but gets never read them: the index already says
+ * which segment holds a key. Only compaction does, to drop a tombstone
+ * once no other segment may hold an older record of its key, where
+ * without them it keeps every tombstone for as long as any other sealed
+ * segment is left.
+ * They are off by default; turn them on for deletes of keys written long
+ * before, where tombstones would otherwise pile up.
+ */
+
+/*
+ * Background jobs. Segments are compacted as they roll once at least
+ * `compact_garbage` of their bytes are dead, right away when a zoned
+ * device runs full, and with `warm_up` sealed segments are read through
+ * after open, which brings them into the page cache and checks every
+ * record on the way. All of it runs on one pool of `background_threads`
+ * threads per database, shared by its shards, and started only when some
+ * job is enabled.
+ */
+
+typedef struct hut_options_s {
+  uint64_t segment_size;        /* record bytes per segment, at most 4 GiB */
+  hut_compression_options_t compression;
+  unsigned bloom_bits_per_key;  /* per sealed segment, 0 (default) for none */
+  size_t cache_size;            /* decompressed record cache, in bytes */
+  unsigned cache_shards;
+  int sync;                     /* flush every write before returning */
+  int direct_io;                /* write sealed and compacted segments with O_DIRECT */
+  uint64_t erase_block_size;    /* segment files come in multiples of it, 0 for none */
+  hut_huge_pages_t huge_pages;
+  unsigned shards;              /* partitions by key hash, 0 or 1 for none */
+  int numa;                     /* spread shards over NUMA nodes, by core if pinned */
+  hut_runtime_t runtime;
+  int write_queue;              /* hand writes to an appender per shard */
+  unsigned ring_size;           /* requests queued per shard or thread */
+  unsigned background_threads;
+  double compact_garbage;       /* 0 to leave compaction to hut_compact() */
+  int warm_up;
+  int stats;                    /* time operations, see hut_stats_get() */
+  uint32_t trace_events;        /* per thread, 0 to not trace, see Tracing */
+  unsigned trace_threads;       /* traced at most, up to 256 */
+  hut_io_options_t io;
+  hut_zone_options_t zones;
+} hut_options_t;
+
+typedef struct hut_db_s hut_db_t;
+
+/*
+ * A value read from the database. `data` points straight into a segment
+ * map or the record cache, and stays valid until released.
+ */
+typedef struct hut_value_s {
+  const void *data;
+  size_t len;
+  void *pin[3];
+} hut_value_t;
+
+typedef void (*hut_get_fn)(void *arg, int status, hut_value_t *value);
+
+/*
+ * Fills in the defaults: 64 MiB segments, no compression, a 64 MiB cache,
+ * stats on, tracing off.
+ */
+void hut_options_init(hut_options_t *opts);
+
+int hut_open(const char *path, const hut_options_t *opts, hut_db_t **out);
+
+void hut_close(hut_db_t *db);
+
+int hut_put(hut_db_t *db, const void *key, size_t klen, const void *value, size_t vlen);
+
+int hut_get(hut_db_t *db, const void *key, size_t klen, hut_value_t *value);
+
+int hut_del(hut_db_t *db, const void *key, size_t klen);
+
+/*
+ * Gets `count` keys at once, setting `statuses[i]` to what hut_get() would
+ * have returned for `keys[i]` and filling in `values[i]` on success. The
+ * lookups are interleaved, each one prefetching what it needs next and
+ * making way for the others while it loads, so that their cache misses
+ * overlap. Returns HUT_ERR_INVALID only for invalid arguments.
+ */
+int hut_multi_get(hut_db_t *db, size_t count, const void *const *keys, const size_t *klens,
+                  hut_value_t *values, int *statuses);
+
+void hut_value_release(hut_value_t *value);
+
+/* Return non-zero to stop the scan, which then returns it as is. */
+typedef int (*hut_scan_fn)(void *arg, const void *key, size_t klen,
+                           const void *value, size_t vlen);
+
+/*
+ * Calls `fn` for every key and its value, in no particular order. Both
+ * are only valid during the call. Keys written or deleted meanwhile may
+ * or may not be seen, every other one is seen exactly once: compaction
+ * holds off until the scan is done.
+ */
+int hut_scan(hut_db_t *db, hut_scan_fn fn, void *arg);
+
+/*
+ * Exports a snapshot: every key, or those from `start` up to `end` as
+ * compared bytewise, with the value it had when hut_export() was called,
+ * whatever is written meanwhile. Segments are split between `threads`
+ * threads, which call `fn` at once, `thread` telling them apart, and
+ * `flush`, unless NULL, once done. Keys and values with `pinned` set
+ * point into segment maps and stay valid until hut_export() returns,
+ * others only during the call. Writers carry on as usual; compaction
+ * holds off as for scans, and keys overwritten or deleted meanwhile cost
+ * the export some memory. Loads committed meanwhile are left out.
+ */
+typedef int (*hut_export_fn)(void *arg, unsigned thread, const void *key, size_t klen,
+                             const void *value, size_t vlen, int pinned);
+
+typedef struct hut_export_s {
+  const void *start;            /* NULL to start from the first key */
+  size_t start_len;
+  const void *end;              /* excluded, NULL to run to the last key */
+  size_t end_len;
+  unsigned threads;             /* 0 for one per core */
+  hut_export_fn fn;
+  int (*flush)(void *arg, unsigned thread);
+  void *arg;
+} hut_export_t;
+
+int hut_export(hut_db_t *db, const hut_export_t *opts);
+
+/*
+ * Reclaims the space of overwritten and deleted records. Every sealed
+ * segment in which at least `garbage` (from 0 to 1) of the bytes are dead
+ * has its live records rewritten into new segments, and is then deleted.
+ * Writes go on meanwhile. Fails with HUT_ERR_BUSY while a scan is
+ * running, or when one starts before it is done, which leaves what it
+ * moved until then moved.
+ */
+int hut_compact(hut_db_t *db, double garbage);
+
+/*
+ * Flushes every write so far to disk, which without `sync` only closing
+ * the database otherwise does.
+ */
+int hut_sync(hut_db_t *db);
+
+/*
+ * Consistency check. Reads every record of every segment, checking it
+ * against its checksum, and checks that the index points to records that
+ * are there and nowhere else. Each shard is checked under its lock, which
+ * writers and compaction to it wait for meanwhile. Returns
+ * HUT_ERR_CORRUPT when anything failed, with `report` telling what.
+ */
+typedef struct hut_verify_s {
+  uint64_t segments;
+  uint64_t records;             /* including those overwritten and tombstones */
+  uint64_t live_records;        /* that the index points to */
+  uint64_t index_entries;       /* equal to live_records unless some point nowhere */
+  uint64_t corrupt_records;     /* failing their checksum */
+  uint64_t corrupt_segments;    /* that could not be read through */
+} hut_verify_t;
+
+int hut_verify(hut_db_t *db, hut_verify_t *report);
+
+/*
+ * Bulk loading. Puts added to a loader skip the write path: they are
+ * appended to segments built in memory, which `threads` threads (0 for
+ * one per core) seal into a staging directory as they fill up, without
+ * the lock. Loaded keys sort with writes made meanwhile as if put when
+ * added, the last of a key added twice winning, but only become visible
+ * once the load commits, which then indexes the segments staged, a
+ * thread per shard. So a put or delete of a key made after it was added
+ * wins over the loaded value, across reopens too, as may one made shortly
+ * before: sequence numbers are claimed a block per shard at a time. A
+ * delete only counts when it finds the key; one of a key only being
+ * loaded fails with HUT_ERR_NOTFOUND and leaves the load alone. A crash
+ * before the commit loses the load, one after it has the next open
+ * finish it. Takes the compression and bloom filter options of the
+ * database; not supported with zones. One loader at a time, to be
+ * committed or aborted before the database closes.
+ */
+typedef struct hut_loader_s hut_loader_t;
+
+int hut_loader_create(hut_db_t *db, unsigned threads, hut_loader_t **out);
+
+/* From one thread at a time. */
+int hut_loader_add(hut_loader_t *loader, const void *key, size_t klen,
+                   const void *value, size_t vlen);
+
+/*
+ * Frees the loader either way. Fails once committed only when indexing
+ * does, leaving the rest of the load for the next open to install.
+ */
+int hut_loader_commit(hut_loader_t *loader);
+
+void hut_loader_abort(hut_loader_t *loader);
+
+/*
+ * Statistics.
+ *
+ * Latencies are in nanoseconds. Gets, puts and deletes are timed from
+ * call to return on the handle the caller opened, asynchronous gets to
+ * their callback and each key of hut_multi_get() to its answer, as are
+ * flushes of the active segment, the batches of the write queue from
+ * taking the lock to their flush, compactions of a shard from start to
+ * end, and the seals of full segments and compaction outputs. Their counts are those of the operations.
+ *
+ * Each thread records into log-linear histograms and counters of its own,
+ * precise to about 3% for the former, which are only merged when read.
+ * Write amplification counts every byte written to segments, appended or
+ * sealed, against the keys and values written; space amplification the
+ * bytes segments take against those of the records the index points to.
+ */
+
+/*
+ * Tracing.
+ *
+ * With `trace_events` set, the same operations are also logged one event
+ * each, with their key hash, latency, status and segment or value size,
+ * into the TRACE file of the database, a binary ring of that many events
+ * per thread written without locks (see hut_trace.h). Events flag
+ * compactions of their shard that ran meanwhile. Opening the database
+ * again keeps the previous trace as TRACE.old; `hutcli trace dump`
+ * decodes either, and `hutbench --benchmarks=replay` plays the gets, puts
+ * and deletes back as a workload.
+ */
+
+typedef enum hut_stats_op_e {
+  HUT_STATS_GET     = 0,
+  HUT_STATS_PUT     = 1,
+  HUT_STATS_DEL     = 2,
+  HUT_STATS_BATCH   = 3,
+  HUT_STATS_SYNC    = 4,
+  HUT_STATS_COMPACT = 5,
+  HUT_STATS_SEAL    = 6
+} hut_stats_op_t;
+
+#define HUT_STATS_OPS 7
+
+typedef struct hut_latency_s {
+  uint64_t count;
+  uint64_t p50;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} hut_latency_t;
+
+typedef struct hut_stats_s {
+  hut_latency_t latency[HUT_STATS_OPS];   /* by hut_stats_op_t */
+  uint64_t bytes_read;          /* keys and values found by gets */
+  uint64_t bytes_written;       /* keys and values of puts and deletes */
+  uint64_t disk_bytes_written;  /* to segments */
+  uint64_t index_lookups;
+  uint64_t index_probes;        /* records read to compare keys */
+  uint64_t cache_hits;
+  uint64_t cache_misses;
+  uint64_t cache_admission_rejects;     /* records TinyLFU kept out */
+  uint64_t gc_bytes_relocated;  /* records compaction moved */
+  uint64_t disk_bytes;          /* taken by segments now */
+  uint64_t live_bytes;          /* of the records the index points to */
+  double write_amplification;
+  double space_amplification;
+  double cache_hit_ratio;
+} hut_stats_t;
+
+/* Since open, all zeroes with `stats` off. */
+int hut_stats_get(hut_db_t *db, hut_stats_t *stats);
+
+const char *hut_stats_op_name(hut_stats_op_t op);
+
+/*
+ * Asynchronous get. The callback runs on the calling thread, either right
+ * away when the record is in memory, or once its read completes, from a
+ * later hut_poll() or hut_get_async() call. It owns the value, if any,
+ * and must release it. Without the io_uring backend this is a plain
+ * hut_get() followed by the callback.
+ */
+int hut_get_async(hut_db_t *db, const void *key, size_t klen, hut_get_fn fn, void *arg);
+
+/*
+ * Submits the reads queued by this thread and runs the callbacks of those
+ * that completed, waiting for at least `min` completions. Returns the
+ * number of completions processed.
+ */
+int hut_poll(hut_db_t *db, unsigned min);
+
+const char *hut_strerror(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HUT_H */
@@ -0,0 +1,338 @@
+#ifndef HUT_HPP
+#define HUT_HPP
+
+#if __cplusplus < 202002L
+#error "hut.hpp requires C++20"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "hut/hut.h"
+
+/*
+ * C++20 layer over the C API: string_view keys, values that release
+ * themselves, errors as exceptions, and awaitable operations.
+ *
+ * Awaiting get_async() starts an asynchronous get. The coroutine only
+ * suspends when the record is not in memory, and is then resumed from
+ * hut::db::poll() on the same thread once its read completes, so that a
+ * thread interleaves as many lookups as it has coroutines awaiting them.
+ * Thread-per-core databases resume them the same way, once the owning
+ * thread answers. Writes never wait on I/O, beyond the flush with `sync`,
+ * and awaiting put_async() or del_async() completes without suspending.
+ *
+ * Lookups of keys that do not exist are not errors: they come back empty.
+ */
+
+namespace hut {
+
+class error : public std::runtime_error {
+public:
+  explicit error(int status) : std::runtime_error(hut_strerror(status)), status_(status) {}
+
+  int status() const noexcept { return status_; }
+
+private:
+  int status_;
+};
+
+inline void check(int status) {
+  if (status != HUT_OK)
+    throw error(status);
+}
+
+inline hut_options_t default_options() {
+  hut_options_t opts;
+
+  hut_options_init(&opts);
+  return opts;
+}
+
+/* A value pinned in the database until destroyed. */
+class value {
+public:
+  value() noexcept : value_() {}
+
+  explicit value(const hut_value_t &v) noexcept : value_(v), held_(true) {}
+
+  value(value &&other) noexcept : value_(other.value_), held_(std::exchange(other.held_, false)) {}
+
+  value &operator=(value &&other) noexcept {
+    if (this != &other) {
+      reset();
+      value_ = other.value_;
+      held_ = std::exchange(other.held_, false);
+    }
+    return *this;
+  }
+
+  value(const value &) = delete;
+  value &operator=(const value &) = delete;
+
+  ~value() { reset(); }
+
+  void reset() noexcept {
+    if (held_)
+      hut_value_release(&value_);
+    held_ = false;
+  }
+
+  const char *data() const noexcept { return static_cast<const char *>(value_.data); }
+
+  std::size_t size() const noexcept { return held_ ? value_.len : 0; }
+
+  std::string_view view() const noexcept { return std::string_view(data(), size()); }
+
+  std::string str() const { return std::string(view()); }
+
+  operator std::string_view() const noexcept { return view(); }
+
+private:
+  hut_value_t value_;
+  bool held_ = false;
+};
+
+class db;
+
+/* Awaiter of db::get_async(). */
+class get_awaiter {
+public:
+  get_awaiter(hut_db_t *db, std::string_view key) noexcept : db_(db), key_(key) {}
+
+  get_awaiter(const get_awaiter &) = delete;
+  get_awaiter &operator=(const get_awaiter &) = delete;
+
+  bool await_ready() const noexcept { return false; }
+
+  /* Suspends unless the get completed, or failed, right away. */
+  bool await_suspend(std::coroutine_handle<> handle) noexcept {
+    int rc;
+
+    handle_ = handle;
+    submitting_ = true;
+    rc = hut_get_async(db_, key_.data(), key_.size(), &get_awaiter::complete, this);
+    submitting_ = false;
+    if (rc != HUT_OK) {
+      status_ = rc;
+      done_ = true;
+    }
+    return !done_;
+  }
+
+  std::optional<value> await_resume() {
+    if (status_ == HUT_ERR_NOTFOUND)
+      return std::nullopt;
+    check(status_);
+    return std::optional<value>(std::move(value_));
+  }
+
+private:
+  static void complete(void *arg, int status, hut_value_t *v) {
+    get_awaiter *self = static_cast<get_awaiter *>(arg);
+
+    self->status_ = status;
+    if (v)
+      self->value_ = value(*v);
+    self->done_ = true;
+    if (!self->submitting_)
+      self->handle_.resume();
+  }
+
+  hut_db_t *db_;
+  std::string_view key_;
+  std::coroutine_handle<> handle_;
+  int status_ = HUT_OK;
+  bool submitting_ = false;
+  bool done_ = false;
+  value value_;
+};
+
+/* Awaiter of db::put_async() and db::del_async(), writing when awaited. */
+class write_awaiter {
+public:
+  write_awaiter(hut_db_t *db, std::string_view key, const std::string_view *val) noexcept
+    : db_(db), key_(key), val_(val ? *val : std::string_view()), del_(!val) {}
+
+  bool await_ready() noexcept {
+    status_ = del_ ? hut_del(db_, key_.data(), key_.size())
+                   : hut_put(db_, key_.data(), key_.size(), val_.data(), val_.size());
+    return true;
+  }
+
+  void await_suspend(std::coroutine_handle<>) const noexcept {}
+
+  bool await_resume() const {
+    if (status_ == HUT_ERR_NOTFOUND)
+      return false;
+    check(status_);
+    return true;
+  }
+
+private:
+  hut_db_t *db_;
+  std::string_view key_;
+  std::string_view val_;
+  bool del_;
+  int status_ = HUT_OK;
+};
+
+class db {
+public:
+  db() noexcept = default;
+
+  explicit db(const std::string &path) : db(path, default_options()) {}
+
+  db(const std::string &path, const hut_options_t &opts) { check(hut_open(path.c_str(), &opts, &db_)); }
+
+  db(db &&other) noexcept : db_(std::exchange(other.db_, nullptr)) {}
+
+  db &operator=(db &&other) noexcept {
+    if (this != &other) {
+      close();
+      db_ = std::exchange(other.db_, nullptr);
+    }
+    return *this;
+  }
+
+  db(const db &) = delete;
+  db &operator=(const db &) = delete;
+
+  ~db() { close(); }
+
+  /* Values and pending gets must all be gone by then. */
+  void close() noexcept {
+    hut_close(db_);
+    db_ = nullptr;
+  }
+
+  hut_db_t *handle() const noexcept { return db_; }
+
+  void put(std::string_view key, std::string_view val) {
+    check(hut_put(db_, key.data(), key.size(), val.data(), val.size()));
+  }
+
+  std::optional<value> get(std::string_view key) {
+    hut_value_t v;
+    int rc = hut_get(db_, key.data(), key.size(), &v);
+
+    if (rc == HUT_ERR_NOTFOUND)
+      return std::nullopt;
+    check(rc);
+    return std::optional<value>(std::in_place, v);
+  }
+
+  /* Interleaves the lookups, see hut_multi_get(). */
+  std::vector<std::optional<value>> multi_get(std::span<const std::string_view> keys) {
+    std::vector<const void *> ptrs(keys.size());
+    std::vector<std::size_t> lens(keys.size());
+    std::vector<hut_value_t> vals(keys.size());
+    std::vector<int> statuses(keys.size());
+    std::vector<std::optional<value>> out(keys.size());
+
+    for (std::size_t i = 0; i < keys.size(); i++) {
+      ptrs[i] = keys[i].data();
+      lens[i] = keys[i].size();
+    }
+    check(hut_multi_get(db_, keys.size(), ptrs.data(), lens.data(), vals.data(), statuses.data()));
+    for (std::size_t i = 0; i < keys.size(); i++)
+      if (statuses[i] == HUT_OK)
+        out[i].emplace(vals[i]);
+    for (std::size_t i = 0; i < keys.size(); i++)
+      if (statuses[i] != HUT_OK && statuses[i] != HUT_ERR_NOTFOUND)
+        throw error(statuses[i]);
+    return out;
+  }
+
+  /* Returns whether the key existed. */
+  bool del(std::string_view key) {
+    int rc = hut_del(db_, key.data(), key.size());
+
+    if (rc == HUT_ERR_NOTFOUND)
+      return false;
+    check(rc);
+    return true;
+  }
+
+  void compact(double garbage) { check(hut_compact(db_, garbage)); }
+
+  void sync() { check(hut_sync(db_)); }
+
+  /* Returns what hut_verify() found, throwing only when it could not check. */
+  hut_verify_t verify() {
+    hut_verify_t r;
+    int rc = hut_verify(db_, &r);
+
+    if (rc != HUT_ERR_CORRUPT)
+      check(rc);
+    return r;
+  }
+
+  hut_stats_t stats() const {
+    hut_stats_t s;
+
+    check(hut_stats_get(db_, &s));
+    return s;
+  }
+
+  /* Calls fn(key, value) for every key, see hut_scan(), until it returns false. */
+  template <class F>
+  void scan(F &&fn) {
+    struct context {
+      F &fn;
+      std::exception_ptr error;
+    } ctx{fn, nullptr};
+    int rc = hut_scan(db_, [](void *arg, const void *key, std::size_t klen,
+                              const void *val, std::size_t vlen) -> int {
+      context *c = static_cast<context *>(arg);
+
+      try {
+        return c->fn(std::string_view(static_cast<const char *>(key), klen),
+                     std::string_view(static_cast<const char *>(val), vlen)) ? 0 : 1;
+      } catch (...) {
+        c->error = std::current_exception();
+        return 1;
+      }
+    }, &ctx);
+
+    if (ctx.error)
+      std::rethrow_exception(ctx.error);
+    check(rc < 0 ? rc : HUT_OK);
+  }
+
+  /* Keys and values only need to outlive the co_await expression. */
+  get_awaiter get_async(std::string_view key) noexcept { return get_awaiter(db_, key); }
+
+  write_awaiter put_async(std::string_view key, std::string_view val) noexcept {
+    return write_awaiter(db_, key, &val);
+  }
+
+  /* Resolves to whether the key existed. */
+  write_awaiter del_async(std::string_view key) noexcept { return write_awaiter(db_, key, nullptr); }
+
+  /*
+   * Submits this thread's pending reads and resumes the coroutines whose
+   * reads completed, waiting for at least `min` of them.
+   */
+  unsigned poll(unsigned min = 0) {
+    int n = hut_poll(db_, min);
+
+    check(n < 0 ? n : HUT_OK);
+    return static_cast<unsigned>(n);
+  }
+
+private:
+  hut_db_t *db_ = nullptr;
+};
+
+} // namespace hut
+
+#endif /* HUT_HPP */
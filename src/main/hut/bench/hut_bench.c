@@ -0,0 +1,796 @@
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tinycthread.h>
+
+#include "hut/bench/hut_bench.h"
+#include "hut/util/hut_hash.h"
+
+/*
+ * Benchmark driver, after LevelDB's db_bench.
+ *
+ *   hutbench --benchmarks=fillrandom,readrandom --num=1000000 --threads=4
+ *
+ * Every benchmark runs on `threads` threads taking operations from one
+ * shared counter, until `num` (writes), `reads` (reads) or one scan per
+ * thread are done, or for `duration` seconds when set. Keys are `num`
+ * distinct integers, padded to `key_size` bytes; missing keys are taken
+ * from past them. Values are cut from a buffer that compresses to about
+ * half its size.
+ *
+ * Fills start from an empty database, everything else works on what the
+ * previous benchmarks left, or on an existing database with
+ * --use_existing_db. readwhilewriting runs one more thread that keeps
+ * overwriting random keys while the readers are timed. readasync reads as
+ * readrandom does through hut_get_async(), with up to `async_depth` gets
+ * in flight per thread, each timed from its submission to its callback,
+ * which only goes through io_uring with --io=uring. Replays run the
+ * operations of a trace instead, once each, paced as traced unless asked
+ * to go flat out.
+ *
+ * Latencies are taken around every operation, one whole scan for scans,
+ * and reported as percentiles along with throughput, for every kind of
+ * operation of mixed benchmarks such as the YCSB ones, and as one JSON
+ * object per benchmark with --json. Those the engine measures itself, and
+ * its counters, are reported before the database is reopened and at the
+ * end.
+ */
+
+#define HUT_BENCH_DEFAULT_PATH "/tmp/hutbench"
+
+static uint64_t hut_bench_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+/* Waits until `due`, a CLOCK_MONOTONIC time in ns. */
+static void hut_bench_sleep_until(uint64_t due) {
+  struct timespec ts;
+
+  ts.tv_sec = (time_t) (due / 1000000000u);
+  ts.tv_nsec = (long) (due % 1000000000u);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+    ;
+}
+
+/*
+ * Operations.
+ */
+
+int hut_bench_put(hut_bench_thread_t *t, uint64_t n) {
+  hut_bench_t *bench = t->bench;
+  int rc;
+
+  if ((rc = hut_put(bench->db, hut_bench_key(t, t->key, n), bench->key_size,
+                    hut_bench_value(t), bench->value_size)))
+    return rc;
+  t->bytes += bench->key_size + bench->value_size;
+  return 1;
+}
+
+int hut_bench_get(hut_bench_thread_t *t, uint64_t n) {
+  hut_value_t value;
+  int rc;
+
+  rc = hut_get(t->bench->db, hut_bench_key(t, t->key, n), t->bench->key_size, &value);
+  if (rc == HUT_ERR_NOTFOUND)
+    return 1;
+  if (rc)
+    return rc;
+  t->found++;
+  t->bytes += t->bench->key_size + value.len;
+  hut_value_release(&value);
+  return 1;
+}
+
+static int hut_bench_fillseq(hut_bench_thread_t *t, uint64_t i) {
+  return hut_bench_put(t, i);
+}
+
+static int hut_bench_fillrandom(hut_bench_thread_t *t, uint64_t i) {
+  (void) i;
+  return hut_bench_put(t, hut_bench_rand(t) % t->bench->num);
+}
+
+static int hut_bench_readrandom(hut_bench_thread_t *t, uint64_t i) {
+  (void) i;
+  return hut_bench_get(t, hut_bench_rand(t) % t->bench->num);
+}
+
+static int hut_bench_readmissing(hut_bench_thread_t *t, uint64_t i) {
+  (void) i;
+  return hut_bench_get(t, t->bench->num + hut_bench_rand(t) % t->bench->num);
+}
+
+typedef struct hut_bench_async_get_s {
+  hut_bench_thread_t *t;
+  uint64_t start;
+  struct hut_bench_async_get_s *next;   /* free */
+} hut_bench_async_get_t;
+
+/* A thread's gets, in its scratch. */
+typedef struct hut_bench_async_s {
+  hut_bench_async_get_t *free;
+  unsigned inflight;
+  int error;                            /* the first a get failed with */
+  hut_bench_async_get_t gets[];
+} hut_bench_async_t;
+
+static hut_bench_async_t *hut_bench_async(hut_bench_thread_t *t) {
+  hut_bench_async_t *async;
+  unsigned i, depth = t->bench->async_depth;
+
+  if (t->scratch)
+    return t->scratch;
+  if (!(async = malloc(sizeof(*async) + depth * sizeof(*async->gets))))
+    return NULL;
+  async->free = NULL;
+  async->inflight = 0;
+  async->error = HUT_OK;
+  for (i = 0; i < depth; i++) {
+    async->gets[i].t = t;
+    async->gets[i].next = async->free;
+    async->free = &async->gets[i];
+  }
+  t->scratch = async;
+  return async;
+}
+
+static void hut_bench_async_done(void *arg, int status, hut_value_t *value) {
+  hut_bench_async_get_t *get = arg;
+  hut_bench_thread_t *t = get->t;
+  hut_bench_async_t *async = t->scratch;
+
+  hut_histogram_record(&t->hist, hut_bench_now() - get->start);
+  t->ops++;
+  if (value) {
+    t->found++;
+    t->bytes += t->bench->key_size + value->len;
+    hut_value_release(value);
+  } else if (status != HUT_ERR_NOTFOUND && !async->error) {
+    async->error = status;
+  }
+  get->next = async->free;
+  async->free = get;
+  async->inflight--;
+}
+
+/* Counts for nothing, gets count once their callbacks run. */
+static int hut_bench_readasync(hut_bench_thread_t *t, uint64_t i) {
+  hut_bench_t *bench = t->bench;
+  hut_bench_async_t *async;
+  hut_bench_async_get_t *get;
+  int rc;
+
+  (void) i;
+  if (!(async = hut_bench_async(t)))
+    return HUT_ERR_NOMEM;
+  while (!async->free)
+    if ((rc = hut_poll(bench->db, 1)) < 0)
+      return rc;
+  get = async->free;
+  async->free = get->next;
+  async->inflight++;
+  get->start = hut_bench_now();
+  if ((rc = hut_get_async(bench->db, hut_bench_key(t, t->key, hut_bench_rand(t) % bench->num),
+                          bench->key_size, hut_bench_async_done, get))) {
+    get->next = async->free;
+    async->free = get;
+    async->inflight--;
+    return rc;
+  }
+  return async->error;
+}
+
+/* Waits for the gets still in flight, rings must be drained before closing. */
+static int hut_bench_readasync_finish(hut_bench_thread_t *t) {
+  hut_bench_async_t *async = t->scratch;
+  int rc;
+
+  if (!async)
+    return HUT_OK;
+  while (async->inflight)
+    if ((rc = hut_poll(t->bench->db, 1)) < 0)
+      return rc;
+  return async->error;
+}
+
+static int hut_bench_deleterandom(hut_bench_thread_t *t, uint64_t i) {
+  int rc;
+
+  (void) i;
+  rc = hut_del(t->bench->db, hut_bench_key(t, t->key, hut_bench_rand(t) % t->bench->num),
+               t->bench->key_size);
+  if (rc && rc != HUT_ERR_NOTFOUND)
+    return rc;
+  if (!rc)
+    t->found++;
+  return 1;
+}
+
+static int hut_bench_scan_record(void *arg, const void *key, size_t klen,
+                                 const void *value, size_t vlen) {
+  hut_bench_thread_t *t = arg;
+
+  (void) key;
+  (void) value;
+  t->found++;
+  t->bytes += klen + vlen;
+  return 0;
+}
+
+/* Counts for the records seen. */
+static int hut_bench_scan(hut_bench_thread_t *t, uint64_t i) {
+  uint64_t found = t->found;
+  int rc;
+
+  (void) i;
+  if ((rc = hut_scan(t->bench->db, hut_bench_scan_record, t)))
+    return rc;
+  t->ops += t->found - found;
+  return 0;
+}
+
+static const hut_bench_workload_t hut_bench_workloads[] = {
+  { "fillseq",          HUT_BENCH_NUM,   HUT_BENCH_FRESH,  hut_bench_fillseq },
+  { "fillrandom",       HUT_BENCH_NUM,   HUT_BENCH_FRESH,  hut_bench_fillrandom },
+  { "overwrite",        HUT_BENCH_NUM,   0,                hut_bench_fillrandom },
+  { "readrandom",       HUT_BENCH_READS, HUT_BENCH_FOUND,  hut_bench_readrandom },
+  { "readasync",        HUT_BENCH_READS, HUT_BENCH_FOUND | HUT_BENCH_TIMED,
+    hut_bench_readasync, NULL, NULL, NULL, hut_bench_readasync_finish },
+  { "readmissing",      HUT_BENCH_READS, HUT_BENCH_FOUND,  hut_bench_readmissing },
+  { "readwhilewriting", HUT_BENCH_READS, HUT_BENCH_WRITER | HUT_BENCH_FOUND,
+    hut_bench_readrandom },
+  { "deleterandom",     HUT_BENCH_NUM,   HUT_BENCH_FOUND,  hut_bench_deleterandom },
+  { "scan",             HUT_BENCH_SCANS, 0,                hut_bench_scan },
+  { NULL, 0, 0, NULL }
+};
+
+/*
+ * Threads.
+ */
+
+static int hut_bench_thread_run(void *arg) {
+  hut_bench_thread_t *t = arg;
+  hut_bench_t *bench = t->bench;
+  uint64_t i, start, end, limit, deadline, due;
+  int rc;
+
+  for (;;) {
+    i = __atomic_fetch_add(&bench->next, 1, __ATOMIC_RELAXED);
+    limit = __atomic_load_n(&bench->limit, __ATOMIC_RELAXED);
+    if (limit && i >= limit)
+      break;
+    start = hut_bench_now();
+    /* Paced operations count from when they were due when running late. */
+    if (bench->workload->due && (due = bench->workload->due(bench, i))) {
+      if (due > start) {
+        hut_bench_sleep_until(due);
+        start = hut_bench_now();
+      } else {
+        start = due;
+      }
+    }
+    deadline = __atomic_load_n(&bench->deadline, __ATOMIC_RELAXED);
+    if (deadline && start >= deadline)
+      break;
+    if ((rc = bench->workload->op(t, i)) < 0) {
+      t->error = rc;
+      break;
+    }
+    end = hut_bench_now();
+    if (!(bench->workload->flags & HUT_BENCH_TIMED))
+      hut_histogram_record(&t->hist, end - start);
+    if (bench->workload->flags & HUT_BENCH_MIXED)
+      hut_histogram_record(&t->kinds[t->kind], end - start);
+    t->ops += (uint64_t) rc;
+  }
+  /* Failed or not, for what is left in flight. */
+  if (bench->workload->finish && (rc = bench->workload->finish(t)) < 0 && !t->error)
+    t->error = rc;
+  return 0;
+}
+
+/* Overwrites random keys until the readers are done. */
+static int hut_bench_writer_run(void *arg) {
+  hut_bench_thread_t *t = arg;
+  int rc;
+
+  while (!__atomic_load_n(&t->bench->stop, __ATOMIC_ACQUIRE))
+    if ((rc = hut_bench_fillrandom(t, 0)) < 0) {
+      t->error = rc;
+      break;
+    }
+  return 0;
+}
+
+static int hut_bench_thread_init(hut_bench_t *bench, hut_bench_thread_t *t, unsigned id) {
+  unsigned i;
+
+  memset(t, 0, sizeof(*t));
+  t->bench = bench;
+  t->rng = hut_hash64(hut_hash64(bench->seed + bench->run) + id) | 1;
+  hut_histogram_init(&t->hist);
+  for (i = 0; i < HUT_BENCH_KINDS; i++)
+    hut_histogram_init(&t->kinds[i]);
+  if (!(t->key = malloc(bench->key_size)))
+    return HUT_ERR_NOMEM;
+  memset(t->key, 'k', bench->key_size);
+  return HUT_OK;
+}
+
+/*
+ * Runs.
+ */
+
+static int hut_bench_wipe_entry(const char *path, const struct stat *st, int type,
+                                struct FTW *ftw) {
+  (void) st;
+  (void) type;
+  (void) ftw;
+  return remove(path);
+}
+
+/* Reports what the engine measured since open, then closes it. */
+static void hut_bench_close(hut_bench_t *bench) {
+  hut_stats_t stats;
+  hut_latency_t *lat;
+  uint64_t ops = 0;
+  int op, sep = 0;
+
+  if (bench->db && bench->opts.stats && !hut_stats_get(bench->db, &stats))
+    for (op = 0; op < HUT_STATS_OPS; op++)
+      ops += stats.latency[op].count;
+  if (ops) {
+    if (bench->json)
+      printf("{\"engine\":{");
+    else
+      printf("%-16s : since open\n", "engine");
+    for (op = 0; op < HUT_STATS_OPS; op++) {
+      if (!(lat = &stats.latency[op])->count)
+        continue;
+      if (bench->json)
+        printf("%s\"%s\":{\"ops\":%llu,\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+               "\"max_us\":%.3f}", sep++ ? "," : "", hut_stats_op_name((hut_stats_op_t) op),
+               (unsigned long long) lat->count, lat->p50 / 1e3, lat->p99 / 1e3,
+               lat->p999 / 1e3, lat->max / 1e3);
+      else
+        printf("%-16s   %-8s p50 %.1f p99 %.1f p99.9 %.1f max %.1f micros (%llu ops)\n", "",
+               hut_stats_op_name((hut_stats_op_t) op), lat->p50 / 1e3, lat->p99 / 1e3,
+               lat->p999 / 1e3, lat->max / 1e3, (unsigned long long) lat->count);
+    }
+    if (bench->json)
+      printf("},\"write_amplification\":%.3f,\"space_amplification\":%.3f,"
+             "\"gc_bytes_relocated\":%llu,\"index_probes_per_lookup\":%.3f,"
+             "\"cache_hits\":%llu,\"cache_misses\":%llu,\"cache_hit_ratio\":%.4f,"
+             "\"cache_admission_rejects\":%llu}\n",
+             stats.write_amplification, stats.space_amplification,
+             (unsigned long long) stats.gc_bytes_relocated,
+             stats.index_lookups ? (double) stats.index_probes / (double) stats.index_lookups : 0,
+             (unsigned long long) stats.cache_hits, (unsigned long long) stats.cache_misses,
+             stats.cache_hit_ratio, (unsigned long long) stats.cache_admission_rejects);
+    else
+      printf("%-16s   write amp %.2f space amp %.2f gc %.1f MB, %.2f probes per lookup,"
+             " %llu of %llu cache hits (%.1f%%), %llu admission rejects\n", "",
+             stats.write_amplification, stats.space_amplification,
+             (double) stats.gc_bytes_relocated / 1048576,
+             stats.index_lookups ? (double) stats.index_probes / (double) stats.index_lookups : 0,
+             (unsigned long long) stats.cache_hits,
+             (unsigned long long) (stats.cache_hits + stats.cache_misses),
+             stats.cache_hit_ratio * 100, (unsigned long long) stats.cache_admission_rejects);
+    fflush(stdout);
+  }
+  hut_close(bench->db);
+  bench->db = NULL;
+}
+
+static int hut_bench_open(hut_bench_t *bench, int fresh) {
+  int rc;
+
+  hut_bench_close(bench);
+  bench->inserted = bench->num;
+  bench->claimed = bench->num;
+  if (fresh)
+    nftw(bench->path, hut_bench_wipe_entry, 16, FTW_DEPTH | FTW_PHYS);
+  if ((rc = hut_open(bench->path, &bench->opts, &bench->db)))
+    fprintf(stderr, "hutbench: cannot open %s: %s\n", bench->path, hut_strerror(rc));
+  return rc;
+}
+
+static const char *const hut_bench_kind_names[HUT_BENCH_KINDS] = {
+  "read", "update", "insert", "scan", "rmw", "delete"
+};
+
+static void hut_bench_print_latency(const char *name, const hut_histogram_t *hist) {
+  printf("%-16s   %-8s p50 %.1f p99 %.1f p99.9 %.1f max %.1f micros", "", name,
+         hut_histogram_percentile(hist, 50) / 1e3, hut_histogram_percentile(hist, 99) / 1e3,
+         hut_histogram_percentile(hist, 99.9) / 1e3, (double) hist->max / 1e3);
+}
+
+static void hut_bench_json_latency(const char *name, const hut_histogram_t *hist) {
+  printf("\"%s\":{\"ops\":%llu,\"mean_us\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+         "\"p999_us\":%.3f,\"max_us\":%.3f}", name, (unsigned long long) hist->count,
+         hut_histogram_mean(hist) / 1e3, hut_histogram_percentile(hist, 50) / 1e3,
+         hut_histogram_percentile(hist, 99) / 1e3, hut_histogram_percentile(hist, 99.9) / 1e3,
+         (double) hist->max / 1e3);
+}
+
+static void hut_bench_report(hut_bench_t *bench, hut_bench_thread_t *threads, uint64_t elapsed) {
+  hut_histogram_t hist, kinds[HUT_BENCH_KINDS];
+  uint64_t ops = 0, bytes = 0, found = 0;
+  double secs = (double) elapsed / 1e9, rate, mb;
+  const hut_bench_workload_t *w = bench->workload;
+  unsigned i, k;
+
+  hut_histogram_init(&hist);
+  for (k = 0; k < HUT_BENCH_KINDS; k++)
+    hut_histogram_init(&kinds[k]);
+  for (i = 0; i < bench->threads; i++) {
+    hut_histogram_merge(&hist, &threads[i].hist);
+    for (k = 0; k < HUT_BENCH_KINDS; k++)
+      hut_histogram_merge(&kinds[k], &threads[i].kinds[k]);
+    ops += threads[i].ops;
+    bytes += threads[i].bytes;
+    found += threads[i].found;
+  }
+  rate = secs > 0 ? (double) ops / secs : 0;
+  mb = secs > 0 ? (double) bytes / 1048576 / secs : 0;
+
+  if (bench->json) {
+    printf("{\"benchmark\":\"%s\",\"threads\":%u,\"seconds\":%.3f,\"ops\":%llu,"
+           "\"ops_per_sec\":%.1f,\"mb_per_sec\":%.3f,", w->name, bench->threads, secs,
+           (unsigned long long) ops, rate, mb);
+    if (w->flags & HUT_BENCH_FOUND)
+      printf("\"found\":%llu,", (unsigned long long) found);
+    printf("\"latency\":{");
+    hut_bench_json_latency(w->count == HUT_BENCH_SCANS ? "scan" : "all", &hist);
+    for (k = 0; k < HUT_BENCH_KINDS; k++)
+      if (kinds[k].count) {
+        printf(",");
+        hut_bench_json_latency(hut_bench_kind_names[k], &kinds[k]);
+      }
+    printf("}}\n");
+    fflush(stdout);
+    return;
+  }
+
+  printf("%-16s : %10.3f micros/op %10.0f ops/sec %9.1f MB/s",
+         w->name, ops ? secs * 1e6 * bench->threads / (double) ops : 0, rate, mb);
+  if (w->flags & HUT_BENCH_FOUND)
+    printf(" (%llu of %llu found)", (unsigned long long) found, (unsigned long long) ops);
+  printf("\n");
+  hut_bench_print_latency(w->count == HUT_BENCH_SCANS ? "per scan" : "per op", &hist);
+  printf("\n");
+  for (k = 0; k < HUT_BENCH_KINDS; k++)
+    if (kinds[k].count) {
+      hut_bench_print_latency(hut_bench_kind_names[k], &kinds[k]);
+      printf(" (%llu ops)\n", (unsigned long long) kinds[k].count);
+    }
+  fflush(stdout);
+}
+
+static int hut_bench_run(hut_bench_t *bench, const hut_bench_workload_t *workload) {
+  hut_bench_thread_t *threads, writer;
+  uint64_t start;
+  unsigned i, started = 0;
+  int rc = HUT_OK, writing = 0;
+
+  if ((workload->flags & HUT_BENCH_FRESH) && (rc = hut_bench_open(bench, 1)))
+    return rc;
+  if (workload->setup && (rc = workload->setup(bench)))
+    return rc;
+  if (!(threads = calloc(bench->threads, sizeof(*threads))))
+    return HUT_ERR_NOMEM;
+
+  bench->workload = workload;
+  bench->run++;
+  bench->next = 0;
+  bench->stop = 0;
+  switch (workload->count) {
+  case HUT_BENCH_NUM:
+    bench->limit = bench->num;
+    break;
+  case HUT_BENCH_READS:
+    bench->limit = bench->reads;
+    break;
+  case HUT_BENCH_ITEMS:
+    bench->limit = bench->items;
+    break;
+  default:
+    bench->limit = bench->threads;
+  }
+  /* Items run out all the same. */
+  if (bench->duration > 0 && workload->count != HUT_BENCH_ITEMS)
+    bench->limit = 0;
+
+  memset(&writer, 0, sizeof(writer));
+  if ((workload->flags & HUT_BENCH_WRITER)
+      && !(rc = hut_bench_thread_init(bench, &writer, bench->threads))) {
+    if (thrd_create(&writer.thread, hut_bench_writer_run, &writer) == thrd_success)
+      writing = 1;
+    else
+      rc = HUT_ERR_NOMEM;
+  }
+
+  start = hut_bench_now();
+  bench->start = start;
+  bench->deadline = bench->duration > 0 ? start + (uint64_t) (bench->duration * 1e9) : 0;
+  for (i = 0; i < bench->threads && !rc; i++, started++) {
+    if ((rc = hut_bench_thread_init(bench, &threads[i], i)))
+      break;
+    if (thrd_create(&threads[i].thread, hut_bench_thread_run, &threads[i]) != thrd_success)
+      rc = HUT_ERR_NOMEM;
+  }
+  if (rc) {
+    __atomic_store_n(&bench->limit, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&bench->deadline, 1, __ATOMIC_RELAXED);
+  }
+  for (i = 0; i < started; i++) {
+    thrd_join(threads[i].thread, NULL);
+    if (!rc)
+      rc = threads[i].error;
+  }
+  if (!rc)
+    hut_bench_report(bench, threads, hut_bench_now() - start);
+
+  __atomic_store_n(&bench->stop, 1, __ATOMIC_RELEASE);
+  if (writing) {
+    thrd_join(writer.thread, NULL);
+    if (!rc)
+      rc = writer.error;
+  }
+  free(writer.key);
+  for (i = 0; i < bench->threads; i++) {
+    free(threads[i].key);
+    free(threads[i].scratch);
+  }
+  free(threads);
+  if (rc)
+    fprintf(stderr, "hutbench: %s: %s\n", workload->name, hut_strerror(rc));
+  return rc;
+}
+
+/*
+ * Options.
+ */
+
+static void hut_bench_usage(void) {
+  fprintf(stderr,
+          "usage: hutbench [--name=value ...]\n"
+          "\n"
+          "  --benchmarks=LIST       comma separated, of fillseq, fillrandom, overwrite,\n"
+          "                          readrandom, readasync, readmissing,\n"
+          "                          readwhilewriting, deleterandom, scan, and the\n"
+          "                          YCSB core workloads ycsba to ycsbf over keys\n"
+          "                          loaded with fillseq, and replay of a trace,\n"
+          "                          loaded with replayfill\n"
+          "                          (fillrandom,readrandom)\n"
+          "  --db=PATH               database directory (" HUT_BENCH_DEFAULT_PATH ")\n"
+          "  --use_existing_db=0|1   keep the database found at PATH (0)\n"
+          "  --num=N                 keys, and writes per benchmark (1000000)\n"
+          "  --reads=N               reads, or YCSB operations, per benchmark, 0 for\n"
+          "                          num (0)\n"
+          "  --key_size=N            bytes, at least 8 (16)\n"
+          "  --value_size=N          bytes (100)\n"
+          "  --threads=N             (1)\n"
+          "  --async_depth=N         gets in flight per thread for readasync (32)\n"
+          "  --duration=SECONDS      run each benchmark for this long instead (0)\n"
+          "  --seed=N                (0)\n"
+          "  --json=0|1              report as a JSON object per benchmark (0)\n"
+          "  --zipf_theta=F          YCSB request skew, in (0, 1) (0.99)\n"
+          "  --scan_max=N            YCSB scan length, at most (100)\n"
+          "  --trace=PATH            trace file to replay, copied out of a database\n"
+          "                          or its TRACE.old, as opening one starts over\n"
+          "  --replay_speed=F        times the traced pace, 0 for flat out (1)\n"
+          "\n"
+          "  --segment_size=MIB      (64)\n"
+          "  --compression=CODEC     none, lz4 or zstd (none)\n"
+          "  --cache_size=MIB        (64)\n"
+          "  --bloom_bits=N          per key, 0 for none (0)\n"
+          "  --sync=0|1              (0)\n"
+          "  --shards=N              (0)\n"
+          "  --runtime=RUNTIME       shared or thread_per_core (shared)\n"
+          "  --write_queue=0|1       (0)\n"
+          "  --io=BACKEND            mmap or uring, which readasync reads through\n"
+          "                          (mmap)\n"
+          "  --huge_pages=N          0 none, 1 transparent, 2 hugetlb (0)\n"
+          "  --background_threads=N  (0)\n"
+          "  --compact_garbage=F     (0)\n"
+          "  --stats=0|1             report the latencies the engine measures, before\n"
+          "                          every reopen and at the end (1)\n"
+          "  --trace_events=N        per thread, traced into the TRACE file of the\n"
+          "                          database, which reopens start over (0)\n");
+}
+
+/* Matches `--name=`, pointing `*value` past it. */
+static int hut_bench_flag(const char *arg, const char *name, const char **value) {
+  size_t len = strlen(name);
+
+  if (strncmp(arg, "--", 2) || strncmp(arg + 2, name, len) || arg[2 + len] != '=')
+    return 0;
+  *value = arg + 3 + len;
+  return 1;
+}
+
+static int hut_bench_parse(hut_bench_t *bench, int argc, char **argv, const char **list) {
+  const char *v;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (hut_bench_flag(argv[i], "benchmarks", &v))
+      *list = v;
+    else if (hut_bench_flag(argv[i], "db", &v))
+      bench->path = v;
+    else if (hut_bench_flag(argv[i], "use_existing_db", &v))
+      bench->use_existing = atoi(v);
+    else if (hut_bench_flag(argv[i], "num", &v))
+      bench->num = strtoull(v, NULL, 10);
+    else if (hut_bench_flag(argv[i], "reads", &v))
+      bench->reads = strtoull(v, NULL, 10);
+    else if (hut_bench_flag(argv[i], "key_size", &v))
+      bench->key_size = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "value_size", &v))
+      bench->value_size = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "threads", &v))
+      bench->threads = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "async_depth", &v))
+      bench->async_depth = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "duration", &v))
+      bench->duration = atof(v);
+    else if (hut_bench_flag(argv[i], "seed", &v))
+      bench->seed = strtoull(v, NULL, 10);
+    else if (hut_bench_flag(argv[i], "json", &v))
+      bench->json = atoi(v);
+    else if (hut_bench_flag(argv[i], "zipf_theta", &v))
+      bench->theta = atof(v);
+    else if (hut_bench_flag(argv[i], "scan_max", &v))
+      bench->scan_max = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "trace", &v))
+      bench->trace = v;
+    else if (hut_bench_flag(argv[i], "replay_speed", &v))
+      bench->replay_speed = atof(v);
+    else if (hut_bench_flag(argv[i], "segment_size", &v))
+      bench->opts.segment_size = strtoull(v, NULL, 10) << 20;
+    else if (hut_bench_flag(argv[i], "compression", &v)) {
+      if (!strcmp(v, "lz4"))
+        bench->opts.compression.codec = HUT_COMPRESSION_LZ4;
+      else if (!strcmp(v, "zstd"))
+        bench->opts.compression.codec = HUT_COMPRESSION_ZSTD;
+      else if (!strcmp(v, "none"))
+        bench->opts.compression.codec = HUT_COMPRESSION_NONE;
+      else
+        return HUT_ERR_INVALID;
+    } else if (hut_bench_flag(argv[i], "cache_size", &v))
+      bench->opts.cache_size = (size_t) strtoull(v, NULL, 10) << 20;
+    else if (hut_bench_flag(argv[i], "bloom_bits", &v))
+      bench->opts.bloom_bits_per_key = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "sync", &v))
+      bench->opts.sync = atoi(v);
+    else if (hut_bench_flag(argv[i], "shards", &v))
+      bench->opts.shards = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "runtime", &v)) {
+      if (!strcmp(v, "thread_per_core"))
+        bench->opts.runtime = HUT_RUNTIME_THREAD_PER_CORE;
+      else if (!strcmp(v, "shared"))
+        bench->opts.runtime = HUT_RUNTIME_SHARED;
+      else
+        return HUT_ERR_INVALID;
+    } else if (hut_bench_flag(argv[i], "write_queue", &v))
+      bench->opts.write_queue = atoi(v);
+    else if (hut_bench_flag(argv[i], "io", &v)) {
+      if (!strcmp(v, "uring"))
+        bench->opts.io.backend = HUT_IO_URING;
+      else if (!strcmp(v, "mmap"))
+        bench->opts.io.backend = HUT_IO_MMAP;
+      else
+        return HUT_ERR_INVALID;
+    } else if (hut_bench_flag(argv[i], "huge_pages", &v))
+      bench->opts.huge_pages = (hut_huge_pages_t) atoi(v);
+    else if (hut_bench_flag(argv[i], "background_threads", &v))
+      bench->opts.background_threads = (unsigned) atoi(v);
+    else if (hut_bench_flag(argv[i], "compact_garbage", &v))
+      bench->opts.compact_garbage = atof(v);
+    else if (hut_bench_flag(argv[i], "stats", &v))
+      bench->opts.stats = atoi(v);
+    else if (hut_bench_flag(argv[i], "trace_events", &v))
+      bench->opts.trace_events = (uint32_t) strtoul(v, NULL, 10);
+    else
+      return HUT_ERR_INVALID;
+  }
+  if (!bench->reads)
+    bench->reads = bench->num;
+  if (bench->key_size < 8 || !bench->num || !bench->threads || !bench->async_depth
+      || bench->value_size > HUT_BENCH_VALUE_POOL
+      || bench->theta <= 0 || bench->theta >= 1 || !bench->scan_max
+      || bench->replay_speed < 0)
+    return HUT_ERR_INVALID;
+  return HUT_OK;
+}
+
+/* Runs of 100 bytes, the second half repeating the first. */
+static char *hut_bench_values(uint64_t seed) {
+  hut_bench_thread_t t;
+  char *values;
+  size_t i, j;
+
+  if (!(values = malloc(HUT_BENCH_VALUE_POOL)))
+    return NULL;
+  t.rng = hut_hash64(seed) | 1;
+  for (i = 0; i < HUT_BENCH_VALUE_POOL; i += 100)
+    for (j = 0; j < 100 && i + j < HUT_BENCH_VALUE_POOL; j++)
+      values[i + j] = j < 50 ? (char) (' ' + hut_bench_rand(&t) % 95) : values[i + j - 50];
+  return values;
+}
+
+static const hut_bench_workload_t *hut_bench_find(const char *name, size_t len) {
+  const hut_bench_workload_t *tables[3], *w;
+  unsigned i;
+
+  tables[0] = hut_bench_workloads;
+  tables[1] = hut_bench_ycsb_workloads;
+  tables[2] = hut_bench_replay_workloads;
+  for (i = 0; i < 3; i++)
+    for (w = tables[i]; w->name; w++)
+      if (strlen(w->name) == len && !strncmp(w->name, name, len))
+        return w;
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  const hut_bench_workload_t *w;
+  const char *list = "fillrandom,readrandom", *p;
+  hut_bench_t bench;
+  size_t len;
+  int rc = HUT_OK;
+
+  memset(&bench, 0, sizeof(bench));
+  hut_options_init(&bench.opts);
+  bench.path = HUT_BENCH_DEFAULT_PATH;
+  bench.num = 1000000;
+  bench.key_size = 16;
+  bench.value_size = 100;
+  bench.threads = 1;
+  bench.async_depth = 32;
+  bench.theta = 0.99;
+  bench.scan_max = 100;
+  bench.replay_speed = 1;
+  if (hut_bench_parse(&bench, argc, argv, &list)) {
+    hut_bench_usage();
+    return 2;
+  }
+  if (!(bench.values = hut_bench_values(bench.seed))) {
+    fprintf(stderr, "hutbench: %s\n", hut_strerror(HUT_ERR_NOMEM));
+    return 1;
+  }
+
+  if (!bench.json) {
+    printf("Keys:       %u bytes each\n", bench.key_size);
+    printf("Values:     %u bytes each\n", bench.value_size);
+    printf("Entries:    %llu\n", (unsigned long long) bench.num);
+    printf("Threads:    %u\n", bench.threads);
+    printf("------------------------------------------------\n");
+  }
+
+  if ((rc = hut_bench_open(&bench, !bench.use_existing)))
+    goto out;
+  for (p = list; *p && !rc; p += len + (p[len] == ',')) {
+    len = strcspn(p, ",");
+    if (!(w = hut_bench_find(p, len))) {
+      fprintf(stderr, "hutbench: unknown benchmark '%.*s'\n", (int) len, p);
+      rc = HUT_ERR_INVALID;
+      break;
+    }
+    rc = hut_bench_run(&bench, w);
+  }
+
+out:
+  hut_bench_close(&bench);
+  hut_bench_replay_free(&bench);
+  free(bench.values);
+  return rc ? 1 : 0;
+}
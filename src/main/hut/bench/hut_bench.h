@@ -0,0 +1,185 @@
+#ifndef HUT_BENCH_H
+#define HUT_BENCH_H
+
+#include <stdint.h>
+
+#include <tinycthread.h>
+
+#include "hut/hut.h"
+#include "hut/trace/hut_trace.h"
+#include "hut/util/hut_histogram.h"
+
+/*
+ * Benchmark driver internals, shared by the driver and its workloads;
+ * see hut_bench.c.
+ */
+
+/* Where benchmarks take their operation count from. */
+#define HUT_BENCH_NUM   0
+#define HUT_BENCH_READS 1
+#define HUT_BENCH_SCANS 2
+#define HUT_BENCH_ITEMS 3             /* as many as the setup says */
+
+/* Benchmark flags. */
+#define HUT_BENCH_FRESH  0x1          /* start from an empty database */
+#define HUT_BENCH_WRITER 0x2          /* with a writer in the background */
+#define HUT_BENCH_FOUND  0x4          /* report how many keys were found */
+#define HUT_BENCH_MIXED  0x8          /* time each kind of operation apart */
+#define HUT_BENCH_TIMED  0x10         /* operations time themselves */
+
+/* Kinds of operations of mixed benchmarks. */
+typedef enum hut_bench_kind_e {
+  HUT_BENCH_KIND_READ   = 0,
+  HUT_BENCH_KIND_UPDATE = 1,
+  HUT_BENCH_KIND_INSERT = 2,
+  HUT_BENCH_KIND_SCAN   = 3,
+  HUT_BENCH_KIND_RMW    = 4,
+  HUT_BENCH_KIND_DELETE = 5
+} hut_bench_kind_t;
+
+#define HUT_BENCH_KINDS 6
+
+typedef struct hut_bench_s hut_bench_t;
+typedef struct hut_bench_thread_s hut_bench_thread_t;
+
+/* Runs operation `i`, returns how many more it counts for, or an error. */
+typedef int (*hut_bench_op_fn)(hut_bench_thread_t *t, uint64_t i);
+
+typedef struct hut_bench_workload_s {
+  const char *name;
+  int count;                    /* HUT_BENCH_NUM, READS, SCANS or ITEMS */
+  int flags;
+  hut_bench_op_fn op;
+  int (*setup)(hut_bench_t *bench);   /* before the threads start, NULL for none */
+  const void *arg;
+  /*
+   * When operation `i` is due, in ns on the monotonic clock, 0 for right
+   * away; NULL for an unpaced benchmark.
+   */
+  uint64_t (*due)(hut_bench_t *bench, uint64_t i);
+  /* After the last operation of a thread, NULL for none. */
+  int (*finish)(hut_bench_thread_t *t);
+} hut_bench_workload_t;
+
+/*
+ * Zipfian distribution over ranks [0, n), skewed by `theta` in (0, 1),
+ * as generated by Gray et al., "Quickly generating billion-record
+ * synthetic databases".
+ */
+typedef struct hut_bench_zipf_s {
+  uint64_t n;
+  double theta;
+  double alpha;
+  double zeta2;
+  double zetan;
+  double eta;
+} hut_bench_zipf_t;
+
+struct hut_bench_thread_s {
+  hut_bench_t *bench;
+  thrd_t thread;
+  uint64_t rng;
+  char *key;
+  uint64_t ops;
+  uint64_t bytes;
+  uint64_t found;
+  int error;
+  hut_histogram_t hist;
+  hut_bench_kind_t kind;        /* of the operation just run, when mixed */
+  hut_histogram_t kinds[HUT_BENCH_KINDS];
+  hut_bench_zipf_t latest;      /* over the keys inserted so far */
+  void *scratch;                /* for the workload, freed with the thread */
+};
+
+struct hut_bench_s {
+  const char *path;
+  hut_options_t opts;
+  uint64_t num;
+  uint64_t reads;
+  unsigned key_size;
+  unsigned value_size;
+  unsigned threads;
+  unsigned async_depth;         /* gets in flight per thread, for readasync */
+  double duration;
+  int use_existing;
+  uint64_t seed;
+  double theta;
+  unsigned scan_max;
+  int json;
+  const char *trace;            /* to replay */
+  double replay_speed;          /* of the trace, 0 for flat out */
+  hut_db_t *db;
+  char *values;
+  uint64_t inserted;            /* keys in the database, or so */
+  uint64_t claimed;             /* keys handed out to inserts, past those */
+
+  /* The benchmark running. */
+  const hut_bench_workload_t *workload;
+  unsigned run;                 /* seeds threads apart from earlier runs */
+  uint64_t next;                /* operation counter shared by the threads */
+  uint64_t limit;
+  uint64_t deadline;            /* in ns, 0 for none */
+  int stop;                     /* for the background writer */
+  hut_bench_zipf_t zipf;        /* over the `num` keys loaded */
+  uint64_t items;               /* operations of HUT_BENCH_ITEMS benchmarks */
+  uint64_t start;               /* in ns */
+
+  /* The trace, once loaded, see hut_bench_replay.c. */
+  hut_trace_event_t *events;    /* gets, puts and deletes, by time */
+  uint64_t event_count;
+  uint64_t *hashes;             /* of the keys they touch, each once */
+  uint64_t hash_count;
+};
+
+/* Value bytes to cut values from. */
+#define HUT_BENCH_VALUE_POOL (1u << 20)
+
+/* xorshift64*, one per thread. */
+static inline uint64_t hut_bench_rand(hut_bench_thread_t *t) {
+  t->rng ^= t->rng >> 12;
+  t->rng ^= t->rng << 25;
+  t->rng ^= t->rng >> 27;
+  return t->rng * 0x2545f4914f6cdd1dull;
+}
+
+/* Uniform in [0, 1). */
+static inline double hut_bench_uniform(hut_bench_thread_t *t) {
+  return (double) (hut_bench_rand(t) >> 11) / 9007199254740992.0;
+}
+
+/* Key `n` in big endian behind a constant prefix, so that keys sort by n. */
+static inline const char *hut_bench_key(hut_bench_thread_t *t, char *key, uint64_t n) {
+  unsigned i, size = t->bench->key_size;
+
+  for (i = 0; i < 8; i++)
+    key[size - 1 - i] = (char) (n >> (8 * i));
+  return key;
+}
+
+static inline const char *hut_bench_value(hut_bench_thread_t *t) {
+  return t->bench->values
+         + hut_bench_rand(t) % (HUT_BENCH_VALUE_POOL - t->bench->value_size + 1);
+}
+
+/* Operations on key `n`, counting for one. */
+int hut_bench_put(hut_bench_thread_t *t, uint64_t n);
+
+int hut_bench_get(hut_bench_thread_t *t, uint64_t n);
+
+/* Trace replay, see hut_bench_replay.c. */
+extern const hut_bench_workload_t hut_bench_replay_workloads[];
+
+void hut_bench_replay_free(hut_bench_t *bench);
+
+/* YCSB core workloads, see hut_bench_ycsb.c. */
+extern const hut_bench_workload_t hut_bench_ycsb_workloads[];
+
+void hut_bench_zipf_init(hut_bench_zipf_t *zipf, uint64_t n, double theta);
+
+/* Extends the distribution to `n` ranks, at the cost of the ranks added. */
+void hut_bench_zipf_grow(hut_bench_zipf_t *zipf, uint64_t n);
+
+/* Rank for a uniform `u` in [0, 1), 0 being the most popular. */
+uint64_t hut_bench_zipf_rank(const hut_bench_zipf_t *zipf, double u);
+
+#endif /* HUT_BENCH_H */
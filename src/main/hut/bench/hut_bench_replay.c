@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hut/bench/hut_bench.h"
+
+/*
+ * Trace replay: plays back the gets, puts and deletes of a trace captured
+ * with `trace_events` (see hut.h), in the order they started.
+ *
+ *   replayfill  writes every key the trace touches once, `value_size`
+ *               bytes each, into an empty database
+ *   replay      runs the trace's operations, at `replay_speed` times the
+ *               pace they came at, or as fast as possible with 0
+ *
+ * Traces keep key hashes rather than keys, so keys are made from them the
+ * way other benchmarks make them from integers: the same keys recur as
+ * often as the traced ones did, if not with their length. Put values are
+ * as long as the traced ones.
+ *
+ * Threads take the operations in order from the shared counter. When
+ * paced, each waits until its operation is due, and times those it gets
+ * to late from when they were due, so that an engine falling behind
+ * shows in the latencies rather than only slowing the replay down.
+ * Operations of one key may run out of order when close enough to be
+ * picked up by different threads, as they may have in the traced run.
+ */
+
+static int hut_bench_replay_compare(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Keeps the gets, puts and deletes that did not fail, and their keys. */
+static int hut_bench_replay_load(hut_bench_t *bench) {
+  hut_trace_event_t *e;
+  hut_trace_dump_t dump;
+  uint64_t i, n = 0;
+  int rc;
+
+  if (bench->events)
+    return HUT_OK;
+  if (!bench->trace) {
+    fprintf(stderr, "hutbench: replay needs --trace\n");
+    return HUT_ERR_INVALID;
+  }
+  if ((rc = hut_trace_load(bench->trace, &dump))) {
+    fprintf(stderr, "hutbench: cannot load %s: %s\n", bench->trace, hut_strerror(rc));
+    return rc;
+  }
+  for (i = 0; i < dump.count; i++) {
+    e = &dump.events[i];
+    if ((e->type == HUT_STATS_GET || e->type == HUT_STATS_PUT || e->type == HUT_STATS_DEL)
+        && (e->status == HUT_OK || e->status == HUT_ERR_NOTFOUND))
+      dump.events[n++] = *e;
+  }
+  if (!n || !(bench->hashes = malloc(n * sizeof(*bench->hashes)))) {
+    hut_trace_dump_free(&dump);
+    if (!n)
+      fprintf(stderr, "hutbench: %s: nothing to replay\n", bench->trace);
+    return n ? HUT_ERR_NOMEM : HUT_ERR_INVALID;
+  }
+  bench->events = dump.events;
+  bench->event_count = n;
+
+  for (i = 0; i < n; i++)
+    bench->hashes[i] = bench->events[i].hash;
+  qsort(bench->hashes, n, sizeof(*bench->hashes), hut_bench_replay_compare);
+  for (i = 1, bench->hash_count = 1; i < n; i++)
+    if (bench->hashes[i] != bench->hashes[bench->hash_count - 1])
+      bench->hashes[bench->hash_count++] = bench->hashes[i];
+  return HUT_OK;
+}
+
+void hut_bench_replay_free(hut_bench_t *bench) {
+  free(bench->events);
+  free(bench->hashes);
+  bench->events = NULL;
+  bench->hashes = NULL;
+}
+
+static int hut_bench_replayfill_setup(hut_bench_t *bench) {
+  int rc;
+
+  if ((rc = hut_bench_replay_load(bench)))
+    return rc;
+  bench->items = bench->hash_count;
+  return HUT_OK;
+}
+
+static int hut_bench_replay_setup(hut_bench_t *bench) {
+  int rc;
+
+  if ((rc = hut_bench_replay_load(bench)))
+    return rc;
+  bench->items = bench->event_count;
+  return HUT_OK;
+}
+
+static int hut_bench_replayfill(hut_bench_thread_t *t, uint64_t i) {
+  return hut_bench_put(t, t->bench->hashes[i]);
+}
+
+static int hut_bench_replay(hut_bench_thread_t *t, uint64_t i) {
+  hut_bench_t *bench = t->bench;
+  const hut_trace_event_t *e = &bench->events[i];
+  const char *key = hut_bench_key(t, t->key, e->hash);
+  uint32_t vlen;
+  int rc;
+
+  switch (e->type) {
+  case HUT_STATS_GET:
+    t->kind = HUT_BENCH_KIND_READ;
+    return hut_bench_get(t, e->hash);
+  case HUT_STATS_PUT:
+    t->kind = HUT_BENCH_KIND_UPDATE;
+    vlen = e->arg < HUT_BENCH_VALUE_POOL ? e->arg : HUT_BENCH_VALUE_POOL;
+    if ((rc = hut_put(bench->db, key, bench->key_size,
+                      bench->values + hut_bench_rand(t) % (HUT_BENCH_VALUE_POOL - vlen + 1),
+                      vlen)))
+      return rc;
+    t->bytes += bench->key_size + vlen;
+    return 1;
+  default:
+    t->kind = HUT_BENCH_KIND_DELETE;
+    rc = hut_del(bench->db, key, bench->key_size);
+    if (rc && rc != HUT_ERR_NOTFOUND)
+      return rc;
+    return 1;
+  }
+}
+
+static uint64_t hut_bench_replay_due(hut_bench_t *bench, uint64_t i) {
+  if (bench->replay_speed <= 0)
+    return 0;
+  return bench->start + (uint64_t) ((double) (bench->events[i].time - bench->events[0].time)
+                                    / bench->replay_speed);
+}
+
+const hut_bench_workload_t hut_bench_replay_workloads[] = {
+  { "replayfill", HUT_BENCH_ITEMS, HUT_BENCH_FRESH, hut_bench_replayfill,
+    hut_bench_replayfill_setup, NULL, NULL },
+  { "replay",     HUT_BENCH_ITEMS, HUT_BENCH_FOUND | HUT_BENCH_MIXED, hut_bench_replay,
+    hut_bench_replay_setup, NULL, hut_bench_replay_due },
+  { NULL, 0, 0, NULL, NULL, NULL, NULL }
+};
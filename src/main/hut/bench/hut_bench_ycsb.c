@@ -0,0 +1,255 @@
+#include <math.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hut/bench/hut_bench.h"
+#include "hut/util/hut_hash.h"
+
+/*
+ * YCSB core workloads, after Cooper et al., "Benchmarking cloud serving
+ * systems with YCSB", run in process over keys 0 to `num`, which fillseq
+ * loads:
+ *
+ *   A  50% reads, 50% updates
+ *   B  95% reads, 5% updates
+ *   C  reads only
+ *   D  95% reads of the latest keys, 5% inserts
+ *   E  95% short scans, 5% inserts
+ *   F  50% reads, 50% read-modify-writes
+ *
+ * Requests follow a zipfian distribution over the keys, scrambled so that
+ * popular keys are spread over the key space, except for D, which favors
+ * the keys inserted last. Inserts take new keys past the loaded ones, and
+ * only count as inserted once every key before them is, so that readers
+ * of the latest ones do not miss.
+ *
+ * Keys are hashed rather than ordered, so scans read `1` to `scan_max`
+ * consecutive key numbers with one hut_multi_get() instead of a range.
+ */
+
+/* Ranks summed one by one, past which zeta is approximated. */
+#define HUT_BENCH_ZETA_EXACT (1u << 16)
+
+typedef struct hut_bench_ycsb_s {
+  double read;                  /* proportions, read-modify-writes take the rest */
+  double update;
+  double insert;
+  double scan;
+  int latest;                   /* requests favor the keys inserted last */
+} hut_bench_ycsb_t;
+
+typedef struct hut_bench_ycsb_batch_s {
+  hut_value_t *values;
+  const void **keys;
+  size_t *lens;
+  int *statuses;
+  char *buf;
+} hut_bench_ycsb_batch_t;
+
+/*
+ * Zipfian distribution.
+ */
+
+static double hut_bench_zeta_range(uint64_t from, uint64_t to, double theta) {
+  double sum = 0;
+  uint64_t i;
+
+  for (i = from; i <= to; i++)
+    sum += pow((double) i, -theta);
+  return sum;
+}
+
+/*
+ * Sum of 1/i^theta up to n. Past the first ranks, by Euler-Maclaurin,
+ * which is exact to well within a double by then.
+ */
+static double hut_bench_zeta(uint64_t n, double theta) {
+  double a = HUT_BENCH_ZETA_EXACT, b = (double) n;
+
+  if (n <= HUT_BENCH_ZETA_EXACT)
+    return hut_bench_zeta_range(1, n, theta);
+  return hut_bench_zeta_range(1, HUT_BENCH_ZETA_EXACT, theta)
+         + (pow(b, 1 - theta) - pow(a, 1 - theta)) / (1 - theta)
+         + (pow(b, -theta) - pow(a, -theta)) / 2
+         + theta * (pow(a, -theta - 1) - pow(b, -theta - 1)) / 12;
+}
+
+static void hut_bench_zipf_eta(hut_bench_zipf_t *zipf) {
+  zipf->eta = (1 - pow(2.0 / (double) zipf->n, 1 - zipf->theta))
+              / (1 - zipf->zeta2 / zipf->zetan);
+}
+
+void hut_bench_zipf_init(hut_bench_zipf_t *zipf, uint64_t n, double theta) {
+  zipf->n = n;
+  zipf->theta = theta;
+  zipf->alpha = 1 / (1 - theta);
+  zipf->zeta2 = 1 + pow(0.5, theta);
+  zipf->zetan = hut_bench_zeta(n, theta);
+  hut_bench_zipf_eta(zipf);
+}
+
+void hut_bench_zipf_grow(hut_bench_zipf_t *zipf, uint64_t n) {
+  if (n <= zipf->n)
+    return;
+  zipf->zetan += hut_bench_zeta_range(zipf->n + 1, n, zipf->theta);
+  zipf->n = n;
+  hut_bench_zipf_eta(zipf);
+}
+
+uint64_t hut_bench_zipf_rank(const hut_bench_zipf_t *zipf, double u) {
+  double uz = u * zipf->zetan;
+  uint64_t rank;
+
+  if (uz < 1)
+    return 0;
+  if (uz < zipf->zeta2)
+    return 1;
+  rank = (uint64_t) ((double) zipf->n * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha));
+  return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+/*
+ * Operations.
+ */
+
+static uint64_t hut_bench_ycsb_key(hut_bench_thread_t *t, const hut_bench_ycsb_t *spec) {
+  hut_bench_t *bench = t->bench;
+  uint64_t inserted;
+
+  if (!spec->latest)
+    return hut_hash64(hut_bench_zipf_rank(&bench->zipf, hut_bench_uniform(t))) % bench->num;
+  inserted = __atomic_load_n(&bench->inserted, __ATOMIC_ACQUIRE);
+  if (!t->latest.n)
+    hut_bench_zipf_init(&t->latest, inserted, bench->theta);
+  else
+    hut_bench_zipf_grow(&t->latest, inserted);
+  return inserted - 1 - hut_bench_zipf_rank(&t->latest, hut_bench_uniform(t));
+}
+
+static int hut_bench_ycsb_insert(hut_bench_thread_t *t) {
+  hut_bench_t *bench = t->bench;
+  uint64_t n = __atomic_fetch_add(&bench->claimed, 1, __ATOMIC_RELAXED), expected;
+  int rc;
+
+  t->kind = HUT_BENCH_KIND_INSERT;
+  rc = hut_bench_put(t, n);
+  /* Failed inserts are acknowledged all the same, the run ends anyway. */
+  for (expected = n;
+       !__atomic_compare_exchange_n(&bench->inserted, &expected, n + 1, 0,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+       expected = n)
+    sched_yield();
+  return rc;
+}
+
+static hut_bench_ycsb_batch_t *hut_bench_ycsb_batch(hut_bench_thread_t *t) {
+  hut_bench_ycsb_batch_t *batch;
+  unsigned max = t->bench->scan_max;
+  char *p;
+
+  if (t->scratch)
+    return t->scratch;
+  if (!(p = malloc(sizeof(*batch) + max * (sizeof(*batch->values) + sizeof(*batch->keys)
+                                           + sizeof(*batch->lens) + sizeof(*batch->statuses)
+                                           + t->bench->key_size))))
+    return NULL;
+  batch = (hut_bench_ycsb_batch_t *) p;
+  batch->values = (hut_value_t *) (p += sizeof(*batch));
+  batch->keys = (const void **) (p += max * sizeof(*batch->values));
+  batch->lens = (size_t *) (p += max * sizeof(*batch->keys));
+  batch->statuses = (int *) (p += max * sizeof(*batch->lens));
+  batch->buf = p + max * sizeof(*batch->statuses);
+  memset(batch->buf, 'k', (size_t) max * t->bench->key_size);
+  t->scratch = batch;
+  return batch;
+}
+
+static int hut_bench_ycsb_scan(hut_bench_thread_t *t, const hut_bench_ycsb_t *spec) {
+  hut_bench_t *bench = t->bench;
+  hut_bench_ycsb_batch_t *batch;
+  uint64_t first = hut_bench_ycsb_key(t, spec), end;
+  unsigned len = 1 + (unsigned) (hut_bench_rand(t) % bench->scan_max), i;
+  int rc;
+
+  t->kind = HUT_BENCH_KIND_SCAN;
+  if (!(batch = hut_bench_ycsb_batch(t)))
+    return HUT_ERR_NOMEM;
+  end = __atomic_load_n(&bench->inserted, __ATOMIC_ACQUIRE);
+  if (first + len > end)
+    len = (unsigned) (end - first);
+  for (i = 0; i < len; i++) {
+    batch->keys[i] = hut_bench_key(t, batch->buf + (size_t) i * bench->key_size, first + i);
+    batch->lens[i] = bench->key_size;
+  }
+  if ((rc = hut_multi_get(bench->db, len, batch->keys, batch->lens, batch->values,
+                          batch->statuses)))
+    return rc;
+  for (i = 0; i < len; i++) {
+    if (batch->statuses[i] == HUT_ERR_NOTFOUND)
+      continue;
+    if (batch->statuses[i] && !rc)
+      rc = batch->statuses[i];
+    if (batch->statuses[i])
+      continue;
+    t->found++;
+    t->bytes += bench->key_size + batch->values[i].len;
+    hut_value_release(&batch->values[i]);
+  }
+  return rc ? rc : 1;
+}
+
+static int hut_bench_ycsb_rmw(hut_bench_thread_t *t, const hut_bench_ycsb_t *spec) {
+  uint64_t n = hut_bench_ycsb_key(t, spec);
+  int rc;
+
+  t->kind = HUT_BENCH_KIND_RMW;
+  if ((rc = hut_bench_get(t, n)) < 0)
+    return rc;
+  return hut_bench_put(t, n);
+}
+
+static int hut_bench_ycsb_op(hut_bench_thread_t *t, uint64_t i) {
+  const hut_bench_ycsb_t *spec = t->bench->workload->arg;
+  double u = hut_bench_uniform(t);
+
+  (void) i;
+  if ((u -= spec->read) < 0) {
+    t->kind = HUT_BENCH_KIND_READ;
+    return hut_bench_get(t, hut_bench_ycsb_key(t, spec));
+  }
+  if ((u -= spec->update) < 0) {
+    t->kind = HUT_BENCH_KIND_UPDATE;
+    return hut_bench_put(t, hut_bench_ycsb_key(t, spec));
+  }
+  if ((u -= spec->insert) < 0)
+    return hut_bench_ycsb_insert(t);
+  if ((u -= spec->scan) < 0)
+    return hut_bench_ycsb_scan(t, spec);
+  return hut_bench_ycsb_rmw(t, spec);
+}
+
+static int hut_bench_ycsb_setup(hut_bench_t *bench) {
+  hut_bench_zipf_init(&bench->zipf, bench->num, bench->theta);
+  return HUT_OK;
+}
+
+static const hut_bench_ycsb_t hut_bench_ycsb_a = { 0.5,  0.5,  0,    0,    0 };
+static const hut_bench_ycsb_t hut_bench_ycsb_b = { 0.95, 0.05, 0,    0,    0 };
+static const hut_bench_ycsb_t hut_bench_ycsb_c = { 1,    0,    0,    0,    0 };
+static const hut_bench_ycsb_t hut_bench_ycsb_d = { 0.95, 0,    0.05, 0,    1 };
+static const hut_bench_ycsb_t hut_bench_ycsb_e = { 0,    0,    0.05, 0.95, 0 };
+static const hut_bench_ycsb_t hut_bench_ycsb_f = { 0.5,  0,    0,    0,    0 };
+
+#define HUT_BENCH_YCSB(name, spec) \
+  { name, HUT_BENCH_READS, HUT_BENCH_MIXED, hut_bench_ycsb_op, hut_bench_ycsb_setup, &spec }
+
+const hut_bench_workload_t hut_bench_ycsb_workloads[] = {
+  HUT_BENCH_YCSB("ycsba", hut_bench_ycsb_a),
+  HUT_BENCH_YCSB("ycsbb", hut_bench_ycsb_b),
+  HUT_BENCH_YCSB("ycsbc", hut_bench_ycsb_c),
+  HUT_BENCH_YCSB("ycsbd", hut_bench_ycsb_d),
+  HUT_BENCH_YCSB("ycsbe", hut_bench_ycsb_e),
+  HUT_BENCH_YCSB("ycsbf", hut_bench_ycsb_f),
+  { NULL, 0, 0, NULL, NULL, NULL }
+};
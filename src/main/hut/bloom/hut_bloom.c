@@ -0,0 +1,77 @@
+#include "hut/bloom/hut_bloom.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <tinycthread.h>
+
+#define HUT_BLOOM_WORDS 8
+
+static const uint32_t hut_bloom_salt[HUT_BLOOM_WORDS] = {
+  0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+  0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+static int hut_bloom_avx2;
+static once_flag hut_bloom_once = ONCE_FLAG_INIT;
+
+static void hut_bloom_init(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  hut_bloom_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+static uint32_t *hut_bloom_block(const void *filter, size_t len, uint64_t hash) {
+  uint64_t blocks = len / HUT_BLOOM_BLOCK_SIZE;
+
+  return (uint32_t *) filter + ((hash >> 32) * blocks >> 32) * HUT_BLOOM_WORDS;
+}
+
+size_t hut_bloom_size(uint64_t keys, unsigned bits_per_key) {
+  uint64_t blocks = (keys * bits_per_key + HUT_BLOOM_BLOCK_SIZE * 8 - 1)
+                    / (HUT_BLOOM_BLOCK_SIZE * 8);
+
+  return (size_t) (blocks ? blocks : 1) * HUT_BLOOM_BLOCK_SIZE;
+}
+
+void hut_bloom_add(void *filter, size_t len, uint64_t hash) {
+  uint32_t *block = hut_bloom_block(filter, len, hash);
+  uint32_t h = (uint32_t) hash;
+  int i;
+
+  for (i = 0; i < HUT_BLOOM_WORDS; i++)
+    block[i] |= 1u << ((h * hut_bloom_salt[i]) >> 27);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+static int hut_bloom_probe_avx2(const uint32_t *block, uint32_t h) {
+  __m256i salt = _mm256_loadu_si256((const __m256i *) hut_bloom_salt);
+  __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((int) h), salt), 27);
+  __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+
+  return _mm256_testc_si256(_mm256_load_si256((const __m256i *) block), mask);
+}
+#endif
+
+static int hut_bloom_probe(const uint32_t *block, uint32_t h) {
+  int i;
+
+  for (i = 0; i < HUT_BLOOM_WORDS; i++)
+    if (!(block[i] & (1u << ((h * hut_bloom_salt[i]) >> 27))))
+      return 0;
+  return 1;
+}
+
+int hut_bloom_may_contain(const void *filter, size_t len, uint64_t hash) {
+  const uint32_t *block = hut_bloom_block(filter, len, hash);
+
+  call_once(&hut_bloom_once, hut_bloom_init);
+#if defined(__x86_64__)
+  if (hut_bloom_avx2)
+    return hut_bloom_probe_avx2(block, (uint32_t) hash);
+#endif
+  return hut_bloom_probe(block, (uint32_t) hash);
+}
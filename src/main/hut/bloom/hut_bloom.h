@@ -0,0 +1,25 @@
+#ifndef HUT_BLOOM_H
+#define HUT_BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Split block bloom filter. Each key maps to a single 256-bit block, and
+ * sets one bit in each of its eight 32-bit words, so a probe touches one
+ * cache line and is a single AVX2 test where the CPU has it.
+ *
+ * Filters are plain byte arrays of hut_bloom_size() bytes, 32-byte
+ * aligned, so they can be probed in place from a memory map. Keys are
+ * added and probed by their 64-bit hash.
+ */
+
+#define HUT_BLOOM_BLOCK_SIZE 32
+
+size_t hut_bloom_size(uint64_t keys, unsigned bits_per_key);
+
+void hut_bloom_add(void *filter, size_t len, uint64_t hash);
+
+int hut_bloom_may_contain(const void *filter, size_t len, uint64_t hash);
+
+#endif /* HUT_BLOOM_H */
@@ -0,0 +1,418 @@
+#include "hut/cache/hut_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <tinycthread.h>
+
+#include "hut/hut.h"
+#include "hut/util/hut_hash.h"
+
+#define HUT_CACHE_LINE 64
+
+/* Window and protected segment sizes, in percent of the shard capacity. */
+#define HUT_CACHE_WINDOW_PERCENT 1
+#define HUT_CACHE_PROTECTED_PERCENT 80
+
+/* One sketch counter per this many bytes of capacity, four probes each. */
+#define HUT_CACHE_SKETCH_BYTES 128
+#define HUT_CACHE_SKETCH_MIN 256
+#define HUT_CACHE_SKETCH_DEPTH 4
+#define HUT_CACHE_SKETCH_MAX_COUNT 15
+
+#define HUT_CACHE_MIN_BUCKETS 64
+
+enum {
+  HUT_CACHE_DETACHED,
+  HUT_CACHE_WINDOW,
+  HUT_CACHE_PROBATION,
+  HUT_CACHE_PROTECTED
+};
+
+struct hut_cache_entry_s {
+  hut_cache_entry_t *chain;
+  hut_cache_entry_t *prev;
+  hut_cache_entry_t *next;
+  uint64_t key;
+  size_t len;
+  int refs;
+  int queue;
+  char data[];
+};
+
+typedef struct hut_cache_queue_s {
+  hut_cache_entry_t head;       /* sentinel, head.next is the most recent */
+  size_t bytes;
+} hut_cache_queue_t;
+
+typedef struct hut_cache_shard_s {
+  mtx_t lock;
+  hut_cache_entry_t **buckets;
+  size_t bucket_mask;
+  size_t count;
+  hut_cache_queue_t window;
+  hut_cache_queue_t probation;
+  hut_cache_queue_t protected;
+  size_t capacity;
+  size_t window_capacity;
+  size_t main_capacity;
+  size_t protected_capacity;
+  uint8_t *sketch;
+  size_t sketch_mask;
+  size_t sketch_samples;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t admission_rejects;
+  uint64_t evictions;
+} __attribute__((aligned(HUT_CACHE_LINE))) hut_cache_shard_t;
+
+struct hut_cache_s {
+  hut_cache_shard_t *shards;
+  unsigned shard_count;
+};
+
+static size_t hut_cache_charge(const hut_cache_entry_t *e) {
+  return sizeof(*e) + e->len;
+}
+
+static size_t hut_cache_pow2(size_t n) {
+  size_t p = 1;
+
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+/*
+ * Count-min sketch of 4 probes over saturating counters. The low bits of
+ * the key hash already pick the shard, so probes double hash a rehash of
+ * it instead. Every counter is halved once the number of samples reaches
+ * ten times the width, so that frequencies age and the sketch follows a
+ * changing working set.
+ */
+
+#define HUT_CACHE_SKETCH_INDEX(shard, s, i) \
+  ((size_t) ((s) + (i) * (((s) >> 32) | 1)) & (shard)->sketch_mask)
+
+static unsigned hut_cache_sketch_estimate(const hut_cache_shard_t *shard, uint64_t h) {
+  unsigned i, c, min = HUT_CACHE_SKETCH_MAX_COUNT;
+  uint64_t s = hut_hash64(h);
+
+  for (i = 0; i < HUT_CACHE_SKETCH_DEPTH; i++) {
+    c = shard->sketch[HUT_CACHE_SKETCH_INDEX(shard, s, i)];
+    if (c < min)
+      min = c;
+  }
+  return min;
+}
+
+static void hut_cache_sketch_increment(hut_cache_shard_t *shard, uint64_t h) {
+  uint64_t s = hut_hash64(h);
+  uint8_t *c;
+  size_t i;
+
+  for (i = 0; i < HUT_CACHE_SKETCH_DEPTH; i++) {
+    c = &shard->sketch[HUT_CACHE_SKETCH_INDEX(shard, s, i)];
+    if (*c < HUT_CACHE_SKETCH_MAX_COUNT)
+      (*c)++;
+  }
+  if (++shard->sketch_samples >= (shard->sketch_mask + 1) * 10) {
+    for (i = 0; i <= shard->sketch_mask; i++)
+      shard->sketch[i] >>= 1;
+    shard->sketch_samples /= 2;
+  }
+}
+
+static void hut_cache_queue_init(hut_cache_queue_t *q) {
+  q->head.prev = q->head.next = &q->head;
+  q->bytes = 0;
+}
+
+static void hut_cache_queue_push(hut_cache_queue_t *q, hut_cache_entry_t *e) {
+  e->next = q->head.next;
+  e->prev = &q->head;
+  q->head.next->prev = e;
+  q->head.next = e;
+  q->bytes += hut_cache_charge(e);
+}
+
+static void hut_cache_queue_remove(hut_cache_queue_t *q, hut_cache_entry_t *e) {
+  e->prev->next = e->next;
+  e->next->prev = e->prev;
+  q->bytes -= hut_cache_charge(e);
+}
+
+static hut_cache_entry_t *hut_cache_queue_tail(hut_cache_queue_t *q) {
+  return q->head.prev == &q->head ? NULL : q->head.prev;
+}
+
+static hut_cache_queue_t *hut_cache_queue_of(hut_cache_shard_t *shard, const hut_cache_entry_t *e) {
+  switch (e->queue) {
+  case HUT_CACHE_WINDOW:
+    return &shard->window;
+  case HUT_CACHE_PROBATION:
+    return &shard->probation;
+  default:
+    return &shard->protected;
+  }
+}
+
+static void hut_cache_unref(hut_cache_entry_t *e) {
+  if (!__sync_sub_and_fetch(&e->refs, 1))
+    free(e);
+}
+
+static hut_cache_entry_t **hut_cache_bucket(hut_cache_shard_t *shard, uint64_t h) {
+  return &shard->buckets[(h >> 32) & shard->bucket_mask];
+}
+
+static hut_cache_entry_t *hut_cache_find(hut_cache_shard_t *shard, uint64_t key, uint64_t h) {
+  hut_cache_entry_t *e;
+
+  for (e = *hut_cache_bucket(shard, h); e; e = e->chain)
+    if (e->key == key)
+      return e;
+  return NULL;
+}
+
+static void hut_cache_grow(hut_cache_shard_t *shard) {
+  size_t i, count = (shard->bucket_mask + 1) * 2;
+  hut_cache_entry_t **buckets, *e, *next, **b;
+
+  if (!(buckets = calloc(count, sizeof(*buckets))))
+    return;
+  for (i = 0; i <= shard->bucket_mask; i++) {
+    for (e = shard->buckets[i]; e; e = next) {
+      next = e->chain;
+      b = &buckets[(hut_hash64(e->key) >> 32) & (count - 1)];
+      e->chain = *b;
+      *b = e;
+    }
+  }
+  free(shard->buckets);
+  shard->buckets = buckets;
+  shard->bucket_mask = count - 1;
+}
+
+/* Unlinks an entry from its queue and the table, dropping the cache's reference. */
+static void hut_cache_drop(hut_cache_shard_t *shard, hut_cache_entry_t *e) {
+  hut_cache_entry_t **p = hut_cache_bucket(shard, hut_hash64(e->key));
+
+  while (*p != e)
+    p = &(*p)->chain;
+  *p = e->chain;
+  hut_cache_queue_remove(hut_cache_queue_of(shard, e), e);
+  e->queue = HUT_CACHE_DETACHED;
+  shard->count--;
+  hut_cache_unref(e);
+}
+
+/*
+ * TinyLFU admission of an entry evicted from the window: it only enters
+ * the main area if it is estimated to be used more often than each of
+ * the entries it would push out.
+ */
+static void hut_cache_admit(hut_cache_shard_t *shard, hut_cache_entry_t *candidate) {
+  unsigned freq = hut_cache_sketch_estimate(shard, hut_hash64(candidate->key));
+  size_t charge = hut_cache_charge(candidate);
+  hut_cache_entry_t *victim;
+
+  while (shard->probation.bytes + shard->protected.bytes + charge > shard->main_capacity) {
+    if (!(victim = hut_cache_queue_tail(&shard->probation))
+        && !(victim = hut_cache_queue_tail(&shard->protected)))
+      break;
+    if (freq <= hut_cache_sketch_estimate(shard, hut_hash64(victim->key))) {
+      shard->admission_rejects++;
+      hut_cache_drop(shard, candidate);
+      return;
+    }
+    shard->evictions++;
+    hut_cache_drop(shard, victim);
+  }
+
+  hut_cache_queue_remove(&shard->window, candidate);
+  candidate->queue = HUT_CACHE_PROBATION;
+  hut_cache_queue_push(&shard->probation, candidate);
+}
+
+static void hut_cache_touch(hut_cache_shard_t *shard, hut_cache_entry_t *e) {
+  hut_cache_entry_t *demoted;
+
+  hut_cache_queue_remove(hut_cache_queue_of(shard, e), e);
+  if (e->queue == HUT_CACHE_PROBATION)
+    e->queue = HUT_CACHE_PROTECTED;
+  hut_cache_queue_push(hut_cache_queue_of(shard, e), e);
+
+  while (shard->protected.bytes > shard->protected_capacity
+         && (demoted = hut_cache_queue_tail(&shard->protected)) != e) {
+    hut_cache_queue_remove(&shard->protected, demoted);
+    demoted->queue = HUT_CACHE_PROBATION;
+    hut_cache_queue_push(&shard->probation, demoted);
+  }
+}
+
+static hut_cache_shard_t *hut_cache_shard(hut_cache_t *cache, uint64_t h) {
+  return &cache->shards[h % cache->shard_count];
+}
+
+int hut_cache_create(size_t capacity, unsigned shards, hut_cache_t **out) {
+  hut_cache_shard_t *shard;
+  hut_cache_t *cache;
+  size_t sketch;
+  unsigned i;
+
+  if (!shards)
+    return HUT_ERR_INVALID;
+  if (!(cache = calloc(1, sizeof(*cache))))
+    return HUT_ERR_NOMEM;
+  if (posix_memalign((void **) &cache->shards, HUT_CACHE_LINE, shards * sizeof(*cache->shards))) {
+    free(cache);
+    return HUT_ERR_NOMEM;
+  }
+  memset(cache->shards, 0, shards * sizeof(*cache->shards));
+  cache->shard_count = shards;
+
+  for (i = 0; i < shards; i++) {
+    shard = &cache->shards[i];
+    shard->capacity = capacity / shards;
+    shard->window_capacity = shard->capacity * HUT_CACHE_WINDOW_PERCENT / 100;
+    shard->main_capacity = shard->capacity - shard->window_capacity;
+    shard->protected_capacity = shard->main_capacity * HUT_CACHE_PROTECTED_PERCENT / 100;
+    hut_cache_queue_init(&shard->window);
+    hut_cache_queue_init(&shard->probation);
+    hut_cache_queue_init(&shard->protected);
+    mtx_init(&shard->lock, mtx_plain);
+
+    sketch = hut_cache_pow2(shard->capacity / HUT_CACHE_SKETCH_BYTES);
+    if (sketch < HUT_CACHE_SKETCH_MIN)
+      sketch = HUT_CACHE_SKETCH_MIN;
+    shard->sketch = calloc(sketch, 1);
+    shard->sketch_mask = sketch - 1;
+    shard->buckets = calloc(HUT_CACHE_MIN_BUCKETS, sizeof(*shard->buckets));
+    shard->bucket_mask = HUT_CACHE_MIN_BUCKETS - 1;
+    if (!shard->sketch || !shard->buckets) {
+      cache->shard_count = i + 1;
+      hut_cache_destroy(cache);
+      return HUT_ERR_NOMEM;
+    }
+  }
+
+  *out = cache;
+  return HUT_OK;
+}
+
+void hut_cache_destroy(hut_cache_t *cache) {
+  hut_cache_shard_t *shard;
+  hut_cache_entry_t *e;
+  unsigned i;
+  size_t b;
+
+  if (!cache)
+    return;
+  for (i = 0; i < cache->shard_count; i++) {
+    shard = &cache->shards[i];
+    for (b = 0; shard->buckets && b <= shard->bucket_mask; b++)
+      while ((e = shard->buckets[b]))
+        hut_cache_drop(shard, e);
+    mtx_destroy(&shard->lock);
+    free(shard->buckets);
+    free(shard->sketch);
+  }
+  free(cache->shards);
+  free(cache);
+}
+
+hut_cache_entry_t *hut_cache_lookup(hut_cache_t *cache, uint64_t key) {
+  uint64_t h = hut_hash64(key);
+  hut_cache_shard_t *shard = hut_cache_shard(cache, h);
+  hut_cache_entry_t *e;
+
+  mtx_lock(&shard->lock);
+  hut_cache_sketch_increment(shard, h);
+  if ((e = hut_cache_find(shard, key, h))) {
+    shard->hits++;
+    hut_cache_touch(shard, e);
+    __sync_add_and_fetch(&e->refs, 1);
+  } else {
+    shard->misses++;
+  }
+  mtx_unlock(&shard->lock);
+  return e;
+}
+
+hut_cache_entry_t *hut_cache_insert(hut_cache_t *cache, uint64_t key,
+                                    const void *data, size_t len) {
+  uint64_t h = hut_hash64(key);
+  hut_cache_shard_t *shard = hut_cache_shard(cache, h);
+  hut_cache_entry_t *e, *found, *candidate;
+
+  if (!(e = malloc(sizeof(*e) + len)))
+    return NULL;
+  memcpy(e->data, data, len);
+  e->key = key;
+  e->len = len;
+  e->refs = 1;
+  e->queue = HUT_CACHE_DETACHED;
+  e->chain = e->prev = e->next = NULL;
+
+  if (hut_cache_charge(e) > shard->main_capacity)
+    return e;
+
+  mtx_lock(&shard->lock);
+  if ((found = hut_cache_find(shard, key, h))) {
+    /* Lost a race with another reader decompressing the same record. */
+    __sync_add_and_fetch(&found->refs, 1);
+    mtx_unlock(&shard->lock);
+    free(e);
+    return found;
+  }
+
+  e->refs++;
+  e->chain = *hut_cache_bucket(shard, h);
+  *hut_cache_bucket(shard, h) = e;
+  e->queue = HUT_CACHE_WINDOW;
+  hut_cache_queue_push(&shard->window, e);
+  shard->inserts++;
+  if (++shard->count > shard->bucket_mask + 1)
+    hut_cache_grow(shard);
+
+  while (shard->window.bytes > shard->window_capacity
+         && (candidate = hut_cache_queue_tail(&shard->window)))
+    hut_cache_admit(shard, candidate);
+  mtx_unlock(&shard->lock);
+  return e;
+}
+
+void hut_cache_release(hut_cache_entry_t *entry) {
+  hut_cache_unref(entry);
+}
+
+const void *hut_cache_entry_data(const hut_cache_entry_t *entry) {
+  return entry->data;
+}
+
+size_t hut_cache_entry_len(const hut_cache_entry_t *entry) {
+  return entry->len;
+}
+
+void hut_cache_stats(hut_cache_t *cache, hut_cache_stats_t *stats) {
+  hut_cache_shard_t *shard;
+  unsigned i;
+
+  memset(stats, 0, sizeof(*stats));
+  for (i = 0; i < cache->shard_count; i++) {
+    shard = &cache->shards[i];
+    mtx_lock(&shard->lock);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->inserts += shard->inserts;
+    stats->admission_rejects += shard->admission_rejects;
+    stats->evictions += shard->evictions;
+    stats->entries += shard->count;
+    stats->bytes += shard->window.bytes + shard->probation.bytes + shard->protected.bytes;
+    mtx_unlock(&shard->lock);
+  }
+  if (stats->hits + stats->misses)
+    stats->hit_ratio = (double) stats->hits / (double) (stats->hits + stats->misses);
+}
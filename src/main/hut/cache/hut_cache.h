@@ -0,0 +1,55 @@
+#ifndef HUT_CACHE_H
+#define HUT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded cache of decompressed records, keyed by record address.
+ *
+ * The cache is split into independently locked shards, each running
+ * W-TinyLFU: new entries land in a small LRU window, and entries falling
+ * out of it are only admitted into the main segmented LRU if a frequency
+ * sketch says they are used more often than what they would evict.
+ * Capacity is in bytes, entry overhead included.
+ *
+ * Entries are reference counted. Lookups and inserts return a pinned
+ * entry that stays valid, even if evicted meanwhile, until released.
+ */
+
+typedef struct hut_cache_s hut_cache_t;
+typedef struct hut_cache_entry_s hut_cache_entry_t;
+
+typedef struct hut_cache_stats_s {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t admission_rejects;
+  uint64_t evictions;
+  uint64_t entries;
+  uint64_t bytes;
+  double hit_ratio;
+} hut_cache_stats_t;
+
+int hut_cache_create(size_t capacity, unsigned shards, hut_cache_t **out);
+
+void hut_cache_destroy(hut_cache_t *cache);
+
+hut_cache_entry_t *hut_cache_lookup(hut_cache_t *cache, uint64_t key);
+
+/*
+ * Copies `len` bytes into a new entry. Returns NULL only when out of
+ * memory; an entry that is not admitted is still returned, detached.
+ */
+hut_cache_entry_t *hut_cache_insert(hut_cache_t *cache, uint64_t key,
+                                    const void *data, size_t len);
+
+void hut_cache_release(hut_cache_entry_t *entry);
+
+const void *hut_cache_entry_data(const hut_cache_entry_t *entry);
+
+size_t hut_cache_entry_len(const hut_cache_entry_t *entry);
+
+void hut_cache_stats(hut_cache_t *cache, hut_cache_stats_t *stats);
+
+#endif /* HUT_CACHE_H */
@@ -1,3 +1,679 @@
-int main() {
-  return 0;
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tinycthread.h>
+
+#include "hut/hut.h"
+#include "hut/trace/hut_trace.h"
+#include "hut/util/hut_file.h"
+#include "hut/util/hut_numa.h"
+
+/*
+ * Command line client.
+ *
+ *   hutcli [--name=value ...] PATH COMMAND [ARG ...] [COMMAND [ARG ...] ...]
+ *   hutcli [--name=value ...] PATH < SCRIPT
+ *   hutcli trace dump PATH [MIN_US]
+ *
+ * Opens the database at PATH and runs the commands in order, stopping at
+ * the first that fails. Gets and deletes of missing keys are reported but
+ * do not fail. Keys and values are taken as given, without their
+ * terminating NUL.
+ *
+ * Without commands they are read from stdin instead, one per line, words
+ * split at blanks but for the last argument, which takes the rest of the
+ * line: `put KEY VALUE` writes whatever follows KEY. Blank lines and lines
+ * starting with `#` are skipped. On a terminal it prompts for each, and
+ * reports failures without stopping.
+ *
+ * With --sync=1 writes are flushed in batches of --batch rather than one
+ * by one, once per line on a terminal, and before the database closes.
+ *
+ * Trace dumps read the trace file at PATH, or the one of the database
+ * there, without opening the database, which may be in use meanwhile.
+ */
+
+#define HUT_CLI_MAX_ARGS 2
+
+typedef struct hut_cli_s {
+  hut_db_t *db;
+  int sync;                     /* flush writes in batches */
+  unsigned batch;
+  unsigned pending;             /* writes not flushed yet */
+  unsigned threads;             /* of loads and dumps, 0 for one per core */
+  const char *start;            /* first key dumped, NULL for any */
+  const char *end;              /* key past the last dumped, NULL for none */
+} hut_cli_t;
+
+typedef struct hut_cli_command_s {
+  const char *name;
+  int argc;
+  int write;                    /* counts towards a batch */
+  int (*run)(hut_cli_t *cli, char **argv);
+  const char *usage;
+} hut_cli_command_t;
+
+static int hut_cli_get(hut_cli_t *cli, char **argv) {
+  hut_value_t value;
+  int rc;
+
+  if ((rc = hut_get(cli->db, argv[0], strlen(argv[0]), &value)))
+    return rc;
+  fwrite(value.data, 1, value.len, stdout);
+  putchar('\n');
+  hut_value_release(&value);
+  return HUT_OK;
+}
+
+static int hut_cli_put(hut_cli_t *cli, char **argv) {
+  return hut_put(cli->db, argv[0], strlen(argv[0]), argv[1], strlen(argv[1]));
+}
+
+static int hut_cli_del(hut_cli_t *cli, char **argv) {
+  return hut_del(cli->db, argv[0], strlen(argv[0]));
+}
+
+static int hut_cli_stats(hut_cli_t *cli, char **argv) {
+  hut_stats_t stats;
+  hut_latency_t *lat;
+  int op, rc;
+
+  (void) argv;
+  if ((rc = hut_stats_get(cli->db, &stats)))
+    return rc;
+  printf("%-8s %10s %10s %10s %10s %10s\n", "op", "count", "p50 us", "p99 us", "p99.9 us",
+         "max us");
+  for (op = 0; op < HUT_STATS_OPS; op++) {
+    lat = &stats.latency[op];
+    printf("%-8s %10llu %10.1f %10.1f %10.1f %10.1f\n", hut_stats_op_name((hut_stats_op_t) op),
+           (unsigned long long) lat->count, (double) lat->p50 / 1e3, (double) lat->p99 / 1e3,
+           (double) lat->p999 / 1e3, (double) lat->max / 1e3);
+  }
+  printf("\n");
+  printf("%-20s %llu\n", "bytes read", (unsigned long long) stats.bytes_read);
+  printf("%-20s %llu\n", "bytes written", (unsigned long long) stats.bytes_written);
+  printf("%-20s %llu\n", "disk bytes written", (unsigned long long) stats.disk_bytes_written);
+  printf("%-20s %llu\n", "index lookups", (unsigned long long) stats.index_lookups);
+  printf("%-20s %llu\n", "index probes", (unsigned long long) stats.index_probes);
+  printf("%-20s %llu\n", "cache hits", (unsigned long long) stats.cache_hits);
+  printf("%-20s %llu\n", "cache misses", (unsigned long long) stats.cache_misses);
+  printf("%-20s %.3f\n", "cache hit ratio", stats.cache_hit_ratio);
+  printf("%-20s %llu\n", "admission rejects", (unsigned long long) stats.cache_admission_rejects);
+  printf("%-20s %llu\n", "gc bytes relocated", (unsigned long long) stats.gc_bytes_relocated);
+  printf("%-20s %llu\n", "disk bytes", (unsigned long long) stats.disk_bytes);
+  printf("%-20s %llu\n", "live bytes", (unsigned long long) stats.live_bytes);
+  printf("%-20s %.2f\n", "write amplification", stats.write_amplification);
+  printf("%-20s %.2f\n", "space amplification", stats.space_amplification);
+  return HUT_OK;
+}
+
+static int hut_cli_scan_record(void *arg, const void *key, size_t klen,
+                               const void *value, size_t vlen) {
+  (void) arg;
+  fwrite(key, 1, klen, stdout);
+  putchar('\t');
+  fwrite(value, 1, vlen, stdout);
+  putchar('\n');
+  return ferror(stdout) ? HUT_ERR_IO : HUT_OK;
+}
+
+static int hut_cli_scan(hut_cli_t *cli, char **argv) {
+  (void) argv;
+  return hut_scan(cli->db, hut_cli_scan_record, NULL);
+}
+
+static int hut_cli_compact(hut_cli_t *cli, char **argv) {
+  char *end;
+  double garbage = strtod(argv[0], &end);
+
+  if (!*argv[0] || *end)
+    return HUT_ERR_INVALID;
+  return hut_compact(cli->db, garbage);
+}
+
+static int hut_cli_checkpoint(hut_cli_t *cli, char **argv) {
+  (void) argv;
+  return hut_sync(cli->db);
+}
+
+static int hut_cli_verify(hut_cli_t *cli, char **argv) {
+  hut_verify_t report;
+  int rc;
+
+  (void) argv;
+  rc = hut_verify(cli->db, &report);
+  if (rc && rc != HUT_ERR_CORRUPT)
+    return rc;
+  printf("%-20s %llu\n", "segments", (unsigned long long) report.segments);
+  printf("%-20s %llu\n", "records", (unsigned long long) report.records);
+  printf("%-20s %llu\n", "live records", (unsigned long long) report.live_records);
+  printf("%-20s %llu\n", "index entries", (unsigned long long) report.index_entries);
+  printf("%-20s %llu\n", "corrupt records", (unsigned long long) report.corrupt_records);
+  printf("%-20s %llu\n", "corrupt segments", (unsigned long long) report.corrupt_segments);
+  return rc;
+}
+
+/*
+ * Bulk loads, from tab separated lines, the value running to the end of
+ * the line, or from records of the key and value lengths as 32-bit
+ * integers in native byte order, followed by the key and the value.
+ */
+
+#define HUT_CLI_LOAD_BUFFER (1u << 20)
+
+typedef struct hut_cli_load_s {
+  FILE *in;
+  const char *name;
+  char *buf;
+  size_t cap;
+  uint64_t records;
+  uint64_t bytes;
+} hut_cli_load_t;
+
+static int hut_cli_load_tsv(hut_cli_load_t *load, hut_loader_t *loader) {
+  ssize_t len;
+  char *tab;
+  int rc;
+
+  while ((len = getline(&load->buf, &load->cap, load->in)) >= 0) {
+    if (len && load->buf[len - 1] == '\n')
+      load->buf[--len] = '\0';
+    if (!(tab = memchr(load->buf, '\t', (size_t) len))) {
+      fprintf(stderr, "hutcli: load: %s:%llu: no tab\n", load->name,
+              (unsigned long long) load->records + 1);
+      return HUT_ERR_INVALID;
+    }
+    if ((rc = hut_loader_add(loader, load->buf, (size_t) (tab - load->buf), tab + 1,
+                             (size_t) (load->buf + len - tab - 1))))
+      return rc;
+    load->records++;
+    load->bytes += (uint64_t) len - 1;
+  }
+  return ferror(load->in) ? HUT_ERR_IO : HUT_OK;
+}
+
+static int hut_cli_load_binary(hut_cli_load_t *load, hut_loader_t *loader) {
+  uint32_t lens[2];
+  size_t len, n;
+  char *grown;
+  int rc;
+
+  while ((n = fread(lens, 1, sizeof(lens), load->in)) == sizeof(lens)) {
+    len = (size_t) lens[0] + lens[1];
+    if (len > load->cap) {
+      if (!(grown = realloc(load->buf, len)))
+        return HUT_ERR_NOMEM;
+      load->buf = grown;
+      load->cap = len;
+    }
+    if (fread(load->buf, 1, len, load->in) != len)
+      return ferror(load->in) ? HUT_ERR_IO : HUT_ERR_CORRUPT;
+    if ((rc = hut_loader_add(loader, load->buf, lens[0], load->buf + lens[0], lens[1])))
+      return rc;
+    load->records++;
+    load->bytes += len;
+  }
+  if (ferror(load->in))
+    return HUT_ERR_IO;
+  return n ? HUT_ERR_CORRUPT : HUT_OK;
+}
+
+static int hut_cli_load(hut_cli_t *cli, char **argv) {
+  int (*parse)(hut_cli_load_t *load, hut_loader_t *loader);
+  struct timespec start, end;
+  hut_loader_t *loader;
+  hut_cli_load_t load;
+  double secs;
+  int rc;
+
+  if (!strcmp(argv[0], "tsv"))
+    parse = hut_cli_load_tsv;
+  else if (!strcmp(argv[0], "binary"))
+    parse = hut_cli_load_binary;
+  else
+    return HUT_ERR_INVALID;
+  memset(&load, 0, sizeof(load));
+  load.name = argv[1];
+  if (!(load.in = strcmp(argv[1], "-") ? fopen(argv[1], "rb") : stdin))
+    return HUT_ERR_IO;
+  setvbuf(load.in, NULL, _IOFBF, HUT_CLI_LOAD_BUFFER);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (!(rc = hut_loader_create(cli->db, cli->threads, &loader))) {
+    if ((rc = parse(&load, loader)))
+      hut_loader_abort(loader);
+    else
+      rc = hut_loader_commit(loader);
+  }
+  free(load.buf);
+  if (load.in != stdin)
+    fclose(load.in);
+  if (rc)
+    return rc;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  secs = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("loaded %llu records, %.1f MB in %.2f s, %.1f MB/s\n",
+         (unsigned long long) load.records, (double) load.bytes / 1e6, secs,
+         secs > 0 ? (double) load.bytes / 1e6 / secs : 0);
+  return HUT_OK;
+}
+
+/*
+ * Dumps a snapshot, of the keys from --start up to --end, in the formats
+ * loads take. Every export thread gathers its records into a batch of
+ * its own, written out with a single writev() once full: keys and values
+ * of uncompressed segments are pointed to where they lie in the segment
+ * maps, the others copied into a buffer of the thread's, as are binary
+ * record headers. Batches hold whole records, so that they can go out in
+ * any order.
+ */
+
+#define HUT_CLI_DUMP_IOV    1024        /* IOV_MAX on Linux */
+#define HUT_CLI_DUMP_BUFFER (1u << 20)
+
+typedef struct hut_cli_dump_thread_s {
+  struct iovec iov[HUT_CLI_DUMP_IOV];
+  int count;
+  char *buf;
+  size_t used;
+  size_t cap;
+  uint64_t records;
+  uint64_t bytes;
+} hut_cli_dump_thread_t;
+
+typedef struct hut_cli_dump_s {
+  int fd;
+  int binary;
+  mtx_t lock;                   /* of the file offset */
+  hut_cli_dump_thread_t *threads;
+} hut_cli_dump_t;
+
+static int hut_cli_dump_flush(void *arg, unsigned thread) {
+  hut_cli_dump_t *dump = arg;
+  hut_cli_dump_thread_t *t = &dump->threads[thread];
+  int rc;
+
+  mtx_lock(&dump->lock);
+  rc = hut_file_writev(dump->fd, t->iov, t->count);
+  mtx_unlock(&dump->lock);
+  t->count = 0;
+  t->used = 0;
+  return rc;
+}
+
+static void hut_cli_dump_add(hut_cli_dump_thread_t *t, const void *data, size_t len) {
+  t->iov[t->count].iov_base = (void *) data;
+  t->iov[t->count++].iov_len = len;
+}
+
+static const void *hut_cli_dump_copy(hut_cli_dump_thread_t *t, const void *data, size_t len) {
+  char *copy = t->buf + t->used;
+
+  memcpy(copy, data, len);
+  t->used += len;
+  return copy;
+}
+
+static int hut_cli_dump_record(void *arg, unsigned thread, const void *key, size_t klen,
+                               const void *value, size_t vlen, int pinned) {
+  hut_cli_dump_t *dump = arg;
+  hut_cli_dump_thread_t *t = &dump->threads[thread];
+  size_t need = (dump->binary ? 2 * sizeof(uint32_t) : 0) + (pinned ? 0 : klen + vlen), cap;
+  uint32_t lens[2];
+  char *grown;
+  int rc;
+
+  /* Loads would split these differently. */
+  if (!dump->binary && (memchr(key, '\t', klen) || memchr(key, '\n', klen)
+                        || memchr(value, '\n', vlen)))
+    return HUT_ERR_INVALID;
+  if (t->count + 4 > HUT_CLI_DUMP_IOV || t->used + need > t->cap) {
+    if ((rc = hut_cli_dump_flush(dump, thread)))
+      return rc;
+    if (need > t->cap) {
+      cap = need > HUT_CLI_DUMP_BUFFER ? need : HUT_CLI_DUMP_BUFFER;
+      if (!(grown = realloc(t->buf, cap)))
+        return HUT_ERR_NOMEM;
+      t->buf = grown;
+      t->cap = cap;
+    }
+  }
+  if (dump->binary) {
+    lens[0] = (uint32_t) klen;
+    lens[1] = (uint32_t) vlen;
+    hut_cli_dump_add(t, hut_cli_dump_copy(t, lens, sizeof(lens)), sizeof(lens));
+  }
+  if (!pinned) {
+    key = hut_cli_dump_copy(t, key, klen);
+    value = hut_cli_dump_copy(t, value, vlen);
+  }
+  hut_cli_dump_add(t, key, klen);
+  if (!dump->binary)
+    hut_cli_dump_add(t, "\t", 1);
+  hut_cli_dump_add(t, value, vlen);
+  if (!dump->binary)
+    hut_cli_dump_add(t, "\n", 1);
+  t->records++;
+  t->bytes += klen + vlen;
+  return HUT_OK;
+}
+
+static int hut_cli_dump(hut_cli_t *cli, char **argv) {
+  struct timespec start, end;
+  hut_cli_dump_t dump;
+  hut_export_t opts;
+  uint64_t records = 0, bytes = 0;
+  unsigned i, threads = cli->threads ? cli->threads : hut_numa_cpu_count();
+  double secs;
+  int rc;
+
+  memset(&dump, 0, sizeof(dump));
+  if (!(dump.binary = !strcmp(argv[0], "binary")) && strcmp(argv[0], "tsv"))
+    return HUT_ERR_INVALID;
+  if (!(dump.threads = calloc(threads, sizeof(*dump.threads))))
+    return HUT_ERR_NOMEM;
+  if (mtx_init(&dump.lock, mtx_plain) != thrd_success) {
+    free(dump.threads);
+    return HUT_ERR_NOMEM;
+  }
+  fflush(stdout);
+  dump.fd = strcmp(argv[1], "-") ? open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644)
+                                 : STDOUT_FILENO;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  memset(&opts, 0, sizeof(opts));
+  opts.start = cli->start;
+  opts.start_len = cli->start ? strlen(cli->start) : 0;
+  opts.end = cli->end;
+  opts.end_len = cli->end ? strlen(cli->end) : 0;
+  opts.threads = threads;
+  opts.fn = hut_cli_dump_record;
+  opts.flush = hut_cli_dump_flush;
+  opts.arg = &dump;
+  rc = dump.fd < 0 ? HUT_ERR_IO : hut_export(cli->db, &opts);
+
+  for (i = 0; i < threads; i++) {
+    records += dump.threads[i].records;
+    bytes += dump.threads[i].bytes;
+    free(dump.threads[i].buf);
+  }
+  free(dump.threads);
+  mtx_destroy(&dump.lock);
+  if (dump.fd > STDOUT_FILENO && close(dump.fd) && !rc)
+    rc = HUT_ERR_IO;
+  if (rc)
+    return rc;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  secs = (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf(dump.fd == STDOUT_FILENO ? stderr : stdout,
+          "dumped %llu records, %.1f MB in %.2f s, %.1f MB/s\n", (unsigned long long) records,
+          (double) bytes / 1e6, secs, secs > 0 ? (double) bytes / 1e6 / secs : 0);
+  return HUT_OK;
+}
+
+static const hut_cli_command_t hut_cli_commands[] = {
+  { "get",        1, 0, hut_cli_get,        "get KEY          print the value of KEY" },
+  { "put",        2, 1, hut_cli_put,        "put KEY VALUE" },
+  { "del",        1, 1, hut_cli_del,        "del KEY" },
+  { "scan",       0, 0, hut_cli_scan,       "scan             print every key and value, a tab apart" },
+  { "stats",      0, 0, hut_cli_stats,      "stats            what the engine measured so far" },
+  { "compact",    1, 0, hut_cli_compact,
+    "compact GARBAGE  rewrite segments at least GARBAGE (0 to 1) dead" },
+  { "checkpoint", 0, 0, hut_cli_checkpoint, "checkpoint       flush every write so far" },
+  { "verify",     0, 0, hut_cli_verify,     "verify           check every record and the index" },
+  { "load",       2, 0, hut_cli_load,
+    "load FORMAT FILE bulk load tsv or binary records from FILE, - for stdin" },
+  { "dump",       2, 0, hut_cli_dump,
+    "dump FORMAT FILE write a snapshot as tsv or binary records to FILE, - for stdout" },
+  { NULL, 0, 0, NULL, NULL }
+};
+
+static const hut_cli_command_t *hut_cli_find(const char *name) {
+  const hut_cli_command_t *cmd;
+
+  for (cmd = hut_cli_commands; cmd->name && strcmp(cmd->name, name); cmd++)
+    ;
+  return cmd->name ? cmd : NULL;
+}
+
+static int hut_cli_flush(hut_cli_t *cli) {
+  int rc;
+
+  if (!cli->pending)
+    return HUT_OK;
+  cli->pending = 0;
+  if ((rc = hut_sync(cli->db)))
+    fprintf(stderr, "hutcli: sync: %s\n", hut_strerror(rc));
+  return rc;
+}
+
+static int hut_cli_run(hut_cli_t *cli, const hut_cli_command_t *cmd, char **argv) {
+  int rc;
+
+  if ((rc = cmd->run(cli, argv))) {
+    fflush(stdout);
+    fprintf(stderr, "hutcli: %s: %s\n", cmd->name, hut_strerror(rc));
+    /* Nothing was written either. */
+    return rc == HUT_ERR_NOTFOUND ? HUT_OK : rc;
+  }
+  if (cmd->write && cli->sync && ++cli->pending >= cli->batch)
+    return hut_cli_flush(cli);
+  return HUT_OK;
+}
+
+/* Next word of `*line`, NULL when none is left; with `rest`, all that is left. */
+static char *hut_cli_word(char **line, int rest) {
+  char *word = *line + strspn(*line, " \t"), *end;
+
+  if (!*word)
+    return NULL;
+  end = rest ? word + strlen(word) : word + strcspn(word, " \t");
+  *line = *end ? end + 1 : end;
+  *end = '\0';
+  return word;
+}
+
+static void hut_cli_help(FILE *out) {
+  const hut_cli_command_t *cmd;
+
+  for (cmd = hut_cli_commands; cmd->name; cmd++)
+    fprintf(out, "  %s\n", cmd->usage);
+}
+
+/* Runs the commands on stdin, see above. */
+static int hut_cli_shell(hut_cli_t *cli) {
+  const hut_cli_command_t *cmd;
+  char *line = NULL, *p, *name, *argv[HUT_CLI_MAX_ARGS];
+  int tty = isatty(STDIN_FILENO), i, rc = HUT_OK, flush_rc;
+  size_t cap = 0;
+  ssize_t len;
+
+  if (tty)
+    cli->batch = 1;
+  for (;;) {
+    if (tty) {
+      fputs("hut> ", stdout);
+      fflush(stdout);
+    }
+    if ((len = getline(&line, &cap, stdin)) < 0)
+      break;
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    p = line;
+    if (!(name = hut_cli_word(&p, 0)) || *name == '#')
+      continue;
+    if (!strcmp(name, "quit") || !strcmp(name, "exit"))
+      break;
+    if (!strcmp(name, "help")) {
+      hut_cli_help(stdout);
+      continue;
+    }
+
+    if (!(cmd = hut_cli_find(name))) {
+      fprintf(stderr, "hutcli: %s: unknown command\n", name);
+      rc = HUT_ERR_INVALID;
+    } else {
+      for (i = 0; i < cmd->argc && (argv[i] = hut_cli_word(&p, i == cmd->argc - 1)); i++)
+        ;
+      if (i < cmd->argc || hut_cli_word(&p, 0)) {
+        fprintf(stderr, "hutcli: %s: %s arguments\n", name, i < cmd->argc ? "missing" : "too many");
+        rc = HUT_ERR_INVALID;
+      } else {
+        rc = hut_cli_run(cli, cmd, argv);
+      }
+    }
+    if (tty)
+      rc = HUT_OK;
+    else if (rc)
+      break;
+    fflush(stdout);
+  }
+  if (tty && len < 0)
+    putchar('\n');
+  free(line);
+  flush_rc = hut_cli_flush(cli);
+  return rc ? rc : flush_rc;
+}
+
+/* Prints the events lasting at least `min_us` microseconds, by time. */
+static int hut_cli_trace_dump(const char *path, const char *min_us) {
+  char when[32], *file = NULL, *end;
+  hut_trace_dump_t dump;
+  hut_trace_event_t *e;
+  uint64_t min = 0, ns;
+  struct stat st;
+  time_t secs;
+  struct tm tm;
+  size_t i;
+  int rc;
+
+  if (min_us) {
+    min = (uint64_t) (strtod(min_us, &end) * 1e3);
+    if (!*min_us || *end)
+      return HUT_ERR_INVALID;
+  }
+  if (!stat(path, &st) && S_ISDIR(st.st_mode) && !(file = hut_file_path(path, "TRACE")))
+    return HUT_ERR_NOMEM;
+  rc = hut_trace_load(file ? file : path, &dump);
+  free(file);
+  if (rc)
+    return rc;
+
+  printf("%-26s %4s %7s %-7s %-16s %10s %10s %-2s %s\n", "time", "ring", "tid", "op", "hash",
+         "arg", "us", "gc", "status");
+  for (i = 0; i < dump.count; i++) {
+    e = &dump.events[i];
+    if (e->latency < min)
+      continue;
+    ns = dump.start + e->time;
+    secs = (time_t) (ns / 1000000000u);
+    localtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06u %4u %7d %-7s %016llx %10u %10.1f %-2s %s\n", when,
+           (unsigned) (ns % 1000000000u / 1000), e->thread, dump.tids[e->thread],
+           hut_stats_op_name((hut_stats_op_t) e->type), (unsigned long long) e->hash, e->arg,
+           (double) e->latency / 1e3, e->flags & HUT_TRACE_GC ? "gc" : "-",
+           e->status ? hut_strerror(e->status) : "ok");
+  }
+  hut_trace_dump_free(&dump);
+  return HUT_OK;
+}
+
+static void hut_cli_usage(void) {
+  fprintf(stderr,
+          "usage: hutcli [--name=value ...] PATH COMMAND [ARG ...] ...\n"
+          "       hutcli [--name=value ...] PATH < SCRIPT\n"
+          "       hutcli trace dump PATH [MIN_US]\n"
+          "\n"
+          "  --shards=N              as the database was created with (0)\n"
+          "  --sync=0|1              (0)\n"
+          "  --batch=N               writes per flush with --sync=1 (1000)\n"
+          "  --threads=N             of loads and dumps, 0 for one per core (0)\n"
+          "  --start=KEY             first key dumped\n"
+          "  --end=KEY               key dumps stop short of\n"
+          "\n"
+          "commands:\n");
+  hut_cli_help(stderr);
+}
+
+/* Matches `--name=`, pointing `*value` past it. */
+static int hut_cli_flag(const char *arg, const char *name, const char **value) {
+  size_t len = strlen(name);
+
+  if (strncmp(arg, "--", 2) || strncmp(arg + 2, name, len) || arg[2 + len] != '=')
+    return 0;
+  *value = arg + 3 + len;
+  return 1;
+}
+
+/* Returns the index of the first argument past the options, 0 on error. */
+static int hut_cli_parse(hut_options_t *opts, hut_cli_t *cli, int argc, char **argv) {
+  const char *v;
+  char *end;
+  int i;
+
+  for (i = 1; i < argc && !strncmp(argv[i], "--", 2); i++) {
+    if (hut_cli_flag(argv[i], "shards", &v))
+      opts->shards = (unsigned) strtoul(v, &end, 10);
+    else if (hut_cli_flag(argv[i], "sync", &v))
+      opts->sync = (int) strtol(v, &end, 10);
+    else if (hut_cli_flag(argv[i], "batch", &v))
+      cli->batch = (unsigned) strtoul(v, &end, 10);
+    else if (hut_cli_flag(argv[i], "threads", &v))
+      cli->threads = (unsigned) strtoul(v, &end, 10);
+    else if (hut_cli_flag(argv[i], "start", &cli->start) || hut_cli_flag(argv[i], "end", &cli->end))
+      continue;
+    else
+      return 0;
+    if (!*v || *end)
+      return 0;
+  }
+  return cli->batch ? i : 0;
+}
+
+int main(int argc, char **argv) {
+  const hut_cli_command_t *cmd;
+  hut_options_t opts;
+  hut_cli_t cli;
+  int i, rc = HUT_OK, flush_rc;
+
+  hut_options_init(&opts);
+  memset(&cli, 0, sizeof(cli));
+  cli.batch = 1000;
+  if (!(i = hut_cli_parse(&opts, &cli, argc, argv)) || i >= argc) {
+    hut_cli_usage();
+    return 2;
+  }
+  if (i + 1 < argc && !strcmp(argv[i], "trace") && !strcmp(argv[i + 1], "dump")
+      && (argc == i + 3 || argc == i + 4)) {
+    if ((rc = hut_cli_trace_dump(argv[i + 2], i + 3 < argc ? argv[i + 3] : NULL)))
+      fprintf(stderr, "hutcli: trace dump: %s: %s\n", argv[i + 2], hut_strerror(rc));
+    return rc ? 1 : 0;
+  }
+  /* Flushed here instead, in batches. */
+  cli.sync = opts.sync;
+  opts.sync = 0;
+  if ((rc = hut_open(argv[i], &opts, &cli.db))) {
+    fprintf(stderr, "hutcli: %s: %s\n", argv[i], hut_strerror(rc));
+    return 1;
+  }
+  if (i + 1 == argc)
+    rc = hut_cli_shell(&cli);
+  for (i++; i < argc && !rc; i += 1 + cmd->argc) {
+    if (!(cmd = hut_cli_find(argv[i])) || i + cmd->argc >= argc) {
+      fprintf(stderr, "hutcli: %s: %s\n", argv[i], cmd ? "missing arguments" : "unknown command");
+      rc = HUT_ERR_INVALID;
+      break;
+    }
+    rc = hut_cli_run(&cli, cmd, argv + i + 1);
+  }
+  flush_rc = hut_cli_flush(&cli);
+  hut_close(cli.db);
+  return rc || flush_rc ? 1 : 0;
 }
@@ -0,0 +1,247 @@
+#include "hut/compress/hut_compress.h"
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include <tinycthread.h>
+
+#ifdef HUT_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HUT_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+struct hut_compress_dict_s {
+#ifdef HUT_HAVE_ZSTD
+  ZSTD_CDict *cdict;
+  ZSTD_DDict *ddict;
+#endif
+  size_t len;
+};
+
+#ifdef HUT_HAVE_ZSTD
+
+static tss_t hut_zstd_cctx_key;
+static tss_t hut_zstd_dctx_key;
+static once_flag hut_zstd_once = ONCE_FLAG_INIT;
+
+static void hut_zstd_cctx_free(void *ctx) {
+  ZSTD_freeCCtx(ctx);
+}
+
+static void hut_zstd_dctx_free(void *ctx) {
+  ZSTD_freeDCtx(ctx);
+}
+
+static void hut_zstd_init(void) {
+  tss_create(&hut_zstd_cctx_key, hut_zstd_cctx_free);
+  tss_create(&hut_zstd_dctx_key, hut_zstd_dctx_free);
+}
+
+static ZSTD_CCtx *hut_zstd_cctx(void) {
+  ZSTD_CCtx *ctx;
+
+  call_once(&hut_zstd_once, hut_zstd_init);
+  ctx = tss_get(hut_zstd_cctx_key);
+  if (!ctx && (ctx = ZSTD_createCCtx()))
+    tss_set(hut_zstd_cctx_key, ctx);
+  return ctx;
+}
+
+static ZSTD_DCtx *hut_zstd_dctx(void) {
+  ZSTD_DCtx *ctx;
+
+  call_once(&hut_zstd_once, hut_zstd_init);
+  ctx = tss_get(hut_zstd_dctx_key);
+  if (!ctx && (ctx = ZSTD_createDCtx()))
+    tss_set(hut_zstd_dctx_key, ctx);
+  return ctx;
+}
+
+#endif /* HUT_HAVE_ZSTD */
+
+int hut_compress_supported(hut_compression_t codec) {
+  switch (codec) {
+  case HUT_COMPRESSION_NONE:
+    return 1;
+#ifdef HUT_HAVE_LZ4
+  case HUT_COMPRESSION_LZ4:
+    return 1;
+#endif
+#ifdef HUT_HAVE_ZSTD
+  case HUT_COMPRESSION_ZSTD:
+    return 1;
+#endif
+  default:
+    return 0;
+  }
+}
+
+size_t hut_compress_bound(hut_compression_t codec, size_t len) {
+  switch (codec) {
+#ifdef HUT_HAVE_LZ4
+  case HUT_COMPRESSION_LZ4:
+    return len > LZ4_MAX_INPUT_SIZE ? 0 : (size_t) LZ4_compressBound((int) len);
+#endif
+#ifdef HUT_HAVE_ZSTD
+  case HUT_COMPRESSION_ZSTD:
+    return ZSTD_compressBound(len);
+#endif
+  default:
+    return len;
+  }
+}
+
+int hut_compress(hut_compression_t codec, int level,
+                 const hut_compress_dict_t *dict,
+                 const void *src, size_t len,
+                 void *dst, size_t cap, size_t *out) {
+  switch (codec) {
+#ifdef HUT_HAVE_LZ4
+  case HUT_COMPRESSION_LZ4: {
+    int n;
+
+    if (dict || len > LZ4_MAX_INPUT_SIZE)
+      return HUT_ERR_INVALID;
+    n = LZ4_compress_fast(src, dst, (int) len, cap > INT_MAX ? INT_MAX : (int) cap,
+                          level > 0 ? level : 1);
+    if (n <= 0)
+      return HUT_ERR_FULL;
+    *out = (size_t) n;
+    return HUT_OK;
+  }
+#endif
+#ifdef HUT_HAVE_ZSTD
+  case HUT_COMPRESSION_ZSTD: {
+    ZSTD_CCtx *ctx = hut_zstd_cctx();
+    size_t n;
+
+    if (!ctx)
+      return HUT_ERR_NOMEM;
+    if (dict)
+      n = ZSTD_compress_usingCDict(ctx, dst, cap, src, len, dict->cdict);
+    else
+      n = ZSTD_compressCCtx(ctx, dst, cap, src, len,
+                            level ? level : ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(n))
+      return HUT_ERR_FULL;
+    *out = n;
+    return HUT_OK;
+  }
+#endif
+  default:
+    (void) level;
+    (void) dict;
+    (void) src;
+    (void) len;
+    (void) dst;
+    (void) cap;
+    (void) out;
+    return HUT_ERR_NOTSUP;
+  }
+}
+
+int hut_decompress(hut_compression_t codec,
+                   const hut_compress_dict_t *dict,
+                   const void *src, size_t len,
+                   void *dst, size_t raw_len) {
+  switch (codec) {
+#ifdef HUT_HAVE_LZ4
+  case HUT_COMPRESSION_LZ4:
+    if (dict || len > INT_MAX || raw_len > INT_MAX)
+      return HUT_ERR_INVALID;
+    if (LZ4_decompress_safe(src, dst, (int) len, (int) raw_len) != (int) raw_len)
+      return HUT_ERR_CORRUPT;
+    return HUT_OK;
+#endif
+#ifdef HUT_HAVE_ZSTD
+  case HUT_COMPRESSION_ZSTD: {
+    ZSTD_DCtx *ctx = hut_zstd_dctx();
+    size_t n;
+
+    if (!ctx)
+      return HUT_ERR_NOMEM;
+    if (dict)
+      n = ZSTD_decompress_usingDDict(ctx, dst, raw_len, src, len, dict->ddict);
+    else
+      n = ZSTD_decompressDCtx(ctx, dst, raw_len, src, len);
+    if (ZSTD_isError(n) || n != raw_len)
+      return HUT_ERR_CORRUPT;
+    return HUT_OK;
+  }
+#endif
+  default:
+    (void) dict;
+    (void) src;
+    (void) len;
+    (void) dst;
+    (void) raw_len;
+    return HUT_ERR_NOTSUP;
+  }
+}
+
+int hut_compress_dict_train(const void *samples, const size_t *sizes,
+                            unsigned count, size_t dict_size,
+                            void **dict, size_t *dict_len) {
+#ifdef HUT_HAVE_ZSTD
+  void *buf;
+  size_t n;
+
+  if (!(buf = malloc(dict_size)))
+    return HUT_ERR_NOMEM;
+  n = ZDICT_trainFromBuffer(buf, dict_size, samples, sizes, count);
+  if (ZDICT_isError(n)) {
+    free(buf);
+    return HUT_ERR_INVALID;
+  }
+  *dict = buf;
+  *dict_len = n;
+  return HUT_OK;
+#else
+  (void) samples;
+  (void) sizes;
+  (void) count;
+  (void) dict_size;
+  (void) dict;
+  (void) dict_len;
+  return HUT_ERR_NOTSUP;
+#endif
+}
+
+int hut_compress_dict_create(const void *buf, size_t len, int level,
+                             hut_compress_dict_t **out) {
+#ifdef HUT_HAVE_ZSTD
+  hut_compress_dict_t *dict;
+
+  if (!(dict = calloc(1, sizeof(*dict))))
+    return HUT_ERR_NOMEM;
+  dict->cdict = ZSTD_createCDict(buf, len, level ? level : ZSTD_CLEVEL_DEFAULT);
+  dict->ddict = ZSTD_createDDict(buf, len);
+  dict->len = len;
+  if (!dict->cdict || !dict->ddict) {
+    hut_compress_dict_free(dict);
+    return HUT_ERR_NOMEM;
+  }
+  *out = dict;
+  return HUT_OK;
+#else
+  (void) buf;
+  (void) len;
+  (void) level;
+  (void) out;
+  return HUT_ERR_NOTSUP;
+#endif
+}
+
+void hut_compress_dict_free(hut_compress_dict_t *dict) {
+  if (!dict)
+    return;
+#ifdef HUT_HAVE_ZSTD
+  ZSTD_freeCDict(dict->cdict);
+  ZSTD_freeDDict(dict->ddict);
+#endif
+  free(dict);
+}
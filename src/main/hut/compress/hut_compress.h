@@ -0,0 +1,49 @@
+#ifndef HUT_COMPRESS_H
+#define HUT_COMPRESS_H
+
+#include <stddef.h>
+
+#include "hut/hut.h"
+
+/*
+ * Thin codec layer over LZ4 and zstd. Codecs are compiled in only when
+ * the library was found at configure time (HUT_HAVE_LZ4, HUT_HAVE_ZSTD);
+ * asking for a missing codec fails with HUT_ERR_NOTSUP.
+ *
+ * Compression and decompression contexts are cached per thread, so both
+ * calls are safe to use concurrently and allocation free once warm.
+ */
+
+typedef struct hut_compress_dict_s hut_compress_dict_t;
+
+int hut_compress_supported(hut_compression_t codec);
+
+size_t hut_compress_bound(hut_compression_t codec, size_t len);
+
+int hut_compress(hut_compression_t codec, int level,
+                 const hut_compress_dict_t *dict,
+                 const void *src, size_t len,
+                 void *dst, size_t cap, size_t *out);
+
+int hut_decompress(hut_compression_t codec,
+                   const hut_compress_dict_t *dict,
+                   const void *src, size_t len,
+                   void *dst, size_t raw_len);
+
+/*
+ * Dictionaries (zstd only). Training takes `count` samples laid out back
+ * to back in `samples` and returns a malloc'ed dictionary of at most
+ * `dict_size` bytes. Training can legitimately fail on too little or too
+ * uniform input, in which case callers should simply go without.
+ */
+
+int hut_compress_dict_train(const void *samples, const size_t *sizes,
+                            unsigned count, size_t dict_size,
+                            void **dict, size_t *dict_len);
+
+int hut_compress_dict_create(const void *buf, size_t len, int level,
+                             hut_compress_dict_t **out);
+
+void hut_compress_dict_free(hut_compress_dict_t *dict);
+
+#endif /* HUT_COMPRESS_H */
@@ -0,0 +1,1049 @@
+#include "hut/db/hut_db.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hut/bloom/hut_bloom.h"
+#include "hut/compress/hut_compress.h"
+#include "hut/util/hut_file.h"
+#include "hut/util/hut_hash.h"
+#include "hut/util/hut_mem.h"
+#include "hut/util/hut_numa.h"
+
+#define HUT_DB_LOCK_FILE "LOCK"
+#define HUT_DB_ZONE_FILE "ZONES"
+#define HUT_DB_TRACE_FILE "TRACE"
+#define HUT_DB_SHARD_DIR "shard."
+#define HUT_DB_MIN_SEGMENT_SIZE (1u << 16)
+
+/* Sealing streams files out through buffers of this size. */
+#define HUT_DB_WRITE_BUFFER (1u << 20)
+#define HUT_DB_WRITE_BUFFERS 4
+
+const char *hut_strerror(int status) {
+  switch (status) {
+  case HUT_OK:
+    return "success";
+  case HUT_ERR_NOMEM:
+    return "out of memory";
+  case HUT_ERR_IO:
+    return "i/o error";
+  case HUT_ERR_CORRUPT:
+    return "corrupted data";
+  case HUT_ERR_INVALID:
+    return "invalid argument";
+  case HUT_ERR_NOTSUP:
+    return "not supported";
+  case HUT_ERR_NOTFOUND:
+    return "not found";
+  case HUT_ERR_FULL:
+    return "no space left";
+  case HUT_ERR_BUSY:
+    return "resource busy";
+  default:
+    return "unknown error";
+  }
+}
+
+void hut_options_init(hut_options_t *opts) {
+  memset(opts, 0, sizeof(*opts));
+  opts->segment_size = 64u << 20;
+  opts->compression.codec = HUT_COMPRESSION_NONE;
+  opts->compression.block_size = 16u << 10;
+  opts->cache_size = 64u << 20;
+  opts->cache_shards = 16;
+  opts->io.backend = HUT_IO_MMAP;
+  opts->io.queue_depth = 256;
+  opts->io.sqpoll_idle = 1000;
+  opts->io.buffer_count = 64;
+  opts->io.buffer_size = 64u << 10;
+  opts->zones.max_open = 14;
+  opts->ring_size = 1024;
+  opts->stats = 1;
+  opts->trace_threads = 64;
+}
+
+/*
+ * Segment table.
+ */
+
+/* The handle itself may still be looked at by readers, it is freed on close. */
+void hut_db_segment_unref(hut_db_segment_t *dbseg) {
+  hut_db_t *db = dbseg->db;
+
+  if (__sync_sub_and_fetch(&dbseg->refs, 1))
+    return;
+  hut_segment_close(dbseg->seg);
+  dbseg->seg = NULL;
+  dbseg->retired = __atomic_load_n(&db->retired, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&db->retired, &dbseg->retired, dbseg, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  if (dbseg->sealed)
+    hut_db_segment_unref(dbseg->sealed);
+}
+
+/* The old table goes to the garbage, published after the new one is. */
+static int hut_db_segment_grow(hut_db_t *db, uint32_t id) {
+  hut_db_segment_t **grown;
+  hut_db_garbage_t *old;
+  uint32_t cap;
+
+  for (cap = db->segment_cap ? db->segment_cap : 64; cap <= id; cap *= 2)
+    ;
+  if (!(old = malloc(sizeof(*old))))
+    return HUT_ERR_NOMEM;
+  if (!(grown = calloc(cap, sizeof(*grown)))) {
+    free(old);
+    return HUT_ERR_NOMEM;
+  }
+  if (db->segment_cap)
+    memcpy(grown, db->segments, db->segment_cap * sizeof(*grown));
+  old->ptr = db->segments;
+  old->next = db->garbage;
+  db->garbage = old;
+  __atomic_store_n(&db->segments, grown, __ATOMIC_RELEASE);
+  __atomic_store_n(&db->segment_cap, cap, __ATOMIC_RELEASE);
+  return HUT_OK;
+}
+
+int hut_db_segment_add(hut_db_t *db, hut_segment_t *seg, hut_db_segment_t **out) {
+  uint32_t id = hut_segment_id(seg);
+  hut_db_segment_t *dbseg;
+  int rc;
+
+  if (id >= db->segment_cap && (rc = hut_db_segment_grow(db, id)))
+    return rc;
+  if (!(dbseg = calloc(1, sizeof(*dbseg))))
+    return HUT_ERR_NOMEM;
+  dbseg->seg = seg;
+  dbseg->refs = 1;
+  dbseg->db = db;
+  hut_segment_set_cache(seg, db->cache);
+  __atomic_store_n(&db->segments[id], dbseg, __ATOMIC_RELEASE);
+  if (out)
+    *out = dbseg;
+  return HUT_OK;
+}
+
+static int hut_db_segment_create(hut_db_t *db) {
+  hut_segment_t *seg;
+  int rc;
+
+  if ((rc = hut_segment_create(db->path, db->next_id, db->opts.segment_size,
+                               db->opts.huge_pages, &seg)))
+    return rc;
+  if ((rc = hut_db_segment_add(db, seg, &db->active))) {
+    hut_segment_close(seg);
+    return rc;
+  }
+  db->next_id++;
+  return HUT_OK;
+}
+
+int hut_db_segment_seal_file(hut_db_t *db, hut_segment_t *seg, uint32_t zone_reserve,
+                             hut_segment_t **sealed) {
+  hut_segment_seal_options_t opts;
+  hut_db_timer_t timer;
+  int rc;
+
+  hut_db_timer_start(db, &timer, 0);
+  opts.compression = db->opts.compression;
+  opts.bloom_bits_per_key = db->opts.bloom_bits_per_key;
+  opts.direct = db->opts.direct_io;
+  opts.pool = db->pool;
+  opts.erase_block_size = db->opts.erase_block_size;
+  opts.zones = db->zones;
+  opts.zone_reserve = zone_reserve;
+  rc = hut_segment_seal(seg, &opts, sealed);
+  hut_db_timer_stop(db, &timer, HUT_STATS_SEAL, 0, hut_segment_id(seg), rc);
+  if (!rc)
+    hut_db_stats_add(db, HUT_DB_DISK_WRITTEN, hut_segment_seal_written(seg));
+  return rc;
+}
+
+/*
+ * Readers still pinning the old handle keep using it until they let go.
+ * Sealed in place, both handles map the same file, whose blocks the new
+ * one punches out on close once compaction deleted it: the old one pins
+ * the new one, so that this never happens under a reader of the old.
+ */
+int hut_db_segment_seal(hut_db_t *db, hut_db_segment_t *dbseg, uint32_t zone_reserve) {
+  hut_db_segment_t *sealed;
+  hut_segment_t *seg;
+  int rc;
+
+  if ((rc = hut_db_segment_seal_file(db, dbseg->seg, zone_reserve, &seg)))
+    return rc;
+  if ((rc = hut_db_segment_add(db, seg, &sealed))) {
+    hut_segment_close(seg);
+    return rc;
+  }
+  sealed->live = dbseg->live;
+  hut_db_segment_ref(sealed);
+  dbseg->sealed = sealed;
+  hut_db_segment_unref(dbseg);
+  return HUT_OK;
+}
+
+static int hut_db_roll(hut_db_t *db) {
+  int rc;
+
+  if ((rc = hut_db_segment_seal(db, db->active, HUT_DB_ZONE_RESERVE))) {
+    if (rc == HUT_ERR_FULL)
+      hut_db_compact_later(db, HUT_SCHED_HIGH);
+    return rc;
+  }
+  db->active = NULL;
+  hut_db_compact_later(db, HUT_SCHED_NORMAL);
+  return hut_db_segment_create(db);
+}
+
+/*
+ * Lookups.
+ *
+ * Those without the lock write to one shared word: the reference count
+ * of the segment they pin, an atomic increment and decrement on a line
+ * that every get of the segment touches. Reads not served straight from
+ * a segment map, of compressed segments or through io_uring, also go
+ * through the record cache, whose shards take locks of their own. Pins
+ * outlive the call, since values hold them until released, which a
+ * per-thread epoch or hazard slot could not cover; a hot segment costs
+ * its line bouncing between readers instead.
+ */
+
+int hut_db_find(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                uint64_t *addr, hut_segment_record_t *rec, hut_db_segment_t **dbseg) {
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES];
+  unsigned i, n;
+  hut_db_segment_t *s;
+
+  n = hut_index_find(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES);
+  if (n > HUT_DB_MAX_CANDIDATES)
+    n = HUT_DB_MAX_CANDIDATES;
+  hut_db_stats_add(db, HUT_DB_INDEX_LOOKUPS, 1);
+
+  for (i = 0; i < n; i++) {
+    hut_db_stats_add(db, HUT_DB_INDEX_PROBES, 1);
+    if (!(s = hut_db_segment(db, (uint32_t) (addrs[i] >> 32)))
+        || hut_segment_read(s->seg, (uint32_t) addrs[i], rec))
+      continue;
+    if (rec->klen == klen && !memcmp(rec->key, key, klen)) {
+      *addr = addrs[i];
+      *dbseg = s;
+      return HUT_OK;
+    }
+    hut_segment_record_release(rec);
+  }
+  return HUT_ERR_NOTFOUND;
+}
+
+int hut_db_find_concurrent(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                           hut_segment_record_t *rec, hut_db_segment_t **dbseg) {
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES];
+  unsigned attempt, i, n;
+  hut_db_segment_t *s;
+  int gone, rc;
+
+  for (attempt = 0; attempt < HUT_DB_READ_RETRIES; attempt++) {
+    hut_db_stats_add(db, HUT_DB_INDEX_LOOKUPS, 1);
+    if ((rc = hut_index_find_concurrent(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES, &n)))
+      return rc;
+    if (n > HUT_DB_MAX_CANDIDATES)
+      n = HUT_DB_MAX_CANDIDATES;
+
+    for (i = 0, gone = 0; i < n; i++) {
+      hut_db_stats_add(db, HUT_DB_INDEX_PROBES, 1);
+      if (!(s = hut_db_segment_load(db, (uint32_t) (addrs[i] >> 32)))
+          || !hut_db_segment_try_ref(s)) {
+        gone = 1;
+        continue;
+      }
+      if (!hut_segment_read(s->seg, (uint32_t) addrs[i], rec)) {
+        if (rec->klen == klen && !memcmp(rec->key, key, klen)) {
+          *dbseg = s;
+          return HUT_OK;
+        }
+        hut_segment_record_release(rec);
+      }
+      hut_db_segment_unref(s);
+    }
+    /* A segment dropped since means the record may have moved. */
+    if (!gone)
+      return HUT_ERR_NOTFOUND;
+  }
+  return HUT_ERR_BUSY;
+}
+
+void hut_db_value_init(hut_value_t *value, hut_db_segment_t *dbseg, hut_segment_record_t *rec) {
+  value->data = rec->value;
+  value->len = rec->vlen;
+  value->pin[0] = dbseg;
+  value->pin[1] = rec->block;
+  value->pin[2] = rec->entry;
+}
+
+void hut_value_release(hut_value_t *value) {
+  if (value->pin[2])
+    hut_cache_release(value->pin[2]);
+  free(value->pin[1]);
+  if (value->pin[0])
+    hut_db_segment_unref(value->pin[0]);
+  memset(value, 0, sizeof(*value));
+}
+
+/*
+ * Recovery. Of several records for a key, the one with the highest
+ * sequence number wins, whatever the order segments are replayed in:
+ * compaction moves older records into newer segments. Tombstones are
+ * indexed like any record during replay so that they keep shadowing older
+ * records replayed after them, and are dropped from the index at the end.
+ */
+
+typedef struct hut_db_tombstone_s {
+  uint64_t hash;
+  uint64_t addr;
+} hut_db_tombstone_t;
+
+typedef struct hut_db_replay_s {
+  hut_db_t *db;
+  hut_db_segment_t *dbseg;
+  hut_db_tombstone_t *tombstones;
+  size_t tombstone_count;
+  size_t tombstone_cap;
+} hut_db_replay_t;
+
+static int hut_db_replay_tombstone(hut_db_replay_t *replay, uint64_t hash, uint64_t addr) {
+  hut_db_tombstone_t *grown;
+  size_t cap;
+
+  if (replay->tombstone_count == replay->tombstone_cap) {
+    cap = replay->tombstone_cap ? replay->tombstone_cap * 2 : 1024;
+    if (!(grown = realloc(replay->tombstones, cap * sizeof(*grown))))
+      return HUT_ERR_NOMEM;
+    replay->tombstones = grown;
+    replay->tombstone_cap = cap;
+  }
+  replay->tombstones[replay->tombstone_count].hash = hash;
+  replay->tombstones[replay->tombstone_count].addr = addr;
+  replay->tombstone_count++;
+  return HUT_OK;
+}
+
+static int hut_db_replay_record(void *arg, uint64_t off, const hut_segment_record_t *rec) {
+  hut_db_replay_t *replay = arg;
+  hut_db_t *db = replay->db;
+  uint64_t hash = hut_hash_bytes(rec->key, rec->klen, 0), addr;
+  uint64_t size = hut_segment_record_size(rec->klen, rec->vlen);
+  uint64_t new_addr = hut_segment_address(hut_segment_id(replay->dbseg->seg), off);
+  hut_segment_record_t old;
+  hut_db_segment_t *s;
+  int tombstone = rec->flags & HUT_SEGMENT_RECORD_TOMBSTONE, rc;
+
+  if (rec->seq > db->seq)
+    db->seq = rec->seq;
+
+  if (tombstone && (rc = hut_db_replay_tombstone(replay, hash, new_addr)))
+    return rc;
+  if (!tombstone)
+    replay->dbseg->live += size;
+
+  if (!hut_db_find(db, rec->key, rec->klen, hash, &addr, &old, &s)) {
+    if (old.seq > rec->seq) {
+      if (!tombstone)
+        replay->dbseg->live -= size;
+      hut_segment_record_release(&old);
+      return HUT_OK;
+    }
+    if (!(old.flags & HUT_SEGMENT_RECORD_TOMBSTONE))
+      s->live -= hut_segment_record_size(old.klen, old.vlen);
+    if (db->exports)
+      hut_db_export_note(db, addr, old.seq);
+    hut_segment_record_release(&old);
+    return hut_index_update(db->index, hash, addr, new_addr);
+  }
+  /* Loaded, and deleted since its sequence number was claimed. */
+  if (db->load_log && hut_db_load_log_deleted(db, rec->key, rec->klen, hash, rec->seq)) {
+    if (!tombstone)
+      replay->dbseg->live -= size;
+    return HUT_OK;
+  }
+  return hut_index_insert(db->index, hash, new_addr);
+}
+
+int hut_db_index_segment(hut_db_t *db, hut_db_segment_t *dbseg) {
+  hut_db_replay_t replay;
+  size_t t;
+  int rc;
+
+  memset(&replay, 0, sizeof(replay));
+  replay.db = db;
+  replay.dbseg = dbseg;
+  rc = hut_segment_iterate(dbseg->seg, hut_db_replay_record, &replay);
+  for (t = 0; t < replay.tombstone_count; t++)
+    hut_index_remove(db->index, replay.tombstones[t].hash, replay.tombstones[t].addr);
+  free(replay.tombstones);
+  return rc;
+}
+
+static int hut_db_compare_ids(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Lists segment ids in ascending order, dropping leftovers of interrupted seals. */
+static int hut_db_list(hut_db_t *db, uint32_t **out, uint32_t *count) {
+  uint32_t *ids = NULL, *grown, n = 0, cap = 0;
+  struct dirent *ent;
+  unsigned int id;
+  char suffix[8];
+  char *tmp;
+  DIR *dir;
+
+  if (!(dir = opendir(db->path)))
+    return HUT_ERR_IO;
+  while ((ent = readdir(dir))) {
+    if (sscanf(ent->d_name, "%8x.%7s", &id, suffix) != 2 || strlen(ent->d_name) < 12)
+      continue;
+    if (!strcmp(suffix, "seg.tmp") && (tmp = hut_file_path(db->path, ent->d_name))) {
+      unlink(tmp);
+      free(tmp);
+      continue;
+    }
+    if (strcmp(suffix, "seg") || strlen(ent->d_name) != 12)
+      continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 64;
+      if (!(grown = realloc(ids, cap * sizeof(*ids)))) {
+        free(ids);
+        closedir(dir);
+        return HUT_ERR_NOMEM;
+      }
+      ids = grown;
+    }
+    ids[n++] = id;
+  }
+  closedir(dir);
+
+  if (n)
+    qsort(ids, n, sizeof(*ids), hut_db_compare_ids);
+  *out = ids;
+  *count = n;
+  return HUT_OK;
+}
+
+/* Lists the segments sealed into zones, ahead of the files they may duplicate. */
+static int hut_db_load_zones(hut_db_t *db) {
+  hut_segment_t *seg;
+  uint32_t zone;
+  int rc;
+
+  for (zone = 0; zone < hut_zone_count(db->zones); zone++) {
+    rc = hut_segment_open_zone(db->path, db->zones, zone, db->opts.huge_pages, &seg);
+    if (rc == HUT_ERR_NOTFOUND)
+      continue;
+    if (rc)
+      return rc;
+    if ((rc = hut_db_segment_add(db, seg, NULL))) {
+      hut_segment_close(seg);
+      return rc;
+    }
+  }
+  return HUT_OK;
+}
+
+static int hut_db_load_files(hut_db_t *db) {
+  hut_segment_t *seg;
+  uint32_t *ids, count, i;
+  int rc = HUT_OK;
+
+  if ((rc = hut_db_list(db, &ids, &count)))
+    return rc;
+  for (i = 0; i < count; i++) {
+    if ((rc = hut_segment_open(db->path, ids[i], db->opts.huge_pages, &seg)))
+      break;
+    /* Sealed into a zone just before a crash, the file is stale. */
+    if (hut_db_segment(db, ids[i])) {
+      hut_segment_remove(seg);
+      hut_segment_close(seg);
+      continue;
+    }
+    if ((rc = hut_db_segment_add(db, seg, NULL))) {
+      hut_segment_close(seg);
+      break;
+    }
+  }
+  free(ids);
+  return rc;
+}
+
+static int hut_db_recover(hut_db_t *db) {
+  hut_db_replay_t replay;
+  hut_db_segment_t *dbseg;
+  uint32_t id;
+  size_t t;
+  int rc;
+
+  if ((db->zones && (rc = hut_db_load_zones(db))) || (rc = hut_db_load_files(db)))
+    return rc;
+
+  memset(&replay, 0, sizeof(replay));
+  replay.db = db;
+  for (id = 0; id < db->segment_cap; id++) {
+    if (!(dbseg = db->segments[id]))
+      continue;
+    replay.dbseg = dbseg;
+    if ((rc = hut_segment_iterate(dbseg->seg, hut_db_replay_record, &replay)))
+      break;
+    db->next_id = id + 1;
+
+    /* Only the newest unsealed segment stays active, others died mid-seal. */
+    if (!hut_segment_sealed(dbseg->seg)) {
+      if (db->active && (rc = hut_db_segment_seal(db, db->active, 0)))
+        break;
+      db->active = dbseg;
+    }
+  }
+
+  /* Tombstones superseded by newer records are gone from the index already. */
+  for (t = 0; t < replay.tombstone_count; t++)
+    hut_index_remove(db->index, replay.tombstones[t].hash, replay.tombstones[t].addr);
+  free(replay.tombstones);
+  if (rc)
+    return rc;
+
+  if (!db->active)
+    return hut_db_segment_create(db);
+  return HUT_OK;
+}
+
+/*
+ * Open and close.
+ */
+
+/*
+ * Opens the emulated zoned device and shrinks segments as needed for a
+ * sealed one to fit a zone, with its bloom filter and header pages.
+ */
+static int hut_db_zones_open(hut_db_t *db) {
+  hut_zone_options_t *zopts = &db->opts.zones;
+  uint64_t overhead, size = db->opts.segment_size;
+  char *path;
+  int rc;
+
+  /* Records take at least 32 bytes, which bounds the keys a segment holds. */
+  overhead = 3 * HUT_SEGMENT_DATA_OFFSET + HUT_BLOOM_BLOCK_SIZE;
+  if (db->opts.bloom_bits_per_key)
+    overhead += hut_bloom_size(zopts->zone_size / 32, db->opts.bloom_bits_per_key);
+  if (zopts->zone_size <= overhead + HUT_DB_MIN_SEGMENT_SIZE
+      || zopts->zone_count <= HUT_DB_ZONE_RESERVE)
+    return HUT_ERR_INVALID;
+  if (size > zopts->zone_size - overhead)
+    db->opts.segment_size = zopts->zone_size - overhead;
+
+  if (!(path = hut_file_path(db->path, HUT_DB_ZONE_FILE)))
+    return HUT_ERR_NOMEM;
+  rc = hut_zone_open(path, zopts->zone_size, zopts->zone_count, zopts->max_open, &db->zones);
+  free(path);
+  return rc;
+}
+
+/* Starts a new trace, keeping the previous one as TRACE.old. */
+static int hut_db_trace_open(hut_db_t *db) {
+  char *path, *old = NULL;
+  int rc = HUT_ERR_NOMEM;
+
+  if (!(path = hut_file_path(db->path, HUT_DB_TRACE_FILE))
+      || !(old = hut_file_path(db->path, HUT_DB_TRACE_FILE ".old")))
+    goto out;
+  if (rename(path, old) && errno != ENOENT)
+    rc = HUT_ERR_IO;
+  else
+    rc = hut_trace_create(path, db->opts.trace_threads, db->opts.trace_events, &db->trace);
+
+out:
+  free(old);
+  free(path);
+  return rc;
+}
+
+static int hut_db_lock(hut_db_t *db) {
+  char *path;
+
+  if (!(path = hut_file_path(db->path, HUT_DB_LOCK_FILE)))
+    return HUT_ERR_NOMEM;
+  db->lock_fd = open(path, O_RDWR | O_CREAT, 0644);
+  free(path);
+  if (db->lock_fd < 0)
+    return HUT_ERR_IO;
+  if (flock(db->lock_fd, LOCK_EX | LOCK_NB))
+    return errno == EWOULDBLOCK ? HUT_ERR_BUSY : HUT_ERR_IO;
+  return HUT_OK;
+}
+
+/* Counts the shard directories, and whether there are segments outside. */
+static int hut_db_layout(hut_db_t *db, unsigned *shards, int *data) {
+  struct dirent *ent;
+  unsigned id;
+  int end;
+  DIR *dir;
+
+  *shards = 0;
+  *data = 0;
+  if (!(dir = opendir(db->path)))
+    return HUT_ERR_IO;
+  while ((ent = readdir(dir))) {
+    if (!strncmp(ent->d_name, HUT_DB_SHARD_DIR, strlen(HUT_DB_SHARD_DIR)))
+      (*shards)++;
+    else if ((end = 0, sscanf(ent->d_name, "%8x.seg%n", &id, &end) == 1 && end)
+             || !strcmp(ent->d_name, HUT_DB_ZONE_FILE))
+      *data = 1;
+  }
+  closedir(dir);
+  return HUT_OK;
+}
+
+/*
+ * Refuses to open a directory laid out for another shard count: keys
+ * would be looked for in the wrong place.
+ */
+static int hut_db_layout_check(hut_db_t *db, unsigned shards) {
+  unsigned found;
+  int data, rc;
+
+  if ((rc = hut_db_layout(db, &found, &data)))
+    return rc;
+  if (shards ? data || (found && found != shards) : found)
+    return HUT_ERR_INVALID;
+  return HUT_OK;
+}
+
+/* What segment files come in multiples of: erase blocks and huge pages. */
+static uint64_t hut_db_segment_unit(const hut_options_t *opts) {
+  uint64_t unit = opts->erase_block_size, a, b, t;
+
+  if (opts->huge_pages == HUT_HUGE_PAGES_NONE)
+    return unit;
+  if (!unit)
+    return HUT_MEM_HUGE_PAGE;
+  for (a = unit, b = HUT_MEM_HUGE_PAGE; b; a = b, b = t)
+    t = a % b;
+  return unit / a * HUT_MEM_HUGE_PAGE;
+}
+
+static int hut_db_open(const char *path, const hut_options_t *opts, int node,
+                       hut_db_t *router, hut_db_t **out) {
+  hut_db_t *db;
+  uint64_t unit;
+  int rc;
+
+  if (!(db = calloc(1, sizeof(*db))))
+    return HUT_ERR_NOMEM;
+  db->lock_fd = -1;
+  db->next_id = 1;
+  db->node = node;
+  db->opts = *opts;
+  if (router) {
+    db->shard = 1;
+    db->stats = router->stats;
+    db->trace = router->trace;
+  }
+  mtx_init(&db->lock, mtx_plain);
+  mtx_init(&db->compact_lock, mtx_plain);
+
+  /* Grow segments to fill their last erase block or huge page, header included. */
+  if (db->opts.erase_block_size % HUT_POOL_ALIGN) {
+    rc = HUT_ERR_INVALID;
+    goto fail;
+  }
+  if ((unit = hut_db_segment_unit(&db->opts)))
+    db->opts.segment_size = (HUT_SEGMENT_DATA_OFFSET + db->opts.segment_size + unit - 1)
+                            / unit * unit - HUT_SEGMENT_DATA_OFFSET;
+  if (db->opts.segment_size < HUT_DB_MIN_SEGMENT_SIZE || db->opts.segment_size > UINT32_MAX) {
+    rc = HUT_ERR_INVALID;
+    goto fail;
+  }
+  if (!hut_compress_supported(db->opts.compression.codec)) {
+    rc = HUT_ERR_NOTSUP;
+    goto fail;
+  }
+  if (!(db->path = strdup(path))) {
+    rc = HUT_ERR_NOMEM;
+    goto fail;
+  }
+  if (mkdir(path, 0755) && errno != EEXIST) {
+    rc = HUT_ERR_IO;
+    goto fail;
+  }
+  if (!router && db->opts.stats && (rc = hut_db_stats_create(&db->stats)))
+    goto fail;
+  if ((rc = hut_db_lock(db))
+      || (!router && db->opts.trace_events && (rc = hut_db_trace_open(db)))
+      || (rc = hut_db_layout_check(db, 0))
+      || (db->opts.zones.zone_count && (rc = hut_db_zones_open(db)))
+      || (db->opts.cache_size
+          && (rc = hut_cache_create(db->opts.cache_size, db->opts.cache_shards, &db->cache)))
+      || (rc = hut_pool_create(HUT_DB_WRITE_BUFFER, HUT_DB_WRITE_BUFFERS, &db->pool))
+      || (rc = hut_index_create(0, db->opts.huge_pages, db->node, &db->index))
+      || (rc = hut_db_load_recover(db, router ? router->path : path))
+      || (rc = hut_db_recover(db))
+      || (rc = hut_db_async_init(db))
+      || (rc = hut_db_background_start(db, router ? router->sched : NULL))
+      || (db->opts.write_queue && (rc = hut_db_append_start(db))))
+    goto fail;
+
+  *out = db;
+  return HUT_OK;
+
+fail:
+  hut_close(db);
+  return rc;
+}
+
+/*
+ * Opens every shard in a subdirectory of its own, splitting the cache and
+ * the zones between them and sharing one background scheduler, and starts
+ * their owner threads when running thread-per-core.
+ */
+static int hut_db_open_sharded(const char *path, const hut_options_t *opts, hut_db_t **out) {
+  hut_options_t shard_opts = *opts;
+  int per_core = opts->runtime == HUT_RUNTIME_THREAD_PER_CORE, data, node, rc;
+  unsigned i, nodes = opts->numa ? hut_numa_node_count() : 0;
+  char name[32], *shard_path;
+  hut_db_t *db;
+
+  if (!(db = calloc(1, sizeof(*db))))
+    return HUT_ERR_NOMEM;
+  db->lock_fd = -1;
+  db->node = -1;
+  db->opts = *opts;
+  mtx_init(&db->lock, mtx_plain);
+  mtx_init(&db->compact_lock, mtx_plain);
+
+  if (!(db->path = strdup(path))) {
+    rc = HUT_ERR_NOMEM;
+    goto fail;
+  }
+  if (mkdir(path, 0755) && errno != EEXIST) {
+    rc = HUT_ERR_IO;
+    goto fail;
+  }
+  if ((rc = hut_db_lock(db)) || (rc = hut_db_background_start(db, NULL))
+      || (db->opts.stats && (rc = hut_db_stats_create(&db->stats)))
+      || (db->opts.trace_events && (rc = hut_db_trace_open(db))))
+    goto fail;
+  /* One shard per core, unless the database already has its shards. */
+  if (!db->opts.shards && (rc = hut_db_layout(db, &db->opts.shards, &data)))
+    goto fail;
+  if (!db->opts.shards)
+    db->opts.shards = hut_numa_cpu_count();
+  if ((rc = hut_db_layout_check(db, db->opts.shards)))
+    goto fail;
+  if (!(db->shards = calloc(db->opts.shards, sizeof(*db->shards)))) {
+    rc = HUT_ERR_NOMEM;
+    goto fail;
+  }
+
+  shard_opts.shards = 0;
+  shard_opts.runtime = HUT_RUNTIME_SHARED;
+  /* Owners are the only writers of their shards already. */
+  if (per_core)
+    shard_opts.write_queue = 0;
+  shard_opts.cache_size /= db->opts.shards;
+  shard_opts.zones.zone_count /= db->opts.shards;
+  /*
+   * Shared rings are the router's. Owners have their own, and poll them
+   * from their event loop: a kernel polling thread each would only take
+   * another core.
+   */
+  if (!per_core)
+    shard_opts.io.backend = HUT_IO_MMAP;
+  else
+    shard_opts.io.sqpoll = 0;
+  for (i = 0; i < db->opts.shards; i++) {
+    snprintf(name, sizeof(name), HUT_DB_SHARD_DIR "%03u", i);
+    if (!(shard_path = hut_file_path(path, name))) {
+      rc = HUT_ERR_NOMEM;
+      goto fail;
+    }
+    node = -1;
+    if (nodes)
+      node = per_core ? hut_numa_cpu_node(hut_db_core_cpu(i)) : (int) (i % nodes);
+    rc = hut_db_open(shard_path, &shard_opts, node, db, &db->shards[i]);
+    free(shard_path);
+    if (rc)
+      goto fail;
+    db->shard_count++;
+  }
+  if ((rc = hut_db_load_clear(path)))
+    goto fail;
+  if ((rc = per_core ? hut_db_core_start(db) : hut_db_async_init(db)))
+    goto fail;
+
+  *out = db;
+  return HUT_OK;
+
+fail:
+  hut_close(db);
+  return rc;
+}
+
+int hut_open(const char *path, const hut_options_t *opts, hut_db_t **out) {
+  hut_options_t defaults;
+
+  if (!opts) {
+    hut_options_init(&defaults);
+    opts = &defaults;
+  }
+  if (opts->shards > 1 || opts->runtime == HUT_RUNTIME_THREAD_PER_CORE)
+    return hut_db_open_sharded(path, opts, out);
+  return hut_db_open(path, opts, -1, NULL, out);
+}
+
+void hut_close(hut_db_t *db) {
+  hut_db_garbage_t *garbage;
+  hut_db_segment_t *dbseg;
+  uint32_t i;
+
+  if (!db)
+    return;
+  hut_db_core_stop(db);
+  hut_db_append_stop(db);
+  hut_db_background_stop(db);
+  hut_db_async_destroy(db);
+  for (i = 0; i < db->shard_count; i++)
+    hut_close(db->shards[i]);
+  free(db->shards);
+  hut_db_load_log_free(db->load_log);
+  if (db->active)
+    hut_segment_sync(db->active->seg);
+  for (i = 0; i < db->segment_cap; i++)
+    if (db->segments[i])
+      hut_db_segment_unref(db->segments[i]);
+  free(db->segments);
+  while ((garbage = db->garbage)) {
+    db->garbage = garbage->next;
+    free(garbage->ptr);
+    free(garbage);
+  }
+  while ((dbseg = db->retired)) {
+    db->retired = dbseg->retired;
+    free(dbseg);
+  }
+  hut_index_destroy(db->index);
+  hut_cache_destroy(db->cache);
+  hut_pool_destroy(db->pool);
+  hut_zone_close(db->zones);
+  if (!db->shard) {
+    hut_db_stats_destroy(db->stats);
+    hut_trace_close(db->trace);
+  }
+  if (db->lock_fd >= 0)
+    close(db->lock_fd);
+  mtx_destroy(&db->lock);
+  mtx_destroy(&db->compact_lock);
+  free(db->path);
+  free(db);
+}
+
+/*
+ * Reads and writes.
+ */
+
+int hut_db_apply(hut_db_t *db, const void *key, size_t klen, const void *value,
+                 size_t vlen, uint32_t flags, uint64_t hash) {
+  int tombstone = flags & HUT_SEGMENT_RECORD_TOMBSTONE, found, rc;
+  uint64_t addr, old_addr, old_seq = 0, size, off;
+  hut_db_segment_t *old_seg = NULL;
+  hut_segment_record_t old;
+
+  size = hut_segment_record_size((uint32_t) klen, (uint32_t) vlen);
+  found = !hut_db_find(db, key, (uint32_t) klen, hash, &old_addr, &old, &old_seg);
+  if (!found && tombstone)
+    return HUT_ERR_NOTFOUND;
+  if (tombstone && db->load_log
+      && (rc = hut_db_load_log_add(db, key, (uint32_t) klen, hash, db->seq + 1))) {
+    hut_segment_record_release(&old);
+    return rc;
+  }
+  if (found) {
+    old_seg->live -= hut_segment_record_size(old.klen, old.vlen);
+    old_seq = old.seq;
+    hut_segment_record_release(&old);
+  }
+
+  rc = hut_segment_append(db->active->seg, key, (uint32_t) klen, value, (uint32_t) vlen,
+                          flags, db->seq + 1, &off);
+  if (rc == HUT_ERR_FULL && !(rc = hut_db_roll(db)))
+    rc = hut_segment_append(db->active->seg, key, (uint32_t) klen, value, (uint32_t) vlen,
+                            flags, db->seq + 1, &off);
+  if (rc) {
+    if (found)
+      hut_db_segment(db, (uint32_t) (old_addr >> 32))->live +=
+        hut_segment_record_size(old.klen, old.vlen);
+    if (tombstone && db->load_log)
+      hut_db_load_log_drop(db);
+    return rc;
+  }
+  db->seq++;
+  hut_db_stats_add(db, HUT_DB_DISK_WRITTEN, size);
+  if (found && db->exports)
+    hut_db_export_note(db, old_addr, old_seq);
+
+  addr = hut_segment_address(hut_segment_id(db->active->seg), off);
+  if (tombstone)
+    rc = hut_index_remove(db->index, hash, old_addr);
+  else if (found)
+    rc = hut_index_update(db->index, hash, old_addr, addr);
+  else
+    rc = hut_index_insert(db->index, hash, addr);
+  if (!tombstone)
+    db->active->live += size;
+  return rc;
+}
+
+static int hut_db_write(hut_db_t *db, const void *key, size_t klen,
+                        const void *value, size_t vlen, uint32_t flags) {
+  uint64_t hash = hut_hash_bytes(key, klen, 0);
+  hut_db_timer_t timer;
+  int rc;
+
+  if (!klen || klen > UINT32_MAX || vlen > UINT32_MAX)
+    return HUT_ERR_INVALID;
+  db = hut_db_route(db, hash);
+  if (hut_segment_record_size((uint32_t) klen, (uint32_t) vlen) > db->opts.segment_size)
+    return HUT_ERR_INVALID;
+  if (db->appender)
+    return hut_db_append_write(db, key, klen, value, vlen, flags, hash);
+
+  mtx_lock(&db->lock);
+  rc = hut_db_apply(db, key, klen, value, vlen, flags, hash);
+  if (!rc && db->opts.sync) {
+    hut_db_timer_start(db, &timer, hash);
+    rc = hut_segment_sync(db->active->seg);
+    hut_db_timer_stop(db, &timer, HUT_STATS_SYNC, hash, hut_segment_id(db->active->seg), rc);
+  }
+  mtx_unlock(&db->lock);
+  return rc;
+}
+
+/*
+ * Operations are timed on the handle the caller opened, not on its
+ * shards. Keys are only hashed here for the trace, hence `*hash` stays 0
+ * without one.
+ */
+void hut_db_op_start(hut_db_t *db, hut_db_timer_t *timer, const void *key, size_t klen,
+                     uint64_t *hash) {
+  *hash = 0;
+  timer->start = 0;
+  if (db->shard)
+    return;
+  if (db->trace)
+    *hash = hut_hash_bytes(key, klen, 0);
+  hut_db_timer_start(db, timer, *hash);
+}
+
+/* Records an operation started with hut_db_op_start(), and its key and value bytes. */
+void hut_db_op_done(hut_db_t *db, const hut_db_timer_t *timer, hut_stats_op_t op,
+                    uint64_t hash, uint32_t arg, int rc, uint64_t bytes) {
+  if (!timer->start)
+    return;
+  hut_db_timer_stop(db, timer, op, hash, arg, rc);
+  if (!rc && bytes)
+    hut_db_stats_add(db, op == HUT_STATS_GET ? HUT_DB_BYTES_READ : HUT_DB_BYTES_WRITTEN, bytes);
+}
+
+int hut_put(hut_db_t *db, const void *key, size_t klen, const void *value, size_t vlen) {
+  hut_db_timer_t timer;
+  uint64_t hash;
+  int rc;
+
+  hut_db_op_start(db, &timer, key, klen, &hash);
+  if (db->cores)
+    rc = hut_db_core_write(db, key, klen, value, vlen, 0);
+  else
+    rc = hut_db_write(db, key, klen, value, vlen, 0);
+  hut_db_op_done(db, &timer, HUT_STATS_PUT, hash, (uint32_t) vlen, rc, klen + vlen);
+  return rc;
+}
+
+int hut_del(hut_db_t *db, const void *key, size_t klen) {
+  hut_db_timer_t timer;
+  uint64_t hash;
+  int rc;
+
+  hut_db_op_start(db, &timer, key, klen, &hash);
+  if (db->cores)
+    rc = hut_db_core_write(db, key, klen, NULL, 0, 1);
+  else
+    rc = hut_db_write(db, key, klen, NULL, 0, HUT_SEGMENT_RECORD_TOMBSTONE);
+  hut_db_op_done(db, &timer, HUT_STATS_DEL, hash, 0, rc, klen);
+  return rc;
+}
+
+int hut_sync(hut_db_t *db) {
+  hut_db_timer_t timer;
+  unsigned i;
+  int rc = HUT_OK;
+
+  for (i = 0; i < db->shard_count && !rc; i++)
+    rc = hut_sync(db->shards[i]);
+  if (db->shard_count)
+    return rc;
+
+  mtx_lock(&db->lock);
+  if (db->active) {
+    hut_db_timer_start(db, &timer, 0);
+    rc = hut_segment_sync(db->active->seg);
+    hut_db_timer_stop(db, &timer, HUT_STATS_SYNC, 0, hut_segment_id(db->active->seg), rc);
+  }
+  mtx_unlock(&db->lock);
+  return rc;
+}
+
+/* Traces the segment the value was found in. */
+int hut_get(hut_db_t *db, const void *key, size_t klen, hut_value_t *value) {
+  hut_db_segment_t *dbseg;
+  hut_db_timer_t timer;
+  uint64_t hash;
+  int rc;
+
+  hut_db_op_start(db, &timer, key, klen, &hash);
+  rc = hut_db_get(db, key, klen, value);
+  dbseg = rc ? NULL : value->pin[0];
+  hut_db_op_done(db, &timer, HUT_STATS_GET, hash, dbseg ? hut_segment_id(dbseg->seg) : 0, rc,
+                 rc ? 0 : klen + value->len);
+  return rc;
+}
+
+int hut_db_get(hut_db_t *db, const void *key, size_t klen, hut_value_t *value) {
+  uint64_t hash = hut_hash_bytes(key, klen, 0), addr;
+  hut_segment_record_t rec;
+  hut_db_segment_t *dbseg;
+  int rc;
+
+  if (db->cores)
+    return hut_db_core_get(db, key, klen, value);
+  if (!klen || klen > UINT32_MAX)
+    return HUT_ERR_INVALID;
+  db = hut_db_route(db, hash);
+
+  if ((rc = hut_db_find_concurrent(db, key, (uint32_t) klen, hash, &rec, &dbseg)) == HUT_ERR_BUSY) {
+    mtx_lock(&db->lock);
+    if (!(rc = hut_db_find(db, key, (uint32_t) klen, hash, &addr, &rec, &dbseg)))
+      hut_db_segment_ref(dbseg);
+    mtx_unlock(&db->lock);
+  }
+
+  if (!rc)
+    hut_db_value_init(value, dbseg, &rec);
+  return rc;
+}
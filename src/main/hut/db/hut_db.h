@@ -0,0 +1,337 @@
+#ifndef HUT_DB_H
+#define HUT_DB_H
+
+#include <stdint.h>
+
+#include <tinycthread.h>
+
+#include "hut/hut.h"
+#include "hut/cache/hut_cache.h"
+#include "hut/index/hut_index.h"
+#include "hut/sched/hut_sched.h"
+#include "hut/segment/hut_segment.h"
+#include "hut/trace/hut_trace.h"
+#include "hut/util/hut_pool.h"
+
+/*
+ * Database internals, shared by the modules built on top of the core
+ * put/get/del path.
+ *
+ * A database is a directory of segments plus an in-memory index that is
+ * rebuilt from them on open. Records carry a sequence number, so replay
+ * order across segments does not matter. All index and segment table
+ * changes happen under `lock`.
+ *
+ * Gets run without it. The index is read under its sequence locks, and
+ * the segment table through atomic loads; nothing readers may still be
+ * looking at is ever freed before close, neither grown out of tables nor
+ * the handles of dropped segments, whose segments are closed meanwhile.
+ * Readers pin a segment only if it still has references, and retry from
+ * the index when one they were pointed to is gone, as compaction repoints
+ * the index before dropping segments. That reference count is the one
+ * shared word gets write to, see hut_db.c.
+ *
+ * A sharded database is a directory of such databases, one per shard in
+ * a subdirectory, each with its own lock, index and segments, and its
+ * memory on a NUMA node of its own where asked to. The handle returned
+ * to the caller only routes requests by key hash, and holds the per-thread
+ * rings of async gets for all of its shards.
+ */
+
+/*
+ * A segment as listed by the database. Readers pin it while they hold
+ * records pointing into it; the table holds one reference of its own.
+ */
+typedef struct hut_db_segment_s hut_db_segment_t;
+
+struct hut_db_segment_s {
+  hut_segment_t *seg;
+  int refs;
+  uint64_t live;                /* bytes of records the index points to */
+  hut_db_t *db;
+  hut_db_segment_t *retired;    /* next of the dropped handles */
+  hut_db_segment_t *sealed;     /* what it was sealed into, pinned until it closes */
+};
+
+/* Memory dropped from under readers, freed on close. */
+typedef struct hut_db_garbage_s {
+  void *ptr;
+  struct hut_db_garbage_s *next;
+} hut_db_garbage_t;
+
+typedef struct hut_db_io_s hut_db_io_t;
+typedef struct hut_db_core_s hut_db_core_t;
+typedef struct hut_db_client_s hut_db_client_t;
+typedef struct hut_db_appender_s hut_db_appender_t;
+typedef struct hut_db_stats_s hut_db_stats_t;
+typedef struct hut_db_export_log_s hut_db_export_log_t;
+typedef struct hut_db_load_log_s hut_db_load_log_t;
+
+struct hut_db_s {
+  char *path;
+  hut_options_t opts;
+  int lock_fd;
+  mtx_t lock;
+  hut_index_t *index;
+  hut_db_segment_t **segments;  /* indexed by segment id */
+  hut_db_garbage_t *garbage;    /* tables grown out of */
+  hut_db_segment_t *retired;    /* handles dropped */
+  uint32_t segment_cap;
+  uint32_t next_id;
+  hut_db_segment_t *active;
+  uint64_t seq;
+  hut_cache_t *cache;
+  hut_pool_t *pool;             /* write buffers for sealing and compaction */
+  hut_zone_dev_t *zones;        /* where sealed segments go, NULL for files */
+  int io_ready;                 /* io_key and io_lock set up */
+  tss_t io_key;
+  mtx_t io_lock;
+  hut_db_io_t *ios;             /* per-thread rings, for teardown */
+  hut_db_t **shards;            /* routed to by key hash, NULL when unsharded */
+  unsigned shard_count;
+  int node;                     /* NUMA node of the index, -1 for any */
+  hut_db_core_t *cores;         /* shard owners, thread-per-core only */
+  int client_ready;             /* client_key and client_lock set up */
+  tss_t client_key;
+  mtx_t client_lock;
+  hut_db_client_t *clients;     /* per-thread completion rings, for teardown */
+  hut_sched_t *sched;           /* background jobs, NULL when none enabled */
+  int sched_owned;              /* shards borrow the scheduler of the router */
+  int compact_queued;           /* priority of the queued compaction plus one, 0 for none */
+  unsigned long corrupt_segments; /* found by warm-up */
+  hut_db_appender_t *appender;  /* applies writes in batches, write_queue only */
+  unsigned scans;               /* running, compaction waits for them */
+  mtx_t compact_lock;           /* held by the compaction running, before `lock` */
+  hut_db_stats_t *stats;        /* NULL when off */
+  hut_trace_t *trace;           /* NULL when off */
+  int shard;                    /* of a router, whose stats and trace it borrows */
+  unsigned long compactions;    /* started and finished, odd while one runs */
+  int loading;                  /* a loader stages into it, or its shards */
+  hut_db_load_log_t *load_log;  /* deletes made while a load stages into it */
+  hut_db_export_log_t *exports; /* running */
+};
+
+/*
+ * What a running export learns from writers: the records of its snapshot
+ * they overwrote or deleted since, which were the newest of their keys.
+ */
+struct hut_db_export_log_s {
+  uint64_t seq;                 /* the last written before the snapshot */
+  uint64_t *addrs;
+  size_t count;
+  size_t cap;
+  int failed;                   /* ran out of memory noting one */
+  hut_db_export_log_t *next;
+};
+
+/* Number of records sharing a key hash that lookups are willing to check. */
+#define HUT_DB_MAX_CANDIDATES 8
+
+/* Lookups racing compaction for longer than this fall back to the lock. */
+#define HUT_DB_READ_RETRIES 4
+
+/* Zones only compaction may seal into, so that a full device can recover. */
+#define HUT_DB_ZONE_RESERVE 2
+
+/* The shard a key hash goes to; the high half, as the index uses the low. */
+static inline hut_db_t *hut_db_route(hut_db_t *db, uint64_t hash) {
+  return db->shard_count ? db->shards[(hash >> 32) % db->shard_count] : db;
+}
+
+static inline hut_db_segment_t *hut_db_segment(const hut_db_t *db, uint32_t id) {
+  return id < db->segment_cap ? db->segments[id] : NULL;
+}
+
+/* hut_db_segment() without the lock. */
+static inline hut_db_segment_t *hut_db_segment_load(const hut_db_t *db, uint32_t id) {
+  uint32_t cap = __atomic_load_n(&db->segment_cap, __ATOMIC_ACQUIRE);
+  hut_db_segment_t **segments = __atomic_load_n(&db->segments, __ATOMIC_ACQUIRE);
+
+  return id < cap ? __atomic_load_n(&segments[id], __ATOMIC_ACQUIRE) : NULL;
+}
+
+static inline void hut_db_segment_ref(hut_db_segment_t *dbseg) {
+  __sync_add_and_fetch(&dbseg->refs, 1);
+}
+
+/* Pins a segment found without the lock, unless it was dropped already. */
+static inline int hut_db_segment_try_ref(hut_db_segment_t *dbseg) {
+  int refs = __atomic_load_n(&dbseg->refs, __ATOMIC_RELAXED);
+
+  while (refs)
+    if (__atomic_compare_exchange_n(&dbseg->refs, &refs, refs + 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+}
+
+void hut_db_segment_unref(hut_db_segment_t *dbseg);
+
+/* Lists a segment under its id, the table taking the one reference. */
+int hut_db_segment_add(hut_db_t *db, hut_segment_t *seg, hut_db_segment_t **out);
+
+/*
+ * Seals a segment without listing it, as its own file or into zones,
+ * leaving `zone_reserve` of them empty, timed and counted as a seal.
+ * Needs no lock.
+ */
+int hut_db_segment_seal_file(hut_db_t *db, hut_segment_t *seg, uint32_t zone_reserve,
+                             hut_segment_t **sealed);
+
+/*
+ * Seals a segment and swaps the sealed version into the table, leaving
+ * `zone_reserve` zones empty when sealing into zones.
+ */
+int hut_db_segment_seal(hut_db_t *db, hut_db_segment_t *dbseg, uint32_t zone_reserve);
+
+/*
+ * Finds the live record for a key, with the lock held. On success the
+ * record is returned unpinned: it stays valid only while the lock is held
+ * unless the caller pins `*dbseg`.
+ */
+int hut_db_find(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                uint64_t *addr, hut_segment_record_t *rec, hut_db_segment_t **dbseg);
+
+/*
+ * Writes a record, or a tombstone with HUT_SEGMENT_RECORD_TOMBSTONE, with
+ * the lock held, leaving syncing to the caller. The key and value sizes
+ * must have been checked.
+ */
+int hut_db_apply(hut_db_t *db, const void *key, size_t klen, const void *value,
+                 size_t vlen, uint32_t flags, uint64_t hash);
+
+/*
+ * hut_db_find() without the lock, returning the record pinned through
+ * `*dbseg`. HUT_ERR_BUSY when racing writers for too long, for callers to
+ * retry under the lock.
+ */
+int hut_db_find_concurrent(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                           hut_segment_record_t *rec, hut_db_segment_t **dbseg);
+
+/*
+ * Indexes the records of a segment just listed, with the lock held, as
+ * recovery does: of the records of a key, the one with the highest
+ * sequence number wins.
+ */
+int hut_db_index_segment(hut_db_t *db, hut_db_segment_t *dbseg);
+
+/* hut_get() without timing it, for the operations built on it. */
+int hut_db_get(hut_db_t *db, const void *key, size_t klen, hut_value_t *value);
+
+/* Hands a record over to a value, which takes over the pin on `dbseg`. */
+void hut_db_value_init(hut_value_t *value, hut_db_segment_t *dbseg, hut_segment_record_t *rec);
+
+/* Async I/O, see hut_db_async.c. */
+int hut_db_async_init(hut_db_t *db);
+
+void hut_db_async_destroy(hut_db_t *db);
+
+/* Write queue, see hut_db_append.c. */
+int hut_db_append_start(hut_db_t *db);
+
+void hut_db_append_stop(hut_db_t *db);
+
+int hut_db_append_write(hut_db_t *db, const void *key, size_t klen, const void *value,
+                        size_t vlen, uint32_t flags, uint64_t hash);
+
+/* Background jobs, see hut_db_background.c. */
+int hut_db_background_start(hut_db_t *db, hut_sched_t *sched);
+
+void hut_db_background_stop(hut_db_t *db);
+
+/* Queues a compaction of the shard unless one as urgent is queued already. */
+void hut_db_compact_later(hut_db_t *db, hut_sched_priority_t priority);
+
+/* Bulk loads, see hut_db_load.c. */
+
+/*
+ * Before recovery, finishes installing what was staged in the database
+ * of a load committed to the one at `dir`, its router's when a shard, or
+ * drops it when the load was not committed.
+ */
+int hut_db_load_recover(hut_db_t *db, const char *dir);
+
+/* Drops what was staged in the database at `dir`, its commit included. */
+int hut_db_load_clear(const char *dir);
+
+/*
+ * With the lock held and a load log, notes a delete about to be written
+ * with sequence number `seq`, for installing the load to skip what it
+ * loaded of the key before. Dropped again, while still holding the lock,
+ * when writing the delete fails.
+ */
+int hut_db_load_log_add(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                        uint64_t seq);
+
+void hut_db_load_log_drop(hut_db_t *db);
+
+/* Whether a delete of the key past `seq` was noted, with the lock held. */
+int hut_db_load_log_deleted(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                            uint64_t seq);
+
+void hut_db_load_log_free(hut_db_load_log_t *log);
+
+/*
+ * Tells running exports, with the lock held, that the record at `addr`
+ * was just overwritten or deleted.
+ */
+void hut_db_export_note(hut_db_t *db, uint64_t addr, uint64_t seq);
+
+/* Stats, see hut_db_stats.c. */
+typedef enum hut_db_counter_e {
+  HUT_DB_BYTES_READ         = 0,
+  HUT_DB_BYTES_WRITTEN      = 1,
+  HUT_DB_DISK_WRITTEN       = 2,
+  HUT_DB_INDEX_LOOKUPS      = 3,
+  HUT_DB_INDEX_PROBES       = 4,
+  HUT_DB_GC_RELOCATED       = 5
+} hut_db_counter_t;
+
+#define HUT_DB_COUNTERS 6
+
+int hut_db_stats_create(hut_db_stats_t **out);
+
+void hut_db_stats_destroy(hut_db_stats_t *stats);
+
+/* An operation being timed and traced. */
+typedef struct hut_db_timer_s {
+  uint64_t start;               /* 0 with both stats and tracing off */
+  unsigned long compactions;    /* of the shard the key hash goes to */
+} hut_db_timer_t;
+
+void hut_db_timer_start(hut_db_t *db, hut_db_timer_t *timer, uint64_t hash);
+
+/*
+ * Records the operation, and traces it with `arg` (see hut_trace_event_t)
+ * and its status, flagged when the shard compacted meanwhile.
+ */
+void hut_db_timer_stop(hut_db_t *db, const hut_db_timer_t *timer, hut_stats_op_t op,
+                       uint64_t hash, uint32_t arg, int status);
+
+void hut_db_stats_add(hut_db_t *db, hut_db_counter_t counter, uint64_t n);
+
+/* Timing of the calls of the API, on the handle they were made on. */
+void hut_db_op_start(hut_db_t *db, hut_db_timer_t *timer, const void *key, size_t klen,
+                     uint64_t *hash);
+
+void hut_db_op_done(hut_db_t *db, const hut_db_timer_t *timer, hut_stats_op_t op,
+                    uint64_t hash, uint32_t arg, int rc, uint64_t bytes);
+
+/* Thread-per-core runtime, see hut_db_core.c. */
+int hut_db_core_start(hut_db_t *db);
+
+void hut_db_core_stop(hut_db_t *db);
+
+/* CPU the thread owning shard `shard` runs on. */
+unsigned hut_db_core_cpu(unsigned shard);
+
+int hut_db_core_write(hut_db_t *db, const void *key, size_t klen,
+                      const void *value, size_t vlen, int del);
+
+int hut_db_core_get(hut_db_t *db, const void *key, size_t klen, hut_value_t *value);
+
+int hut_db_core_get_async(hut_db_t *db, const void *key, size_t klen, hut_get_fn fn, void *arg);
+
+int hut_db_core_poll(hut_db_t *db, unsigned min);
+
+#endif /* HUT_DB_H */
@@ -0,0 +1,186 @@
+#include "hut/db/hut_db.h"
+
+#include <sched.h>
+#include <stdlib.h>
+
+#include "hut/util/hut_futex.h"
+#include "hut/util/hut_ring.h"
+
+/*
+ * Write queue.
+ *
+ * Writers push their write, kept on their stack, to the ring of the shard
+ * and wait for it as thread-per-core callers do, spinning for a while and
+ * then sleeping on a futex. The appender drains the ring a batch at a time
+ * and applies the batch under one hold of the lock, so that the lock no
+ * longer bounces between writers; gets never take it at all.
+ *
+ * With `sync`, the batch is group committed: the active segment is
+ * flushed once, outside the lock, before any of its writers hears back.
+ * Writes that rolled the segment are durable already, sealing syncs.
+ */
+
+#define HUT_DB_APPEND_SPIN 256
+#define HUT_DB_APPEND_BATCH 256
+
+/* Futex word of a write. */
+#define HUT_DB_APPEND_PENDING  0
+#define HUT_DB_APPEND_DONE     1
+#define HUT_DB_APPEND_SLEEPING 2
+#define HUT_DB_APPEND_RELEASED 3      /* done, and woken if it slept */
+
+struct hut_db_appender_s {
+  hut_db_t *db;
+  hut_ring_t *ring;
+  thrd_t thread;
+  int started;
+};
+
+typedef struct hut_db_append_msg_s {
+  const void *key;
+  size_t klen;
+  const void *value;
+  size_t vlen;
+  uint32_t flags;
+  uint64_t hash;
+  int status;
+  int state;
+} hut_db_append_msg_t;
+
+static inline void hut_db_append_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause");
+#endif
+}
+
+/*
+ * Writers that slept wait for RELEASED, not DONE, as thread-per-core
+ * callers do: their stack frame must outlive the wake.
+ */
+static void hut_db_append_complete(hut_db_append_msg_t *msg) {
+  if (__atomic_exchange_n(&msg->state, HUT_DB_APPEND_DONE, __ATOMIC_RELEASE)
+      != HUT_DB_APPEND_SLEEPING)
+    return;
+  hut_futex_wake(&msg->state, 1);
+  __atomic_store_n(&msg->state, HUT_DB_APPEND_RELEASED, __ATOMIC_RELEASE);
+}
+
+static void hut_db_append_batch(hut_db_t *db, hut_db_append_msg_t **batch, unsigned n) {
+  hut_db_timer_t timer, sync_timer;
+  hut_db_segment_t *active = NULL;
+  unsigned i, ok = 0;
+  int rc = HUT_OK;
+
+  hut_db_timer_start(db, &timer, 0);
+  mtx_lock(&db->lock);
+  for (i = 0; i < n; i++) {
+    batch[i]->status = hut_db_apply(db, batch[i]->key, batch[i]->klen, batch[i]->value,
+                                    batch[i]->vlen, batch[i]->flags, batch[i]->hash);
+    ok += !batch[i]->status;
+  }
+  if (ok && db->opts.sync) {
+    active = db->active;
+    hut_db_segment_ref(active);
+  }
+  mtx_unlock(&db->lock);
+
+  if (active) {
+    hut_db_timer_start(db, &sync_timer, 0);
+    if ((rc = hut_segment_sync(active->seg)))
+      for (i = 0; i < n; i++)
+        if (!batch[i]->status)
+          batch[i]->status = rc;
+    hut_db_timer_stop(db, &sync_timer, HUT_STATS_SYNC, 0, hut_segment_id(active->seg), rc);
+    hut_db_segment_unref(active);
+  }
+  hut_db_timer_stop(db, &timer, HUT_STATS_BATCH, 0, n, rc);
+  for (i = 0; i < n; i++)
+    hut_db_append_complete(batch[i]);
+}
+
+static int hut_db_append_run(void *arg) {
+  hut_db_appender_t *app = arg;
+  hut_db_append_msg_t *batch[HUT_DB_APPEND_BATCH];
+  unsigned n, idle = 0;
+
+  while (!hut_ring_stopped(app->ring)) {
+    for (n = 0; n < HUT_DB_APPEND_BATCH && (batch[n] = hut_ring_pop(app->ring)); n++)
+      ;
+    if (n) {
+      hut_db_append_batch(app->db, batch, n);
+      idle = 0;
+    } else if (++idle < HUT_DB_APPEND_SPIN) {
+      hut_db_append_relax();
+    } else {
+      hut_ring_wait(app->ring);
+      idle = 0;
+    }
+  }
+  return 0;
+}
+
+int hut_db_append_start(hut_db_t *db) {
+  hut_db_appender_t *app;
+  int rc;
+
+  if (!(app = calloc(1, sizeof(*app))))
+    return HUT_ERR_NOMEM;
+  db->appender = app;
+  app->db = db;
+  if ((rc = hut_ring_create(db->opts.ring_size, &app->ring)))
+    return rc;
+  if (thrd_create(&app->thread, hut_db_append_run, app) != thrd_success)
+    return HUT_ERR_NOMEM;
+  app->started = 1;
+  return HUT_OK;
+}
+
+/* Callers must be done writing. */
+void hut_db_append_stop(hut_db_t *db) {
+  hut_db_appender_t *app = db->appender;
+
+  if (!app)
+    return;
+  if (app->started) {
+    hut_ring_stop(app->ring);
+    thrd_join(app->thread, NULL);
+  }
+  hut_ring_destroy(app->ring);
+  free(app);
+  db->appender = NULL;
+}
+
+int hut_db_append_write(hut_db_t *db, const void *key, size_t klen, const void *value,
+                        size_t vlen, uint32_t flags, uint64_t hash) {
+  hut_db_append_msg_t msg;
+  unsigned spin;
+  int state;
+
+  msg.key = key;
+  msg.klen = klen;
+  msg.value = value;
+  msg.vlen = vlen;
+  msg.flags = flags;
+  msg.hash = hash;
+  msg.status = HUT_OK;
+  msg.state = HUT_DB_APPEND_PENDING;
+  while (hut_ring_push(db->appender->ring, &msg) == HUT_ERR_FULL)
+    sched_yield();
+
+  for (spin = 0; spin < HUT_DB_APPEND_SPIN; spin++) {
+    if (__atomic_load_n(&msg.state, __ATOMIC_ACQUIRE) == HUT_DB_APPEND_DONE)
+      return msg.status;
+    hut_db_append_relax();
+  }
+  state = HUT_DB_APPEND_PENDING;
+  if (!__atomic_compare_exchange_n(&msg.state, &state, HUT_DB_APPEND_SLEEPING, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    return msg.status;
+  while ((state = __atomic_load_n(&msg.state, __ATOMIC_ACQUIRE)) != HUT_DB_APPEND_RELEASED) {
+    if (state == HUT_DB_APPEND_SLEEPING)
+      hut_futex_wait(&msg.state, HUT_DB_APPEND_SLEEPING);
+    else
+      sched_yield();
+  }
+  return msg.status;
+}
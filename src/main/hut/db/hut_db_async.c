@@ -0,0 +1,330 @@
+#include "hut/db/hut_db.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hut/io/hut_io.h"
+#include "hut/util/hut_hash.h"
+
+/*
+ * Asynchronous gets over io_uring.
+ *
+ * Each thread calling hut_get_async() gets a ring of its own, created on
+ * first use and found again through a thread-specific key. The index
+ * lookup happens synchronously, without the lock as hut_get() does it
+ * unless compaction keeps moving the record; only the read of the record
+ * bytes goes through the ring. Sharded databases keep a single ring per
+ * thread, shared by all shards, so that hut_poll() waits on one. Records
+ * already in memory, in the active segment or the record cache, complete
+ * inline.
+ *
+ * Gets are timed from the call to their callback, as hut_get() is to its
+ * return, by a small wrapper around the callback, only allocated while
+ * stats or tracing are on.
+ */
+
+#define HUT_DB_ASYNC_HINT 4096
+#define HUT_DB_ASYNC_ALIGN 4096
+
+struct hut_db_io_s {
+  hut_io_t *io;
+  hut_db_io_t *next;
+};
+
+typedef struct hut_db_timed_s {
+  hut_db_t *db;                 /* the handle called */
+  hut_db_timer_t timer;
+  uint64_t hash;
+  size_t klen;
+  hut_get_fn fn;
+  void *arg;
+} hut_db_timed_t;
+
+typedef struct hut_db_request_s {
+  hut_io_op_t op;
+  hut_db_io_t *ctx;
+  hut_db_segment_t *dbseg;
+  uint64_t off;
+  hut_segment_extent_t ext;
+  void *buf;
+  int buf_index;
+  hut_get_fn fn;
+  void *arg;
+  uint32_t klen;
+  char key[];
+} hut_db_request_t;
+
+int hut_db_async_init(hut_db_t *db) {
+  if (db->opts.io.backend != HUT_IO_URING)
+    return HUT_OK;
+  if (tss_create(&db->io_key, NULL) != thrd_success)
+    return HUT_ERR_NOMEM;
+  mtx_init(&db->io_lock, mtx_plain);
+  db->io_ready = 1;
+  return HUT_OK;
+}
+
+/* Rings must be drained by their threads before the database is closed. */
+void hut_db_async_destroy(hut_db_t *db) {
+  hut_db_io_t *ctx;
+
+  if (!db->io_ready)
+    return;
+  while ((ctx = db->ios)) {
+    db->ios = ctx->next;
+    hut_io_destroy(ctx->io);
+    free(ctx);
+  }
+  tss_delete(db->io_key);
+  mtx_destroy(&db->io_lock);
+  db->io_ready = 0;
+}
+
+/* Returns this thread's ring, NULL when io_uring is off or unavailable. */
+static hut_db_io_t *hut_db_io(hut_db_t *db) {
+  hut_db_io_t *ctx;
+
+  if (!db->io_ready)
+    return NULL;
+  if ((ctx = tss_get(db->io_key)))
+    return ctx;
+  if (!(ctx = calloc(1, sizeof(*ctx))))
+    return NULL;
+  if (hut_io_create(&db->opts.io, &ctx->io)) {
+    free(ctx);
+    return NULL;
+  }
+  tss_set(db->io_key, ctx);
+  mtx_lock(&db->io_lock);
+  ctx->next = db->ios;
+  db->ios = ctx;
+  mtx_unlock(&db->io_lock);
+  return ctx;
+}
+
+static void hut_db_request_free_buf(hut_db_request_t *req) {
+  if (req->buf_index >= 0)
+    hut_io_buffer_put(req->ctx->io, req->buf_index);
+  else
+    free(req->buf);
+  req->buf = NULL;
+  req->buf_index = -1;
+}
+
+static void hut_db_request_done(hut_db_request_t *req, int status, hut_value_t *value) {
+  hut_get_fn fn = req->fn;
+  void *arg = req->arg;
+
+  hut_db_request_free_buf(req);
+  if (status)
+    hut_db_segment_unref(req->dbseg);
+  free(req);
+  fn(arg, status, status ? NULL : value);
+}
+
+static int hut_db_request_submit(hut_db_request_t *req) {
+  hut_io_t *io = req->ctx->io;
+  int rc;
+
+  req->buf_index = hut_io_buffer_get(io, req->ext.len, &req->buf);
+  if (req->buf_index < 0 && posix_memalign(&req->buf, HUT_DB_ASYNC_ALIGN, req->ext.len))
+    return HUT_ERR_NOMEM;
+
+  /* Make room by reaping completions when the submission queue is full. */
+  while ((rc = hut_io_read(io, &req->op, hut_segment_fd(req->dbseg->seg), req->buf,
+                           req->ext.len, req->ext.file_off, req->buf_index)) == HUT_ERR_FULL)
+    if ((rc = hut_io_poll(io, 1)) < 0)
+      break;
+  if (rc)
+    hut_db_request_free_buf(req);
+  return rc;
+}
+
+static void hut_db_request_complete(hut_io_op_t *op, int res) {
+  hut_db_request_t *req = (hut_db_request_t *) op;
+  hut_segment_record_t rec;
+  hut_value_t value;
+  int rc;
+
+  if (res < 0 || (uint32_t) res < req->ext.len) {
+    hut_db_request_done(req, HUT_ERR_IO, NULL);
+    return;
+  }
+
+  rc = hut_segment_read_extent(req->dbseg->seg, req->off, &req->ext, req->buf, &rec);
+  if (rc == HUT_ERR_FULL) {
+    /* The speculative read was short, go again for the whole record. */
+    hut_db_request_free_buf(req);
+    if ((rc = hut_db_request_submit(req)))
+      hut_db_request_done(req, rc, NULL);
+    return;
+  }
+  if (rc) {
+    hut_db_request_done(req, rc, NULL);
+    return;
+  }
+  if (rec.klen != req->klen || memcmp(rec.key, req->key, req->klen)) {
+    hut_segment_record_release(&rec);
+    hut_db_request_done(req, HUT_ERR_NOTFOUND, NULL);
+    return;
+  }
+  hut_db_value_init(&value, req->dbseg, &rec);
+  hut_db_request_done(req, HUT_OK, &value);
+}
+
+static int hut_db_get_sync(hut_db_t *db, const void *key, size_t klen, hut_get_fn fn, void *arg) {
+  hut_value_t value;
+  int rc;
+
+  rc = hut_db_get(db, key, klen, &value);
+  fn(arg, rc, rc ? NULL : &value);
+  return HUT_OK;
+}
+
+/*
+ * Finds the address of the one record a key hash maps to, pinning its
+ * segment, as hut_db_find_concurrent() does but without reading it.
+ * Returns how many there are, leaving `*dbseg` NULL unless just the one.
+ */
+static unsigned hut_db_async_find(hut_db_t *db, uint64_t hash, uint64_t *addr,
+                                  hut_db_segment_t **dbseg) {
+  uint64_t addrs[2];
+  unsigned attempt, n;
+
+  for (attempt = 0; attempt < HUT_DB_READ_RETRIES; attempt++) {
+    if (hut_index_find_concurrent(db->index, hash, addrs, 2, &n))
+      break;
+    *dbseg = NULL;
+    if (n != 1)
+      return n;
+    /* Dropped since, the record may have moved: look again. */
+    if ((*dbseg = hut_db_segment_load(db, (uint32_t) (addrs[0] >> 32)))
+        && hut_db_segment_try_ref(*dbseg)) {
+      *addr = addrs[0];
+      return 1;
+    }
+  }
+
+  mtx_lock(&db->lock);
+  n = hut_index_find(db->index, hash, addrs, 2);
+  if (n == 1 && (*dbseg = hut_db_segment(db, (uint32_t) (addrs[0] >> 32))))
+    hut_db_segment_ref(*dbseg);
+  else
+    *dbseg = NULL;
+  mtx_unlock(&db->lock);
+  *addr = addrs[0];
+  return n;
+}
+
+static int hut_db_get_async(hut_db_t *db, const void *key, size_t klen, hut_get_fn fn,
+                            void *arg) {
+  uint64_t hash, addr;
+  hut_segment_record_t rec;
+  hut_db_request_t *req;
+  hut_db_segment_t *dbseg;
+  hut_value_t value;
+  hut_db_io_t *ctx;
+  unsigned n;
+  int rc;
+
+  if (db->cores)
+    return hut_db_core_get_async(db, key, klen, fn, arg);
+  if (!klen || klen > UINT32_MAX)
+    return HUT_ERR_INVALID;
+  if (!(ctx = hut_db_io(db)))
+    return hut_db_get_sync(db, key, klen, fn, arg);
+
+  /* The ring is the router's, the lookup the shard's. */
+  hash = hut_hash_bytes(key, klen, 0);
+  db = hut_db_route(db, hash);
+  n = hut_db_async_find(db, hash, &addr, &dbseg);
+  if (!n) {
+    fn(arg, HUT_ERR_NOTFOUND, NULL);
+    return HUT_OK;
+  }
+  /* Hash collisions are rare enough to be resolved the slow way. */
+  if (!dbseg)
+    return hut_db_get_sync(db, key, klen, fn, arg);
+
+  if (!hut_segment_lookup_cached(dbseg->seg, (uint32_t) addr, &rec)) {
+    if (rec.klen != klen || memcmp(rec.key, key, klen)) {
+      hut_segment_record_release(&rec);
+      hut_db_segment_unref(dbseg);
+      fn(arg, HUT_ERR_NOTFOUND, NULL);
+      return HUT_OK;
+    }
+    hut_db_value_init(&value, dbseg, &rec);
+    fn(arg, HUT_OK, &value);
+    return HUT_OK;
+  }
+
+  if (!(req = malloc(sizeof(*req) + klen))) {
+    hut_db_segment_unref(dbseg);
+    return HUT_ERR_NOMEM;
+  }
+  req->op.fn = hut_db_request_complete;
+  req->ctx = ctx;
+  req->dbseg = dbseg;
+  req->off = (uint32_t) addr;
+  req->buf = NULL;
+  req->buf_index = -1;
+  req->fn = fn;
+  req->arg = arg;
+  req->klen = (uint32_t) klen;
+  memcpy(req->key, key, klen);
+
+  if ((rc = hut_segment_extent(dbseg->seg, req->off, HUT_DB_ASYNC_HINT, &req->ext))
+      || (rc = hut_db_request_submit(req))) {
+    hut_db_segment_unref(dbseg);
+    free(req);
+    return rc;
+  }
+  return HUT_OK;
+}
+
+static void hut_db_timed_done(void *arg, int status, hut_value_t *value) {
+  hut_db_timed_t *t = arg;
+  hut_db_segment_t *dbseg = status ? NULL : value->pin[0];
+  hut_get_fn fn = t->fn;
+
+  hut_db_op_done(t->db, &t->timer, HUT_STATS_GET, t->hash,
+                 dbseg ? hut_segment_id(dbseg->seg) : 0, status,
+                 status ? 0 : t->klen + value->len);
+  arg = t->arg;
+  free(t);
+  fn(arg, status, value);
+}
+
+int hut_get_async(hut_db_t *db, const void *key, size_t klen, hut_get_fn fn, void *arg) {
+  hut_db_timer_t timer;
+  hut_db_timed_t *t;
+  uint64_t hash;
+  int rc;
+
+  hut_db_op_start(db, &timer, key, klen, &hash);
+  if (!timer.start)
+    return hut_db_get_async(db, key, klen, fn, arg);
+  if (!(t = malloc(sizeof(*t))))
+    return HUT_ERR_NOMEM;
+  t->db = db;
+  t->timer = timer;
+  t->hash = hash;
+  t->klen = klen;
+  t->fn = fn;
+  t->arg = arg;
+  if ((rc = hut_db_get_async(db, key, klen, hut_db_timed_done, t))) {
+    hut_db_op_done(db, &timer, HUT_STATS_GET, hash, 0, rc, 0);
+    free(t);
+  }
+  return rc;
+}
+
+int hut_poll(hut_db_t *db, unsigned min) {
+  hut_db_io_t *ctx;
+
+  if (db->cores)
+    return hut_db_core_poll(db, min);
+  if (!db->io_ready || !(ctx = tss_get(db->io_key)))
+    return 0;
+  return hut_io_poll(ctx->io, min);
+}
@@ -0,0 +1,110 @@
+#include "hut/db/hut_db.h"
+
+#include <stdlib.h>
+
+/*
+ * Background jobs, run on the scheduler of the database.
+ *
+ * Compaction is queued whenever the active segment rolls, as that is when
+ * a sealed segment may have crossed the garbage threshold, and at high
+ * priority when a zoned device runs full, as writes fail until it runs.
+ * At most one is queued per shard and priority, clearing its mark when it
+ * starts, so that rolls during compaction queue the next one.
+ *
+ * Warm-up reads every sealed segment present at open once, at low
+ * priority. Reading them through checks the checksum of every record;
+ * segments that fail are counted and otherwise left to reads to report.
+ */
+
+typedef struct hut_db_warm_s {
+  hut_db_t *db;
+  hut_db_segment_t *dbseg;
+} hut_db_warm_t;
+
+static void hut_db_compact_job(void *arg, int cancelled) {
+  hut_db_t *db = arg;
+
+  __atomic_store_n(&db->compact_queued, 0, __ATOMIC_RELEASE);
+  if (!cancelled)
+    hut_compact(db, db->opts.compact_garbage);
+}
+
+void hut_db_compact_later(hut_db_t *db, hut_sched_priority_t priority) {
+  int queued = __atomic_load_n(&db->compact_queued, __ATOMIC_ACQUIRE);
+
+  if (!db->sched || db->opts.compact_garbage <= 0)
+    return;
+  do {
+    if (queued && queued - 1 <= (int) priority)
+      return;
+  } while (!__atomic_compare_exchange_n(&db->compact_queued, &queued, (int) priority + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  if (hut_sched_submit(db->sched, priority, hut_db_compact_job, db))
+    __atomic_store_n(&db->compact_queued, 0, __ATOMIC_RELEASE);
+}
+
+static int hut_db_warm_record(void *arg, uint64_t off, const hut_segment_record_t *rec) {
+  (void) arg;
+  (void) off;
+  return hut_segment_record_valid(rec) ? HUT_OK : HUT_ERR_CORRUPT;
+}
+
+static void hut_db_warm_job(void *arg, int cancelled) {
+  hut_db_warm_t *warm = arg;
+
+  if (!cancelled && hut_segment_iterate(warm->dbseg->seg, hut_db_warm_record, NULL))
+    __atomic_add_fetch(&warm->db->corrupt_segments, 1, __ATOMIC_RELAXED);
+  hut_db_segment_unref(warm->dbseg);
+  free(warm);
+}
+
+static int hut_db_warm_up(hut_db_t *db) {
+  hut_db_warm_t *warm;
+  hut_db_segment_t *s;
+  uint32_t id;
+  int rc;
+
+  for (id = 0; id < db->segment_cap; id++) {
+    if (!(s = db->segments[id]) || !hut_segment_sealed(s->seg))
+      continue;
+    if (!(warm = malloc(sizeof(*warm))))
+      return HUT_ERR_NOMEM;
+    warm->db = db;
+    warm->dbseg = s;
+    hut_db_segment_ref(s);
+    if ((rc = hut_sched_submit(db->sched, HUT_SCHED_LOW, hut_db_warm_job, warm))) {
+      hut_db_segment_unref(s);
+      free(warm);
+      return rc;
+    }
+  }
+  return HUT_OK;
+}
+
+/*
+ * Sets the database up to run its jobs on `sched`, creating a scheduler of
+ * its own when NULL and some job is enabled. Shards are handed the one of
+ * the router.
+ */
+int hut_db_background_start(hut_db_t *db, hut_sched_t *sched) {
+  int rc;
+
+  if (!sched && db->opts.background_threads
+      && (db->opts.compact_garbage > 0 || db->opts.warm_up)) {
+    if ((rc = hut_sched_create(db->opts.background_threads, &sched)))
+      return rc;
+    db->sched_owned = 1;
+  }
+  db->sched = sched;
+  if (db->sched && db->opts.warm_up)
+    return hut_db_warm_up(db);
+  return HUT_OK;
+}
+
+/* Jobs of the shards are stopped along, with the scheduler of the router. */
+void hut_db_background_stop(hut_db_t *db) {
+  if (db->sched_owned)
+    hut_sched_destroy(db->sched);
+  db->sched = NULL;
+  db->sched_owned = 0;
+}
@@ -0,0 +1,281 @@
+#include "hut/db/hut_db.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hut/util/hut_hash.h"
+
+/*
+ * Compaction. Live records of the victim segments are appended, with
+ * their sequence numbers, to segments built in memory, which are sealed
+ * straight to disk once full, then listed. Index entries are repointed
+ * only then, and victims are deleted only once every output is durable,
+ * so a crash at any point leaves either the victims or both behind,
+ * which recovery copes with through sequence numbers.
+ *
+ * Only listing an output and repointing the index at it take the lock of
+ * the shard; records are copied and outputs sealed without it, for
+ * writers to carry on meanwhile. A record they overwrite or delete after
+ * it was copied keeps its index entry elsewhere, and its copy is garbage
+ * from the start. Victims and the segments tombstones are checked against
+ * are those sealed when compaction started, pinned until it ends, and
+ * compactions of a shard run one at a time under `compact_lock`. An
+ * output that fails to be sealed or listed is discarded, the index never
+ * having pointed into it, and the victims all stay.
+ *
+ * Tombstones are carried over as long as some other sealed segment may
+ * still hold an older record of the key, other victims included: those
+ * are unlinked one at a time, and some may stay behind, so the tombstone
+ * must outlive every one of them. Segments sealed since compaction
+ * started need no check: everything in them is newer than any tombstone
+ * of a victim. Segments a load stages are not listed until installed, so
+ * when one was running every tombstone is kept, while those it starts
+ * later are newer as well.
+ *
+ * On a zoned device outputs may take the zones held back from regular
+ * seals, which is what lets compaction run once the device is full.
+ */
+
+/* A record copied to the output, for the index to be repointed at. */
+typedef struct hut_db_compact_move_s {
+  hut_db_segment_t *victim;
+  uint64_t hash;
+  uint64_t from;                /* address in the victim */
+  uint64_t off;                 /* in the output */
+  uint64_t size;
+} hut_db_compact_move_t;
+
+typedef struct hut_db_compact_s {
+  hut_db_t *db;
+  hut_db_segment_t **segs;      /* sealed when it started, pinned */
+  unsigned char *victims;       /* by index into segs */
+  uint32_t count;
+  uint32_t current;             /* the victim being copied */
+  int keep_tombstones;          /* a load was running */
+  hut_segment_t *out;           /* being filled, not listed yet */
+  hut_db_compact_move_t *moves; /* into `out` */
+  size_t move_count;
+  size_t move_cap;
+} hut_db_compact_t;
+
+/* As scans do, falling back to the lock when racing writers too long. */
+static int hut_db_compact_live(hut_db_t *db, uint64_t hash, uint64_t addr) {
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES];
+  unsigned i, n;
+
+  if (hut_index_find_concurrent(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES, &n)) {
+    mtx_lock(&db->lock);
+    n = hut_index_find(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES);
+    mtx_unlock(&db->lock);
+  }
+  for (i = 0; i < n && i < HUT_DB_MAX_CANDIDATES; i++)
+    if (addrs[i] == addr)
+      return 1;
+  return 0;
+}
+
+static int hut_db_compact_shadows(const hut_db_compact_t *c, uint64_t hash) {
+  uint32_t i;
+
+  if (c->keep_tombstones)
+    return 1;
+  /* Outputs only ever take live records and tombstones, never one they shadow. */
+  for (i = 0; i < c->count; i++)
+    if (i != c->current && hut_segment_may_contain(c->segs[i]->seg, hash))
+      return 1;
+  return 0;
+}
+
+/*
+ * Seals the output and lists it, then repoints the index at the records
+ * it took that are still live. Discarded when either fails, or when a
+ * scan started meanwhile, which would miss the records moved under it.
+ */
+static int hut_db_compact_install(hut_db_compact_t *c) {
+  hut_db_t *db = c->db;
+  hut_db_compact_move_t *m;
+  hut_db_segment_t *out;
+  hut_segment_t *sealed;
+  uint32_t id = hut_segment_id(c->out);
+  size_t i;
+  int rc;
+
+  rc = hut_db_segment_seal_file(db, c->out, 0, &sealed);
+  hut_segment_close(c->out);
+  c->out = NULL;
+  if (rc)
+    goto out;
+
+  mtx_lock(&db->lock);
+  if (db->scans)
+    rc = HUT_ERR_BUSY;
+  else if (!(rc = hut_db_segment_add(db, sealed, &out)))
+    for (i = 0; i < c->move_count; i++) {
+      m = &c->moves[i];
+      if (hut_index_update(db->index, m->hash, m->from, hut_segment_address(id, m->off)))
+        continue;
+      m->victim->live -= m->size;
+      out->live += m->size;
+    }
+  mtx_unlock(&db->lock);
+  if (rc) {
+    hut_segment_remove(sealed);
+    hut_segment_close(sealed);
+  }
+
+out:
+  c->move_count = 0;
+  return rc;
+}
+
+static int hut_db_compact_output(hut_db_compact_t *c) {
+  hut_db_t *db = c->db;
+  uint32_t id;
+  int rc;
+
+  if (c->out && (rc = hut_db_compact_install(c)))
+    return rc;
+  mtx_lock(&db->lock);
+  id = db->next_id++;
+  mtx_unlock(&db->lock);
+  return hut_segment_create_memory(db->path, id, db->opts.segment_size,
+                                   db->opts.huge_pages, &c->out);
+}
+
+static int hut_db_compact_move(hut_db_compact_t *c, uint64_t hash, uint64_t from,
+                               uint64_t off, uint64_t size) {
+  hut_db_compact_move_t *grown, *m;
+  size_t cap;
+
+  if (c->move_count == c->move_cap) {
+    cap = c->move_cap ? c->move_cap * 2 : 256;
+    if (!(grown = realloc(c->moves, cap * sizeof(*grown))))
+      return HUT_ERR_NOMEM;
+    c->moves = grown;
+    c->move_cap = cap;
+  }
+  m = &c->moves[c->move_count++];
+  m->victim = c->segs[c->current];
+  m->hash = hash;
+  m->from = from;
+  m->off = off;
+  m->size = size;
+  return HUT_OK;
+}
+
+static int hut_db_compact_record(void *arg, uint64_t off, const hut_segment_record_t *rec) {
+  hut_db_compact_t *c = arg;
+  hut_db_t *db = c->db;
+  uint64_t hash = hut_hash_bytes(rec->key, rec->klen, 0), new_off;
+  uint64_t addr = hut_segment_address(hut_segment_id(c->segs[c->current]->seg), off);
+  uint64_t size = hut_segment_record_size(rec->klen, rec->vlen);
+  int tombstone = rec->flags & HUT_SEGMENT_RECORD_TOMBSTONE, rc;
+
+  if (tombstone ? !hut_db_compact_shadows(c, hash) : !hut_db_compact_live(db, hash, addr))
+    return HUT_OK;
+
+  if (!c->out && (rc = hut_db_compact_output(c)))
+    return rc;
+  rc = hut_segment_append(c->out, rec->key, rec->klen, rec->value, rec->vlen,
+                          rec->flags, rec->seq, &new_off);
+  if (rc == HUT_ERR_FULL && !(rc = hut_db_compact_output(c)))
+    rc = hut_segment_append(c->out, rec->key, rec->klen, rec->value, rec->vlen,
+                            rec->flags, rec->seq, &new_off);
+  if (rc)
+    return rc;
+  hut_db_stats_add(db, HUT_DB_GC_RELOCATED, size);
+  return tombstone ? HUT_OK : hut_db_compact_move(c, hash, addr, new_off, size);
+}
+
+int hut_compact(hut_db_t *db, double garbage) {
+  hut_db_compact_t c;
+  hut_db_segment_t *s;
+  hut_db_timer_t timer;
+  uint32_t id, i, victims = 0;
+  uint64_t size;
+  int rc = HUT_OK;
+
+  if (garbage < 0 || garbage > 1)
+    return HUT_ERR_INVALID;
+  for (id = 0; id < db->shard_count && !rc; id++)
+    rc = hut_compact(db->shards[id], garbage);
+  if (db->shard_count)
+    return rc;
+
+  mtx_lock(&db->compact_lock);
+  mtx_lock(&db->lock);
+  hut_db_timer_start(db, &timer, 0);
+
+  memset(&c, 0, sizeof(c));
+  c.db = db;
+  /* Scans would miss the records moved under them. */
+  if (db->scans) {
+    rc = HUT_ERR_BUSY;
+    goto out;
+  }
+  if (!(c.segs = malloc(db->segment_cap * sizeof(*c.segs)))
+      || !(c.victims = calloc(db->segment_cap, 1))) {
+    rc = HUT_ERR_NOMEM;
+    goto out;
+  }
+  for (id = 0; id < db->segment_cap; id++) {
+    if (!(s = db->segments[id]) || s == db->active || !hut_segment_sealed(s->seg))
+      continue;
+    size = hut_segment_size(s->seg);
+    if (size && (double) (size - s->live) >= garbage * (double) size) {
+      c.victims[c.count] = 1;
+      victims++;
+    }
+    hut_db_segment_ref(s);
+    c.segs[c.count++] = s;
+  }
+  if (!victims)
+    goto out;
+  c.keep_tombstones = db->load_log != NULL;
+  /* Odd for as long as records move, for the trace to flag what ran meanwhile. */
+  __sync_add_and_fetch(&db->compactions, 1);
+  mtx_unlock(&db->lock);
+
+  for (i = 0; i < c.count && !rc; i++) {
+    if (!c.victims[i])
+      continue;
+    c.current = i;
+    rc = hut_segment_iterate(c.segs[i]->seg, hut_db_compact_record, &c);
+  }
+  if (c.out) {
+    if (!rc)
+      rc = hut_db_compact_install(&c);
+    else
+      hut_segment_close(c.out);
+  }
+
+  /*
+   * On failure the victims stay, and with them every record. Outputs
+   * listed so far are kept as well, the index points into them. So are
+   * victims with records left live, which only hash collisions cause.
+   */
+  mtx_lock(&db->lock);
+  for (i = 0; i < c.count && !rc; i++) {
+    s = c.segs[i];
+    id = hut_segment_id(s->seg);
+    if (!c.victims[i] || s->live || db->segments[id] != s)
+      continue;
+    if ((rc = hut_segment_remove(s->seg)))
+      break;
+    __atomic_store_n(&db->segments[id], NULL, __ATOMIC_RELEASE);
+    hut_db_segment_unref(s);
+  }
+
+out:
+  if (victims)
+    __sync_add_and_fetch(&db->compactions, 1);
+  hut_db_timer_stop(db, &timer, HUT_STATS_COMPACT, 0, victims, rc);
+  mtx_unlock(&db->lock);
+  for (i = 0; i < c.count; i++)
+    hut_db_segment_unref(c.segs[i]);
+  free(c.segs);
+  free(c.victims);
+  free(c.moves);
+  mtx_unlock(&db->compact_lock);
+  return rc;
+}
@@ -0,0 +1,366 @@
+#include "hut/db/hut_db.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hut/util/hut_futex.h"
+#include "hut/util/hut_hash.h"
+#include "hut/util/hut_numa.h"
+#include "hut/util/hut_ring.h"
+
+/*
+ * Thread-per-core runtime.
+ *
+ * Every shard is owned by a thread pinned to a core, the only one to ever
+ * touch its index and segments, which therefore stay in that core's
+ * caches. Other threads send it messages through its request ring, a
+ * lock-free MPSC ring, and the owner runs an event loop over the ring and
+ * its own io_uring, so that gets that need the disk do not hold up the
+ * requests behind them.
+ *
+ * Synchronous callers keep the message on their stack and spin on it for
+ * a while before sleeping on a futex. Async gets are answered through a
+ * completion ring per calling thread, drained by hut_poll(); callers never
+ * have more gets outstanding than that ring holds, so that owners never
+ * block on a full one.
+ *
+ * Owners spin for a while once out of work before going to sleep on their
+ * ring, and do not sleep at all while reads are in flight.
+ *
+ * Background jobs are the one exception to ownership: they work on shards
+ * from the scheduler's threads, under the shard's lock, which owners take
+ * as well.
+ */
+
+#define HUT_DB_CORE_SPIN 256
+
+#define HUT_DB_MSG_PUT 0
+#define HUT_DB_MSG_DEL 1
+#define HUT_DB_MSG_GET 2
+
+/* Futex word of a synchronous message. */
+#define HUT_DB_MSG_PENDING  0
+#define HUT_DB_MSG_DONE     1
+#define HUT_DB_MSG_SLEEPING 2
+#define HUT_DB_MSG_RELEASED 3         /* done, and woken if it slept */
+
+struct hut_db_core_s {
+  hut_db_t *db;                 /* the shard owned */
+  hut_ring_t *ring;
+  thrd_t thread;
+  unsigned cpu;
+  unsigned pending;             /* gets waiting on the shard's io_uring */
+  int started;
+};
+
+struct hut_db_client_s {
+  hut_ring_t *ring;
+  unsigned inflight;
+  unsigned capacity;
+  hut_db_client_t *next;
+};
+
+typedef struct hut_db_msg_s {
+  int op;
+  int state;
+  int status;
+  hut_db_core_t *core;
+  hut_db_client_t *client;      /* where to answer, NULL when synchronous */
+  const void *key;
+  size_t klen;
+  const void *value;
+  size_t vlen;
+  hut_value_t result;
+  hut_get_fn fn;
+  void *arg;
+  char key_copy[];
+} hut_db_msg_t;
+
+static inline void hut_db_core_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause");
+#endif
+}
+
+unsigned hut_db_core_cpu(unsigned shard) {
+  return shard % hut_numa_cpu_count();
+}
+
+/*
+ * Owner side.
+ */
+
+/*
+ * The message lives on the caller's stack, gone once the caller returns.
+ * A caller that never slept returns on DONE, and then nothing touches it
+ * again. One that slept may wake spuriously and see DONE before the wake,
+ * so it holds on until RELEASED, the last store made to the message.
+ */
+static void hut_db_msg_complete(hut_db_msg_t *msg) {
+  if (msg->client) {
+    /* Cannot fail: clients keep no more in flight than their ring holds. */
+    hut_ring_push(msg->client->ring, msg);
+    return;
+  }
+  if (__atomic_exchange_n(&msg->state, HUT_DB_MSG_DONE, __ATOMIC_RELEASE)
+      != HUT_DB_MSG_SLEEPING)
+    return;
+  hut_futex_wake(&msg->state, 1);
+  __atomic_store_n(&msg->state, HUT_DB_MSG_RELEASED, __ATOMIC_RELEASE);
+}
+
+static void hut_db_core_got(void *arg, int status, hut_value_t *value) {
+  hut_db_msg_t *msg = arg;
+
+  msg->core->pending--;
+  msg->status = status;
+  if (value)
+    msg->result = *value;
+  hut_db_msg_complete(msg);
+}
+
+static void hut_db_core_exec(hut_db_core_t *core, hut_db_msg_t *msg) {
+  int rc;
+
+  switch (msg->op) {
+  case HUT_DB_MSG_PUT:
+    msg->status = hut_put(core->db, msg->key, msg->klen, msg->value, msg->vlen);
+    break;
+  case HUT_DB_MSG_DEL:
+    msg->status = hut_del(core->db, msg->key, msg->klen);
+    break;
+  default:
+    core->pending++;
+    if ((rc = hut_get_async(core->db, msg->key, msg->klen, hut_db_core_got, msg))) {
+      core->pending--;
+      msg->status = rc;
+      break;
+    }
+    return;
+  }
+  hut_db_msg_complete(msg);
+}
+
+static int hut_db_core_run(void *arg) {
+  hut_db_core_t *core = arg;
+  hut_db_msg_t *msg;
+  unsigned idle = 0;
+  int work;
+
+  hut_numa_pin(core->cpu);
+  while (!hut_ring_stopped(core->ring)) {
+    work = 0;
+    while ((msg = hut_ring_pop(core->ring))) {
+      hut_db_core_exec(core, msg);
+      work = 1;
+    }
+    if (core->pending && hut_poll(core->db, 0) > 0)
+      work = 1;
+    if (work) {
+      idle = 0;
+    } else if (core->pending || ++idle < HUT_DB_CORE_SPIN) {
+      hut_db_core_relax();
+    } else {
+      hut_ring_wait(core->ring);
+      idle = 0;
+    }
+  }
+  while (core->pending && hut_poll(core->db, 1) >= 0)
+    ;
+  return 0;
+}
+
+int hut_db_core_start(hut_db_t *db) {
+  hut_db_core_t *core;
+  unsigned i;
+  int rc;
+
+  if (tss_create(&db->client_key, NULL) != thrd_success)
+    return HUT_ERR_NOMEM;
+  mtx_init(&db->client_lock, mtx_plain);
+  db->client_ready = 1;
+
+  if (!(db->cores = calloc(db->shard_count, sizeof(*db->cores))))
+    return HUT_ERR_NOMEM;
+  for (i = 0; i < db->shard_count; i++) {
+    core = &db->cores[i];
+    core->db = db->shards[i];
+    core->cpu = hut_db_core_cpu(i);
+    if ((rc = hut_ring_create(db->opts.ring_size, &core->ring)))
+      return rc;
+    if (thrd_create(&core->thread, hut_db_core_run, core) != thrd_success)
+      return HUT_ERR_NOMEM;
+    core->started = 1;
+  }
+  return HUT_OK;
+}
+
+/* Callers must be done with the database, async gets included. */
+void hut_db_core_stop(hut_db_t *db) {
+  hut_db_client_t *client;
+  hut_db_core_t *core;
+  unsigned i;
+
+  for (i = 0; db->cores && i < db->shard_count; i++) {
+    core = &db->cores[i];
+    if (core->started) {
+      hut_ring_stop(core->ring);
+      thrd_join(core->thread, NULL);
+    }
+    hut_ring_destroy(core->ring);
+  }
+  free(db->cores);
+  db->cores = NULL;
+
+  if (!db->client_ready)
+    return;
+  while ((client = db->clients)) {
+    db->clients = client->next;
+    hut_ring_destroy(client->ring);
+    free(client);
+  }
+  tss_delete(db->client_key);
+  mtx_destroy(&db->client_lock);
+  db->client_ready = 0;
+}
+
+/*
+ * Caller side.
+ */
+
+static hut_db_core_t *hut_db_core_route(hut_db_t *db, const void *key, size_t klen) {
+  uint64_t hash = hut_hash_bytes(key, klen, 0);
+
+  return &db->cores[(hash >> 32) % db->shard_count];
+}
+
+static void hut_db_core_send(hut_db_core_t *core, hut_db_msg_t *msg) {
+  while (hut_ring_push(core->ring, msg) == HUT_ERR_FULL)
+    sched_yield();
+}
+
+static int hut_db_core_call(hut_db_t *db, hut_db_msg_t *msg) {
+  unsigned spin;
+  int state;
+
+  msg->core = hut_db_core_route(db, msg->key, msg->klen);
+  msg->client = NULL;
+  msg->state = HUT_DB_MSG_PENDING;
+  hut_db_core_send(msg->core, msg);
+
+  for (spin = 0; spin < HUT_DB_CORE_SPIN; spin++) {
+    if (__atomic_load_n(&msg->state, __ATOMIC_ACQUIRE) == HUT_DB_MSG_DONE)
+      return msg->status;
+    hut_db_core_relax();
+  }
+  state = HUT_DB_MSG_PENDING;
+  if (!__atomic_compare_exchange_n(&msg->state, &state, HUT_DB_MSG_SLEEPING, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    return msg->status;
+  /* Until the owner is done waking us, see hut_db_msg_complete(). */
+  while ((state = __atomic_load_n(&msg->state, __ATOMIC_ACQUIRE)) != HUT_DB_MSG_RELEASED) {
+    if (state == HUT_DB_MSG_SLEEPING)
+      hut_futex_wait(&msg->state, HUT_DB_MSG_SLEEPING);
+    else
+      sched_yield();
+  }
+  return msg->status;
+}
+
+int hut_db_core_write(hut_db_t *db, const void *key, size_t klen,
+                      const void *value, size_t vlen, int del) {
+  hut_db_msg_t msg;
+
+  if (!klen)
+    return HUT_ERR_INVALID;
+  memset(&msg, 0, sizeof(msg));
+  msg.op = del ? HUT_DB_MSG_DEL : HUT_DB_MSG_PUT;
+  msg.key = key;
+  msg.klen = klen;
+  msg.value = value;
+  msg.vlen = vlen;
+  return hut_db_core_call(db, &msg);
+}
+
+int hut_db_core_get(hut_db_t *db, const void *key, size_t klen, hut_value_t *value) {
+  hut_db_msg_t msg;
+  int rc;
+
+  if (!klen)
+    return HUT_ERR_INVALID;
+  memset(&msg, 0, sizeof(msg));
+  msg.op = HUT_DB_MSG_GET;
+  msg.key = key;
+  msg.klen = klen;
+  if (!(rc = hut_db_core_call(db, &msg)))
+    *value = msg.result;
+  return rc;
+}
+
+/* Returns this thread's completion ring, NULL when out of memory. */
+static hut_db_client_t *hut_db_client(hut_db_t *db) {
+  hut_db_client_t *client;
+
+  if ((client = tss_get(db->client_key)))
+    return client;
+  if (!(client = calloc(1, sizeof(*client))))
+    return NULL;
+  if (hut_ring_create(db->opts.ring_size, &client->ring)) {
+    free(client);
+    return NULL;
+  }
+  client->capacity = (unsigned) client->ring->mask + 1;
+  tss_set(db->client_key, client);
+  mtx_lock(&db->client_lock);
+  client->next = db->clients;
+  db->clients = client;
+  mtx_unlock(&db->client_lock);
+  return client;
+}
+
+int hut_db_core_get_async(hut_db_t *db, const void *key, size_t klen, hut_get_fn fn, void *arg) {
+  hut_db_client_t *client;
+  hut_db_msg_t *msg;
+  int rc;
+
+  if (!klen)
+    return HUT_ERR_INVALID;
+  if (!(client = hut_db_client(db)))
+    return HUT_ERR_NOMEM;
+  if (client->inflight == client->capacity && (rc = hut_db_core_poll(db, 1)) < 0)
+    return rc;
+  if (!(msg = calloc(1, sizeof(*msg) + klen)))
+    return HUT_ERR_NOMEM;
+  memcpy(msg->key_copy, key, klen);
+  msg->op = HUT_DB_MSG_GET;
+  msg->key = msg->key_copy;
+  msg->klen = klen;
+  msg->fn = fn;
+  msg->arg = arg;
+  msg->client = client;
+  msg->core = hut_db_core_route(db, key, klen);
+  client->inflight++;
+  hut_db_core_send(msg->core, msg);
+  return HUT_OK;
+}
+
+int hut_db_core_poll(hut_db_t *db, unsigned min) {
+  hut_db_client_t *client;
+  hut_db_msg_t *msg;
+  int done = 0;
+
+  if (!db->client_ready || !(client = tss_get(db->client_key)))
+    return 0;
+  for (;;) {
+    while ((msg = hut_ring_pop(client->ring))) {
+      client->inflight--;
+      msg->fn(msg->arg, msg->status, msg->status ? NULL : &msg->result);
+      free(msg);
+      done++;
+    }
+    if ((unsigned) done >= min || !client->inflight)
+      return done;
+    hut_ring_wait(client->ring);
+  }
+}
@@ -0,0 +1,388 @@
+#include "hut/db/hut_db.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hut/util/hut_hash.h"
+#include "hut/util/hut_numa.h"
+
+/*
+ * Exports. The segments of every shard, how far the active ones are
+ * written and the last sequence number given out are noted with all the
+ * shard locks held at once, which makes for a snapshot across shards.
+ * Segments noted are pinned, and compaction holds off as for scans.
+ *
+ * Threads then take the segments one at a time and read them through
+ * without the lock. A record the index still points to is the newest of
+ * its key and in the snapshot, hence the one exported; one whose key the
+ * index points elsewhere within the snapshot was overwritten before it.
+ * That leaves the records of keys written since, or deleted. Writers log
+ * the records of the snapshot they overwrite or delete while it runs,
+ * which were the newest of their keys, and those of the records set
+ * aside that are in the log are exported once every segment was read.
+ */
+
+/* What a record is to the snapshot. */
+#define HUT_DB_EXPORT_OLD    0      /* overwritten before it */
+#define HUT_DB_EXPORT_LIVE   1
+#define HUT_DB_EXPORT_LATER  2      /* of a key written since, or gone */
+
+typedef struct hut_db_export_shard_s {
+  hut_db_t *db;
+  hut_db_export_log_t log;      /* log.seq the last written before the snapshot */
+  int logging;                  /* log listed in the shard's */
+  uint32_t first;               /* of its segments noted, by id */
+  uint32_t count;
+} hut_db_export_shard_t;
+
+typedef struct hut_db_export_seg_s {
+  hut_db_export_shard_t *shard;
+  hut_db_segment_t *dbseg;
+  uint64_t end;                 /* of the records in the snapshot */
+} hut_db_export_seg_t;
+
+/* A record set aside. */
+typedef struct hut_db_export_later_s {
+  uint64_t addr;
+  uint32_t seg;                 /* index in the segments noted */
+} hut_db_export_later_t;
+
+typedef struct hut_db_export_thread_s hut_db_export_thread_t;
+
+typedef struct hut_db_export_s {
+  const hut_export_t *opts;
+  hut_db_export_shard_t *shards;
+  unsigned shard_count;
+  hut_db_export_seg_t *segs;
+  uint32_t seg_count;
+  uint32_t next;                /* segment handed out next */
+  hut_db_export_thread_t *threads;
+  unsigned thread_count;
+  unsigned running;
+  int status;                   /* of the first thread that failed */
+} hut_db_export_t;
+
+struct hut_db_export_thread_s {
+  hut_db_export_t *exp;
+  unsigned index;
+  thrd_t thread;
+  uint32_t seg;                 /* being read */
+  hut_db_export_later_t *later;
+  size_t later_count;
+  size_t later_cap;
+};
+
+void hut_db_export_note(hut_db_t *db, uint64_t addr, uint64_t seq) {
+  hut_db_export_log_t *log;
+  uint64_t *grown;
+  size_t cap;
+
+  for (log = db->exports; log; log = log->next) {
+    if (seq > log->seq || log->failed)
+      continue;
+    if (log->count == log->cap) {
+      cap = log->cap ? log->cap * 2 : 1024;
+      if (!(grown = realloc(log->addrs, cap * sizeof(*grown)))) {
+        log->failed = 1;
+        continue;
+      }
+      log->addrs = grown;
+      log->cap = cap;
+    }
+    log->addrs[log->count++] = addr;
+  }
+}
+
+/* With the shard lock held. */
+static void hut_db_export_unlog(hut_db_export_shard_t *shard) {
+  hut_db_export_log_t **p;
+
+  if (!shard->logging)
+    return;
+  for (p = &shard->db->exports; *p != &shard->log; p = &(*p)->next)
+    ;
+  *p = shard->log.next;
+  shard->logging = 0;
+}
+
+static int hut_db_export_compare(const void *a, size_t alen, const void *b, size_t blen) {
+  int c = memcmp(a, b, alen < blen ? alen : blen);
+
+  return c ? c : (alen > blen) - (alen < blen);
+}
+
+static int hut_db_export_wanted(const hut_export_t *opts, const void *key, size_t klen) {
+  return (!opts->start || hut_db_export_compare(key, klen, opts->start, opts->start_len) >= 0)
+         && (!opts->end || hut_db_export_compare(key, klen, opts->end, opts->end_len) < 0);
+}
+
+/* Whether a segment was noted, unlike those a load installed since. */
+static int hut_db_export_noted(const hut_db_export_t *exp, const hut_db_export_shard_t *shard,
+                               uint32_t id) {
+  uint32_t lo = shard->first, hi = shard->first + shard->count, mid, cur;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    cur = hut_segment_id(exp->segs[mid].dbseg->seg);
+    if (cur == id)
+      return 1;
+    if (cur < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return 0;
+}
+
+static int hut_db_export_classify(const hut_db_export_t *exp, const hut_db_export_shard_t *shard,
+                                  const hut_segment_record_t *rec, uint64_t hash, uint64_t addr) {
+  hut_db_t *db = shard->db;
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES], cur_addr;
+  hut_segment_record_t cur;
+  hut_db_segment_t *dbseg;
+  unsigned i, n;
+  int rc, old;
+
+  if (hut_index_find_concurrent(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES, &n)) {
+    mtx_lock(&db->lock);
+    n = hut_index_find(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES);
+    mtx_unlock(&db->lock);
+  }
+  for (i = 0; i < n && i < HUT_DB_MAX_CANDIDATES; i++)
+    if (addrs[i] == addr)
+      return HUT_DB_EXPORT_LIVE;
+
+  if ((rc = hut_db_find_concurrent(db, rec->key, rec->klen, hash, &cur, &dbseg))
+      == HUT_ERR_BUSY) {
+    mtx_lock(&db->lock);
+    if (!(rc = hut_db_find(db, rec->key, rec->klen, hash, &cur_addr, &cur, &dbseg)))
+      hut_db_segment_ref(dbseg);
+    mtx_unlock(&db->lock);
+  }
+  if (rc == HUT_ERR_NOTFOUND)
+    return HUT_DB_EXPORT_LATER;
+  if (rc)
+    return rc;
+  old = cur.seq <= shard->log.seq
+        && hut_db_export_noted(exp, shard, hut_segment_id(dbseg->seg));
+  hut_segment_record_release(&cur);
+  hut_db_segment_unref(dbseg);
+  return old ? HUT_DB_EXPORT_OLD : HUT_DB_EXPORT_LATER;
+}
+
+static int hut_db_export_set_aside(hut_db_export_thread_t *t, uint64_t addr) {
+  hut_db_export_later_t *later;
+  size_t cap;
+
+  if (t->later_count == t->later_cap) {
+    cap = t->later_cap ? t->later_cap * 2 : 1024;
+    if (!(later = realloc(t->later, cap * sizeof(*later))))
+      return HUT_ERR_NOMEM;
+    t->later = later;
+    t->later_cap = cap;
+  }
+  t->later[t->later_count].addr = addr;
+  t->later[t->later_count].seg = t->seg;
+  t->later_count++;
+  return HUT_OK;
+}
+
+static int hut_db_export_record(void *arg, uint64_t off, const hut_segment_record_t *rec) {
+  hut_db_export_thread_t *t = arg;
+  hut_db_export_seg_t *seg = &t->exp->segs[t->seg];
+  const hut_export_t *opts = t->exp->opts;
+  uint64_t addr;
+  int rc;
+
+  /* Tombstones are never indexed, hence never overwritten either. */
+  if (rec->seq > seg->shard->log.seq || (rec->flags & HUT_SEGMENT_RECORD_TOMBSTONE)
+      || !hut_db_export_wanted(opts, rec->key, rec->klen))
+    return HUT_OK;
+
+  addr = hut_segment_address(hut_segment_id(seg->dbseg->seg), off);
+  rc = hut_db_export_classify(t->exp, seg->shard, rec, hut_hash_bytes(rec->key, rec->klen, 0),
+                              addr);
+  if (rc == HUT_DB_EXPORT_LIVE)
+    return opts->fn(opts->arg, t->index, rec->key, rec->klen, rec->value, rec->vlen,
+                    !hut_segment_compressed(seg->dbseg->seg));
+  if (rc == HUT_DB_EXPORT_LATER)
+    return hut_db_export_set_aside(t, addr);
+  return rc;
+}
+
+static int hut_db_export_compare_addrs(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * Exports the records set aside that writers logged. A record was set
+ * aside once the index no longer pointed to it, so that the log already
+ * holds it if it ever will.
+ */
+static int hut_db_export_resolve(hut_db_export_thread_t *t) {
+  hut_db_export_t *exp = t->exp;
+  const hut_export_t *opts = exp->opts;
+  hut_db_export_shard_t *shard;
+  hut_db_export_later_t *later;
+  hut_segment_record_t rec;
+  unsigned i, k;
+  size_t j;
+  int rc = HUT_OK;
+
+  for (i = 0; i < exp->shard_count; i++) {
+    shard = &exp->shards[i];
+    mtx_lock(&shard->db->lock);
+    hut_db_export_unlog(shard);
+    mtx_unlock(&shard->db->lock);
+    if (shard->log.failed)
+      return HUT_ERR_NOMEM;
+    if (shard->log.count)
+      qsort(shard->log.addrs, shard->log.count, sizeof(*shard->log.addrs),
+            hut_db_export_compare_addrs);
+  }
+
+  for (k = 0; k < exp->thread_count && !rc; k++) {
+    for (j = 0; j < exp->threads[k].later_count && !rc; j++) {
+      later = &exp->threads[k].later[j];
+      shard = exp->segs[later->seg].shard;
+      if (!shard->log.count || !bsearch(&later->addr, shard->log.addrs, shard->log.count,
+                                        sizeof(later->addr), hut_db_export_compare_addrs))
+        continue;
+      if ((rc = hut_segment_read(exp->segs[later->seg].dbseg->seg, later->addr & UINT32_MAX,
+                                 &rec)))
+        break;
+      rc = opts->fn(opts->arg, t->index, rec.key, rec.klen, rec.value, rec.vlen,
+                    !rec.block && !rec.entry);
+      hut_segment_record_release(&rec);
+    }
+  }
+  return rc;
+}
+
+static int hut_db_export_run(void *arg) {
+  hut_db_export_thread_t *t = arg;
+  hut_db_export_t *exp = t->exp;
+  const hut_export_t *opts = exp->opts;
+  int rc = HUT_OK;
+
+  while (!rc && !__atomic_load_n(&exp->status, __ATOMIC_ACQUIRE)
+         && (t->seg = __atomic_fetch_add(&exp->next, 1, __ATOMIC_RELAXED)) < exp->seg_count)
+    rc = hut_segment_iterate_to(exp->segs[t->seg].dbseg->seg, exp->segs[t->seg].end,
+                                hut_db_export_record, t);
+  if (rc)
+    __sync_bool_compare_and_swap(&exp->status, 0, rc);
+  /* The last one done has every record set aside. */
+  if (__atomic_sub_fetch(&exp->running, 1, __ATOMIC_ACQ_REL) == 0
+      && !__atomic_load_n(&exp->status, __ATOMIC_ACQUIRE)
+      && (rc = hut_db_export_resolve(t)))
+    __sync_bool_compare_and_swap(&exp->status, 0, rc);
+  if (!rc && opts->flush && (rc = opts->flush(opts->arg, t->index)))
+    __sync_bool_compare_and_swap(&exp->status, 0, rc);
+  return rc;
+}
+
+/* Notes the snapshot, holding every shard lock at once. */
+static int hut_db_export_begin(hut_db_export_t *exp, hut_db_t *db) {
+  hut_db_export_shard_t *shard;
+  uint32_t count = 0, id;
+  unsigned i;
+  int rc = HUT_OK;
+
+  exp->shard_count = db->shard_count ? db->shard_count : 1;
+  if (!(exp->shards = calloc(exp->shard_count, sizeof(*exp->shards))))
+    return HUT_ERR_NOMEM;
+  for (i = 0; i < exp->shard_count; i++) {
+    exp->shards[i].db = db->shard_count ? db->shards[i] : db;
+    mtx_lock(&exp->shards[i].db->lock);
+    count += exp->shards[i].db->segment_cap;
+  }
+  if (!(exp->segs = malloc((count ? count : 1) * sizeof(*exp->segs))))
+    rc = HUT_ERR_NOMEM;
+  for (i = 0; i < exp->shard_count; i++) {
+    shard = &exp->shards[i];
+    shard->first = exp->seg_count;
+    for (id = 0; !rc && id < shard->db->segment_cap; id++) {
+      if (!shard->db->segments[id])
+        continue;
+      exp->segs[exp->seg_count].shard = shard;
+      exp->segs[exp->seg_count].dbseg = shard->db->segments[id];
+      exp->segs[exp->seg_count].end = shard->db->segments[id] == shard->db->active
+                                      ? hut_segment_size(shard->db->active->seg) : UINT64_MAX;
+      hut_db_segment_ref(shard->db->segments[id]);
+      exp->seg_count++;
+    }
+    shard->count = exp->seg_count - shard->first;
+    shard->log.seq = shard->db->seq;
+    if (!rc) {
+      shard->db->scans++;
+      shard->log.next = shard->db->exports;
+      shard->db->exports = &shard->log;
+      shard->logging = 1;
+    }
+    mtx_unlock(&shard->db->lock);
+  }
+  return rc;
+}
+
+static void hut_db_export_end(hut_db_export_t *exp, int noted) {
+  uint32_t i;
+
+  for (i = 0; noted && i < exp->shard_count; i++) {
+    mtx_lock(&exp->shards[i].db->lock);
+    exp->shards[i].db->scans--;
+    hut_db_export_unlog(&exp->shards[i]);
+    mtx_unlock(&exp->shards[i].db->lock);
+  }
+  for (i = 0; i < exp->seg_count; i++)
+    hut_db_segment_unref(exp->segs[i].dbseg);
+  for (i = 0; i < exp->shard_count; i++)
+    free(exp->shards[i].log.addrs);
+  free(exp->segs);
+  free(exp->shards);
+}
+
+int hut_export(hut_db_t *db, const hut_export_t *opts) {
+  hut_db_export_t exp;
+  unsigned i, started;
+  int rc;
+
+  if (!opts || !opts->fn)
+    return HUT_ERR_INVALID;
+  memset(&exp, 0, sizeof(exp));
+  exp.opts = opts;
+  if ((rc = hut_db_export_begin(&exp, db))) {
+    hut_db_export_end(&exp, 0);
+    return rc;
+  }
+
+  exp.thread_count = opts->threads ? opts->threads : hut_numa_cpu_count();
+  if (exp.thread_count > exp.seg_count)
+    exp.thread_count = exp.seg_count ? exp.seg_count : 1;
+  if (!(exp.threads = calloc(exp.thread_count, sizeof(*exp.threads)))) {
+    hut_db_export_end(&exp, 1);
+    return HUT_ERR_NOMEM;
+  }
+  exp.running = exp.thread_count;
+  for (started = 0; started < exp.thread_count; started++) {
+    exp.threads[started].exp = &exp;
+    exp.threads[started].index = started;
+    if (thrd_create(&exp.threads[started].thread, hut_db_export_run, &exp.threads[started])
+        != thrd_success)
+      break;
+  }
+  /* Threads that did not start are done as far as the others know. */
+  if (started < exp.thread_count) {
+    __sync_bool_compare_and_swap(&exp.status, 0, HUT_ERR_NOMEM);
+    __atomic_sub_fetch(&exp.running, exp.thread_count - started, __ATOMIC_ACQ_REL);
+  }
+  for (i = 0; i < started; i++)
+    thrd_join(exp.threads[i].thread, NULL);
+
+  for (i = 0; i < exp.thread_count; i++)
+    free(exp.threads[i].later);
+  free(exp.threads);
+  hut_db_export_end(&exp, 1);
+  return exp.status;
+}
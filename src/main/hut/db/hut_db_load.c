@@ -0,0 +1,622 @@
+#include "hut/db/hut_db.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hut/util/hut_file.h"
+#include "hut/util/hut_hash.h"
+#include "hut/util/hut_numa.h"
+
+/*
+ * Bulk loading.
+ *
+ * Records go to a stream per shard, appended to a segment built in
+ * memory, which is handed to the loader's own scheduler once full to be
+ * sealed into the LOAD directory of the shard, as compaction does with
+ * its outputs. Segment ids and sequence numbers are taken from the shard,
+ * the latter a block at a time.
+ *
+ * Committing creates LOAD/COMMIT in the database directory, the router's
+ * when sharded, past which the load is as good as done: every shard then
+ * moves its staged segments in, listing and indexing them one at a time
+ * under its lock, and drops its LOAD directory once its own is synced,
+ * the database its commit last. Opening a shard does the same when the
+ * commit is there, and otherwise drops what was staged.
+ *
+ * A record installed finds no other of its key in the index either when
+ * there never was one or when it was deleted since its sequence number
+ * was claimed, which recovery tells apart by the tombstone and install by
+ * a log of the deletes made while loading: the record loses to one past
+ * it. The log is kept until the load is installed, or until close when
+ * that failed, and compaction keeps every tombstone meanwhile, for
+ * recovery to agree.
+ */
+
+#define HUT_DB_LOAD_DIR "LOAD"
+#define HUT_DB_LOAD_COMMIT "COMMIT"
+
+/* Sequence numbers a stream claims from its shard at a time. */
+#define HUT_DB_LOAD_SEQS 4096
+
+/* Full segments waiting to be sealed, per thread, before adding waits. */
+#define HUT_DB_LOAD_PENDING 2
+
+typedef struct hut_db_load_stream_s {
+  hut_loader_t *loader;
+  hut_db_t *db;                 /* the shard loaded into */
+  hut_segment_t *seg;           /* being filled */
+  uint64_t seq;                 /* next of those claimed */
+  uint64_t seq_end;
+  uint32_t *ids;                /* of the segments staged */
+  uint32_t count;
+  uint32_t cap;
+  int status;                   /* of installing them */
+} hut_db_load_stream_t;
+
+struct hut_loader_s {
+  hut_db_t *db;
+  hut_db_load_stream_t *streams;  /* by shard */
+  unsigned stream_count;
+  hut_sched_t *sched;
+  unsigned max_pending;
+  int ready;                    /* lock and done set up */
+  mtx_t lock;
+  cnd_t done;
+  unsigned pending;             /* jobs queued or running */
+  int status;                   /* of the first job that failed */
+  int stuck;                    /* committed but not installed, until reopened */
+};
+
+typedef struct hut_db_load_job_s {
+  hut_db_load_stream_t *stream;
+  hut_segment_t *seg;
+} hut_db_load_job_t;
+
+typedef struct hut_db_load_delete_s {
+  uint64_t hash;
+  uint64_t seq;
+  unsigned char *key;
+  uint32_t klen;
+} hut_db_load_delete_t;
+
+struct hut_db_load_log_s {
+  hut_db_load_delete_t *deletes;
+  size_t count;
+  size_t cap;
+  size_t sorted;                /* leading deletes in hash order */
+};
+
+/* "<dir>/LOAD/<name>", or the LOAD directory itself without `name`. */
+static char *hut_db_load_path(const char *dir, const char *name) {
+  char *stage, *path;
+
+  if (!(stage = hut_file_path(dir, HUT_DB_LOAD_DIR)) || !name)
+    return stage;
+  path = hut_file_path(stage, name);
+  free(stage);
+  return path;
+}
+
+static int hut_db_load_committed(const char *dir) {
+  char *path;
+  int committed;
+
+  if (!(path = hut_db_load_path(dir, HUT_DB_LOAD_COMMIT)))
+    return HUT_ERR_NOMEM;
+  committed = !access(path, F_OK);
+  free(path);
+  return committed;
+}
+
+/* Moves LOAD/<name> of `dir` into `dir`. */
+static int hut_db_load_rename(const char *dir, const char *name) {
+  char *from, *to = NULL;
+  int rc = HUT_ERR_NOMEM;
+
+  if ((from = hut_db_load_path(dir, name)) && (to = hut_file_path(dir, name)))
+    rc = rename(from, to) ? HUT_ERR_IO : HUT_OK;
+  free(from);
+  free(to);
+  return rc;
+}
+
+/* Calls `fn` for every file in LOAD of `dir`, of which there may be none. */
+static int hut_db_load_each(const char *dir, int (*fn)(const char *dir, const char *name)) {
+  struct dirent *ent;
+  char *stage;
+  DIR *d;
+  int rc = HUT_OK;
+
+  if (!(stage = hut_db_load_path(dir, NULL)))
+    return HUT_ERR_NOMEM;
+  if (!(d = opendir(stage))) {
+    rc = errno == ENOENT ? HUT_OK : HUT_ERR_IO;
+    free(stage);
+    return rc;
+  }
+  while (!rc && (ent = readdir(d)))
+    if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+      rc = fn(dir, ent->d_name);
+  closedir(d);
+  free(stage);
+  return rc;
+}
+
+static int hut_db_load_move(const char *dir, const char *name) {
+  unsigned id;
+  int end = 0;
+
+  if (sscanf(name, "%8x.seg%n", &id, &end) != 1 || !end || name[end])
+    return HUT_OK;
+  return hut_db_load_rename(dir, name);
+}
+
+static int hut_db_load_unlink(const char *dir, const char *name) {
+  char *path;
+  int rc;
+
+  if (!(path = hut_db_load_path(dir, name)))
+    return HUT_ERR_NOMEM;
+  rc = unlink(path) ? HUT_ERR_IO : HUT_OK;
+  free(path);
+  return rc;
+}
+
+int hut_db_load_clear(const char *dir) {
+  char *stage;
+  int rc;
+
+  /* Segments moved out go first, in case this drops the commit. */
+  if ((rc = hut_file_sync_dir(dir)) || (rc = hut_db_load_each(dir, hut_db_load_unlink)))
+    return rc;
+  if (!(stage = hut_db_load_path(dir, NULL)))
+    return HUT_ERR_NOMEM;
+  rc = rmdir(stage) && errno != ENOENT ? HUT_ERR_IO : HUT_OK;
+  free(stage);
+  return rc;
+}
+
+int hut_db_load_recover(hut_db_t *db, const char *dir) {
+  int committed, rc;
+
+  if ((committed = hut_db_load_committed(dir)) < 0)
+    return committed;
+  if (committed && (rc = hut_db_load_each(db->path, hut_db_load_move)))
+    return rc;
+  return hut_db_load_clear(db->path);
+}
+
+/*
+ * Delete logs.
+ */
+
+int hut_db_load_log_add(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                        uint64_t seq) {
+  hut_db_load_log_t *log = db->load_log;
+  hut_db_load_delete_t *grown, *del;
+  size_t cap;
+
+  if (log->count == log->cap) {
+    cap = log->cap ? log->cap * 2 : 256;
+    if (!(grown = realloc(log->deletes, cap * sizeof(*grown))))
+      return HUT_ERR_NOMEM;
+    log->deletes = grown;
+    log->cap = cap;
+  }
+  del = &log->deletes[log->count];
+  if (!(del->key = malloc(klen)))
+    return HUT_ERR_NOMEM;
+  memcpy(del->key, key, klen);
+  del->klen = klen;
+  del->hash = hash;
+  del->seq = seq;
+  log->count++;
+  return HUT_OK;
+}
+
+/* Nothing looked the log up since the delete was added, it is still last. */
+void hut_db_load_log_drop(hut_db_t *db) {
+  hut_db_load_log_t *log = db->load_log;
+
+  free(log->deletes[--log->count].key);
+}
+
+static int hut_db_load_log_compare(const void *a, const void *b) {
+  uint64_t x = ((const hut_db_load_delete_t *) a)->hash;
+  uint64_t y = ((const hut_db_load_delete_t *) b)->hash;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Sorted lazily, deletes come in while installing only as long as it takes. */
+int hut_db_load_log_deleted(hut_db_t *db, const void *key, uint32_t klen, uint64_t hash,
+                            uint64_t seq) {
+  hut_db_load_log_t *log = db->load_log;
+  hut_db_load_delete_t *del;
+  size_t lo = 0, hi = log->count, mid;
+
+  if (log->sorted < log->count) {
+    qsort(log->deletes, log->count, sizeof(*log->deletes), hut_db_load_log_compare);
+    log->sorted = log->count;
+  }
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (log->deletes[mid].hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < log->count && (del = &log->deletes[lo])->hash == hash; lo++)
+    if (del->seq > seq && del->klen == klen && !memcmp(del->key, key, klen))
+      return 1;
+  return 0;
+}
+
+void hut_db_load_log_free(hut_db_load_log_t *log) {
+  size_t i;
+
+  if (!log)
+    return;
+  for (i = 0; i < log->count; i++)
+    free(log->deletes[i].key);
+  free(log->deletes);
+  free(log);
+}
+
+/* Starts logging the deletes of a shard, or stops, dropping what it logged. */
+static void hut_db_load_log(hut_db_t *db, hut_db_load_log_t *log) {
+  hut_db_load_log_t *old;
+
+  mtx_lock(&db->lock);
+  old = db->load_log;
+  db->load_log = log;
+  mtx_unlock(&db->lock);
+  hut_db_load_log_free(old);
+}
+
+/*
+ * Jobs. Adding waits while too many full segments are pending, so that
+ * the loader never holds more than a few per thread in memory.
+ */
+
+static void hut_db_load_done(hut_loader_t *loader, int rc) {
+  mtx_lock(&loader->lock);
+  if (rc && !loader->status)
+    loader->status = rc;
+  loader->pending--;
+  cnd_broadcast(&loader->done);
+  mtx_unlock(&loader->lock);
+}
+
+static void hut_db_load_wait(hut_loader_t *loader) {
+  mtx_lock(&loader->lock);
+  while (loader->pending)
+    cnd_wait(&loader->done, &loader->lock);
+  mtx_unlock(&loader->lock);
+}
+
+static int hut_db_load_note(hut_db_load_stream_t *stream, uint32_t id) {
+  uint32_t *grown, cap;
+
+  if (stream->count == stream->cap) {
+    cap = stream->cap ? stream->cap * 2 : 64;
+    if (!(grown = realloc(stream->ids, cap * sizeof(*grown))))
+      return HUT_ERR_NOMEM;
+    stream->ids = grown;
+    stream->cap = cap;
+  }
+  stream->ids[stream->count++] = id;
+  return HUT_OK;
+}
+
+static void hut_db_load_seal_job(void *arg, int cancelled) {
+  hut_db_load_job_t *job = arg;
+  hut_db_load_stream_t *stream = job->stream;
+  hut_loader_t *loader = stream->loader;
+  hut_db_t *db = stream->db;
+  hut_segment_seal_options_t opts;
+  hut_segment_t *sealed;
+  int rc = HUT_ERR_BUSY;
+
+  if (!cancelled) {
+    memset(&opts, 0, sizeof(opts));
+    opts.compression = db->opts.compression;
+    opts.bloom_bits_per_key = db->opts.bloom_bits_per_key;
+    opts.direct = db->opts.direct_io;
+    opts.pool = db->pool;
+    opts.erase_block_size = db->opts.erase_block_size;
+    if (!(rc = hut_segment_seal(job->seg, &opts, &sealed))) {
+      hut_db_stats_add(db, HUT_DB_DISK_WRITTEN, hut_segment_seal_written(job->seg));
+      hut_segment_close(sealed);
+      mtx_lock(&loader->lock);
+      rc = hut_db_load_note(stream, hut_segment_id(job->seg));
+      mtx_unlock(&loader->lock);
+    }
+  }
+  hut_segment_close(job->seg);
+  free(job);
+  hut_db_load_done(loader, rc);
+}
+
+/* Hands the full segment of a stream over to be sealed. */
+static int hut_db_load_submit(hut_db_load_stream_t *stream) {
+  hut_loader_t *loader = stream->loader;
+  hut_db_load_job_t *job;
+  int rc;
+
+  if (!(job = malloc(sizeof(*job))))
+    return HUT_ERR_NOMEM;
+  job->stream = stream;
+  job->seg = stream->seg;
+
+  mtx_lock(&loader->lock);
+  while (loader->pending >= loader->max_pending)
+    cnd_wait(&loader->done, &loader->lock);
+  if (!(rc = loader->status))
+    loader->pending++;
+  mtx_unlock(&loader->lock);
+  if (rc) {
+    free(job);
+    return rc;
+  }
+
+  stream->seg = NULL;
+  if ((rc = hut_sched_submit(loader->sched, HUT_SCHED_NORMAL, hut_db_load_seal_job, job))) {
+    stream->seg = job->seg;
+    free(job);
+    hut_db_load_done(loader, HUT_OK);
+  }
+  return rc;
+}
+
+static int hut_db_load_segment(hut_db_load_stream_t *stream) {
+  hut_db_t *db = stream->db;
+  char *stage;
+  uint32_t id;
+  int rc;
+
+  if (!(stage = hut_db_load_path(db->path, NULL)))
+    return HUT_ERR_NOMEM;
+  mtx_lock(&db->lock);
+  id = db->next_id++;
+  mtx_unlock(&db->lock);
+  rc = hut_segment_create_memory(stage, id, db->opts.segment_size, db->opts.huge_pages,
+                                 &stream->seg);
+  free(stage);
+  return rc;
+}
+
+/* Lists and indexes a staged segment, moving it in first. */
+static int hut_db_load_install(hut_db_t *db, uint32_t id) {
+  hut_db_segment_t *dbseg;
+  hut_segment_t *seg;
+  char name[16];
+  int rc;
+
+  snprintf(name, sizeof(name), "%08x.seg", id);
+  if ((rc = hut_db_load_rename(db->path, name))
+      || (rc = hut_segment_open(db->path, id, db->opts.huge_pages, &seg)))
+    return rc;
+  mtx_lock(&db->lock);
+  if ((rc = hut_db_segment_add(db, seg, &dbseg)))
+    hut_segment_close(seg);
+  else
+    rc = hut_db_index_segment(db, dbseg);
+  mtx_unlock(&db->lock);
+  return rc;
+}
+
+static void hut_db_load_install_job(void *arg, int cancelled) {
+  hut_db_load_stream_t *stream = arg;
+  uint32_t i;
+  int rc = cancelled ? HUT_ERR_BUSY : HUT_OK;
+
+  for (i = 0; i < stream->count && !rc; i++)
+    rc = hut_db_load_install(stream->db, stream->ids[i]);
+  if (!rc)
+    rc = hut_db_load_clear(stream->db->path);
+  stream->status = rc;
+  hut_db_load_done(stream->loader, rc);
+}
+
+/*
+ * Loaders.
+ */
+
+static void hut_db_load_free(hut_loader_t *loader, int drop) {
+  hut_db_t *db = loader->db;
+  unsigned i;
+
+  if (loader->ready)
+    hut_db_load_wait(loader);
+  hut_sched_destroy(loader->sched);
+  for (i = 0; i < loader->stream_count; i++) {
+    hut_segment_close(loader->streams[i].seg);
+    free(loader->streams[i].ids);
+    /* Left for close when stuck, what was not installed still may be. */
+    if (!loader->stuck)
+      hut_db_load_log(loader->streams[i].db, NULL);
+    if (drop)
+      hut_db_load_clear(loader->streams[i].db->path);
+  }
+  if (drop)
+    hut_db_load_clear(db->path);
+  free(loader->streams);
+  if (loader->ready) {
+    cnd_destroy(&loader->done);
+    mtx_destroy(&loader->lock);
+  }
+  mtx_lock(&db->lock);
+  db->loading = loader->stuck;
+  mtx_unlock(&db->lock);
+  free(loader);
+}
+
+static int hut_db_load_stage(const char *dir) {
+  char *stage;
+  int rc;
+
+  if (!(stage = hut_db_load_path(dir, NULL)))
+    return HUT_ERR_NOMEM;
+  rc = mkdir(stage, 0755) && errno != EEXIST ? HUT_ERR_IO : HUT_OK;
+  free(stage);
+  return rc;
+}
+
+int hut_loader_create(hut_db_t *db, unsigned threads, hut_loader_t **out) {
+  hut_db_load_stream_t *stream;
+  hut_db_load_log_t *log;
+  hut_loader_t *loader;
+  unsigned i;
+  int rc;
+
+  if (db->opts.zones.zone_count)
+    return HUT_ERR_NOTSUP;
+  mtx_lock(&db->lock);
+  rc = db->loading ? HUT_ERR_BUSY : HUT_OK;
+  db->loading = 1;
+  mtx_unlock(&db->lock);
+  if (rc)
+    return rc;
+  if (!(loader = calloc(1, sizeof(*loader)))) {
+    mtx_lock(&db->lock);
+    db->loading = 0;
+    mtx_unlock(&db->lock);
+    return HUT_ERR_NOMEM;
+  }
+  loader->db = db;
+  if (!threads)
+    threads = hut_numa_cpu_count();
+  loader->max_pending = threads * HUT_DB_LOAD_PENDING;
+
+  if (!(loader->streams = calloc(db->shard_count ? db->shard_count : 1,
+                                 sizeof(*loader->streams)))) {
+    rc = HUT_ERR_NOMEM;
+    goto fail;
+  }
+  for (i = 0; i < (db->shard_count ? db->shard_count : 1); i++) {
+    stream = &loader->streams[i];
+    stream->loader = loader;
+    stream->db = db->shard_count ? db->shards[i] : db;
+    loader->stream_count++;
+    if ((rc = hut_db_load_stage(stream->db->path)))
+      goto fail;
+    if (!(log = calloc(1, sizeof(*log)))) {
+      rc = HUT_ERR_NOMEM;
+      goto fail;
+    }
+    hut_db_load_log(stream->db, log);
+  }
+  mtx_init(&loader->lock, mtx_plain);
+  cnd_init(&loader->done);
+  loader->ready = 1;
+  if ((rc = hut_db_load_stage(db->path)) || (rc = hut_sched_create(threads, &loader->sched)))
+    goto fail;
+
+  *out = loader;
+  return HUT_OK;
+
+fail:
+  hut_db_load_free(loader, 1);
+  return rc;
+}
+
+int hut_loader_add(hut_loader_t *loader, const void *key, size_t klen,
+                   const void *value, size_t vlen) {
+  uint64_t hash = hut_hash_bytes(key, klen, 0), off;
+  hut_db_load_stream_t *stream;
+  hut_db_t *db;
+  int rc;
+
+  if (!klen || klen > UINT32_MAX || vlen > UINT32_MAX)
+    return HUT_ERR_INVALID;
+  /* As hut_db_route() does. */
+  stream = &loader->streams[loader->db->shard_count ? (hash >> 32) % loader->db->shard_count
+                                                    : 0];
+  db = stream->db;
+  if (hut_segment_record_size((uint32_t) klen, (uint32_t) vlen) > db->opts.segment_size)
+    return HUT_ERR_INVALID;
+
+  if (stream->seq == stream->seq_end) {
+    mtx_lock(&db->lock);
+    stream->seq = db->seq + 1;
+    db->seq += HUT_DB_LOAD_SEQS;
+    mtx_unlock(&db->lock);
+    stream->seq_end = stream->seq + HUT_DB_LOAD_SEQS;
+  }
+  if (!stream->seg && (rc = hut_db_load_segment(stream)))
+    return rc;
+  while ((rc = hut_segment_append(stream->seg, key, (uint32_t) klen, value, (uint32_t) vlen,
+                                  0, stream->seq, &off)) == HUT_ERR_FULL)
+    if ((rc = hut_db_load_submit(stream)) || (rc = hut_db_load_segment(stream)))
+      return rc;
+  if (rc)
+    return rc;
+  stream->seq++;
+  hut_db_stats_add(db, HUT_DB_BYTES_WRITTEN, klen + vlen);
+  return HUT_OK;
+}
+
+static int hut_db_load_commit_write(hut_db_t *db) {
+  char *path, *stage;
+  int fd, rc = HUT_ERR_NOMEM;
+
+  if (!(path = hut_db_load_path(db->path, HUT_DB_LOAD_COMMIT)))
+    return rc;
+  if ((stage = hut_db_load_path(db->path, NULL))) {
+    rc = HUT_ERR_IO;
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+      if (!fsync(fd))
+        rc = hut_file_sync_dir(stage);
+      close(fd);
+    }
+  }
+  free(stage);
+  free(path);
+  return rc;
+}
+
+int hut_loader_commit(hut_loader_t *loader) {
+  hut_db_load_stream_t *stream;
+  unsigned i;
+  int rc = HUT_OK;
+
+  for (i = 0; i < loader->stream_count && !rc; i++) {
+    stream = &loader->streams[i];
+    if (stream->seg && hut_segment_size(stream->seg))
+      rc = hut_db_load_submit(stream);
+  }
+  hut_db_load_wait(loader);
+  if (!rc)
+    rc = loader->status;
+  if (rc || (rc = hut_db_load_commit_write(loader->db))) {
+    hut_db_load_free(loader, 1);
+    return rc;
+  }
+
+  /* Committed, failures past here are left for the next open to finish. */
+  for (i = 0; i < loader->stream_count; i++) {
+    mtx_lock(&loader->lock);
+    loader->pending++;
+    mtx_unlock(&loader->lock);
+    if ((rc = hut_sched_submit(loader->sched, HUT_SCHED_NORMAL, hut_db_load_install_job,
+                               &loader->streams[i])))
+      hut_db_load_done(loader, rc);
+  }
+  hut_db_load_wait(loader);
+  if (!(rc = loader->status) && loader->db->shard_count)
+    rc = hut_db_load_clear(loader->db->path);
+  loader->stuck = rc != HUT_OK;
+  hut_db_load_free(loader, 0);
+  return rc;
+}
+
+void hut_loader_abort(hut_loader_t *loader) {
+  hut_db_load_free(loader, 1);
+}
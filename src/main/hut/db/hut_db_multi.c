@@ -0,0 +1,153 @@
+#include "hut/db/hut_db.h"
+
+#include <string.h>
+
+#include "hut/util/hut_hash.h"
+
+/*
+ * Interleaved multi-get.
+ *
+ * Every lookup is a stackless coroutine, a small state machine that stops
+ * wherever it would otherwise wait on memory: after prefetching its index
+ * slot, and after prefetching its record. A group of them is stepped round
+ * robin in the calling thread, so that by the time a lookup is resumed its
+ * data has had a whole round to arrive, and a batch of probes into a large
+ * index costs about as much as its bandwidth rather than its latency.
+ *
+ * Lookups run lock-free, as in hut_get(). Whatever that path would have to
+ * retry or resolve the slow way, hash collisions included, is handed to
+ * hut_db_get() itself. Each one is recorded as a get, timed from its start
+ * to its answer.
+ */
+
+#define HUT_DB_MULTI_WIDTH 16
+
+#define HUT_DB_MULTI_INDEX  0         /* index slot prefetched */
+#define HUT_DB_MULTI_RECORD 1         /* record prefetched */
+
+typedef struct hut_db_multi_s {
+  int state;
+  size_t i;                     /* of the key */
+  hut_db_t *shard;
+  uint64_t hash;
+  uint64_t addr;
+  hut_db_segment_t *dbseg;
+  hut_db_timer_t timer;
+} hut_db_multi_t;
+
+/* Runs a lookup up to its next prefetch, returns zero once it is done. */
+static int hut_db_multi_step(hut_db_multi_t *co, const void *key, size_t klen,
+                             hut_value_t *value, int *status) {
+  hut_segment_record_t rec;
+  unsigned n;
+
+  switch (co->state) {
+  case HUT_DB_MULTI_INDEX:
+    hut_db_stats_add(co->shard, HUT_DB_INDEX_LOOKUPS, 1);
+    if (hut_index_find_concurrent(co->shard->index, co->hash, &co->addr, 1, &n) || n > 1)
+      break;
+    if (!n) {
+      *status = HUT_ERR_NOTFOUND;
+      return 0;
+    }
+    if (!(co->dbseg = hut_db_segment_load(co->shard, (uint32_t) (co->addr >> 32)))
+        || !hut_db_segment_try_ref(co->dbseg))
+      break;
+    hut_segment_prefetch(co->dbseg->seg, (uint32_t) co->addr);
+    co->state = HUT_DB_MULTI_RECORD;
+    return 1;
+
+  case HUT_DB_MULTI_RECORD:
+    hut_db_stats_add(co->shard, HUT_DB_INDEX_PROBES, 1);
+    if (!hut_segment_read(co->dbseg->seg, (uint32_t) co->addr, &rec)) {
+      if (rec.klen == klen && !memcmp(rec.key, key, klen)) {
+        hut_db_value_init(value, co->dbseg, &rec);
+        *status = HUT_OK;
+        return 0;
+      }
+      hut_segment_record_release(&rec);
+    }
+    hut_db_segment_unref(co->dbseg);
+    break;
+  }
+  *status = hut_db_get(co->shard, key, klen, value);
+  return 0;
+}
+
+/* Starts the lookup of key `i`, returns zero if it is done already. */
+static int hut_db_multi_start(hut_db_t *db, hut_db_multi_t *co, size_t i,
+                              const void *key, size_t klen, int *status) {
+  /* Invalid keys are not recorded. */
+  co->timer.start = 0;
+  if (!klen || klen > UINT32_MAX) {
+    *status = HUT_ERR_INVALID;
+    return 0;
+  }
+  co->state = HUT_DB_MULTI_INDEX;
+  co->i = i;
+  co->hash = hut_hash_bytes(key, klen, 0);
+  co->shard = hut_db_route(db, co->hash);
+  if (!db->shard)
+    hut_db_timer_start(db, &co->timer, co->hash);
+  hut_index_prefetch(co->shard->index, co->hash);
+  return 1;
+}
+
+/* Records a lookup done. */
+static void hut_db_multi_done(hut_db_t *db, const hut_db_timer_t *timer, uint64_t hash,
+                              hut_value_t *value, int status) {
+  hut_db_segment_t *dbseg = status ? NULL : value->pin[0];
+
+  hut_db_timer_stop(db, timer, HUT_STATS_GET, hash, dbseg ? hut_segment_id(dbseg->seg) : 0,
+                    status);
+}
+
+int hut_multi_get(hut_db_t *db, size_t count, const void *const *keys, const size_t *klens,
+                  hut_value_t *values, int *statuses) {
+  hut_db_multi_t group[HUT_DB_MULTI_WIDTH], *co;
+  hut_db_timer_t timer;
+  size_t next = 0, i;
+  uint64_t bytes, hash;
+  unsigned active = 0, k;
+
+  if (count && (!keys || !klens || !values || !statuses))
+    return HUT_ERR_INVALID;
+  /* Owners do the lookups of their shards, hut_db_get() hands them over. */
+  if (db->cores) {
+    for (i = 0; i < count; i++) {
+      hut_db_op_start(db, &timer, keys[i], klens[i], &hash);
+      statuses[i] = hut_db_get(db, keys[i], klens[i], &values[i]);
+      hut_db_multi_done(db, &timer, hash, &values[i], statuses[i]);
+    }
+    goto out;
+  }
+
+  for (;;) {
+    while (active < HUT_DB_MULTI_WIDTH && next < count) {
+      if (hut_db_multi_start(db, &group[active], next, keys[next], klens[next], &statuses[next]))
+        active++;
+      else
+        hut_db_multi_done(db, &group[active].timer, 0, NULL, statuses[next]);
+      next++;
+    }
+    if (!active)
+      break;
+    for (k = 0; k < active;) {
+      co = &group[k];
+      if (hut_db_multi_step(co, keys[co->i], klens[co->i], &values[co->i], &statuses[co->i])) {
+        k++;
+      } else {
+        hut_db_multi_done(db, &co->timer, co->hash, &values[co->i], statuses[co->i]);
+        group[k] = group[--active];
+      }
+    }
+  }
+
+out:
+  for (i = 0, bytes = 0; i < count; i++)
+    if (!statuses[i])
+      bytes += klens[i] + values[i].len;
+  if (!db->shard)
+    hut_db_stats_add(db, HUT_DB_BYTES_READ, bytes);
+  return HUT_OK;
+}
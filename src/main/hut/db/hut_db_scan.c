@@ -0,0 +1,99 @@
+#include "hut/db/hut_db.h"
+
+#include <stdlib.h>
+
+#include "hut/util/hut_hash.h"
+
+/*
+ * Scans. The segments of a shard, and how far the active one is written,
+ * are noted under the lock, and then read through without it, records
+ * being passed on if the index still points at them. Segments noted are
+ * pinned meanwhile, and compaction holds off: records it moved from
+ * segments not read yet into new ones would be missed.
+ */
+
+typedef struct hut_db_scan_s {
+  hut_db_t *db;
+  uint32_t id;                  /* of the segment being read */
+  hut_scan_fn fn;
+  void *arg;
+} hut_db_scan_t;
+
+static int hut_db_scan_live(hut_db_t *db, uint64_t hash, uint64_t addr) {
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES];
+  unsigned i, n;
+
+  if (hut_index_find_concurrent(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES, &n)) {
+    mtx_lock(&db->lock);
+    n = hut_index_find(db->index, hash, addrs, HUT_DB_MAX_CANDIDATES);
+    mtx_unlock(&db->lock);
+  }
+  for (i = 0; i < n && i < HUT_DB_MAX_CANDIDATES; i++)
+    if (addrs[i] == addr)
+      return 1;
+  return 0;
+}
+
+static int hut_db_scan_record(void *arg, uint64_t off, const hut_segment_record_t *rec) {
+  hut_db_scan_t *scan = arg;
+
+  if ((rec->flags & HUT_SEGMENT_RECORD_TOMBSTONE)
+      || !hut_db_scan_live(scan->db, hut_hash_bytes(rec->key, rec->klen, 0),
+                           hut_segment_address(scan->id, off)))
+    return HUT_OK;
+  return scan->fn(scan->arg, rec->key, rec->klen, rec->value, rec->vlen);
+}
+
+static int hut_db_scan_shard(hut_db_t *db, hut_scan_fn fn, void *arg) {
+  hut_db_segment_t **segs, *active;
+  hut_db_scan_t scan;
+  uint64_t active_end = 0;
+  uint32_t count = 0, i;
+  int rc = HUT_OK;
+
+  mtx_lock(&db->lock);
+  if (!(segs = malloc((db->segment_cap ? db->segment_cap : 1) * sizeof(*segs)))) {
+    mtx_unlock(&db->lock);
+    return HUT_ERR_NOMEM;
+  }
+  for (i = 0; i < db->segment_cap; i++) {
+    if (!db->segments[i])
+      continue;
+    hut_db_segment_ref(db->segments[i]);
+    segs[count++] = db->segments[i];
+  }
+  if ((active = db->active))
+    active_end = hut_segment_size(active->seg);
+  db->scans++;
+  mtx_unlock(&db->lock);
+
+  scan.db = db;
+  scan.fn = fn;
+  scan.arg = arg;
+  for (i = 0; i < count && !rc; i++) {
+    scan.id = hut_segment_id(segs[i]->seg);
+    rc = hut_segment_iterate_to(segs[i]->seg, segs[i] == active ? active_end : UINT64_MAX,
+                                hut_db_scan_record, &scan);
+  }
+
+  mtx_lock(&db->lock);
+  db->scans--;
+  mtx_unlock(&db->lock);
+  for (i = 0; i < count; i++)
+    hut_db_segment_unref(segs[i]);
+  free(segs);
+  return rc;
+}
+
+int hut_scan(hut_db_t *db, hut_scan_fn fn, void *arg) {
+  unsigned i;
+  int rc = HUT_OK;
+
+  if (!fn)
+    return HUT_ERR_INVALID;
+  if (!db->shard_count)
+    return hut_db_scan_shard(db, fn, arg);
+  for (i = 0; i < db->shard_count && !rc; i++)
+    rc = hut_db_scan_shard(db->shards[i], fn, arg);
+  return rc;
+}
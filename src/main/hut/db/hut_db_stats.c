@@ -0,0 +1,226 @@
+#include "hut/db/hut_db.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hut/util/hut_histogram.h"
+
+/*
+ * Stats.
+ *
+ * Each thread timing or counting something gets a set of histograms and
+ * counters of its own on first use, found again through a thread-specific
+ * key, so that recording takes no lock and shares no cache line. Sets
+ * outlive their threads until the database is closed, which keeps what
+ * exited threads recorded, and readers merge them all under the list
+ * lock, which only thread arrivals take otherwise.
+ *
+ * A sharded database has one such list, the router's, which its shards
+ * record into as well, as they do into its trace. Cache hits come from the counters the cache keeps
+ * per shard under its locks, and space from the segment tables.
+ */
+
+#define HUT_DB_STATS_LINE 64
+
+typedef struct hut_db_stats_thread_s hut_db_stats_thread_t;
+
+struct hut_db_stats_thread_s {
+  uint64_t counters[HUT_DB_COUNTERS];
+  hut_db_stats_thread_t *next;
+  hut_histogram_t latency[HUT_STATS_OPS];
+} __attribute__((aligned(HUT_DB_STATS_LINE)));
+
+struct hut_db_stats_s {
+  tss_t key;
+  mtx_t lock;
+  hut_db_stats_thread_t *threads;
+};
+
+static uint64_t hut_db_stats_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+int hut_db_stats_create(hut_db_stats_t **out) {
+  hut_db_stats_t *stats;
+
+  if (!(stats = calloc(1, sizeof(*stats))))
+    return HUT_ERR_NOMEM;
+  if (tss_create(&stats->key, NULL) != thrd_success) {
+    free(stats);
+    return HUT_ERR_NOMEM;
+  }
+  mtx_init(&stats->lock, mtx_plain);
+  *out = stats;
+  return HUT_OK;
+}
+
+void hut_db_stats_destroy(hut_db_stats_t *stats) {
+  hut_db_stats_thread_t *t;
+
+  if (!stats)
+    return;
+  while ((t = stats->threads)) {
+    stats->threads = t->next;
+    free(t);
+  }
+  tss_delete(stats->key);
+  mtx_destroy(&stats->lock);
+  free(stats);
+}
+
+/* Returns this thread's stats, NULL when out of memory. */
+static hut_db_stats_thread_t *hut_db_stats_thread(hut_db_stats_t *stats) {
+  hut_db_stats_thread_t *t;
+  unsigned op;
+
+  if ((t = tss_get(stats->key)))
+    return t;
+  if (posix_memalign((void **) &t, HUT_DB_STATS_LINE, sizeof(*t)))
+    return NULL;
+  memset(t->counters, 0, sizeof(t->counters));
+  for (op = 0; op < HUT_STATS_OPS; op++)
+    hut_histogram_init(&t->latency[op]);
+  tss_set(stats->key, t);
+  mtx_lock(&stats->lock);
+  t->next = stats->threads;
+  stats->threads = t;
+  mtx_unlock(&stats->lock);
+  return t;
+}
+
+void hut_db_timer_start(hut_db_t *db, hut_db_timer_t *timer, uint64_t hash) {
+  timer->start = 0;
+  if (!db->stats && !db->trace)
+    return;
+  if (db->trace)
+    timer->compactions = __atomic_load_n(&hut_db_route(db, hash)->compactions,
+                                         __ATOMIC_ACQUIRE);
+  timer->start = hut_db_stats_now();
+}
+
+void hut_db_timer_stop(hut_db_t *db, const hut_db_timer_t *timer, hut_stats_op_t op,
+                       uint64_t hash, uint32_t arg, int status) {
+  hut_db_stats_thread_t *t;
+  unsigned long compactions;
+  uint64_t end;
+
+  if (!timer->start)
+    return;
+  end = hut_db_stats_now();
+  if (db->stats && (t = hut_db_stats_thread(db->stats)))
+    hut_histogram_record(&t->latency[op], end - timer->start);
+  if (db->trace) {
+    compactions = __atomic_load_n(&hut_db_route(db, hash)->compactions, __ATOMIC_ACQUIRE);
+    hut_trace_record(db->trace, op, timer->start, end, hash, arg, status,
+                     (timer->compactions & 1) || compactions != timer->compactions
+                     ? HUT_TRACE_GC : 0);
+  }
+}
+
+void hut_db_stats_add(hut_db_t *db, hut_db_counter_t counter, uint64_t n) {
+  hut_db_stats_thread_t *t;
+
+  if (db->stats && (t = hut_db_stats_thread(db->stats)))
+    __atomic_store_n(&t->counters[counter],
+                     __atomic_load_n(&t->counters[counter], __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/* Adds up the cache and space figures of an unsharded database. */
+static void hut_db_stats_shard(hut_db_t *db, hut_stats_t *stats) {
+  hut_cache_stats_t cache;
+  hut_db_segment_t *s;
+  uint32_t id;
+
+  if (db->cache) {
+    hut_cache_stats(db->cache, &cache);
+    stats->cache_hits += cache.hits;
+    stats->cache_misses += cache.misses;
+    stats->cache_admission_rejects += cache.admission_rejects;
+  }
+  mtx_lock(&db->lock);
+  for (id = 0; id < db->segment_cap; id++) {
+    if (!(s = db->segments[id]))
+      continue;
+    stats->disk_bytes += hut_segment_file_size(s->seg);
+    stats->live_bytes += s->live;
+  }
+  mtx_unlock(&db->lock);
+}
+
+int hut_stats_get(hut_db_t *db, hut_stats_t *stats) {
+  uint64_t counters[HUT_DB_COUNTERS];
+  hut_db_stats_thread_t *t;
+  hut_histogram_t *merged;
+  hut_latency_t *lat;
+  unsigned op, i;
+
+  memset(stats, 0, sizeof(*stats));
+  if (!db->stats)
+    return HUT_OK;
+  if (!(merged = malloc(sizeof(*merged))))
+    return HUT_ERR_NOMEM;
+  memset(counters, 0, sizeof(counters));
+  mtx_lock(&db->stats->lock);
+  for (t = db->stats->threads; t; t = t->next)
+    for (i = 0; i < HUT_DB_COUNTERS; i++)
+      counters[i] += __atomic_load_n(&t->counters[i], __ATOMIC_RELAXED);
+  for (op = 0; op < HUT_STATS_OPS; op++) {
+    hut_histogram_init(merged);
+    for (t = db->stats->threads; t; t = t->next)
+      hut_histogram_merge(merged, &t->latency[op]);
+    lat = &stats->latency[op];
+    lat->count = merged->count;
+    lat->p50 = hut_histogram_percentile(merged, 50);
+    lat->p99 = hut_histogram_percentile(merged, 99);
+    lat->p999 = hut_histogram_percentile(merged, 99.9);
+    lat->max = hut_histogram_percentile(merged, 100);
+  }
+  mtx_unlock(&db->stats->lock);
+  free(merged);
+
+  stats->bytes_read = counters[HUT_DB_BYTES_READ];
+  stats->bytes_written = counters[HUT_DB_BYTES_WRITTEN];
+  stats->disk_bytes_written = counters[HUT_DB_DISK_WRITTEN];
+  stats->index_lookups = counters[HUT_DB_INDEX_LOOKUPS];
+  stats->index_probes = counters[HUT_DB_INDEX_PROBES];
+  stats->gc_bytes_relocated = counters[HUT_DB_GC_RELOCATED];
+  if (!db->shard_count)
+    hut_db_stats_shard(db, stats);
+  for (i = 0; i < db->shard_count; i++)
+    hut_db_stats_shard(db->shards[i], stats);
+  if (stats->bytes_written)
+    stats->write_amplification = (double) stats->disk_bytes_written
+                                 / (double) stats->bytes_written;
+  if (stats->live_bytes)
+    stats->space_amplification = (double) stats->disk_bytes / (double) stats->live_bytes;
+  if (stats->cache_hits + stats->cache_misses)
+    stats->cache_hit_ratio = (double) stats->cache_hits
+                             / (double) (stats->cache_hits + stats->cache_misses);
+  return HUT_OK;
+}
+
+const char *hut_stats_op_name(hut_stats_op_t op) {
+  switch (op) {
+  case HUT_STATS_GET:
+    return "get";
+  case HUT_STATS_PUT:
+    return "put";
+  case HUT_STATS_DEL:
+    return "del";
+  case HUT_STATS_BATCH:
+    return "batch";
+  case HUT_STATS_SYNC:
+    return "sync";
+  case HUT_STATS_COMPACT:
+    return "compact";
+  case HUT_STATS_SEAL:
+    return "seal";
+  default:
+    return "unknown";
+  }
+}
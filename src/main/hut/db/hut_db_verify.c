@@ -0,0 +1,81 @@
+#include "hut/db/hut_db.h"
+
+#include <string.h>
+
+#include "hut/util/hut_hash.h"
+
+/*
+ * Consistency check. Every segment of a shard is read through under its
+ * lock, so that neither the index nor the segments change meanwhile, and
+ * the records the index points to are counted as they go by. Index
+ * entries are only ever added for records appended, so as many of them
+ * as there are live records means none points anywhere else.
+ */
+
+typedef struct hut_db_verify_s {
+  hut_db_t *db;
+  uint32_t id;                  /* of the segment being read */
+  hut_verify_t *report;
+} hut_db_verify_t;
+
+static int hut_db_verify_record(void *arg, uint64_t off, const hut_segment_record_t *rec) {
+  hut_db_verify_t *v = arg;
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES], addr = hut_segment_address(v->id, off);
+  unsigned i, n;
+
+  v->report->records++;
+  if (!hut_segment_record_valid(rec)) {
+    v->report->corrupt_records++;
+    return HUT_OK;
+  }
+  if (rec->flags & HUT_SEGMENT_RECORD_TOMBSTONE)
+    return HUT_OK;
+  n = hut_index_find(v->db->index, hut_hash_bytes(rec->key, rec->klen, 0), addrs,
+                     HUT_DB_MAX_CANDIDATES);
+  for (i = 0; i < n && i < HUT_DB_MAX_CANDIDATES; i++)
+    if (addrs[i] == addr) {
+      v->report->live_records++;
+      break;
+    }
+  return HUT_OK;
+}
+
+/* Fails only when running out of memory, which says nothing about the data. */
+static int hut_db_verify_shard(hut_db_t *db, hut_verify_t *report) {
+  hut_db_verify_t v;
+  uint32_t id;
+  int rc = HUT_OK;
+
+  v.db = db;
+  v.report = report;
+  mtx_lock(&db->lock);
+  for (id = 0; id < db->segment_cap && rc != HUT_ERR_NOMEM; id++) {
+    if (!db->segments[id])
+      continue;
+    v.id = id;
+    report->segments++;
+    if ((rc = hut_segment_iterate(db->segments[id]->seg, hut_db_verify_record, &v))
+        && rc != HUT_ERR_NOMEM)
+      report->corrupt_segments++;
+  }
+  report->index_entries += hut_index_count(db->index);
+  mtx_unlock(&db->lock);
+  return rc == HUT_ERR_NOMEM ? rc : HUT_OK;
+}
+
+int hut_verify(hut_db_t *db, hut_verify_t *report) {
+  unsigned i;
+  int rc = HUT_OK;
+
+  if (!report)
+    return HUT_ERR_INVALID;
+  memset(report, 0, sizeof(*report));
+  if (!db->shard_count)
+    rc = hut_db_verify_shard(db, report);
+  for (i = 0; i < db->shard_count && !rc; i++)
+    rc = hut_db_verify_shard(db->shards[i], report);
+  if (rc)
+    return rc;
+  return report->corrupt_records || report->corrupt_segments
+         || report->live_records != report->index_entries ? HUT_ERR_CORRUPT : HUT_OK;
+}
@@ -0,0 +1,309 @@
+#include "hut/index/hut_index.h"
+
+#include <stdlib.h>
+
+#include "hut/util/hut_mem.h"
+
+#define HUT_INDEX_MIN_CAPACITY 1024
+
+/* Grow once more than 7/8 of the slots are taken. */
+#define HUT_INDEX_LOAD_NUM 7
+#define HUT_INDEX_LOAD_DEN 8
+
+/* Zero marks an empty slot, so hashes are never stored as zero. */
+#define HUT_INDEX_HASH(h) ((h) ? (h) : 1)
+
+/* Slots per sequence lock, a kilobyte of entries. */
+#define HUT_INDEX_STRIPE_SHIFT 6
+
+/* Concurrent lookups give up past this many stripes, or failed attempts. */
+#define HUT_INDEX_READ_STRIPES 8
+#define HUT_INDEX_READ_RETRIES 16
+
+typedef struct hut_index_entry_s {
+  uint64_t hash;
+  uint64_t addr;
+} hut_index_entry_t;
+
+/* A table with its sequence locks, replaced as a whole when growing. */
+typedef struct hut_index_table_s hut_index_table_t;
+
+struct hut_index_table_s {
+  hut_index_entry_t *entries;
+  uint64_t mask;
+  uint32_t *seqs;               /* by stripe, odd while being written */
+  uint64_t stripes;
+  hut_index_table_t *retired;   /* tables grown out of */
+};
+
+struct hut_index_s {
+  hut_index_table_t *table;     /* the writer's */
+  hut_index_table_t *published; /* the readers', lagging behind while growing */
+  uint64_t count;
+  hut_huge_pages_t huge;
+  int node;
+};
+
+static size_t hut_index_bytes(uint64_t slots) {
+  return (size_t) slots * sizeof(hut_index_entry_t);
+}
+
+static void hut_index_table_free(hut_index_t *index, hut_index_table_t *t) {
+  hut_mem_free(t->entries, hut_index_bytes(t->mask + 1), index->huge);
+  free(t->seqs);
+  free(t);
+}
+
+static hut_index_table_t *hut_index_table_alloc(hut_index_t *index, uint64_t capacity) {
+  uint64_t slots = HUT_INDEX_MIN_CAPACITY;
+  hut_index_table_t *t;
+
+  while (slots * HUT_INDEX_LOAD_NUM / HUT_INDEX_LOAD_DEN < capacity)
+    slots <<= 1;
+  if (!(t = calloc(1, sizeof(*t))))
+    return NULL;
+  t->mask = slots - 1;
+  t->stripes = slots >> HUT_INDEX_STRIPE_SHIFT;
+  if (!(t->seqs = calloc(t->stripes, sizeof(*t->seqs)))
+      || !(t->entries = hut_mem_alloc(hut_index_bytes(slots), index->huge, index->node))) {
+    free(t->seqs);
+    free(t);
+    return NULL;
+  }
+  return t;
+}
+
+int hut_index_create(uint64_t capacity, hut_huge_pages_t huge, int node, hut_index_t **out) {
+  hut_index_t *index;
+
+  if (!(index = calloc(1, sizeof(*index))))
+    return HUT_ERR_NOMEM;
+  index->huge = huge;
+  index->node = node;
+  if (!(index->table = hut_index_table_alloc(index, capacity))) {
+    free(index);
+    return HUT_ERR_NOMEM;
+  }
+  index->published = index->table;
+  *out = index;
+  return HUT_OK;
+}
+
+void hut_index_destroy(hut_index_t *index) {
+  hut_index_table_t *t;
+
+  if (!index)
+    return;
+  while ((t = index->table)) {
+    index->table = t->retired;
+    hut_index_table_free(index, t);
+  }
+  free(index);
+}
+
+/*
+ * Sequence locks. The writer makes the stripes it is about to touch odd,
+ * and even again once done. Entries are written with atomic stores in
+ * between, so that a reader seeing any of them also sees the records they
+ * point to, and then the locks changed.
+ */
+
+static void hut_index_write_begin(hut_index_table_t *t, uint64_t from, uint64_t to) {
+  uint64_t s = (from & t->mask) >> HUT_INDEX_STRIPE_SHIFT;
+  uint64_t last = (to & t->mask) >> HUT_INDEX_STRIPE_SHIFT;
+
+  for (;; s = (s + 1) % t->stripes) {
+    __atomic_store_n(&t->seqs[s], t->seqs[s] + 1, __ATOMIC_RELAXED);
+    if (s == last)
+      break;
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void hut_index_write_end(hut_index_table_t *t, uint64_t from, uint64_t to) {
+  uint64_t s = (from & t->mask) >> HUT_INDEX_STRIPE_SHIFT;
+  uint64_t last = (to & t->mask) >> HUT_INDEX_STRIPE_SHIFT;
+
+  for (;; s = (s + 1) % t->stripes) {
+    __atomic_store_n(&t->seqs[s], t->seqs[s] + 1, __ATOMIC_RELEASE);
+    if (s == last)
+      break;
+  }
+}
+
+static void hut_index_set(hut_index_entry_t *e, uint64_t hash, uint64_t addr) {
+  __atomic_store_n(&e->hash, hash, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->addr, addr, __ATOMIC_RELAXED);
+}
+
+static void hut_index_place(hut_index_table_t *t, uint64_t hash, uint64_t addr) {
+  uint64_t i = hash & t->mask;
+
+  while (t->entries[i].hash)
+    i = (i + 1) & t->mask;
+  hut_index_write_begin(t, i, i);
+  hut_index_set(&t->entries[i], hash, addr);
+  hut_index_write_end(t, i, i);
+}
+
+/*
+ * The new table is filled before readers get to see it. They may still be
+ * probing the old one, which stays allocated until the index is destroyed,
+ * at a total cost of at most one more table's worth of memory.
+ */
+static int hut_index_grow(hut_index_t *index) {
+  hut_index_table_t *old = index->table, *t;
+  uint64_t i;
+
+  if (!(t = hut_index_table_alloc(index, old->mask + 1)))
+    return HUT_ERR_NOMEM;
+  for (i = 0; i <= old->mask; i++)
+    if (old->entries[i].hash)
+      hut_index_place(t, old->entries[i].hash, old->entries[i].addr);
+  t->retired = old;
+  index->table = t;
+  __atomic_store_n(&index->published, t, __ATOMIC_RELEASE);
+  return HUT_OK;
+}
+
+unsigned hut_index_find(const hut_index_t *index, uint64_t hash, uint64_t *addrs, unsigned max) {
+  const hut_index_table_t *t = index->table;
+  uint64_t i;
+  unsigned n = 0;
+
+  hash = HUT_INDEX_HASH(hash);
+  for (i = hash & t->mask; t->entries[i].hash; i = (i + 1) & t->mask) {
+    if (t->entries[i].hash != hash)
+      continue;
+    if (n < max)
+      addrs[n] = t->entries[i].addr;
+    n++;
+  }
+  return n;
+}
+
+/*
+ * One attempt at a concurrent lookup: a probe noting the lock of every
+ * stripe it enters, valid if none of them was odd or changed by the end.
+ */
+static int hut_index_find_once(const hut_index_table_t *t, uint64_t hash,
+                               uint64_t *addrs, unsigned max, unsigned *count) {
+  uint32_t seqs[HUT_INDEX_READ_STRIPES];
+  uint64_t i, e_hash, stripe, first;
+  unsigned n = 0, visited = 0, k;
+
+  first = stripe = (hash & t->mask) >> HUT_INDEX_STRIPE_SHIFT;
+  seqs[visited++] = __atomic_load_n(&t->seqs[stripe], __ATOMIC_ACQUIRE);
+  for (i = hash & t->mask;; i = (i + 1) & t->mask) {
+    if (i >> HUT_INDEX_STRIPE_SHIFT != stripe) {
+      if (visited == HUT_INDEX_READ_STRIPES)
+        return HUT_ERR_BUSY;
+      stripe = i >> HUT_INDEX_STRIPE_SHIFT;
+      seqs[visited++] = __atomic_load_n(&t->seqs[stripe], __ATOMIC_ACQUIRE);
+    }
+    if (!(e_hash = __atomic_load_n(&t->entries[i].hash, __ATOMIC_RELAXED)))
+      break;
+    if (e_hash != hash)
+      continue;
+    if (n < max)
+      addrs[n] = __atomic_load_n(&t->entries[i].addr, __ATOMIC_RELAXED);
+    n++;
+  }
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  for (k = 0, stripe = first; k < visited; k++, stripe = (stripe + 1) % t->stripes)
+    if ((seqs[k] & 1) || __atomic_load_n(&t->seqs[stripe], __ATOMIC_RELAXED) != seqs[k])
+      return HUT_ERR_BUSY;
+  *count = n;
+  return HUT_OK;
+}
+
+int hut_index_find_concurrent(const hut_index_t *index, uint64_t hash,
+                              uint64_t *addrs, unsigned max, unsigned *count) {
+  unsigned attempt;
+
+  hash = HUT_INDEX_HASH(hash);
+  for (attempt = 0; attempt < HUT_INDEX_READ_RETRIES; attempt++)
+    if (!hut_index_find_once(__atomic_load_n(&index->published, __ATOMIC_ACQUIRE),
+                             hash, addrs, max, count))
+      return HUT_OK;
+  return HUT_ERR_BUSY;
+}
+
+void hut_index_prefetch(const hut_index_t *index, uint64_t hash) {
+  const hut_index_table_t *t = __atomic_load_n(&index->published, __ATOMIC_ACQUIRE);
+  uint64_t i = HUT_INDEX_HASH(hash) & t->mask;
+
+  __builtin_prefetch(&t->entries[i]);
+  __builtin_prefetch(&t->seqs[i >> HUT_INDEX_STRIPE_SHIFT]);
+}
+
+int hut_index_insert(hut_index_t *index, uint64_t hash, uint64_t addr) {
+  int rc;
+
+  if ((index->count + 1) * HUT_INDEX_LOAD_DEN > (index->table->mask + 1) * HUT_INDEX_LOAD_NUM
+      && (rc = hut_index_grow(index)))
+    return rc;
+  hut_index_place(index->table, HUT_INDEX_HASH(hash), addr);
+  index->count++;
+  return HUT_OK;
+}
+
+static hut_index_entry_t *hut_index_lookup(const hut_index_t *index, uint64_t hash, uint64_t addr) {
+  const hut_index_table_t *t = index->table;
+  uint64_t i;
+
+  hash = HUT_INDEX_HASH(hash);
+  for (i = hash & t->mask; t->entries[i].hash; i = (i + 1) & t->mask)
+    if (t->entries[i].hash == hash && t->entries[i].addr == addr)
+      return &t->entries[i];
+  return NULL;
+}
+
+int hut_index_update(hut_index_t *index, uint64_t hash, uint64_t old_addr, uint64_t new_addr) {
+  hut_index_table_t *t = index->table;
+  hut_index_entry_t *e;
+  uint64_t i;
+
+  if (!(e = hut_index_lookup(index, hash, old_addr)))
+    return HUT_ERR_NOTFOUND;
+  i = (uint64_t) (e - t->entries);
+  hut_index_write_begin(t, i, i);
+  __atomic_store_n(&e->addr, new_addr, __ATOMIC_RELAXED);
+  hut_index_write_end(t, i, i);
+  return HUT_OK;
+}
+
+int hut_index_remove(hut_index_t *index, uint64_t hash, uint64_t addr) {
+  hut_index_table_t *t = index->table;
+  hut_index_entry_t *e;
+  uint64_t i, j, home, end;
+
+  if (!(e = hut_index_lookup(index, hash, addr)))
+    return HUT_ERR_NOTFOUND;
+
+  /*
+   * Backward shift: pull later entries of the cluster into the hole as
+   * long as that does not move them before their home slot. Every stripe
+   * up to the end of the cluster may see an entry move.
+   */
+  i = (uint64_t) (e - t->entries);
+  for (end = i; t->entries[(end + 1) & t->mask].hash; end = (end + 1) & t->mask)
+    ;
+  hut_index_write_begin(t, i, end);
+  for (j = (i + 1) & t->mask; t->entries[j].hash; j = (j + 1) & t->mask) {
+    home = t->entries[j].hash & t->mask;
+    if (((j - home) & t->mask) >= ((j - i) & t->mask)) {
+      hut_index_set(&t->entries[i], t->entries[j].hash, t->entries[j].addr);
+      i = j;
+    }
+  }
+  hut_index_set(&t->entries[i], 0, 0);
+  hut_index_write_end(t, (uint64_t) (e - t->entries), end);
+  index->count--;
+  return HUT_OK;
+}
+
+uint64_t hut_index_count(const hut_index_t *index) {
+  return index->count;
+}
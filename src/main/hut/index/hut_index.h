@@ -0,0 +1,60 @@
+#ifndef HUT_INDEX_H
+#define HUT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hut/hut.h"
+
+/*
+ * In-memory hash index from key hash to record address. Keys themselves
+ * are not stored: callers read the records at the candidate addresses a
+ * hash maps to and compare keys, which full 64-bit hashes make a single
+ * read in practice.
+ *
+ * Open addressing with linear probing over 16-byte entries, grown by
+ * doubling, with backward shift deletion so there are no tombstones.
+ * Probes land anywhere in the table, which can be backed by huge pages to
+ * keep them from missing the TLB as well as the cache.
+ *
+ * There is a single writer at a time, but lookups may also run alongside
+ * it with hut_index_find_concurrent(). Every stripe of slots has a
+ * sequence lock the writer bumps around its changes, and readers take a
+ * snapshot of the stripes they probe without writing anything, retrying
+ * when a write overlapped.
+ */
+
+typedef struct hut_index_s hut_index_t;
+
+/* Tables come from NUMA node `node`, any node when negative. */
+int hut_index_create(uint64_t capacity, hut_huge_pages_t huge, int node, hut_index_t **out);
+
+void hut_index_destroy(hut_index_t *index);
+
+/* Stores up to `max` addresses of entries with this hash, returns how many there are. */
+unsigned hut_index_find(const hut_index_t *index, uint64_t hash, uint64_t *addrs, unsigned max);
+
+/*
+ * hut_index_find() for readers racing the writer. HUT_ERR_BUSY when no
+ * consistent snapshot could be had in a few attempts, left to callers to
+ * resolve under whatever excludes the writer.
+ */
+int hut_index_find_concurrent(const hut_index_t *index, uint64_t hash,
+                              uint64_t *addrs, unsigned max, unsigned *count);
+
+/*
+ * Starts loading the slot a lookup of `hash` lands on, and its sequence
+ * lock, for callers interleaving lookups to overlap their cache misses.
+ */
+void hut_index_prefetch(const hut_index_t *index, uint64_t hash);
+
+int hut_index_insert(hut_index_t *index, uint64_t hash, uint64_t addr);
+
+/* HUT_ERR_NOTFOUND unless an entry (hash, old_addr) exists. */
+int hut_index_update(hut_index_t *index, uint64_t hash, uint64_t old_addr, uint64_t new_addr);
+
+int hut_index_remove(hut_index_t *index, uint64_t hash, uint64_t addr);
+
+uint64_t hut_index_count(const hut_index_t *index);
+
+#endif /* HUT_INDEX_H */
@@ -0,0 +1,320 @@
+#include "hut/io/hut_io.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define HUT_IO_BUFFER_ALIGN 4096
+
+typedef struct hut_io_sq_s {
+  unsigned *head;
+  unsigned *tail;
+  unsigned *mask;
+  unsigned *flags;
+  unsigned *array;
+  struct io_uring_sqe *sqes;
+  unsigned pending;             /* filled but not yet handed to the kernel */
+} hut_io_sq_t;
+
+typedef struct hut_io_cq_s {
+  unsigned *head;
+  unsigned *tail;
+  unsigned *mask;
+  struct io_uring_cqe *cqes;
+} hut_io_cq_t;
+
+struct hut_io_s {
+  int fd;
+  int sqpoll;
+  unsigned entries;
+  unsigned inflight;
+  hut_io_sq_t sq;
+  hut_io_cq_t cq;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_len;
+  size_t cq_ring_len;
+  size_t sqes_len;
+  struct iovec *buffers;
+  int registered;
+  int *free_buffers;
+  unsigned free_count;
+  unsigned buffer_count;
+  size_t buffer_size;
+};
+
+static int hut_io_setup(unsigned entries, struct io_uring_params *p) {
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int hut_io_enter(int fd, unsigned submit, unsigned min, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, submit, min, flags, NULL, 0);
+}
+
+static int hut_io_register(int fd, unsigned op, void *arg, unsigned n) {
+  return (int) syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static int hut_io_map_rings(hut_io_t *io, const struct io_uring_params *p) {
+  char *sq, *cq;
+
+  io->sq_ring_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+  io->cq_ring_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  if (p->features & IORING_FEAT_SINGLE_MMAP) {
+    if (io->cq_ring_len > io->sq_ring_len)
+      io->sq_ring_len = io->cq_ring_len;
+    io->cq_ring_len = 0;
+  }
+
+  sq = mmap(NULL, io->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            io->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+    return HUT_ERR_IO;
+  io->sq_ring = sq;
+
+  if (io->cq_ring_len) {
+    cq = mmap(NULL, io->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              io->fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+      return HUT_ERR_IO;
+    io->cq_ring = cq;
+  } else {
+    cq = sq;
+  }
+
+  io->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+  io->sq.sqes = mmap(NULL, io->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     io->fd, IORING_OFF_SQES);
+  if (io->sq.sqes == MAP_FAILED) {
+    io->sq.sqes = NULL;
+    return HUT_ERR_IO;
+  }
+
+  io->sq.head = (unsigned *) (sq + p->sq_off.head);
+  io->sq.tail = (unsigned *) (sq + p->sq_off.tail);
+  io->sq.mask = (unsigned *) (sq + p->sq_off.ring_mask);
+  io->sq.flags = (unsigned *) (sq + p->sq_off.flags);
+  io->sq.array = (unsigned *) (sq + p->sq_off.array);
+  io->cq.head = (unsigned *) (cq + p->cq_off.head);
+  io->cq.tail = (unsigned *) (cq + p->cq_off.tail);
+  io->cq.mask = (unsigned *) (cq + p->cq_off.ring_mask);
+  io->cq.cqes = (struct io_uring_cqe *) (cq + p->cq_off.cqes);
+  return HUT_OK;
+}
+
+/*
+ * Buffers are registered as fixed buffers when the kernel lets us, which
+ * can fail on a low RLIMIT_MEMLOCK. They are then still pooled, just used
+ * with plain reads and writes.
+ */
+static int hut_io_alloc_buffers(hut_io_t *io, unsigned count, size_t size) {
+  unsigned i;
+
+  if (!count || !size)
+    return HUT_OK;
+  size = (size + HUT_IO_BUFFER_ALIGN - 1) & ~(size_t) (HUT_IO_BUFFER_ALIGN - 1);
+  if (!(io->buffers = calloc(count, sizeof(*io->buffers)))
+      || !(io->free_buffers = malloc(count * sizeof(*io->free_buffers))))
+    return HUT_ERR_NOMEM;
+  for (i = 0; i < count; i++) {
+    if (posix_memalign(&io->buffers[i].iov_base, HUT_IO_BUFFER_ALIGN, size))
+      return HUT_ERR_NOMEM;
+    io->buffers[i].iov_len = size;
+    io->free_buffers[i] = (int) (count - 1 - i);
+    io->buffer_count++;
+  }
+  io->free_count = count;
+  io->buffer_size = size;
+  io->registered = !hut_io_register(io->fd, IORING_REGISTER_BUFFERS, io->buffers, count);
+  return HUT_OK;
+}
+
+int hut_io_create(const hut_io_options_t *opts, hut_io_t **out) {
+  struct io_uring_params p;
+  hut_io_t *io;
+  int rc;
+
+  if (!(io = calloc(1, sizeof(*io))))
+    return HUT_ERR_NOMEM;
+
+  memset(&p, 0, sizeof(p));
+  if (opts->sqpoll) {
+    p.flags |= IORING_SETUP_SQPOLL;
+    p.sq_thread_idle = opts->sqpoll_idle;
+  }
+  if ((io->fd = hut_io_setup(opts->queue_depth, &p)) < 0) {
+    free(io);
+    return errno == ENOSYS || errno == EPERM ? HUT_ERR_NOTSUP : HUT_ERR_IO;
+  }
+  io->sqpoll = opts->sqpoll;
+  io->entries = p.sq_entries;
+
+  if ((rc = hut_io_map_rings(io, &p))
+      || (rc = hut_io_alloc_buffers(io, opts->buffer_count, opts->buffer_size))) {
+    hut_io_destroy(io);
+    return rc;
+  }
+
+  *out = io;
+  return HUT_OK;
+}
+
+void hut_io_destroy(hut_io_t *io) {
+  unsigned i;
+
+  if (!io)
+    return;
+  while (io->inflight || io->sq.pending)
+    if (hut_io_poll(io, 1) < 0)
+      break;
+  if (io->sq.sqes)
+    munmap(io->sq.sqes, io->sqes_len);
+  if (io->cq_ring)
+    munmap(io->cq_ring, io->cq_ring_len);
+  if (io->sq_ring)
+    munmap(io->sq_ring, io->sq_ring_len);
+  close(io->fd);
+  for (i = 0; i < io->buffer_count; i++)
+    free(io->buffers[i].iov_base);
+  free(io->buffers);
+  free(io->free_buffers);
+  free(io);
+}
+
+static struct io_uring_sqe *hut_io_sqe(hut_io_t *io) {
+  unsigned head = __atomic_load_n(io->sq.head, __ATOMIC_ACQUIRE);
+  unsigned tail = *io->sq.tail + io->sq.pending;
+  struct io_uring_sqe *sqe;
+
+  if (tail - head >= io->entries || io->inflight + io->sq.pending >= io->entries)
+    return NULL;
+  sqe = &io->sq.sqes[tail & *io->sq.mask];
+  memset(sqe, 0, sizeof(*sqe));
+  io->sq.array[tail & *io->sq.mask] = tail & *io->sq.mask;
+  io->sq.pending++;
+  return sqe;
+}
+
+static int hut_io_rw(hut_io_t *io, hut_io_op_t *op, int fd, const void *buf, size_t len,
+                     uint64_t off, int buf_index, int plain, int fixed) {
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = hut_io_sqe(io)))
+    return HUT_ERR_FULL;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) buf;
+  sqe->len = (unsigned) len;
+  sqe->off = off;
+  sqe->user_data = (uintptr_t) op;
+  if (buf_index >= 0 && io->registered) {
+    sqe->opcode = (uint8_t) fixed;
+    sqe->buf_index = (uint16_t) buf_index;
+  } else {
+    sqe->opcode = (uint8_t) plain;
+  }
+  return HUT_OK;
+}
+
+int hut_io_read(hut_io_t *io, hut_io_op_t *op, int fd, void *buf, size_t len,
+                uint64_t off, int buf_index) {
+  return hut_io_rw(io, op, fd, buf, len, off, buf_index, IORING_OP_READ, IORING_OP_READ_FIXED);
+}
+
+int hut_io_write(hut_io_t *io, hut_io_op_t *op, int fd, const void *buf, size_t len,
+                 uint64_t off, int buf_index) {
+  return hut_io_rw(io, op, fd, buf, len, off, buf_index, IORING_OP_WRITE, IORING_OP_WRITE_FIXED);
+}
+
+int hut_io_fsync(hut_io_t *io, hut_io_op_t *op, int fd, int datasync) {
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = hut_io_sqe(io)))
+    return HUT_ERR_FULL;
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+  sqe->user_data = (uintptr_t) op;
+  return HUT_OK;
+}
+
+static int hut_io_flush(hut_io_t *io, unsigned min) {
+  unsigned submit = io->sq.pending, flags = 0;
+  int n;
+
+  if (submit)
+    __atomic_store_n(io->sq.tail, *io->sq.tail + submit, __ATOMIC_RELEASE);
+  io->sq.pending = 0;
+  io->inflight += submit;
+
+  if (io->sqpoll) {
+    /* The kernel thread picks entries up by itself unless it went idle. */
+    if (__atomic_load_n(io->sq.flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    submit = 0;
+    if (!flags && !min)
+      return HUT_OK;
+  } else if (!submit && !min) {
+    return HUT_OK;
+  }
+  if (min)
+    flags |= IORING_ENTER_GETEVENTS;
+
+  do {
+    n = hut_io_enter(io->fd, submit, min, flags);
+  } while (n < 0 && errno == EINTR);
+  return n < 0 ? HUT_ERR_IO : HUT_OK;
+}
+
+int hut_io_submit(hut_io_t *io) {
+  return hut_io_flush(io, 0);
+}
+
+int hut_io_poll(hut_io_t *io, unsigned min) {
+  struct io_uring_cqe *cqe;
+  unsigned head, tail;
+  hut_io_op_t *op;
+  int done = 0, rc;
+
+  if (min > io->inflight + io->sq.pending)
+    min = io->inflight + io->sq.pending;
+  if ((rc = hut_io_flush(io, min)))
+    return rc;
+
+  head = *io->cq.head;
+  tail = __atomic_load_n(io->cq.tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    cqe = &io->cq.cqes[head & *io->cq.mask];
+    op = (hut_io_op_t *) (uintptr_t) cqe->user_data;
+    rc = cqe->res;
+    __atomic_store_n(io->cq.head, ++head, __ATOMIC_RELEASE);
+    io->inflight--;
+    op->fn(op, rc);
+    done++;
+    tail = __atomic_load_n(io->cq.tail, __ATOMIC_ACQUIRE);
+  }
+  return done;
+}
+
+unsigned hut_io_inflight(const hut_io_t *io) {
+  return io->inflight + io->sq.pending;
+}
+
+int hut_io_buffer_get(hut_io_t *io, size_t len, void **buf) {
+  int index;
+
+  if (len > io->buffer_size || !io->free_count)
+    return -1;
+  index = io->free_buffers[--io->free_count];
+  *buf = io->buffers[index].iov_base;
+  return index;
+}
+
+void hut_io_buffer_put(hut_io_t *io, int index) {
+  if (index >= 0)
+    io->free_buffers[io->free_count++] = index;
+}
@@ -0,0 +1,58 @@
+#ifndef HUT_IO_H
+#define HUT_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hut/hut.h"
+
+/*
+ * Minimal io_uring wrapper, talking to the kernel directly rather than
+ * through liburing. A ring is meant to be driven by a single thread.
+ *
+ * Operations are queued with hut_io_read() and friends, which only fill
+ * submission entries, and handed to the kernel in one batch by
+ * hut_io_submit(). hut_io_poll() reaps completions and runs the callback
+ * of each operation with the result of the underlying syscall (negative
+ * errno on failure).
+ *
+ * The ring owns a pool of page aligned buffers, registered with the
+ * kernel when possible so reads into them skip the per-I/O page pinning.
+ */
+
+typedef struct hut_io_s hut_io_t;
+typedef struct hut_io_op_s hut_io_op_t;
+
+typedef void (*hut_io_fn)(hut_io_op_t *op, int res);
+
+/* Embedded by callers in their own request structures. */
+struct hut_io_op_s {
+  hut_io_fn fn;
+};
+
+int hut_io_create(const hut_io_options_t *opts, hut_io_t **out);
+
+void hut_io_destroy(hut_io_t *io);
+
+/* HUT_ERR_FULL when the submission queue is full and completions need reaping. */
+int hut_io_read(hut_io_t *io, hut_io_op_t *op, int fd, void *buf, size_t len,
+                uint64_t off, int buf_index);
+
+int hut_io_write(hut_io_t *io, hut_io_op_t *op, int fd, const void *buf, size_t len,
+                 uint64_t off, int buf_index);
+
+int hut_io_fsync(hut_io_t *io, hut_io_op_t *op, int fd, int datasync);
+
+int hut_io_submit(hut_io_t *io);
+
+/* Waits for at least `min` completions, returns how many were processed. */
+int hut_io_poll(hut_io_t *io, unsigned min);
+
+unsigned hut_io_inflight(const hut_io_t *io);
+
+/* Takes a pooled buffer of at least `len` bytes, returning its index or -1. */
+int hut_io_buffer_get(hut_io_t *io, size_t len, void **buf);
+
+void hut_io_buffer_put(hut_io_t *io, int index);
+
+#endif /* HUT_IO_H */
@@ -0,0 +1,214 @@
+#include "hut/sched/hut_sched.h"
+
+#include <stdlib.h>
+
+#include <tinycthread.h>
+
+#include "hut/util/hut_deque.h"
+
+typedef struct hut_sched_task_s hut_sched_task_t;
+
+struct hut_sched_task_s {
+  hut_sched_fn fn;
+  void *arg;
+  hut_sched_task_t *next;       /* in the shared queue */
+};
+
+typedef struct hut_sched_worker_s {
+  hut_sched_t *sched;
+  hut_deque_t deques[HUT_SCHED_PRIORITIES];
+  thrd_t thread;
+  int started;
+  unsigned seed;                /* where stealing starts */
+} hut_sched_worker_t;
+
+struct hut_sched_s {
+  hut_sched_worker_t *workers;
+  unsigned count;
+  int self_ready;
+  tss_t self;                   /* the worker of the calling thread */
+  mtx_t lock;
+  cnd_t wake;
+  hut_sched_task_t *head[HUT_SCHED_PRIORITIES];
+  hut_sched_task_t *tail[HUT_SCHED_PRIORITIES];
+  unsigned long queued;         /* tasks submitted and not yet picked up */
+  int stop;
+};
+
+static hut_sched_task_t *hut_sched_shared_pop(hut_sched_t *sched, int priority) {
+  hut_sched_task_t *task;
+
+  if (!__atomic_load_n(&sched->head[priority], __ATOMIC_RELAXED))
+    return NULL;
+  mtx_lock(&sched->lock);
+  if ((task = sched->head[priority]) && !(sched->head[priority] = task->next))
+    sched->tail[priority] = NULL;
+  mtx_unlock(&sched->lock);
+  return task;
+}
+
+static hut_sched_task_t *hut_sched_next(hut_sched_worker_t *w) {
+  hut_sched_t *sched = w->sched;
+  hut_sched_task_t *task;
+  unsigned i, victim;
+  int p;
+
+  w->seed = w->seed * 1103515245u + 12345u;
+  for (p = 0; p < HUT_SCHED_PRIORITIES; p++) {
+    if ((task = hut_deque_take(&w->deques[p])) || (task = hut_sched_shared_pop(sched, p)))
+      return task;
+    for (i = 1; i < sched->count; i++) {
+      victim = (w->seed + i) % sched->count;
+      if (&sched->workers[victim] != w
+          && (task = hut_deque_steal(&sched->workers[victim].deques[p])))
+        return task;
+    }
+  }
+  return NULL;
+}
+
+static int hut_sched_run(void *arg) {
+  hut_sched_worker_t *w = arg;
+  hut_sched_t *sched = w->sched;
+  hut_sched_task_t *task;
+
+  tss_set(sched->self, w);
+  while (!__atomic_load_n(&sched->stop, __ATOMIC_ACQUIRE)) {
+    if ((task = hut_sched_next(w))) {
+      __atomic_sub_fetch(&sched->queued, 1, __ATOMIC_SEQ_CST);
+      task->fn(task->arg, 0);
+      free(task);
+      continue;
+    }
+    /* Steals lost to a race leave `queued` up, and get retried. */
+    mtx_lock(&sched->lock);
+    while (!sched->stop && !__atomic_load_n(&sched->queued, __ATOMIC_SEQ_CST))
+      cnd_wait(&sched->wake, &sched->lock);
+    mtx_unlock(&sched->lock);
+  }
+  return 0;
+}
+
+int hut_sched_create(unsigned threads, hut_sched_t **out) {
+  hut_sched_t *sched;
+  unsigned i;
+  int p, rc;
+
+  if (!threads)
+    return HUT_ERR_INVALID;
+  if (!(sched = calloc(1, sizeof(*sched))))
+    return HUT_ERR_NOMEM;
+  mtx_init(&sched->lock, mtx_plain);
+  cnd_init(&sched->wake);
+  if (tss_create(&sched->self, NULL) != thrd_success) {
+    rc = HUT_ERR_NOMEM;
+    goto fail;
+  }
+  sched->self_ready = 1;
+  if (!(sched->workers = calloc(threads, sizeof(*sched->workers)))) {
+    rc = HUT_ERR_NOMEM;
+    goto fail;
+  }
+  for (i = 0; i < threads; i++) {
+    sched->workers[i].sched = sched;
+    sched->workers[i].seed = i;
+    for (p = 0; p < HUT_SCHED_PRIORITIES; p++)
+      if ((rc = hut_deque_init(&sched->workers[i].deques[p])))
+        goto fail;
+    sched->count++;
+  }
+  for (i = 0; i < threads; i++) {
+    if (thrd_create(&sched->workers[i].thread, hut_sched_run, &sched->workers[i]) != thrd_success) {
+      rc = HUT_ERR_NOMEM;
+      goto fail;
+    }
+    sched->workers[i].started = 1;
+  }
+
+  *out = sched;
+  return HUT_OK;
+
+fail:
+  hut_sched_destroy(sched);
+  return rc;
+}
+
+static void hut_sched_cancel(hut_sched_task_t *task) {
+  task->fn(task->arg, 1);
+  free(task);
+}
+
+void hut_sched_destroy(hut_sched_t *sched) {
+  hut_sched_worker_t *w;
+  hut_sched_task_t *task;
+  unsigned i;
+  int p;
+
+  if (!sched)
+    return;
+  mtx_lock(&sched->lock);
+  __atomic_store_n(&sched->stop, 1, __ATOMIC_RELEASE);
+  cnd_broadcast(&sched->wake);
+  mtx_unlock(&sched->lock);
+
+  /* Every worker, as any of them may still be stealing from the others. */
+  for (i = 0; i < sched->count; i++)
+    if (sched->workers[i].started)
+      thrd_join(sched->workers[i].thread, NULL);
+
+  /* Workers are gone by now, their deques can be drained from here. */
+  for (i = 0; i < sched->count; i++) {
+    w = &sched->workers[i];
+    for (p = 0; p < HUT_SCHED_PRIORITIES; p++) {
+      while ((task = hut_deque_take(&w->deques[p])))
+        hut_sched_cancel(task);
+      hut_deque_destroy(&w->deques[p]);
+    }
+  }
+  for (p = 0; p < HUT_SCHED_PRIORITIES; p++)
+    while ((task = sched->head[p])) {
+      sched->head[p] = task->next;
+      hut_sched_cancel(task);
+    }
+
+  free(sched->workers);
+  if (sched->self_ready)
+    tss_delete(sched->self);
+  cnd_destroy(&sched->wake);
+  mtx_destroy(&sched->lock);
+  free(sched);
+}
+
+int hut_sched_submit(hut_sched_t *sched, hut_sched_priority_t priority,
+                     hut_sched_fn fn, void *arg) {
+  hut_sched_worker_t *self = tss_get(sched->self);
+  hut_sched_task_t *task;
+  int rc;
+
+  if (priority < 0 || priority >= HUT_SCHED_PRIORITIES)
+    return HUT_ERR_INVALID;
+  if (!(task = malloc(sizeof(*task))))
+    return HUT_ERR_NOMEM;
+  task->fn = fn;
+  task->arg = arg;
+  task->next = NULL;
+
+  /* Counted first, so that thieves never see more tasks than counted. */
+  __atomic_add_fetch(&sched->queued, 1, __ATOMIC_SEQ_CST);
+  if (self && (rc = hut_deque_push(&self->deques[priority], task))) {
+    __atomic_sub_fetch(&sched->queued, 1, __ATOMIC_SEQ_CST);
+    free(task);
+    return rc;
+  }
+  mtx_lock(&sched->lock);
+  if (!self) {
+    if (sched->tail[priority])
+      sched->tail[priority]->next = task;
+    else
+      __atomic_store_n(&sched->head[priority], task, __ATOMIC_RELAXED);
+    sched->tail[priority] = task;
+  }
+  cnd_signal(&sched->wake);
+  mtx_unlock(&sched->lock);
+  return HUT_OK;
+}
@@ -0,0 +1,42 @@
+#ifndef HUT_SCHED_H
+#define HUT_SCHED_H
+
+#include "hut/hut.h"
+
+/*
+ * Background task scheduler, the one pool of threads that compaction,
+ * warm-up and every other background job of a database run on, however
+ * many shards it has.
+ *
+ * Every worker has a work-stealing deque per priority. Tasks submitted by
+ * a task go to the deque of the worker running it, others to a shared
+ * queue. Workers run the most urgent task they can find, in order from
+ * their own deque, the shared queue, and the deques of the others, and
+ * sleep on a condition variable when there is none.
+ */
+
+typedef struct hut_sched_s hut_sched_t;
+
+typedef enum hut_sched_priority_e {
+  HUT_SCHED_HIGH   = 0,         /* the database is stuck until it runs */
+  HUT_SCHED_NORMAL = 1,
+  HUT_SCHED_LOW    = 2          /* whenever nothing else is queued */
+} hut_sched_priority_t;
+
+#define HUT_SCHED_PRIORITIES 3
+
+/*
+ * Tasks queued when the scheduler is destroyed are still called, with
+ * `cancelled` set, to release what they hold.
+ */
+typedef void (*hut_sched_fn)(void *arg, int cancelled);
+
+int hut_sched_create(unsigned threads, hut_sched_t **out);
+
+/* Waits for running tasks and cancels queued ones. */
+void hut_sched_destroy(hut_sched_t *sched);
+
+int hut_sched_submit(hut_sched_t *sched, hut_sched_priority_t priority,
+                     hut_sched_fn fn, void *arg);
+
+#endif /* HUT_SCHED_H */
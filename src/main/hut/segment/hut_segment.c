@@ -0,0 +1,1198 @@
+#include "hut/segment/hut_segment.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hut/bloom/hut_bloom.h"
+#include "hut/compress/hut_compress.h"
+#include "hut/util/hut_crc.h"
+#include "hut/util/hut_file.h"
+#include "hut/util/hut_hash.h"
+#include "hut/util/hut_mem.h"
+#include "hut/zone/hut_zone.h"
+
+#define HUT_SEGMENT_MAGIC "HUTSEG\0\1"
+#define HUT_SEGMENT_VERSION 1
+
+#define HUT_SEGMENT_ALIGN 8
+#define HUT_SEGMENT_BLOOM_ALIGN 64
+
+#define HUT_SEGMENT_SEALED     0x1
+#define HUT_SEGMENT_COMPRESSED 0x2
+#define HUT_SEGMENT_MEMORY     0x4  /* never on disk: built in anonymous memory */
+#define HUT_SEGMENT_REMOVED    0x8  /* never on disk: file deleted or replaced */
+
+/* Dictionary training input is capped at this multiple of the dictionary size. */
+#define HUT_SEGMENT_DICT_SAMPLE_RATIO 100
+
+/*
+ * On-disk structures, in host byte order.
+ *
+ *   active:      header | records ...
+ *   sealed:      header | records ... | bloom filter
+ *   compressed:  header | dictionary | blocks ... | block index | bloom filter
+ *
+ *   zoned:       label | sealed or compressed body ... | header
+ *
+ * Sealed files other than those sealed in place are streamed out front
+ * to back through a hut_file_writer_t, header last. Zones cannot be
+ * rewritten, so segments sealed into a zone start with a label, a header
+ * carrying only the segment id, and end with the real header on the last
+ * page written.
+ */
+
+typedef struct hut_segment_header_s {
+  char magic[8];
+  uint32_t version;
+  uint32_t id;
+  uint64_t capacity;
+  uint64_t raw_size;
+  uint64_t index_off;
+  uint64_t dict_off;
+  uint64_t bloom_off;
+  uint32_t flags;
+  uint32_t codec;
+  uint32_t block_count;
+  uint32_t dict_len;
+  uint32_t bloom_len;
+  uint32_t crc;
+} hut_segment_header_t;
+
+typedef struct hut_segment_rec_header_s {
+  uint32_t crc;         /* covers the rest of the header, key and value */
+  uint32_t klen;
+  uint32_t vlen;
+  uint32_t flags;
+  uint64_t seq;
+} hut_segment_rec_header_t;
+
+typedef struct hut_segment_block_s {
+  uint64_t raw_off;
+  uint64_t file_off;
+  uint32_t raw_len;
+  uint32_t len;         /* equal to raw_len when stored uncompressed */
+} hut_segment_block_t;
+
+struct hut_segment_s {
+  char *dir;
+  char *path;
+  int fd;
+  uint32_t id;
+  uint32_t flags;
+  hut_compression_t codec;
+  char *map;
+  size_t map_len;
+  uint64_t capacity;
+  uint64_t size;
+  const hut_segment_block_t *blocks;
+  uint32_t block_count;
+  hut_compress_dict_t *dict;
+  const void *bloom;
+  size_t bloom_len;
+  hut_cache_t *cache;
+  hut_zone_dev_t *zones;        /* device holding the segment, if zoned */
+  uint32_t zone;
+  uint64_t base;                /* device offset of the segment */
+  hut_huge_pages_t huge;        /* backing of the map */
+  uint64_t seal_written;        /* bytes sealing it wrote out */
+};
+
+#define HUT_SEGMENT_DATA(seg) ((seg)->map + HUT_SEGMENT_DATA_OFFSET)
+
+uint64_t hut_segment_record_size(uint32_t klen, uint32_t vlen) {
+  uint64_t len = sizeof(hut_segment_rec_header_t) + (uint64_t) klen + vlen;
+
+  return (len + HUT_SEGMENT_ALIGN - 1) & ~(uint64_t) (HUT_SEGMENT_ALIGN - 1);
+}
+
+static uint32_t hut_segment_rec_crc(const hut_segment_rec_header_t *h) {
+  return hut_crc32c(0, &h->klen, sizeof(*h) - offsetof(hut_segment_rec_header_t, klen)
+                                 + (uint64_t) h->klen + h->vlen);
+}
+
+static char *hut_segment_path(const char *dir, uint32_t id, const char *suffix) {
+  char name[32];
+
+  snprintf(name, sizeof(name), "%08x.seg%s", id, suffix);
+  return hut_file_path(dir, name);
+}
+
+static void hut_segment_header_finish(hut_segment_header_t *h) {
+  memcpy(h->magic, HUT_SEGMENT_MAGIC, sizeof(h->magic));
+  h->version = HUT_SEGMENT_VERSION;
+  h->crc = hut_crc32c(0, h, offsetof(hut_segment_header_t, crc));
+}
+
+static int hut_segment_header_write(int fd, hut_segment_header_t *h) {
+  hut_segment_header_finish(h);
+  return hut_file_pwrite(fd, h, sizeof(*h), 0);
+}
+
+static int hut_segment_header_check(const hut_segment_header_t *h, uint32_t id) {
+  if (memcmp(h->magic, HUT_SEGMENT_MAGIC, sizeof(h->magic))
+      || h->version != HUT_SEGMENT_VERSION
+      || h->id != id
+      || h->crc != hut_crc32c(0, h, offsetof(hut_segment_header_t, crc)))
+    return HUT_ERR_CORRUPT;
+  return HUT_OK;
+}
+
+static int hut_segment_header_read(int fd, uint64_t off, uint32_t id, hut_segment_header_t *h) {
+  if (hut_file_pread(fd, h, sizeof(*h), off))
+    return HUT_ERR_IO;
+  return hut_segment_header_check(h, id);
+}
+
+static hut_segment_t *hut_segment_alloc(const char *dir, uint32_t id, hut_huge_pages_t huge) {
+  hut_segment_t *seg;
+
+  if (!(seg = calloc(1, sizeof(*seg))))
+    return NULL;
+  seg->fd = -1;
+  seg->id = id;
+  seg->huge = huge;
+  seg->dir = strdup(dir);
+  seg->path = hut_segment_path(dir, id, "");
+  if (!seg->dir || !seg->path) {
+    hut_segment_close(seg);
+    return NULL;
+  }
+  return seg;
+}
+
+static int hut_segment_map(hut_segment_t *seg, size_t len, int prot) {
+  void *map;
+
+  if (!(map = hut_mem_map_file(len, prot, seg->fd, seg->base, seg->huge)))
+    return HUT_ERR_IO;
+  seg->map = map;
+  seg->map_len = len;
+  return HUT_OK;
+}
+
+static void hut_segment_unmap(hut_segment_t *seg) {
+  if (seg->flags & HUT_SEGMENT_MEMORY)
+    hut_mem_free(seg->map, seg->map_len, seg->huge);
+  else if (seg->map)
+    munmap(seg->map, seg->map_len);
+  seg->map = NULL;
+  seg->map_len = 0;
+}
+
+/*
+ * Finds the end of the records of an active segment after a restart. The
+ * first record that is zeroed, truncated or fails its checksum marks the
+ * end of what was written before.
+ */
+static void hut_segment_recover(hut_segment_t *seg) {
+  const hut_segment_rec_header_t *h;
+  uint64_t off = 0, len;
+
+  while (off + sizeof(*h) <= seg->capacity) {
+    h = (const hut_segment_rec_header_t *) (HUT_SEGMENT_DATA(seg) + off);
+    if (!h->klen)
+      break;
+    len = hut_segment_record_size(h->klen, h->vlen);
+    if (off + len > seg->capacity || h->crc != hut_segment_rec_crc(h))
+      break;
+    off += len;
+  }
+  seg->size = off;
+}
+
+int hut_segment_create(const char *dir, uint32_t id, uint64_t capacity,
+                       hut_huge_pages_t huge, hut_segment_t **out) {
+  hut_segment_header_t h;
+  hut_segment_t *seg;
+  int rc;
+
+  if (capacity > UINT32_MAX)
+    return HUT_ERR_INVALID;
+  if (!(seg = hut_segment_alloc(dir, id, huge)))
+    return HUT_ERR_NOMEM;
+  seg->capacity = capacity;
+
+  memset(&h, 0, sizeof(h));
+  h.id = id;
+  h.capacity = capacity;
+
+  if ((seg->fd = open(seg->path, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0
+      || hut_file_allocate(seg->fd, 0, HUT_SEGMENT_DATA_OFFSET + capacity)) {
+    rc = HUT_ERR_IO;
+    goto fail;
+  }
+  if ((rc = hut_segment_header_write(seg->fd, &h))
+      || (rc = hut_segment_map(seg, HUT_SEGMENT_DATA_OFFSET + capacity,
+                               PROT_READ | PROT_WRITE)))
+    goto fail;
+
+  *out = seg;
+  return HUT_OK;
+
+fail:
+  if (seg->fd >= 0)
+    unlink(seg->path);
+  hut_segment_close(seg);
+  return rc;
+}
+
+int hut_segment_create_memory(const char *dir, uint32_t id, uint64_t capacity,
+                              hut_huge_pages_t huge, hut_segment_t **out) {
+  hut_segment_t *seg;
+  void *map;
+
+  if (capacity > UINT32_MAX)
+    return HUT_ERR_INVALID;
+  if (!(seg = hut_segment_alloc(dir, id, huge)))
+    return HUT_ERR_NOMEM;
+  if (!(map = hut_mem_alloc(HUT_SEGMENT_DATA_OFFSET + capacity, huge, -1))) {
+    hut_segment_close(seg);
+    return HUT_ERR_NOMEM;
+  }
+  seg->map = map;
+  seg->map_len = HUT_SEGMENT_DATA_OFFSET + capacity;
+  seg->capacity = capacity;
+  seg->flags = HUT_SEGMENT_MEMORY;
+  *out = seg;
+  return HUT_OK;
+}
+
+static uint64_t hut_segment_align(uint64_t off, uint64_t align) {
+  return (off + align - 1) & ~(align - 1);
+}
+
+/* Maps a sealed segment of `size` bytes, without its header when at the end. */
+static int hut_segment_open_sealed(hut_segment_t *seg, const hut_segment_header_t *h,
+                                   uint64_t size, size_t map_len) {
+  int rc;
+
+  if (h->bloom_off + h->bloom_len > size
+      || h->bloom_off % HUT_SEGMENT_BLOOM_ALIGN)
+    return HUT_ERR_CORRUPT;
+  if ((h->flags & HUT_SEGMENT_COMPRESSED)
+      && (h->index_off + (uint64_t) h->block_count * sizeof(hut_segment_block_t) > size
+          || h->dict_off + h->dict_len > size
+          || h->index_off % HUT_SEGMENT_ALIGN))
+    return HUT_ERR_CORRUPT;
+  if (!(h->flags & HUT_SEGMENT_COMPRESSED) && HUT_SEGMENT_DATA_OFFSET + h->raw_size > size)
+    return HUT_ERR_CORRUPT;
+  if ((h->flags & HUT_SEGMENT_COMPRESSED) && !hut_compress_supported((hut_compression_t) h->codec))
+    return HUT_ERR_NOTSUP;
+  if ((rc = hut_segment_map(seg, map_len, PROT_READ)))
+    return rc;
+
+  seg->flags = h->flags;
+  seg->size = h->raw_size;
+  if (h->bloom_len) {
+    seg->bloom = seg->map + h->bloom_off;
+    seg->bloom_len = h->bloom_len;
+  }
+  if (!(h->flags & HUT_SEGMENT_COMPRESSED))
+    return HUT_OK;
+
+  seg->codec = (hut_compression_t) h->codec;
+  seg->blocks = (const hut_segment_block_t *) (seg->map + h->index_off);
+  seg->block_count = h->block_count;
+  if (h->dict_len && !seg->dict)
+    return hut_compress_dict_create(seg->map + h->dict_off, h->dict_len, 0, &seg->dict);
+  return HUT_OK;
+}
+
+int hut_segment_open(const char *dir, uint32_t id, hut_huge_pages_t huge,
+                     hut_segment_t **out) {
+  hut_segment_header_t h;
+  hut_segment_t *seg;
+  struct stat st;
+  int rc;
+
+  if (!(seg = hut_segment_alloc(dir, id, huge)))
+    return HUT_ERR_NOMEM;
+  if ((seg->fd = open(seg->path, O_RDWR)) < 0) {
+    rc = HUT_ERR_IO;
+    goto fail;
+  }
+  if ((rc = hut_segment_header_read(seg->fd, 0, id, &h)))
+    goto fail;
+
+  seg->flags = h.flags;
+  seg->capacity = h.capacity;
+
+  if (!(h.flags & HUT_SEGMENT_SEALED)) {
+    if ((rc = hut_segment_map(seg, HUT_SEGMENT_DATA_OFFSET + h.capacity,
+                              PROT_READ | PROT_WRITE)))
+      goto fail;
+    hut_segment_recover(seg);
+  } else if (fstat(seg->fd, &st)) {
+    rc = HUT_ERR_IO;
+    goto fail;
+  } else if ((rc = hut_segment_open_sealed(seg, &h, (uint64_t) st.st_size,
+                                           (size_t) st.st_size))) {
+    goto fail;
+  }
+
+  *out = seg;
+  return HUT_OK;
+
+fail:
+  hut_segment_close(seg);
+  return rc;
+}
+
+/*
+ * A zoned segment is deleted by resetting its zone, which has to wait for
+ * the last reader to let go of its map. Until then a marker file records
+ * that the zone is dead, so that a restart in between does not bring the
+ * segment back.
+ */
+static int hut_segment_reset_mark(hut_segment_t *seg) {
+  char *path;
+  int fd;
+
+  if (!(path = hut_segment_path(seg->dir, seg->id, ".reset")))
+    return HUT_ERR_NOMEM;
+  fd = open(path, O_WRONLY | O_CREAT, 0644);
+  free(path);
+  if (fd < 0)
+    return HUT_ERR_IO;
+  close(fd);
+  return hut_file_sync_dir(seg->dir);
+}
+
+static int hut_segment_reset_marked(const hut_segment_t *seg) {
+  char *path;
+  int marked;
+
+  if (!(path = hut_segment_path(seg->dir, seg->id, ".reset")))
+    return 0;
+  marked = !access(path, F_OK);
+  free(path);
+  return marked;
+}
+
+static void hut_segment_reset_done(hut_segment_t *seg) {
+  char *path;
+
+  if (!(path = hut_segment_path(seg->dir, seg->id, ".reset")))
+    return;
+  if (!unlink(path))
+    hut_file_sync_dir(seg->dir);
+  free(path);
+}
+
+int hut_segment_open_zone(const char *dir, hut_zone_dev_t *zones, uint32_t zone,
+                          hut_huge_pages_t huge, hut_segment_t **out) {
+  hut_segment_header_t label, h;
+  hut_zone_info_t info;
+  hut_segment_t *seg;
+  uint64_t base = hut_zone_offset(zones, zone);
+  int fd = hut_zone_fd(zones), rc;
+
+  if ((rc = hut_zone_info(zones, zone, &info)))
+    return rc;
+  if (info.state == HUT_ZONE_EMPTY)
+    return HUT_ERR_NOTFOUND;
+  /* Only seals leave zones open, and this one never completed. */
+  if (info.state == HUT_ZONE_OPEN) {
+    if ((rc = hut_zone_reset(zones, zone)))
+      return rc;
+    return HUT_ERR_NOTFOUND;
+  }
+  if (info.wp < 2 * HUT_SEGMENT_DATA_OFFSET)
+    return HUT_ERR_CORRUPT;
+  if (hut_file_pread(fd, &label, sizeof(label), base))
+    return HUT_ERR_IO;
+  if ((rc = hut_segment_header_check(&label, label.id)))
+    return rc;
+
+  if (!(seg = hut_segment_alloc(dir, label.id, huge)))
+    return HUT_ERR_NOMEM;
+  seg->zones = zones;
+  seg->zone = zone;
+  seg->base = base;
+
+  if (hut_segment_reset_marked(seg)) {
+    if (!(rc = hut_zone_reset(zones, zone))) {
+      hut_segment_reset_done(seg);
+      rc = HUT_ERR_NOTFOUND;
+    }
+    goto fail;
+  }
+  if ((rc = hut_segment_header_read(fd, base + info.wp - HUT_SEGMENT_DATA_OFFSET, label.id, &h)))
+    goto fail;
+  if ((seg->fd = dup(fd)) < 0) {
+    rc = HUT_ERR_IO;
+    goto fail;
+  }
+  seg->capacity = h.capacity;
+  if ((rc = hut_segment_open_sealed(seg, &h, info.wp - HUT_SEGMENT_DATA_OFFSET,
+                                    (size_t) info.wp)))
+    goto fail;
+
+  *out = seg;
+  return HUT_OK;
+
+fail:
+  hut_segment_close(seg);
+  return rc;
+}
+
+void hut_segment_close(hut_segment_t *seg) {
+  struct stat st;
+
+  if (!seg)
+    return;
+  hut_segment_unmap(seg);
+  /*
+   * Hand the blocks of a deleted file back right away, discarding them on
+   * the device, rather than leaving the SSD to find out on its own once
+   * they are overwritten.
+   */
+  if (seg->zones && (seg->flags & HUT_SEGMENT_REMOVED)) {
+    if (!hut_zone_reset(seg->zones, seg->zone))
+      hut_segment_reset_done(seg);
+  } else if (seg->fd >= 0 && (seg->flags & HUT_SEGMENT_REMOVED) && !fstat(seg->fd, &st)) {
+    hut_file_punch(seg->fd, 0, (uint64_t) st.st_size);
+  }
+  if (seg->fd >= 0)
+    close(seg->fd);
+  hut_compress_dict_free(seg->dict);
+  free(seg->path);
+  free(seg->dir);
+  free(seg);
+}
+
+void hut_segment_set_cache(hut_segment_t *seg, hut_cache_t *cache) {
+  seg->cache = cache;
+}
+
+int hut_segment_append(hut_segment_t *seg,
+                       const void *key, uint32_t klen,
+                       const void *value, uint32_t vlen,
+                       uint32_t flags, uint64_t seq, uint64_t *off) {
+  hut_segment_rec_header_t *h;
+  uint64_t len;
+  char *p;
+
+  if ((seg->flags & HUT_SEGMENT_SEALED) || !klen)
+    return HUT_ERR_INVALID;
+  len = hut_segment_record_size(klen, vlen);
+  if (seg->size + len > seg->capacity)
+    return HUT_ERR_FULL;
+
+  p = HUT_SEGMENT_DATA(seg) + seg->size;
+  h = (hut_segment_rec_header_t *) p;
+  h->klen = klen;
+  h->vlen = vlen;
+  h->flags = flags;
+  h->seq = seq;
+  p += sizeof(*h);
+  memcpy(p, key, klen);
+  if (vlen)
+    memcpy(p + klen, value, vlen);
+  memset(p + klen + vlen, 0, len - sizeof(*h) - klen - vlen);
+  h->crc = hut_segment_rec_crc(h);
+
+  *off = seg->size;
+  seg->size += len;
+  return HUT_OK;
+}
+
+static int hut_segment_parse(const char *base, uint64_t off, uint64_t end,
+                             hut_segment_record_t *rec) {
+  const hut_segment_rec_header_t *h;
+
+  if (off + sizeof(*h) > end)
+    return HUT_ERR_INVALID;
+  h = (const hut_segment_rec_header_t *) (base + off);
+  if (off + hut_segment_record_size(h->klen, h->vlen) > end)
+    return HUT_ERR_CORRUPT;
+
+  rec->key = h + 1;
+  rec->value = (const char *) (h + 1) + h->klen;
+  rec->klen = h->klen;
+  rec->vlen = h->vlen;
+  rec->flags = h->flags;
+  rec->seq = h->seq;
+  rec->block = NULL;
+  rec->entry = NULL;
+  return HUT_OK;
+}
+
+static const hut_segment_block_t *hut_segment_block_find(const hut_segment_t *seg,
+                                                         uint64_t off) {
+  uint32_t lo = 0, hi = seg->block_count, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (seg->blocks[mid].raw_off <= off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (!lo || off >= seg->blocks[lo - 1].raw_off + seg->blocks[lo - 1].raw_len)
+    return NULL;
+  return &seg->blocks[lo - 1];
+}
+
+/*
+ * Returns the raw bytes of a block, either in place when it was stored
+ * uncompressed, or in a malloc'ed buffer handed back through `owned`.
+ */
+static int hut_segment_block_load(const hut_segment_t *seg,
+                                  const hut_segment_block_t *b,
+                                  const char **raw, void **owned) {
+  void *buf;
+  int rc;
+
+  *owned = NULL;
+  if (b->len == b->raw_len) {
+    *raw = seg->map + b->file_off;
+    return HUT_OK;
+  }
+  if (!(buf = malloc(b->raw_len)))
+    return HUT_ERR_NOMEM;
+  if ((rc = hut_decompress(seg->codec, seg->dict, seg->map + b->file_off, b->len,
+                           buf, b->raw_len))) {
+    free(buf);
+    return rc;
+  }
+  *raw = buf;
+  *owned = buf;
+  return HUT_OK;
+}
+
+/*
+ * Gives a record parsed out of a transient buffer a home of its own: the
+ * record cache when one is attached, or a malloc'ed copy otherwise.
+ */
+static int hut_segment_adopt(hut_segment_t *seg, uint64_t off, hut_segment_record_t *rec) {
+  const char *raw = (const char *) rec->key - sizeof(hut_segment_rec_header_t);
+  uint64_t len = hut_segment_record_size(rec->klen, rec->vlen);
+  hut_cache_entry_t *e;
+  void *copy;
+
+  if (seg->cache && (e = hut_cache_insert(seg->cache, hut_segment_address(seg->id, off), raw, len))) {
+    hut_segment_parse(hut_cache_entry_data(e), 0, hut_cache_entry_len(e), rec);
+    rec->entry = e;
+    return HUT_OK;
+  }
+  if (!(copy = malloc(len)))
+    return HUT_ERR_NOMEM;
+  memcpy(copy, raw, len);
+  hut_segment_parse(copy, 0, len, rec);
+  rec->block = copy;
+  return HUT_OK;
+}
+
+int hut_segment_read(hut_segment_t *seg, uint64_t off, hut_segment_record_t *rec) {
+  const hut_segment_block_t *b;
+  hut_cache_entry_t *e;
+  const char *raw;
+  void *owned;
+  int rc;
+
+  if (!(seg->flags & HUT_SEGMENT_COMPRESSED))
+    return hut_segment_parse(HUT_SEGMENT_DATA(seg), off, seg->size, rec);
+
+  if (seg->cache && (e = hut_cache_lookup(seg->cache, hut_segment_address(seg->id, off)))) {
+    hut_segment_parse(hut_cache_entry_data(e), 0, hut_cache_entry_len(e), rec);
+    rec->entry = e;
+    return HUT_OK;
+  }
+
+  if (!(b = hut_segment_block_find(seg, off)))
+    return HUT_ERR_INVALID;
+  if ((rc = hut_segment_block_load(seg, b, &raw, &owned)))
+    return rc;
+  if ((rc = hut_segment_parse(raw, off - b->raw_off, b->raw_len, rec))) {
+    free(owned);
+    return rc;
+  }
+
+  /* Stored blocks are read in place, there is nothing to save by caching. */
+  if (!owned)
+    return HUT_OK;
+  if (!seg->cache) {
+    rec->block = owned;
+    return HUT_OK;
+  }
+  rc = hut_segment_adopt(seg, off, rec);
+  free(owned);
+  return rc;
+}
+
+int hut_segment_lookup_cached(hut_segment_t *seg, uint64_t off, hut_segment_record_t *rec) {
+  hut_cache_entry_t *e;
+
+  /* Active segments, and those built in memory, are read straight from their map. */
+  if (!(seg->flags & HUT_SEGMENT_SEALED) || (seg->flags & HUT_SEGMENT_MEMORY))
+    return hut_segment_parse(HUT_SEGMENT_DATA(seg), off, seg->size, rec);
+  if (!seg->cache || !(e = hut_cache_lookup(seg->cache, hut_segment_address(seg->id, off))))
+    return HUT_ERR_NOTFOUND;
+  hut_segment_parse(hut_cache_entry_data(e), 0, hut_cache_entry_len(e), rec);
+  rec->entry = e;
+  return HUT_OK;
+}
+
+int hut_segment_extent(const hut_segment_t *seg, uint64_t off, uint32_t hint,
+                       hut_segment_extent_t *ext) {
+  const hut_segment_block_t *b;
+
+  if (seg->flags & HUT_SEGMENT_COMPRESSED) {
+    if (!(b = hut_segment_block_find(seg, off)))
+      return HUT_ERR_INVALID;
+    ext->file_off = seg->base + b->file_off;
+    ext->len = b->len;
+    return HUT_OK;
+  }
+  if (off + sizeof(hut_segment_rec_header_t) > seg->size)
+    return HUT_ERR_INVALID;
+  if (hint < sizeof(hut_segment_rec_header_t))
+    hint = sizeof(hut_segment_rec_header_t);
+  ext->file_off = seg->base + HUT_SEGMENT_DATA_OFFSET + off;
+  ext->len = seg->size - off < hint ? (uint32_t) (seg->size - off) : hint;
+  return HUT_OK;
+}
+
+int hut_segment_read_extent(hut_segment_t *seg, uint64_t off, hut_segment_extent_t *ext,
+                            const void *buf, hut_segment_record_t *rec) {
+  const hut_segment_rec_header_t *h = buf;
+  const hut_segment_block_t *b;
+  uint64_t len;
+  void *raw;
+  int rc;
+
+  if (!(seg->flags & HUT_SEGMENT_COMPRESSED)) {
+    len = hut_segment_record_size(h->klen, h->vlen);
+    if (len > ext->len) {
+      if (off + len > seg->size)
+        return HUT_ERR_CORRUPT;
+      ext->len = (uint32_t) len;
+      return HUT_ERR_FULL;
+    }
+    hut_segment_parse(buf, 0, ext->len, rec);
+    return hut_segment_adopt(seg, off, rec);
+  }
+
+  b = hut_segment_block_find(seg, off);
+  if (b->len == b->raw_len) {
+    if ((rc = hut_segment_parse(buf, off - b->raw_off, b->raw_len, rec)))
+      return rc;
+    return hut_segment_adopt(seg, off, rec);
+  }
+  if (!(raw = malloc(b->raw_len)))
+    return HUT_ERR_NOMEM;
+  if (!(rc = hut_decompress(seg->codec, seg->dict, buf, b->len, raw, b->raw_len))
+      && !(rc = hut_segment_parse(raw, off - b->raw_off, b->raw_len, rec)))
+    rc = hut_segment_adopt(seg, off, rec);
+  free(raw);
+  return rc;
+}
+
+int hut_segment_fd(const hut_segment_t *seg) {
+  return seg->fd;
+}
+
+void hut_segment_record_release(hut_segment_record_t *rec) {
+  if (rec->entry)
+    hut_cache_release(rec->entry);
+  free(rec->block);
+  rec->block = NULL;
+  rec->entry = NULL;
+}
+
+static int hut_segment_iterate_raw(const char *base, uint64_t raw_off, uint64_t len,
+                                   hut_segment_iter_fn fn, void *arg) {
+  hut_segment_record_t rec;
+  uint64_t off = 0;
+  int rc;
+
+  while (off < len) {
+    if ((rc = hut_segment_parse(base, off, len, &rec)))
+      return rc;
+    if ((rc = fn(arg, raw_off + off, &rec)))
+      return rc;
+    off += hut_segment_record_size(rec.klen, rec.vlen);
+  }
+  return HUT_OK;
+}
+
+void hut_segment_prefetch(const hut_segment_t *seg, uint64_t off) {
+  const char *p;
+
+  if (seg->flags & HUT_SEGMENT_COMPRESSED)
+    return;
+  p = HUT_SEGMENT_DATA(seg) + off;
+  __builtin_prefetch(p);
+  __builtin_prefetch(p + 64);
+}
+
+int hut_segment_iterate(hut_segment_t *seg, hut_segment_iter_fn fn, void *arg) {
+  return hut_segment_iterate_to(seg, UINT64_MAX, fn, arg);
+}
+
+int hut_segment_iterate_to(hut_segment_t *seg, uint64_t end, hut_segment_iter_fn fn, void *arg) {
+  const hut_segment_block_t *b;
+  const char *raw;
+  void *owned;
+  uint32_t i;
+  int rc;
+
+  if (!(seg->flags & HUT_SEGMENT_COMPRESSED))
+    return hut_segment_iterate_raw(HUT_SEGMENT_DATA(seg), 0, end < seg->size ? end : seg->size,
+                                   fn, arg);
+
+  for (i = 0; i < seg->block_count && seg->blocks[i].raw_off < end; i++) {
+    b = &seg->blocks[i];
+    if ((rc = hut_segment_block_load(seg, b, &raw, &owned)))
+      return rc;
+    rc = hut_segment_iterate_raw(raw, b->raw_off, end - b->raw_off < b->raw_len
+                                 ? end - b->raw_off : b->raw_len, fn, arg);
+    free(owned);
+    if (rc)
+      return rc;
+  }
+  return HUT_OK;
+}
+
+int hut_segment_record_valid(const hut_segment_record_t *rec) {
+  const hut_segment_rec_header_t *h = (const hut_segment_rec_header_t *) rec->key - 1;
+
+  return h->crc == hut_segment_rec_crc(h);
+}
+
+int hut_segment_sync(hut_segment_t *seg) {
+  if (seg->flags & (HUT_SEGMENT_SEALED | HUT_SEGMENT_MEMORY))
+    return HUT_OK;
+  return msync(seg->map, HUT_SEGMENT_DATA_OFFSET + seg->size, MS_SYNC)
+         ? HUT_ERR_IO : HUT_OK;
+}
+
+/*
+ * Trains a dictionary on the records of the segment, sampling at most
+ * HUT_SEGMENT_DICT_SAMPLE_RATIO times the dictionary size. Records are
+ * contiguous in the map, so they are handed to the trainer in place.
+ */
+static int hut_segment_train(hut_segment_t *seg, const hut_compression_options_t *opts,
+                             void **dict, size_t *dict_len) {
+  const hut_segment_rec_header_t *h;
+  uint64_t off = 0, limit = (uint64_t) opts->dict_size * HUT_SEGMENT_DICT_SAMPLE_RATIO;
+  size_t *sizes = NULL, *grown;
+  unsigned count = 0, cap = 0;
+  int rc;
+
+  while (off < seg->size && off < limit) {
+    h = (const hut_segment_rec_header_t *) (HUT_SEGMENT_DATA(seg) + off);
+    if (count == cap) {
+      cap = cap ? cap * 2 : 1024;
+      if (!(grown = realloc(sizes, cap * sizeof(*sizes)))) {
+        free(sizes);
+        return HUT_ERR_NOMEM;
+      }
+      sizes = grown;
+    }
+    sizes[count++] = hut_segment_record_size(h->klen, h->vlen);
+    off += sizes[count - 1];
+  }
+
+  rc = hut_compress_dict_train(HUT_SEGMENT_DATA(seg), sizes, count, opts->dict_size,
+                               dict, dict_len);
+  free(sizes);
+  return rc;
+}
+
+/*
+ * Cuts the records into blocks of at least `block_size` raw bytes (one
+ * record per block when zero) and compresses each one on its own. Blocks
+ * that do not shrink are stored as is. Writes everything through `w`, and
+ * returns the block index through `out`.
+ */
+static int hut_segment_write_blocks(hut_segment_t *seg, const hut_compression_options_t *opts,
+                                    const hut_compress_dict_t *dict, hut_file_writer_t *w,
+                                    hut_segment_block_t **out, uint32_t *count) {
+  hut_segment_block_t *blocks = NULL, *grown, *b;
+  const hut_segment_rec_header_t *h;
+  uint64_t start = 0, end;
+  uint32_t n = 0, cap = 0;
+  void *scratch = NULL, *p;
+  size_t scratch_len = 0, bound, len;
+  const char *raw;
+  int rc = HUT_OK;
+
+  while (start < seg->size) {
+    end = start;
+    do {
+      h = (const hut_segment_rec_header_t *) (HUT_SEGMENT_DATA(seg) + end);
+      end += hut_segment_record_size(h->klen, h->vlen);
+    } while (end < seg->size && end - start < opts->block_size);
+
+    if (n == cap) {
+      cap = cap ? cap * 2 : 256;
+      if (!(grown = realloc(blocks, cap * sizeof(*blocks)))) {
+        rc = HUT_ERR_NOMEM;
+        break;
+      }
+      blocks = grown;
+    }
+    b = &blocks[n++];
+    b->raw_off = start;
+    b->raw_len = (uint32_t) (end - start);
+    b->file_off = hut_file_writer_offset(w);
+
+    raw = HUT_SEGMENT_DATA(seg) + start;
+    bound = hut_compress_bound(opts->codec, b->raw_len);
+    if (bound > scratch_len) {
+      if (!(p = realloc(scratch, bound))) {
+        rc = HUT_ERR_NOMEM;
+        break;
+      }
+      scratch = p;
+      scratch_len = bound;
+    }
+    if (!hut_compress(opts->codec, opts->level, dict, raw, b->raw_len,
+                      scratch, scratch_len, &len) && len < b->raw_len) {
+      b->len = (uint32_t) len;
+      rc = hut_file_writer_append(w, scratch, len);
+    } else {
+      b->len = b->raw_len;
+      rc = hut_file_writer_append(w, raw, b->raw_len);
+    }
+    if (rc)
+      break;
+    start = end;
+  }
+
+  free(scratch);
+  if (rc) {
+    free(blocks);
+    return rc;
+  }
+  *out = blocks;
+  *count = n;
+  return HUT_OK;
+}
+
+/*
+ * Builds the bloom filter over every key of the segment, tombstones
+ * included, as a lookup must find those too.
+ */
+static int hut_segment_bloom_build(hut_segment_t *seg, unsigned bits_per_key,
+                                   void **out, size_t *len) {
+  const hut_segment_rec_header_t *h;
+  uint64_t off, keys = 0;
+  void *bloom;
+
+  for (off = 0; off < seg->size; off += hut_segment_record_size(h->klen, h->vlen)) {
+    h = (const hut_segment_rec_header_t *) (HUT_SEGMENT_DATA(seg) + off);
+    keys++;
+  }
+
+  *len = hut_bloom_size(keys, bits_per_key);
+  if (posix_memalign(&bloom, HUT_SEGMENT_BLOOM_ALIGN, *len))
+    return HUT_ERR_NOMEM;
+  memset(bloom, 0, *len);
+
+  for (off = 0; off < seg->size; off += hut_segment_record_size(h->klen, h->vlen)) {
+    h = (const hut_segment_rec_header_t *) (HUT_SEGMENT_DATA(seg) + off);
+    hut_bloom_add(bloom, *len, hut_hash_bytes(h + 1, h->klen, 0));
+  }
+  *out = bloom;
+  return HUT_OK;
+}
+
+static int hut_segment_write_compressed(hut_segment_t *seg,
+                                       const hut_compression_options_t *copts,
+                                       hut_file_writer_t *w, hut_segment_header_t *h) {
+  hut_segment_block_t *blocks = NULL;
+  hut_compress_dict_t *dict = NULL;
+  void *dict_buf = NULL;
+  size_t dict_len = 0;
+  uint32_t count = 0;
+  int rc;
+
+  h->flags |= HUT_SEGMENT_COMPRESSED;
+  h->codec = copts->codec;
+
+  if (copts->dict_size && copts->codec == HUT_COMPRESSION_ZSTD
+      && !hut_segment_train(seg, copts, &dict_buf, &dict_len)) {
+    h->dict_off = hut_file_writer_offset(w);
+    h->dict_len = (uint32_t) dict_len;
+    if ((rc = hut_compress_dict_create(dict_buf, dict_len, copts->level, &dict))
+        || (rc = hut_file_writer_append(w, dict_buf, dict_len)))
+      goto out;
+  }
+
+  if ((rc = hut_segment_write_blocks(seg, copts, dict, w, &blocks, &count)))
+    goto out;
+
+  h->index_off = hut_segment_align(hut_file_writer_offset(w), HUT_SEGMENT_ALIGN);
+  h->block_count = count;
+
+  /* Not worth it, let the caller seal the segment uncompressed. */
+  if (h->index_off + (uint64_t) count * sizeof(*blocks) >= HUT_SEGMENT_DATA_OFFSET + seg->size) {
+    rc = HUT_ERR_FULL;
+    goto out;
+  }
+
+  if (!(rc = hut_file_writer_pad(w, h->index_off)))
+    rc = hut_file_writer_append(w, blocks, (size_t) count * sizeof(*blocks));
+
+out:
+  hut_compress_dict_free(dict);
+  free(blocks);
+  free(dict_buf);
+  return rc;
+}
+
+/* Writes the records, compressed or not, and the bloom filter, filling in `h`. */
+static int hut_segment_write_body(hut_segment_t *seg, const hut_segment_seal_options_t *opts,
+                                  int compress, const void *bloom, size_t bloom_len,
+                                  hut_file_writer_t *w, hut_segment_header_t *h) {
+  int rc;
+
+  memset(h, 0, sizeof(*h));
+  h->id = seg->id;
+  h->capacity = seg->capacity;
+  h->raw_size = seg->size;
+  h->flags = HUT_SEGMENT_SEALED;
+
+  if (compress)
+    rc = hut_segment_write_compressed(seg, &opts->compression, w, h);
+  else
+    rc = hut_file_writer_append(w, HUT_SEGMENT_DATA(seg), seg->size);
+  if (rc || !bloom_len)
+    return rc;
+
+  h->bloom_off = hut_segment_align(hut_file_writer_offset(w), HUT_SEGMENT_BLOOM_ALIGN);
+  h->bloom_len = (uint32_t) bloom_len;
+  if ((rc = hut_file_writer_pad(w, h->bloom_off)))
+    return rc;
+  return hut_file_writer_append(w, bloom, bloom_len);
+}
+
+/*
+ * Streams the sealed segment out to a temporary file, compressed or not,
+ * and renames it over the segment file once complete.
+ */
+static int hut_segment_seal_rewrite(hut_segment_t *seg, const hut_segment_seal_options_t *opts,
+                                    int compress, const void *bloom, size_t bloom_len) {
+  hut_segment_header_t h;
+  hut_file_writer_t w;
+  char *tmp;
+  int rc;
+
+  if (!(tmp = hut_segment_path(seg->dir, seg->id, ".tmp")))
+    return HUT_ERR_NOMEM;
+  if ((rc = hut_file_writer_open(&w, tmp, opts && opts->direct, opts ? opts->pool : NULL,
+                                 HUT_SEGMENT_DATA_OFFSET, opts ? opts->erase_block_size : 0))
+      || (rc = hut_segment_write_body(seg, opts, compress, bloom, bloom_len, &w, &h)))
+    goto out;
+
+  hut_segment_header_finish(&h);
+  seg->seal_written = hut_file_writer_offset(&w);
+  if ((rc = hut_file_writer_finish(&w, &h, sizeof(h))))
+    goto out;
+  if (rename(tmp, seg->path)) {
+    rc = HUT_ERR_IO;
+    goto out;
+  }
+  hut_file_sync_dir(seg->dir);
+
+out:
+  hut_file_writer_close(&w);
+  if (rc)
+    unlink(tmp);
+  free(tmp);
+  return rc;
+}
+
+typedef struct hut_segment_zone_sink_s {
+  hut_zone_dev_t *zones;
+  uint32_t zone;
+} hut_segment_zone_sink_t;
+
+static int hut_segment_zone_write(void *ctx, const void *buf, size_t len, uint64_t off) {
+  hut_segment_zone_sink_t *sink = ctx;
+
+  return hut_zone_write(sink->zones, sink->zone, off, buf, len);
+}
+
+/* Streams the sealed segment into an empty zone, between a label and its header. */
+static int hut_segment_seal_zone(hut_segment_t *seg, const hut_segment_seal_options_t *opts,
+                                 int compress, const void *bloom, size_t bloom_len,
+                                 uint32_t *zone) {
+  hut_segment_zone_sink_t sink;
+  hut_segment_header_t h;
+  hut_file_writer_t w;
+  int rc;
+
+  sink.zones = opts->zones;
+  if ((rc = hut_zone_open_empty(sink.zones, opts->zone_reserve, &sink.zone)))
+    return rc;
+  if ((rc = hut_file_writer_open_sink(&w, hut_segment_zone_write, &sink, opts->pool, 0)))
+    goto out;
+
+  memset(&h, 0, sizeof(h));
+  h.id = seg->id;
+  h.capacity = seg->capacity;
+  hut_segment_header_finish(&h);
+  if ((rc = hut_file_writer_append(&w, &h, sizeof(h)))
+      || (rc = hut_file_writer_pad(&w, HUT_SEGMENT_DATA_OFFSET))
+      || (rc = hut_segment_write_body(seg, opts, compress, bloom, bloom_len, &w, &h))
+      || (rc = hut_file_writer_pad(&w, hut_segment_align(hut_file_writer_offset(&w),
+                                                         HUT_SEGMENT_DATA_OFFSET))))
+    goto out;
+  hut_segment_header_finish(&h);
+  if ((rc = hut_file_writer_append(&w, &h, sizeof(h)))
+      || (rc = hut_file_writer_pad(&w, hut_file_writer_offset(&w) - sizeof(h)
+                                       + HUT_SEGMENT_DATA_OFFSET)))
+    goto out;
+  seg->seal_written = hut_file_writer_offset(&w);
+  if ((rc = hut_file_writer_finish(&w, NULL, 0)))
+    goto out;
+  rc = hut_zone_finish(sink.zones, sink.zone);
+
+out:
+  hut_file_writer_close(&w);
+  if (rc)
+    hut_zone_reset(sink.zones, sink.zone);
+  else
+    *zone = sink.zone;
+  return rc;
+}
+
+/* Seals a file backed segment where it is, records being on disk already. */
+static int hut_segment_seal_plain(hut_segment_t *seg, const void *bloom, size_t bloom_len) {
+  hut_segment_header_t h;
+  uint64_t end = HUT_SEGMENT_DATA_OFFSET + seg->size;
+  int rc;
+
+  memset(&h, 0, sizeof(h));
+  h.id = seg->id;
+  h.capacity = seg->capacity;
+  h.raw_size = seg->size;
+  h.flags = HUT_SEGMENT_SEALED;
+  if (bloom_len) {
+    h.bloom_off = hut_segment_align(end, HUT_SEGMENT_BLOOM_ALIGN);
+    h.bloom_len = (uint32_t) bloom_len;
+    end = h.bloom_off + bloom_len;
+  }
+
+  if (ftruncate(seg->fd, (off_t) end))
+    return HUT_ERR_IO;
+  if (bloom_len && (rc = hut_file_pwrite(seg->fd, bloom, bloom_len, h.bloom_off)))
+    return rc;
+  if ((rc = hut_segment_header_write(seg->fd, &h)))
+    return rc;
+  if (fsync(seg->fd))
+    return HUT_ERR_IO;
+  seg->seal_written = bloom_len + sizeof(h);
+  return HUT_OK;
+}
+
+int hut_segment_seal(hut_segment_t *seg, const hut_segment_seal_options_t *opts,
+                     hut_segment_t **sealed) {
+  hut_compression_t codec = opts ? opts->compression.codec : HUT_COMPRESSION_NONE;
+  void *bloom = NULL;
+  size_t bloom_len = 0;
+  uint32_t zone = 0;
+  int rc;
+
+  if (seg->flags & HUT_SEGMENT_SEALED)
+    return HUT_ERR_INVALID;
+  if (!hut_compress_supported(codec))
+    return HUT_ERR_NOTSUP;
+  if ((rc = hut_segment_sync(seg)))
+    return rc;
+  if (opts && opts->bloom_bits_per_key
+      && (rc = hut_segment_bloom_build(seg, opts->bloom_bits_per_key, &bloom, &bloom_len)))
+    return rc;
+
+  rc = HUT_ERR_FULL;
+  if (opts && opts->zones) {
+    if (codec != HUT_COMPRESSION_NONE)
+      rc = hut_segment_seal_zone(seg, opts, 1, bloom, bloom_len, &zone);
+    if (rc == HUT_ERR_FULL)
+      rc = hut_segment_seal_zone(seg, opts, 0, bloom, bloom_len, &zone);
+  } else {
+    if (codec != HUT_COMPRESSION_NONE)
+      rc = hut_segment_seal_rewrite(seg, opts, 1, bloom, bloom_len);
+    if (rc == HUT_ERR_FULL && (seg->flags & HUT_SEGMENT_MEMORY))
+      rc = hut_segment_seal_rewrite(seg, opts, 0, bloom, bloom_len);
+    else if (rc == HUT_ERR_FULL)
+      rc = hut_segment_seal_plain(seg, bloom, bloom_len);
+    else if (!rc)
+      seg->flags |= HUT_SEGMENT_REMOVED;  /* its file got replaced */
+  }
+  free(bloom);
+  if (rc)
+    return rc;
+
+  /* The old handle stays readable but takes no more appends. */
+  seg->flags |= HUT_SEGMENT_SEALED;
+  if (!(opts && opts->zones))
+    return hut_segment_open(seg->dir, seg->id, seg->huge, sealed);
+
+  /* The zone holds the segment now, its active file goes. */
+  if (!(seg->flags & HUT_SEGMENT_MEMORY) && !unlink(seg->path)) {
+    seg->flags |= HUT_SEGMENT_REMOVED;
+    hut_file_sync_dir(seg->dir);
+  }
+  return hut_segment_open_zone(seg->dir, opts->zones, zone, seg->huge, sealed);
+}
+
+int hut_segment_remove(hut_segment_t *seg) {
+  int rc;
+
+  if (seg->flags & HUT_SEGMENT_MEMORY)
+    return HUT_OK;
+  if (seg->zones) {
+    if ((rc = hut_segment_reset_mark(seg)))
+      return rc;
+    seg->flags |= HUT_SEGMENT_REMOVED;
+    return HUT_OK;
+  }
+  if (unlink(seg->path))
+    return HUT_ERR_IO;
+  seg->flags |= HUT_SEGMENT_REMOVED;
+  hut_file_sync_dir(seg->dir);
+  return HUT_OK;
+}
+
+int hut_segment_may_contain(const hut_segment_t *seg, uint64_t hash) {
+  if (!seg->bloom)
+    return 1;
+  return hut_bloom_may_contain(seg->bloom, seg->bloom_len, hash);
+}
+
+uint32_t hut_segment_id(const hut_segment_t *seg) {
+  return seg->id;
+}
+
+int hut_segment_sealed(const hut_segment_t *seg) {
+  return !!(seg->flags & HUT_SEGMENT_SEALED);
+}
+
+int hut_segment_compressed(const hut_segment_t *seg) {
+  return !!(seg->flags & HUT_SEGMENT_COMPRESSED);
+}
+
+uint64_t hut_segment_size(const hut_segment_t *seg) {
+  return seg->size;
+}
+
+uint64_t hut_segment_file_size(const hut_segment_t *seg) {
+  if (seg->flags & HUT_SEGMENT_SEALED)
+    return seg->map_len;
+  return HUT_SEGMENT_DATA_OFFSET + seg->capacity;
+}
+
+uint64_t hut_segment_seal_written(const hut_segment_t *seg) {
+  return seg->seal_written;
+}
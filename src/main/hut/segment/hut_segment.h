@@ -0,0 +1,209 @@
+#ifndef HUT_SEGMENT_H
+#define HUT_SEGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hut/hut.h"
+#include "hut/cache/hut_cache.h"
+#include "hut/util/hut_pool.h"
+#include "hut/zone/hut_zone.h"
+
+/*
+ * Segments are the unit of data storage: append-only files of records,
+ * memory mapped for zero-copy access.
+ *
+ * A segment starts out active. Records are appended into a writable map
+ * of a file preallocated to the segment capacity, and reads return
+ * pointers straight into that map. Once full, a segment is sealed: it
+ * becomes read-only and, if a codec is configured, is rewritten as a
+ * sequence of independently compressed blocks. Blocks are cut on record
+ * boundaries and indexed by their raw offset, so a record keeps the same
+ * address across sealing and callers never need to relocate anything.
+ * Rewritten files are streamed out sequentially, optionally with O_DIRECT
+ * so that sealing does not push hot data out of the page cache.
+ *
+ * Space is reserved with fallocate(), in erase block steps when asked to,
+ * and handed back with hole punching once a file is deleted, so that
+ * flash devices learn about freed blocks without waiting for overwrites.
+ *
+ * Sealed segments can instead be placed one per zone of a zoned device,
+ * written strictly sequentially and deleted with a zone reset, while
+ * active segments stay in files.
+ *
+ * Sealed segments can also carry a bloom filter of their keys, probed
+ * in place from the map, so that compaction can tell a tombstone has no
+ * older record left to shadow without touching data pages.
+ *
+ * Segments are capped at 4 GiB so that a segment id and a record offset
+ * together fit a 64-bit record address.
+ *
+ * Records read from compressed blocks are copied out of the decompressed
+ * block into the decompressed record cache, when one is attached, so
+ * that hot keys of cold segments are only decompressed once.
+ */
+
+/* Records start past the header page so the data area stays page aligned. */
+#define HUT_SEGMENT_DATA_OFFSET 4096
+
+#define HUT_SEGMENT_RECORD_TOMBSTONE 0x1
+
+typedef struct hut_segment_s hut_segment_t;
+
+typedef struct hut_segment_record_s {
+  const void *key;
+  const void *value;
+  uint32_t klen;
+  uint32_t vlen;
+  uint32_t flags;
+  uint64_t seq;
+  void *block;                  /* decompressed block backing key and value */
+  hut_cache_entry_t *entry;     /* or cache entry backing them, both NULL when zero-copy */
+} hut_segment_record_t;
+
+/* Where the bytes backing a record live in the segment file. */
+typedef struct hut_segment_extent_s {
+  uint64_t file_off;
+  uint32_t len;
+} hut_segment_extent_t;
+
+typedef struct hut_segment_seal_options_s {
+  hut_compression_options_t compression;
+  unsigned bloom_bits_per_key;  /* 0 to go without a bloom filter */
+  int direct;                   /* write rewritten files with O_DIRECT */
+  uint64_t erase_block_size;    /* reserve rewritten files in these steps, 0 for none */
+  hut_pool_t *pool;             /* write buffers, NULL to allocate them */
+  hut_zone_dev_t *zones;        /* seal into a zone of this device instead of a file */
+  uint32_t zone_reserve;        /* zones to leave empty, HUT_ERR_FULL when short */
+} hut_segment_seal_options_t;
+
+/* Return non-zero to stop the iteration, which is then returned as is. */
+typedef int (*hut_segment_iter_fn)(void *arg, uint64_t off,
+                                   const hut_segment_record_t *rec);
+
+/*
+ * Constructors take the page backing of the segment map, which a sealed
+ * version inherits; see hut_mem.h.
+ */
+int hut_segment_create(const char *dir, uint32_t id, uint64_t capacity,
+                       hut_huge_pages_t huge, hut_segment_t **out);
+
+/*
+ * Opens the segment sealed into a zone. Zones left empty, holding an
+ * interrupted seal, or deleted but not reset yet are reset if needed and
+ * reported as HUT_ERR_NOTFOUND.
+ */
+int hut_segment_open_zone(const char *dir, hut_zone_dev_t *zones, uint32_t zone,
+                          hut_huge_pages_t huge, hut_segment_t **out);
+
+/*
+ * Creates a segment that lives in anonymous memory until sealed, for
+ * callers such as compaction that write whole segments in one go. It is
+ * readable like an active segment meanwhile, and has no file descriptor.
+ */
+int hut_segment_create_memory(const char *dir, uint32_t id, uint64_t capacity,
+                              hut_huge_pages_t huge, hut_segment_t **out);
+
+int hut_segment_open(const char *dir, uint32_t id, hut_huge_pages_t huge,
+                     hut_segment_t **out);
+
+void hut_segment_close(hut_segment_t *seg);
+
+void hut_segment_set_cache(hut_segment_t *seg, hut_cache_t *cache);
+
+int hut_segment_append(hut_segment_t *seg,
+                       const void *key, uint32_t klen,
+                       const void *value, uint32_t vlen,
+                       uint32_t flags, uint64_t seq, uint64_t *off);
+
+int hut_segment_read(hut_segment_t *seg, uint64_t off, hut_segment_record_t *rec);
+
+void hut_segment_record_release(hut_segment_record_t *rec);
+
+/*
+ * Reads that must not block on a page fault. hut_segment_lookup_cached()
+ * only succeeds when the record can be had without touching the disk,
+ * from an active segment, one built in memory or the record cache.
+ * Otherwise the caller reads the extent from hut_segment_fd() itself,
+ * `hint` bytes speculatively for uncompressed records, and parses it with
+ * hut_segment_read_extent(), which fails with HUT_ERR_FULL and a grown
+ * extent if the hint was short.
+ */
+int hut_segment_lookup_cached(hut_segment_t *seg, uint64_t off, hut_segment_record_t *rec);
+
+int hut_segment_extent(const hut_segment_t *seg, uint64_t off, uint32_t hint,
+                       hut_segment_extent_t *ext);
+
+int hut_segment_read_extent(hut_segment_t *seg, uint64_t off, hut_segment_extent_t *ext,
+                            const void *buf, hut_segment_record_t *rec);
+
+int hut_segment_fd(const hut_segment_t *seg);
+
+/*
+ * Starts loading the header and key of the record at `off` into the cache.
+ * Does nothing for compressed segments, whose records are not in the map.
+ */
+void hut_segment_prefetch(const hut_segment_t *seg, uint64_t off);
+
+int hut_segment_iterate(hut_segment_t *seg, hut_segment_iter_fn fn, void *arg);
+
+/*
+ * Iterates over the records below raw offset `end` only, such as those
+ * appended before some point to a segment that is still being appended to.
+ */
+int hut_segment_iterate_to(hut_segment_t *seg, uint64_t end, hut_segment_iter_fn fn, void *arg);
+
+/*
+ * Whether a record still matches the checksum it was written with. Reads
+ * and iteration only check that records fit in their segment.
+ */
+int hut_segment_record_valid(const hut_segment_record_t *rec);
+
+int hut_segment_sync(hut_segment_t *seg);
+
+/*
+ * Seals the segment and opens the sealed version as `sealed`. The old
+ * handle takes no more appends but stays readable, so that records it
+ * handed out remain valid until it is closed.
+ */
+int hut_segment_seal(hut_segment_t *seg, const hut_segment_seal_options_t *opts,
+                     hut_segment_t **sealed);
+
+/*
+ * Deletes the segment file. The handle stays readable until closed, which
+ * then punches out the blocks of the file so the device can reclaim them,
+ * or resets the zone holding the segment.
+ */
+int hut_segment_remove(hut_segment_t *seg);
+
+/*
+ * Whether the segment may hold a record for the key hashing to `hash`
+ * with hut_hash_bytes(key, klen, 0). Always true without a filter.
+ */
+int hut_segment_may_contain(const hut_segment_t *seg, uint64_t hash);
+
+uint32_t hut_segment_id(const hut_segment_t *seg);
+
+int hut_segment_sealed(const hut_segment_t *seg);
+
+int hut_segment_compressed(const hut_segment_t *seg);
+
+/* Raw bytes of records held, and bytes the segment occupies on disk. */
+uint64_t hut_segment_size(const hut_segment_t *seg);
+
+uint64_t hut_segment_file_size(const hut_segment_t *seg);
+
+/*
+ * Bytes sealing the segment wrote out, leaving out the records of a
+ * segment sealed in place, which were in its file already.
+ */
+uint64_t hut_segment_seal_written(const hut_segment_t *seg);
+
+static inline uint64_t hut_segment_address(uint32_t id, uint64_t off) {
+  return (uint64_t) id << 32 | off;
+}
+
+/* Bytes needed on disk for a record, header and alignment included. */
+uint64_t hut_segment_record_size(uint32_t klen, uint32_t vlen);
+
+#endif /* HUT_SEGMENT_H */
@@ -0,0 +1,246 @@
+#include "hut/trace/hut_trace.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <tinycthread.h>
+
+#include "hut/hut.h"
+
+/*
+ * The file is a header page followed by the rings, each a cache line
+ * holding its head and owner ahead of its events.
+ */
+
+#define HUT_TRACE_HEADER_SIZE 4096
+#define HUT_TRACE_LINE 64
+#define HUT_TRACE_MAX_THREADS 256
+
+typedef struct hut_trace_header_s {
+  char magic[8];
+  uint32_t version;
+  uint32_t event_size;
+  uint32_t threads;
+  uint32_t events;              /* per ring, a power of two */
+  uint64_t start;               /* CLOCK_REALTIME of time 0, in ns */
+  uint32_t claimed;             /* rings handed out, may run past `threads` */
+} hut_trace_header_t;
+
+typedef struct hut_trace_ring_s {
+  uint64_t head;                /* events written */
+  int32_t tid;
+  char pad[HUT_TRACE_LINE - 12];
+  hut_trace_event_t events[];
+} hut_trace_ring_t;
+
+struct hut_trace_s {
+  int fd;
+  char *map;
+  size_t map_len;
+  hut_trace_header_t *header;
+  size_t ring_size;
+  uint64_t base;                /* CLOCK_MONOTONIC of time 0, in ns */
+  tss_t key;
+};
+
+/* Marks threads that found no ring left. */
+static char hut_trace_none;
+
+static uint64_t hut_trace_clock(clockid_t clock) {
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static size_t hut_trace_ring_size(uint32_t events) {
+  return sizeof(hut_trace_ring_t) + (size_t) events * sizeof(hut_trace_event_t);
+}
+
+int hut_trace_create(const char *path, unsigned threads, uint32_t events, hut_trace_t **out) {
+  hut_trace_t *trace;
+  uint32_t n;
+  int rc = HUT_ERR_IO;
+
+  if (!threads || threads > HUT_TRACE_MAX_THREADS || !events || events > (1u << 30))
+    return HUT_ERR_INVALID;
+  for (n = 1; n < events; n *= 2)
+    ;
+  if (!(trace = calloc(1, sizeof(*trace))))
+    return HUT_ERR_NOMEM;
+  trace->fd = -1;
+  trace->ring_size = hut_trace_ring_size(n);
+  trace->map_len = HUT_TRACE_HEADER_SIZE + threads * trace->ring_size;
+  if (tss_create(&trace->key, NULL) != thrd_success) {
+    free(trace);
+    return HUT_ERR_NOMEM;
+  }
+
+  /* Sparse, rings only take the pages their threads write. */
+  if ((trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0
+      || ftruncate(trace->fd, (off_t) trace->map_len))
+    goto fail;
+  if ((trace->map = mmap(NULL, trace->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         trace->fd, 0)) == MAP_FAILED) {
+    trace->map = NULL;
+    goto fail;
+  }
+  trace->header = (hut_trace_header_t *) trace->map;
+  trace->header->version = HUT_TRACE_VERSION;
+  trace->header->event_size = sizeof(hut_trace_event_t);
+  trace->header->threads = threads;
+  trace->header->events = n;
+  trace->header->start = hut_trace_clock(CLOCK_REALTIME);
+  trace->base = hut_trace_clock(CLOCK_MONOTONIC);
+  /* Readers go by the magic, which goes in last. */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(trace->header->magic, HUT_TRACE_MAGIC, sizeof(trace->header->magic));
+
+  *out = trace;
+  return HUT_OK;
+
+fail:
+  hut_trace_close(trace);
+  return rc;
+}
+
+void hut_trace_close(hut_trace_t *trace) {
+  if (!trace)
+    return;
+  if (trace->map)
+    munmap(trace->map, trace->map_len);
+  if (trace->fd >= 0)
+    close(trace->fd);
+  tss_delete(trace->key);
+  free(trace);
+}
+
+/* Returns this thread's ring, NULL when there was none left for it. */
+static hut_trace_ring_t *hut_trace_ring(hut_trace_t *trace) {
+  hut_trace_ring_t *ring;
+  uint32_t i;
+
+  if ((ring = tss_get(trace->key)))
+    return ring == (void *) &hut_trace_none ? NULL : ring;
+  i = __atomic_fetch_add(&trace->header->claimed, 1, __ATOMIC_RELAXED);
+  if (i >= trace->header->threads) {
+    tss_set(trace->key, &hut_trace_none);
+    return NULL;
+  }
+  ring = (hut_trace_ring_t *) (trace->map + HUT_TRACE_HEADER_SIZE + i * trace->ring_size);
+  ring->tid = (int32_t) syscall(SYS_gettid);
+  tss_set(trace->key, ring);
+  return ring;
+}
+
+void hut_trace_record(hut_trace_t *trace, unsigned type, uint64_t start, uint64_t end,
+                      uint64_t hash, uint32_t arg, int status, unsigned flags) {
+  hut_trace_ring_t *ring;
+  hut_trace_event_t *e;
+  uint64_t i;
+
+  if (!(ring = hut_trace_ring(trace)))
+    return;
+  i = ring->head;
+  e = &ring->events[i & (trace->header->events - 1)];
+  __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  e->time = start - trace->base;
+  e->hash = hash;
+  e->latency = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t) (end - start);
+  e->arg = arg;
+  e->type = (uint8_t) type;
+  e->flags = (uint8_t) flags;
+  e->status = (int8_t) status;
+  e->thread = 0;
+  __atomic_store_n(&e->seq, (uint32_t) (i + 1), __ATOMIC_RELEASE);
+  __atomic_store_n(&ring->head, i + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reading.
+ */
+
+static int hut_trace_compare(const void *a, const void *b) {
+  const hut_trace_event_t *x = a, *y = b;
+
+  return x->time < y->time ? -1 : x->time > y->time;
+}
+
+/* Appends the events of ring `r` still in place, oldest first. */
+static void hut_trace_load_ring(const hut_trace_header_t *h, const hut_trace_ring_t *ring,
+                                unsigned r, hut_trace_dump_t *dump) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), i;
+  const hut_trace_event_t *e;
+  hut_trace_event_t copy;
+  uint32_t seq;
+
+  for (i = head > h->events ? head - h->events : 0; i < head; i++) {
+    e = &ring->events[i & (h->events - 1)];
+    seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+    memcpy(&copy, e, sizeof(copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq != (uint32_t) (i + 1) || __atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+      continue;
+    copy.thread = (uint8_t) r;
+    dump->events[dump->count++] = copy;
+  }
+}
+
+int hut_trace_load(const char *path, hut_trace_dump_t *dump) {
+  hut_trace_header_t h;
+  const char *map = MAP_FAILED;
+  size_t map_len = 0, ring_size;
+  unsigned r;
+  int fd, rc = HUT_ERR_CORRUPT;
+
+  memset(dump, 0, sizeof(*dump));
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return HUT_ERR_IO;
+  if (pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h)
+      || memcmp(h.magic, HUT_TRACE_MAGIC, sizeof(h.magic)) || h.version != HUT_TRACE_VERSION
+      || h.event_size != sizeof(hut_trace_event_t) || !h.threads
+      || h.threads > HUT_TRACE_MAX_THREADS || !h.events || (h.events & (h.events - 1)))
+    goto out;
+  ring_size = hut_trace_ring_size(h.events);
+  map_len = HUT_TRACE_HEADER_SIZE + h.threads * ring_size;
+  if ((map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    rc = HUT_ERR_IO;
+    goto out;
+  }
+
+  dump->start = h.start;
+  dump->threads = h.claimed < h.threads ? h.claimed : h.threads;
+  if (!(dump->events = malloc((size_t) dump->threads * h.events * sizeof(*dump->events)
+                              + 1))) {
+    rc = HUT_ERR_NOMEM;
+    goto out;
+  }
+  for (r = 0; r < dump->threads; r++) {
+    const hut_trace_ring_t *ring =
+      (const hut_trace_ring_t *) (map + HUT_TRACE_HEADER_SIZE + r * ring_size);
+
+    dump->tids[r] = ring->tid;
+    hut_trace_load_ring(&h, ring, r, dump);
+  }
+  qsort(dump->events, dump->count, sizeof(*dump->events), hut_trace_compare);
+  rc = HUT_OK;
+
+out:
+  if (map != MAP_FAILED)
+    munmap((void *) map, map_len);
+  close(fd);
+  if (rc)
+    hut_trace_dump_free(dump);
+  return rc;
+}
+
+void hut_trace_dump_free(hut_trace_dump_t *dump) {
+  free(dump->events);
+  memset(dump, 0, sizeof(*dump));
+}
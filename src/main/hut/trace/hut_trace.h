@@ -0,0 +1,63 @@
+#ifndef HUT_TRACE_H
+#define HUT_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary event trace, kept in a memory-mapped file so that it survives
+ * the process and can be read from another one while it runs.
+ *
+ * The file holds a ring of fixed-size events per thread, each written by
+ * its thread alone without locks: the event number goes in last, and
+ * readers keep only events whose number is the one expected for their
+ * slot both before and after copying them. Threads claim a ring on their
+ * first event and keep it; those finding none left are not traced.
+ */
+
+#define HUT_TRACE_MAGIC "HUTTRACE"
+#define HUT_TRACE_VERSION 1
+
+/* Event flags. */
+#define HUT_TRACE_GC 0x1              /* compaction of the shard ran meanwhile */
+
+typedef struct hut_trace_event_s {
+  uint64_t time;                /* start, in ns since the trace began */
+  uint64_t hash;                /* of the key, 0 for none */
+  uint32_t latency;             /* in ns, saturated */
+  uint32_t arg;                 /* segment id, value size or count, by type */
+  uint8_t type;
+  uint8_t flags;
+  int8_t status;
+  uint8_t thread;               /* ring, filled in by readers */
+  uint32_t seq;                 /* event number plus one, 0 while written */
+} hut_trace_event_t;
+
+typedef struct hut_trace_s hut_trace_t;
+
+/*
+ * Creates a trace file of `threads` rings of at least `events` events,
+ * replacing any previous one.
+ */
+int hut_trace_create(const char *path, unsigned threads, uint32_t events, hut_trace_t **out);
+
+void hut_trace_close(hut_trace_t *trace);
+
+/* Start and end are CLOCK_MONOTONIC times in ns. */
+void hut_trace_record(hut_trace_t *trace, unsigned type, uint64_t start, uint64_t end,
+                      uint64_t hash, uint32_t arg, int status, unsigned flags);
+
+/* Events of a trace file, by time. */
+typedef struct hut_trace_dump_s {
+  uint64_t start;               /* CLOCK_REALTIME of time 0, in ns */
+  unsigned threads;             /* rings claimed */
+  int tids[256];                /* of the threads that claimed them */
+  hut_trace_event_t *events;
+  size_t count;
+} hut_trace_dump_t;
+
+int hut_trace_load(const char *path, hut_trace_dump_t *dump);
+
+void hut_trace_dump_free(hut_trace_dump_t *dump);
+
+#endif /* HUT_TRACE_H */
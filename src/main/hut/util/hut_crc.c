@@ -0,0 +1,66 @@
+#include "hut/util/hut_crc.h"
+
+#include <string.h>
+
+#include <tinycthread.h>
+
+#define HUT_CRC32C_POLY 0x82f63b78u
+
+static uint32_t hut_crc32c_table[256];
+static int hut_crc32c_hw;
+static once_flag hut_crc32c_once = ONCE_FLAG_INIT;
+
+static void hut_crc32c_init(void) {
+  uint32_t i, j, crc;
+
+  for (i = 0; i < 256; i++) {
+    crc = i;
+    for (j = 0; j < 8; j++)
+      crc = (crc & 1) ? (crc >> 1) ^ HUT_CRC32C_POLY : crc >> 1;
+    hut_crc32c_table[i] = crc;
+  }
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  hut_crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t hut_crc32c_sw(uint32_t crc, const uint8_t *p, size_t len) {
+  while (len--)
+    crc = hut_crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t hut_crc32c_hw64(uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t crc64 = crc;
+  uint64_t word;
+
+  while (len && ((uintptr_t) p & 7)) {
+    crc64 = __builtin_ia32_crc32qi((uint32_t) crc64, *p++);
+    len--;
+  }
+  while (len >= 8) {
+    memcpy(&word, p, 8);
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    p += 8;
+    len -= 8;
+  }
+  while (len--)
+    crc64 = __builtin_ia32_crc32qi((uint32_t) crc64, *p++);
+  return (uint32_t) crc64;
+}
+#endif
+
+uint32_t hut_crc32c(uint32_t crc, const void *buf, size_t len) {
+  call_once(&hut_crc32c_once, hut_crc32c_init);
+
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (hut_crc32c_hw)
+    return ~hut_crc32c_hw64(crc, buf, len);
+#endif
+  return ~hut_crc32c_sw(crc, buf, len);
+}
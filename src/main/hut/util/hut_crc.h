@@ -0,0 +1,15 @@
+#ifndef HUT_CRC_H
+#define HUT_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU
+ * has it and a table driven implementation otherwise. Pass the previous
+ * result as `crc` to checksum discontiguous buffers, 0 to start.
+ */
+
+uint32_t hut_crc32c(uint32_t crc, const void *buf, size_t len);
+
+#endif /* HUT_CRC_H */
@@ -0,0 +1,118 @@
+#include "hut/util/hut_deque.h"
+
+#include <stdlib.h>
+
+#include "hut/hut.h"
+
+#define HUT_DEQUE_MIN_SIZE 64
+
+struct hut_deque_array_s {
+  int64_t size;
+  hut_deque_array_t *next;      /* in the retired list */
+  void *items[];
+};
+
+static hut_deque_array_t *hut_deque_array_alloc(int64_t size) {
+  hut_deque_array_t *a;
+
+  if (!(a = malloc(sizeof(*a) + (size_t) size * sizeof(void *))))
+    return NULL;
+  a->size = size;
+  a->next = NULL;
+  return a;
+}
+
+static void *hut_deque_get(hut_deque_array_t *a, int64_t i) {
+  return __atomic_load_n(&a->items[i & (a->size - 1)], __ATOMIC_RELAXED);
+}
+
+static void hut_deque_put(hut_deque_array_t *a, int64_t i, void *item) {
+  __atomic_store_n(&a->items[i & (a->size - 1)], item, __ATOMIC_RELAXED);
+}
+
+int hut_deque_init(hut_deque_t *d) {
+  d->top = 0;
+  d->bottom = 0;
+  d->retired = NULL;
+  if (!(d->array = hut_deque_array_alloc(HUT_DEQUE_MIN_SIZE)))
+    return HUT_ERR_NOMEM;
+  return HUT_OK;
+}
+
+void hut_deque_destroy(hut_deque_t *d) {
+  hut_deque_array_t *a;
+
+  while ((a = d->retired)) {
+    d->retired = a->next;
+    free(a);
+  }
+  free(d->array);
+  d->array = NULL;
+}
+
+static hut_deque_array_t *hut_deque_grow(hut_deque_t *d, hut_deque_array_t *a,
+                                         int64_t top, int64_t bottom) {
+  hut_deque_array_t *grown;
+  int64_t i;
+
+  if (!(grown = hut_deque_array_alloc(a->size * 2)))
+    return NULL;
+  for (i = top; i < bottom; i++)
+    hut_deque_put(grown, i, hut_deque_get(a, i));
+  a->next = d->retired;
+  d->retired = a;
+  __atomic_store_n(&d->array, grown, __ATOMIC_RELEASE);
+  return grown;
+}
+
+int hut_deque_push(hut_deque_t *d, void *item) {
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+  hut_deque_array_t *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+  if (b - t > a->size - 1 && !(a = hut_deque_grow(d, a, t, b)))
+    return HUT_ERR_NOMEM;
+  hut_deque_put(a, b, item);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  return HUT_OK;
+}
+
+void *hut_deque_take(hut_deque_t *d) {
+  int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1, t;
+  hut_deque_array_t *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+  void *item = NULL;
+
+  __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+  if (t <= b) {
+    item = hut_deque_get(a, b);
+    if (t == b) {
+      /* The last item, which a thief may be going for as well. */
+      if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        item = NULL;
+      __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+  } else {
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return item;
+}
+
+void *hut_deque_steal(hut_deque_t *d) {
+  int64_t t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE), b;
+  hut_deque_array_t *a;
+  void *item;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b)
+    return NULL;
+  a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+  item = hut_deque_get(a, t);
+  if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    return NULL;
+  return item;
+}
@@ -0,0 +1,39 @@
+#ifndef HUT_DEQUE_H
+#define HUT_DEQUE_H
+
+#include <stdint.h>
+
+/*
+ * Chase-Lev work-stealing deque of pointers, in the formulation for weak
+ * memory models of Lê et al. Its owner pushes and takes at the bottom
+ * without ever contending with anyone but a thief going for the very last
+ * item; any other thread may steal from the top.
+ *
+ * The array grows as needed. Arrays grown out of stay allocated until the
+ * deque is destroyed, as a thief may still be reading from them.
+ */
+
+typedef struct hut_deque_array_s hut_deque_array_t;
+
+typedef struct hut_deque_s {
+  int64_t top;
+  char pad[64];
+  int64_t bottom;
+  hut_deque_array_t *array;
+  hut_deque_array_t *retired;
+} hut_deque_t;
+
+int hut_deque_init(hut_deque_t *d);
+
+void hut_deque_destroy(hut_deque_t *d);
+
+/* Owner only. */
+int hut_deque_push(hut_deque_t *d, void *item);
+
+/* Owner only, NULL when empty. */
+void *hut_deque_take(hut_deque_t *d);
+
+/* NULL when empty or when losing a race for the item. */
+void *hut_deque_steal(hut_deque_t *d);
+
+#endif /* HUT_DEQUE_H */
@@ -0,0 +1,259 @@
+#include "hut/util/hut_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hut/hut.h"
+
+int hut_file_pwrite(int fd, const void *buf, size_t len, uint64_t off) {
+  const char *p = buf;
+  ssize_t n;
+
+  while (len) {
+    n = pwrite(fd, p, len, (off_t) off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return HUT_ERR_IO;
+    }
+    p += n;
+    off += n;
+    len -= n;
+  }
+  return HUT_OK;
+}
+
+int hut_file_pread(int fd, void *buf, size_t len, uint64_t off) {
+  char *p = buf;
+  ssize_t n;
+
+  while (len) {
+    n = pread(fd, p, len, (off_t) off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return HUT_ERR_IO;
+    }
+    if (n == 0)
+      return HUT_ERR_IO;
+    p += n;
+    off += n;
+    len -= n;
+  }
+  return HUT_OK;
+}
+
+int hut_file_writev(int fd, struct iovec *iov, int count) {
+  ssize_t n;
+
+  while (count) {
+    n = writev(fd, iov, count);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return HUT_ERR_IO;
+    }
+    for (; count && (size_t) n >= iov->iov_len; iov++, count--)
+      n -= iov->iov_len;
+    if (count) {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return HUT_OK;
+}
+
+int hut_file_sync_dir(const char *dir) {
+  int fd, rc;
+
+  if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+    return HUT_ERR_IO;
+  rc = fsync(fd) ? HUT_ERR_IO : HUT_OK;
+  close(fd);
+  return rc;
+}
+
+int hut_file_allocate(int fd, uint64_t off, uint64_t len) {
+  struct stat st;
+
+  if (!fallocate(fd, 0, (off_t) off, (off_t) len))
+    return HUT_OK;
+  if (errno != EOPNOTSUPP && errno != ENOSYS)
+    return HUT_ERR_IO;
+  if (fstat(fd, &st))
+    return HUT_ERR_IO;
+  if ((uint64_t) st.st_size < off + len && ftruncate(fd, (off_t) (off + len)))
+    return HUT_ERR_IO;
+  return HUT_OK;
+}
+
+int hut_file_punch(int fd, uint64_t off, uint64_t len) {
+  if (!fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) off, (off_t) len))
+    return HUT_OK;
+  return errno == EOPNOTSUPP || errno == ENOSYS ? HUT_ERR_NOTSUP : HUT_ERR_IO;
+}
+
+char *hut_file_path(const char *dir, const char *name) {
+  size_t dlen = strlen(dir), nlen = strlen(name);
+  char *path;
+
+  if (!(path = malloc(dlen + nlen + 2)))
+    return NULL;
+  memcpy(path, dir, dlen);
+  path[dlen] = '/';
+  memcpy(path + dlen + 1, name, nlen + 1);
+  return path;
+}
+
+#define HUT_FILE_WRITER_BUFFER (1u << 20)
+
+static int hut_file_writer_init(hut_file_writer_t *w, hut_pool_t *pool, uint64_t start) {
+  void *buf = NULL;
+
+  memset(w, 0, sizeof(*w));
+  w->fd = -1;
+  if (start % HUT_POOL_ALIGN)
+    return HUT_ERR_INVALID;
+
+  if (pool) {
+    buf = hut_pool_get(pool);
+    w->cap = hut_pool_buffer_size(pool);
+  } else if (posix_memalign(&buf, HUT_POOL_ALIGN, HUT_FILE_WRITER_BUFFER)) {
+    buf = NULL;
+  } else {
+    w->cap = HUT_FILE_WRITER_BUFFER;
+  }
+  if (!buf)
+    return HUT_ERR_NOMEM;
+  w->buf = buf;
+  w->pool = pool;
+  w->off = start;
+  return HUT_OK;
+}
+
+int hut_file_writer_open(hut_file_writer_t *w, const char *path, int direct,
+                         hut_pool_t *pool, uint64_t start, uint64_t extent) {
+  int rc;
+
+  if ((rc = hut_file_writer_init(w, pool, start)))
+    return rc;
+  w->extent = extent;
+  if (direct && (w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644)) >= 0)
+    w->direct = 1;
+  else if ((w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    return HUT_ERR_IO;
+  return HUT_OK;
+}
+
+int hut_file_writer_open_sink(hut_file_writer_t *w, hut_file_sink_fn sink, void *ctx,
+                              hut_pool_t *pool, uint64_t start) {
+  int rc;
+
+  if ((rc = hut_file_writer_init(w, pool, start)))
+    return rc;
+  w->sink = sink;
+  w->sink_ctx = ctx;
+  return HUT_OK;
+}
+
+/* Writes out the whole pages of the buffer, keeping a partial last page. */
+static int hut_file_writer_flush(hut_file_writer_t *w, int all) {
+  size_t len = w->fill, keep;
+  uint64_t end;
+  int rc;
+
+  if (all)
+    len = (len + HUT_POOL_ALIGN - 1) & ~(size_t) (HUT_POOL_ALIGN - 1);
+  else
+    len &= ~(size_t) (HUT_POOL_ALIGN - 1);
+  if (!len)
+    return HUT_OK;
+  memset(w->buf + w->fill, 0, len > w->fill ? len - w->fill : 0);
+  if (w->extent && w->off + len > w->allocated) {
+    end = (w->off + len + w->extent - 1) / w->extent * w->extent;
+    if ((rc = hut_file_allocate(w->fd, w->allocated, end - w->allocated)))
+      return rc;
+    w->allocated = end;
+  }
+  if (w->sink)
+    rc = w->sink(w->sink_ctx, w->buf, len, w->off);
+  else
+    rc = hut_file_pwrite(w->fd, w->buf, len, w->off);
+  if (rc)
+    return rc;
+
+  keep = len < w->fill ? w->fill - len : 0;
+  memmove(w->buf, w->buf + len, keep);
+  w->off += len;
+  w->fill = keep;
+  return HUT_OK;
+}
+
+int hut_file_writer_append(hut_file_writer_t *w, const void *buf, size_t len) {
+  const char *p = buf;
+  size_t n;
+  int rc;
+
+  while (len) {
+    if (w->fill == w->cap && (rc = hut_file_writer_flush(w, 0)))
+      return rc;
+    n = w->cap - w->fill < len ? w->cap - w->fill : len;
+    memcpy(w->buf + w->fill, p, n);
+    w->fill += n;
+    p += n;
+    len -= n;
+  }
+  return HUT_OK;
+}
+
+int hut_file_writer_pad(hut_file_writer_t *w, uint64_t off) {
+  size_t n;
+  int rc;
+
+  if (off < hut_file_writer_offset(w))
+    return HUT_ERR_INVALID;
+  while (hut_file_writer_offset(w) < off) {
+    if (w->fill == w->cap && (rc = hut_file_writer_flush(w, 0)))
+      return rc;
+    n = w->cap - w->fill;
+    if (n > off - hut_file_writer_offset(w))
+      n = (size_t) (off - hut_file_writer_offset(w));
+    memset(w->buf + w->fill, 0, n);
+    w->fill += n;
+  }
+  return HUT_OK;
+}
+
+int hut_file_writer_finish(hut_file_writer_t *w, const void *head, size_t head_len) {
+  uint64_t end = hut_file_writer_offset(w);
+  int rc;
+
+  if (head_len > HUT_POOL_ALIGN)
+    return HUT_ERR_INVALID;
+  if ((rc = hut_file_writer_flush(w, 1)) || w->sink)
+    return rc;
+
+  /* The buffer is free again, stage the head page in it. */
+  memset(w->buf, 0, HUT_POOL_ALIGN);
+  memcpy(w->buf, head, head_len);
+  if ((rc = hut_file_pwrite(w->fd, w->buf, HUT_POOL_ALIGN, 0)))
+    return rc;
+  if (ftruncate(w->fd, (off_t) end) || fdatasync(w->fd))
+    return HUT_ERR_IO;
+  return HUT_OK;
+}
+
+void hut_file_writer_close(hut_file_writer_t *w) {
+  if (w->fd >= 0)
+    close(w->fd);
+  if (w->pool)
+    hut_pool_put(w->pool, w->buf);
+  else
+    free(w->buf);
+  w->fd = -1;
+  w->buf = NULL;
+}
@@ -0,0 +1,98 @@
+#ifndef HUT_FILE_H
+#define HUT_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "hut/util/hut_pool.h"
+
+/*
+ * Small POSIX file helpers shared by the storage modules. All of them
+ * retry on EINTR and short transfers, and return HUT_OK or HUT_ERR_IO.
+ */
+
+int hut_file_pwrite(int fd, const void *buf, size_t len, uint64_t off);
+
+int hut_file_pread(int fd, void *buf, size_t len, uint64_t off);
+
+/* Writes at the file offset, advancing `iov` past what was written. */
+int hut_file_writev(int fd, struct iovec *iov, int count);
+
+int hut_file_sync_dir(const char *dir);
+
+/*
+ * Reserves blocks for `[off, off + len)`, extending the file as needed,
+ * so that later writes never allocate. Falls back to extending the file
+ * sparsely where fallocate() is not supported.
+ */
+int hut_file_allocate(int fd, uint64_t off, uint64_t len);
+
+/*
+ * Releases the blocks backing `[off, off + len)` without changing the
+ * file size, which the file system passes down to the device as a discard
+ * when mounted to. HUT_ERR_NOTSUP where holes cannot be punched.
+ */
+int hut_file_punch(int fd, uint64_t off, uint64_t len);
+
+/* Returns a malloc'ed "<dir>/<name>", or NULL when out of memory. */
+char *hut_file_path(const char *dir, const char *name);
+
+/*
+ * Sequential writer for files written once front to back, such as sealed
+ * segments. Data is staged in a page aligned buffer, from `pool` when
+ * given, and written out a buffer at a time. With `direct` the file is
+ * opened O_DIRECT so the writes bypass the page cache, falling back to
+ * buffered writes on file systems without O_DIRECT support.
+ *
+ * Writing starts at `start`, which must be page aligned; the bytes before
+ * it are written last by hut_file_writer_finish(), so that a file only
+ * gets a valid header once everything after it is in place.
+ *
+ * With a non-zero `extent`, blocks are reserved ahead of the writes in
+ * multiples of it, typically the erase block size of the device.
+ *
+ * A writer can also feed a sink instead of a file, which then receives
+ * page aligned writes in strictly ascending order.
+ */
+typedef int (*hut_file_sink_fn)(void *ctx, const void *buf, size_t len, uint64_t off);
+
+typedef struct hut_file_writer_s {
+  int fd;
+  hut_file_sink_fn sink;
+  void *sink_ctx;
+  int direct;
+  hut_pool_t *pool;
+  char *buf;
+  size_t cap;
+  size_t fill;
+  uint64_t off;                 /* file offset of buf[0] */
+  uint64_t extent;
+  uint64_t allocated;
+} hut_file_writer_t;
+
+int hut_file_writer_open(hut_file_writer_t *w, const char *path, int direct,
+                         hut_pool_t *pool, uint64_t start, uint64_t extent);
+
+int hut_file_writer_open_sink(hut_file_writer_t *w, hut_file_sink_fn sink, void *ctx,
+                              hut_pool_t *pool, uint64_t start);
+
+int hut_file_writer_append(hut_file_writer_t *w, const void *buf, size_t len);
+
+/* Zero fills up to `off`, which must not be behind the current offset. */
+int hut_file_writer_pad(hut_file_writer_t *w, uint64_t off);
+
+static inline uint64_t hut_file_writer_offset(const hut_file_writer_t *w) {
+  return w->off + w->fill;
+}
+
+/*
+ * Flushes, writes `head` at offset 0, trims the file to size and syncs it.
+ * Sinks only get the flush, and no head.
+ */
+int hut_file_writer_finish(hut_file_writer_t *w, const void *head, size_t head_len);
+
+void hut_file_writer_close(hut_file_writer_t *w);
+
+#endif /* HUT_FILE_H */
@@ -0,0 +1,14 @@
+#include "hut/util/hut_futex.h"
+
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+void hut_futex_wait(int *addr, int val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+void hut_futex_wake(int *addr, int count) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count < 0 ? INT_MAX : count, NULL, NULL, 0);
+}
@@ -0,0 +1,14 @@
+#ifndef HUT_FUTEX_H
+#define HUT_FUTEX_H
+
+/*
+ * Thin wrappers over the futex system call, for threads that spin on a
+ * word and only sleep once spinning stops paying off.
+ */
+
+/* Sleeps as long as `*addr` holds `val`; may return spuriously. */
+void hut_futex_wait(int *addr, int val);
+
+void hut_futex_wake(int *addr, int count);
+
+#endif /* HUT_FUTEX_H */
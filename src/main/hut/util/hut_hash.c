@@ -0,0 +1,36 @@
+#include "hut/util/hut_hash.h"
+
+#include <string.h>
+
+#define HUT_HASH_M 0xc6a4a7935bd1e995ull
+#define HUT_HASH_R 47
+
+uint64_t hut_hash_bytes(const void *buf, size_t len, uint64_t seed) {
+  const unsigned char *p = buf, *end = p + (len & ~(size_t) 7);
+  uint64_t h = seed ^ (len * HUT_HASH_M), k;
+
+  for (; p != end; p += 8) {
+    memcpy(&k, p, 8);
+    k *= HUT_HASH_M;
+    k ^= k >> HUT_HASH_R;
+    k *= HUT_HASH_M;
+    h ^= k;
+    h *= HUT_HASH_M;
+  }
+
+  switch (len & 7) {
+  case 7: h ^= (uint64_t) p[6] << 48;
+  case 6: h ^= (uint64_t) p[5] << 40;
+  case 5: h ^= (uint64_t) p[4] << 32;
+  case 4: h ^= (uint64_t) p[3] << 24;
+  case 3: h ^= (uint64_t) p[2] << 16;
+  case 2: h ^= (uint64_t) p[1] << 8;
+  case 1: h ^= (uint64_t) p[0];
+          h *= HUT_HASH_M;
+  }
+
+  h ^= h >> HUT_HASH_R;
+  h *= HUT_HASH_M;
+  h ^= h >> HUT_HASH_R;
+  return h;
+}
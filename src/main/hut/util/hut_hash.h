@@ -0,0 +1,23 @@
+#ifndef HUT_HASH_H
+#define HUT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 64-bit finalizer from splitmix64. Cheap, and good enough to spread
+ * sequential integers such as record addresses over a table.
+ */
+static inline uint64_t hut_hash64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+/* MurmurHash64A of a byte string, used for keys. */
+uint64_t hut_hash_bytes(const void *buf, size_t len, uint64_t seed);
+
+#endif /* HUT_HASH_H */
@@ -0,0 +1,86 @@
+#include "hut/util/hut_histogram.h"
+
+#include <string.h>
+
+/* Values below HUT_HISTOGRAM_SUB_BUCKETS get a bucket each. */
+static unsigned hut_histogram_bucket(uint64_t value) {
+  unsigned msb, shift;
+
+  if (value < HUT_HISTOGRAM_SUB_BUCKETS)
+    return (unsigned) value;
+  msb = 63 - (unsigned) __builtin_clzll(value);
+  shift = msb - HUT_HISTOGRAM_SUB_BITS;
+  return (shift + 1) * HUT_HISTOGRAM_SUB_BUCKETS
+         + (unsigned) (value >> shift) - HUT_HISTOGRAM_SUB_BUCKETS;
+}
+
+/* Highest value of a bucket. */
+static uint64_t hut_histogram_top(unsigned bucket) {
+  unsigned shift;
+
+  if (bucket < HUT_HISTOGRAM_SUB_BUCKETS)
+    return bucket;
+  shift = bucket / HUT_HISTOGRAM_SUB_BUCKETS - 1;
+  return (((uint64_t) (bucket % HUT_HISTOGRAM_SUB_BUCKETS + HUT_HISTOGRAM_SUB_BUCKETS) + 1)
+          << shift) - 1;
+}
+
+static void hut_histogram_add(uint64_t *counter, uint64_t n) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void hut_histogram_init(hut_histogram_t *hist) {
+  memset(hist, 0, sizeof(*hist));
+  hist->min = UINT64_MAX;
+}
+
+void hut_histogram_record(hut_histogram_t *hist, uint64_t value) {
+  hut_histogram_add(&hist->buckets[hut_histogram_bucket(value)], 1);
+  hut_histogram_add(&hist->count, 1);
+  hut_histogram_add(&hist->sum, value);
+  if (value < hist->min)
+    __atomic_store_n(&hist->min, value, __ATOMIC_RELAXED);
+  if (value > hist->max)
+    __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+}
+
+void hut_histogram_merge(hut_histogram_t *dst, const hut_histogram_t *src) {
+  uint64_t v;
+  unsigned i;
+
+  for (i = 0; i < HUT_HISTOGRAM_BUCKETS; i++)
+    dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+  dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+  dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+  if ((v = __atomic_load_n(&src->min, __ATOMIC_RELAXED)) < dst->min)
+    dst->min = v;
+  if ((v = __atomic_load_n(&src->max, __ATOMIC_RELAXED)) > dst->max)
+    dst->max = v;
+}
+
+uint64_t hut_histogram_percentile(const hut_histogram_t *hist, double percentile) {
+  uint64_t total = 0, rank, seen = 0, top;
+  unsigned i;
+
+  for (i = 0; i < HUT_HISTOGRAM_BUCKETS; i++)
+    total += hist->buckets[i];
+  if (!total)
+    return 0;
+  if (percentile <= 0)
+    return hist->min;
+  if (percentile >= 100)
+    return hist->max;
+  if (!(rank = (uint64_t) (percentile / 100 * (double) total + 0.5)))
+    rank = 1;
+  for (i = 0; i < HUT_HISTOGRAM_BUCKETS; i++) {
+    if ((seen += hist->buckets[i]) < rank)
+      continue;
+    top = hut_histogram_top(i);
+    return top < hist->max ? top : hist->max;
+  }
+  return hist->max;
+}
+
+double hut_histogram_mean(const hut_histogram_t *hist) {
+  return hist->count ? (double) hist->sum / (double) hist->count : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef HUT_HISTOGRAM_H
+#define HUT_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear histogram of 64-bit values, after HdrHistogram: every power
+ * of two is split into HUT_HISTOGRAM_SUB_BUCKETS linear buckets, so that
+ * values are kept to within about 3% whatever their magnitude, in a fixed
+ * 15 KiB.
+ *
+ * A histogram has a single writer, which updates it with plain atomic
+ * loads and stores, and any number of readers, which merge it into one of
+ * their own without stopping the writer. Readers may then see a value in
+ * a bucket before it shows in the count, or the other way around.
+ */
+
+#define HUT_HISTOGRAM_SUB_BITS 5
+#define HUT_HISTOGRAM_SUB_BUCKETS (1u << HUT_HISTOGRAM_SUB_BITS)
+#define HUT_HISTOGRAM_BUCKETS ((65 - HUT_HISTOGRAM_SUB_BITS) * HUT_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct hut_histogram_s {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;                 /* UINT64_MAX while empty */
+  uint64_t max;
+  uint64_t buckets[HUT_HISTOGRAM_BUCKETS];
+} hut_histogram_t;
+
+void hut_histogram_init(hut_histogram_t *hist);
+
+/* Writer only. */
+void hut_histogram_record(hut_histogram_t *hist, uint64_t value);
+
+/* Adds `src` to `dst`, which must not be written to meanwhile. */
+void hut_histogram_merge(hut_histogram_t *dst, const hut_histogram_t *src);
+
+/*
+ * The value at or below which `percentile` (from 0 to 100) of the values
+ * lie, as the top of its bucket, capped by the maximum. 0 when empty.
+ */
+uint64_t hut_histogram_percentile(const hut_histogram_t *hist, double percentile);
+
+double hut_histogram_mean(const hut_histogram_t *hist);
+
+#endif /* HUT_HISTOGRAM_H */
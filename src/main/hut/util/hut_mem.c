@@ -0,0 +1,99 @@
+#include "hut/util/hut_mem.h"
+
+#include <sys/mman.h>
+
+#include "hut/util/hut_numa.h"
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+static size_t hut_mem_round(size_t len) {
+  return (len + HUT_MEM_HUGE_PAGE - 1) & ~(size_t) (HUT_MEM_HUGE_PAGE - 1);
+}
+
+/*
+ * Reserves `len` bytes of address space starting `phase` bytes past a huge
+ * page boundary, trimming the slack of an oversized reservation.
+ */
+static char *hut_mem_reserve(size_t len, size_t phase) {
+  char *p, *start;
+  size_t span = len + HUT_MEM_HUGE_PAGE;
+
+  p = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  start = p + ((phase - (uintptr_t) p) & (HUT_MEM_HUGE_PAGE - 1));
+  if (start > p)
+    munmap(p, (size_t) (start - p));
+  if (p + span > start + len)
+    munmap(start + len, (size_t) (p + span - (start + len)));
+  return start;
+}
+
+static void hut_mem_advise(void *p, size_t len) {
+#ifdef MADV_HUGEPAGE
+  madvise(p, len, MADV_HUGEPAGE);
+#else
+  (void) p;
+  (void) len;
+#endif
+}
+
+static char *hut_mem_map_anon(size_t len, hut_huge_pages_t huge) {
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  char *p;
+
+  if (huge == HUT_HUGE_PAGES_NONE) {
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+  }
+
+  len = hut_mem_round(len);
+  /* Reserve the pages up front, or running short means SIGBUS on fault. */
+  if (huge == HUT_HUGE_PAGES_HUGETLB) {
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+             -1, 0);
+    if (p != MAP_FAILED)
+      return p;
+  }
+  if (!(p = hut_mem_reserve(len, 0)))
+    return NULL;
+  if (mmap(p, len, PROT_READ | PROT_WRITE, flags | MAP_FIXED, -1, 0) == MAP_FAILED) {
+    munmap(p, len);
+    return NULL;
+  }
+  hut_mem_advise(p, len);
+  return p;
+}
+
+void *hut_mem_alloc(size_t len, hut_huge_pages_t huge, int node) {
+  char *p;
+
+  /* Nothing is faulted in yet, so binding now places every page. */
+  if ((p = hut_mem_map_anon(len, huge)) && node >= 0)
+    hut_numa_bind(p, huge == HUT_HUGE_PAGES_NONE ? len : hut_mem_round(len), node);
+  return p;
+}
+
+void hut_mem_free(void *p, size_t len, hut_huge_pages_t huge) {
+  if (!p)
+    return;
+  munmap(p, huge == HUT_HUGE_PAGES_NONE ? len : hut_mem_round(len));
+}
+
+void *hut_mem_map_file(size_t len, int prot, int fd, uint64_t off, hut_huge_pages_t huge) {
+  char *p = NULL, *map;
+
+  if (huge != HUT_HUGE_PAGES_NONE && !(p = hut_mem_reserve(len, (size_t) off)))
+    return NULL;
+  map = mmap(p, len, prot, MAP_SHARED | (p ? MAP_FIXED : 0), fd, (off_t) off);
+  if (map == MAP_FAILED) {
+    if (p)
+      munmap(p, len);
+    return NULL;
+  }
+  if (p)
+    hut_mem_advise(map, len);
+  return map;
+}
@@ -0,0 +1,34 @@
+#ifndef HUT_MEM_H
+#define HUT_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hut/hut.h"
+
+/*
+ * Large mappings backed by huge pages, to cut the TLB misses of random
+ * accesses spread over gigabytes of index and segments.
+ *
+ * Mappings are placed on a huge page boundary, or for files at an address
+ * congruent to the file offset, since the kernel can only back aligned
+ * ranges with a huge page. Transparent huge pages are then requested with
+ * MADV_HUGEPAGE, which also covers systems where THP is set to "madvise".
+ * Reserved hugetlbfs pages only back anonymous memory, and allocation
+ * falls back to transparent huge pages when none are left.
+ */
+
+#define HUT_MEM_HUGE_PAGE (2u << 20)
+
+/*
+ * Zeroed anonymous memory, NULL when out of memory. Pages come from NUMA
+ * node `node` when not negative.
+ */
+void *hut_mem_alloc(size_t len, hut_huge_pages_t huge, int node);
+
+void hut_mem_free(void *p, size_t len, hut_huge_pages_t huge);
+
+/* Shared mapping of `[off, off + len)` of `fd`, NULL on failure; munmap() it. */
+void *hut_mem_map_file(size_t len, int prot, int fd, uint64_t off, hut_huge_pages_t huge);
+
+#endif /* HUT_MEM_H */
@@ -0,0 +1,80 @@
+#include "hut/util/hut_numa.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define HUT_NUMA_ONLINE "/sys/devices/system/node/online"
+#define HUT_NUMA_CPU_DIR "/sys/devices/system/cpu/cpu%u"
+
+/* From <numaif.h>, which comes with libnuma. */
+#define HUT_NUMA_MPOL_PREFERRED 1
+
+unsigned hut_numa_node_count(void) {
+  unsigned count = 1, lo, hi;
+  char sep;
+  FILE *f;
+
+  if (!(f = fopen(HUT_NUMA_ONLINE, "r")))
+    return 1;
+  /* A list of ranges such as "0-1,3", the highest node is what counts. */
+  while (fscanf(f, "%u", &lo) == 1) {
+    hi = lo;
+    if ((sep = (char) fgetc(f)) == '-' && fscanf(f, "%u", &hi) == 1)
+      sep = (char) fgetc(f);
+    if (hi + 1 > count)
+      count = hi + 1;
+    if (sep != ',')
+      break;
+  }
+  fclose(f);
+  return count;
+}
+
+void hut_numa_bind(void *p, size_t len, int node) {
+#ifdef SYS_mbind
+  unsigned long mask;
+
+  if (node < 0 || node >= (int) (8 * sizeof(mask)) || hut_numa_node_count() < 2)
+    return;
+  mask = 1ul << node;
+  syscall(SYS_mbind, p, len, HUT_NUMA_MPOL_PREFERRED, &mask, 8 * sizeof(mask), 0);
+#else
+  (void) p;
+  (void) len;
+  (void) node;
+#endif
+}
+
+unsigned hut_numa_cpu_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (unsigned) n : 1;
+}
+
+int hut_numa_cpu_node(unsigned cpu) {
+  char path[64];
+  struct dirent *ent;
+  int node = 0;
+  DIR *dir;
+
+  /* The CPU directory links to its node as "node<N>". */
+  snprintf(path, sizeof(path), HUT_NUMA_CPU_DIR, cpu);
+  if (!(dir = opendir(path)))
+    return 0;
+  while ((ent = readdir(dir)))
+    if (sscanf(ent->d_name, "node%d", &node) == 1)
+      break;
+  closedir(dir);
+  return node;
+}
+
+int hut_numa_pin(unsigned cpu) {
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set);
+}
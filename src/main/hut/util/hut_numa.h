@@ -0,0 +1,31 @@
+#ifndef HUT_NUMA_H
+#define HUT_NUMA_H
+
+#include <stddef.h>
+
+/*
+ * NUMA topology and memory placement, straight from sysfs and the mbind()
+ * system call so that no libnuma is needed. On machines or kernels without
+ * NUMA everything reports a single node and binding does nothing.
+ */
+
+/* Number of online nodes, at least 1. */
+unsigned hut_numa_node_count(void);
+
+/* Number of online CPUs, at least 1. */
+unsigned hut_numa_cpu_count(void);
+
+/* Node of a CPU, 0 when unknown. */
+int hut_numa_cpu_node(unsigned cpu);
+
+/* Pins the calling thread to a CPU, returns non-zero when it cannot be. */
+int hut_numa_pin(unsigned cpu);
+
+/*
+ * Asks for the pages of `[p, p + len)`, which must be page aligned, to be
+ * allocated on `node`, falling back to other nodes when it runs out. A
+ * negative node leaves placement to the kernel.
+ */
+void hut_numa_bind(void *p, size_t len, int node);
+
+#endif /* HUT_NUMA_H */
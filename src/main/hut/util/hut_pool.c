@@ -0,0 +1,72 @@
+#include "hut/util/hut_pool.h"
+
+#include <stdlib.h>
+
+#include <tinycthread.h>
+
+#include "hut/hut.h"
+
+struct hut_pool_s {
+  mtx_t lock;
+  size_t buffer_size;
+  unsigned max_free;
+  unsigned free_count;
+  void **free;
+};
+
+int hut_pool_create(size_t buffer_size, unsigned max_free, hut_pool_t **out) {
+  hut_pool_t *pool;
+
+  if (!buffer_size)
+    return HUT_ERR_INVALID;
+  if (!(pool = calloc(1, sizeof(*pool))))
+    return HUT_ERR_NOMEM;
+  if (max_free && !(pool->free = malloc(max_free * sizeof(*pool->free)))) {
+    free(pool);
+    return HUT_ERR_NOMEM;
+  }
+  mtx_init(&pool->lock, mtx_plain);
+  pool->buffer_size = (buffer_size + HUT_POOL_ALIGN - 1) & ~(size_t) (HUT_POOL_ALIGN - 1);
+  pool->max_free = max_free;
+  *out = pool;
+  return HUT_OK;
+}
+
+void hut_pool_destroy(hut_pool_t *pool) {
+  if (!pool)
+    return;
+  while (pool->free_count)
+    free(pool->free[--pool->free_count]);
+  mtx_destroy(&pool->lock);
+  free(pool->free);
+  free(pool);
+}
+
+void *hut_pool_get(hut_pool_t *pool) {
+  void *buf = NULL;
+
+  mtx_lock(&pool->lock);
+  if (pool->free_count)
+    buf = pool->free[--pool->free_count];
+  mtx_unlock(&pool->lock);
+
+  if (!buf && posix_memalign(&buf, HUT_POOL_ALIGN, pool->buffer_size))
+    return NULL;
+  return buf;
+}
+
+void hut_pool_put(hut_pool_t *pool, void *buf) {
+  if (!buf)
+    return;
+  mtx_lock(&pool->lock);
+  if (pool->free_count < pool->max_free) {
+    pool->free[pool->free_count++] = buf;
+    buf = NULL;
+  }
+  mtx_unlock(&pool->lock);
+  free(buf);
+}
+
+size_t hut_pool_buffer_size(const hut_pool_t *pool) {
+  return pool->buffer_size;
+}
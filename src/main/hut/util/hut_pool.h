@@ -0,0 +1,28 @@
+#ifndef HUT_POOL_H
+#define HUT_POOL_H
+
+#include <stddef.h>
+
+/*
+ * Pool of equally sized, page aligned buffers, as needed for O_DIRECT.
+ * Buffers handed back are kept for reuse, up to `max_free` of them, so
+ * that streaming writers do not keep faulting in fresh memory.
+ * Thread-safe.
+ */
+
+#define HUT_POOL_ALIGN 4096
+
+typedef struct hut_pool_s hut_pool_t;
+
+int hut_pool_create(size_t buffer_size, unsigned max_free, hut_pool_t **out);
+
+void hut_pool_destroy(hut_pool_t *pool);
+
+/* Returns NULL when out of memory. */
+void *hut_pool_get(hut_pool_t *pool);
+
+void hut_pool_put(hut_pool_t *pool, void *buf);
+
+size_t hut_pool_buffer_size(const hut_pool_t *pool);
+
+#endif /* HUT_POOL_H */
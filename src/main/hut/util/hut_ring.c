@@ -0,0 +1,108 @@
+#include "hut/util/hut_ring.h"
+
+#include <stdlib.h>
+
+#include "hut/hut.h"
+#include "hut/util/hut_futex.h"
+
+int hut_ring_create(uint32_t capacity, hut_ring_t **out) {
+  hut_ring_t *ring;
+  uint64_t size = 2, i;
+
+  while (size < capacity)
+    size <<= 1;
+  if (posix_memalign((void **) &ring, HUT_RING_CACHE_LINE, sizeof(*ring)))
+    return HUT_ERR_NOMEM;
+  if (!(ring->slots = malloc(size * sizeof(*ring->slots)))) {
+    free(ring);
+    return HUT_ERR_NOMEM;
+  }
+  for (i = 0; i < size; i++)
+    ring->slots[i].seq = i;
+  ring->mask = size - 1;
+  ring->tail = 0;
+  ring->head = 0;
+  ring->sleeping = 0;
+  ring->stopped = 0;
+  *out = ring;
+  return HUT_OK;
+}
+
+void hut_ring_destroy(hut_ring_t *ring) {
+  if (!ring)
+    return;
+  free(ring->slots);
+  free(ring);
+}
+
+int hut_ring_push(hut_ring_t *ring, void *data) {
+  uint64_t pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED), seq;
+  hut_ring_slot_t *slot;
+  int64_t diff;
+
+  for (;;) {
+    slot = &ring->slots[pos & ring->mask];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    diff = (int64_t) (seq - pos);
+    if (!diff) {
+      if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    } else if (diff < 0) {
+      return HUT_ERR_FULL;
+    } else {
+      pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    }
+  }
+  slot->data = data;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+  /* Pairs with the fence in hut_ring_wait(): either it sees the slot or we see it asleep. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED))
+    hut_ring_wake(ring);
+  return HUT_OK;
+}
+
+void *hut_ring_pop(hut_ring_t *ring) {
+  hut_ring_slot_t *slot = &ring->slots[ring->head & ring->mask];
+  void *data;
+
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->head + 1)
+    return NULL;
+  data = slot->data;
+  __atomic_store_n(&slot->seq, ring->head + ring->mask + 1, __ATOMIC_RELEASE);
+  ring->head++;
+  return data;
+}
+
+void hut_ring_wait(hut_ring_t *ring) {
+  hut_ring_slot_t *slot = &ring->slots[ring->head & ring->mask];
+
+  __atomic_store_n(&ring->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == ring->head + 1
+      || __atomic_load_n(&ring->stopped, __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+    return;
+  }
+  hut_futex_wait(&ring->sleeping, 1);
+  __atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+void hut_ring_wake(hut_ring_t *ring) {
+  if (__atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_RELAXED))
+    hut_futex_wake(&ring->sleeping, 1);
+}
+
+void hut_ring_stop(hut_ring_t *ring) {
+  __atomic_store_n(&ring->stopped, 1, __ATOMIC_RELEASE);
+  /* As in hut_ring_push(): either the consumer sees it stopped or we see it asleep. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED))
+    hut_ring_wake(ring);
+}
+
+int hut_ring_stopped(hut_ring_t *ring) {
+  return __atomic_load_n(&ring->stopped, __ATOMIC_ACQUIRE);
+}
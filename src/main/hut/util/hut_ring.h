@@ -0,0 +1,60 @@
+#ifndef HUT_RING_H
+#define HUT_RING_H
+
+#include <stdint.h>
+
+/*
+ * Bounded lock-free ring of pointers with any number of producers and a
+ * single consumer, after Vyukov's bounded queue: every slot carries a
+ * sequence number telling producers and the consumer whose turn it is,
+ * so pushing costs one compare-and-swap and popping none.
+ *
+ * The consumer may sleep in hut_ring_wait() while the ring is empty, and
+ * producers wake it up on push. Both only touch the futex when the
+ * consumer actually went to sleep. hut_ring_stop() asks the consumer to
+ * quit, and is seen by a wait racing it the way a push is.
+ */
+
+#define HUT_RING_CACHE_LINE 64
+
+typedef struct hut_ring_slot_s {
+  uint64_t seq;
+  void *data;
+} hut_ring_slot_t;
+
+typedef struct hut_ring_s {
+  uint64_t mask;
+  hut_ring_slot_t *slots;
+  char pad0[HUT_RING_CACHE_LINE];
+  uint64_t tail;                /* next slot to push, shared by producers */
+  char pad1[HUT_RING_CACHE_LINE];
+  uint64_t head;                /* next slot to pop, consumer only */
+  int sleeping;                 /* futex word, set while the consumer sleeps */
+  int stopped;
+} hut_ring_t;
+
+/* `capacity` is rounded up to a power of two. */
+int hut_ring_create(uint32_t capacity, hut_ring_t **out);
+
+void hut_ring_destroy(hut_ring_t *ring);
+
+/* HUT_ERR_FULL when the ring is full. */
+int hut_ring_push(hut_ring_t *ring, void *data);
+
+/* Returns NULL when the ring is empty. Consumer only. */
+void *hut_ring_pop(hut_ring_t *ring);
+
+/*
+ * Sleeps until something was pushed, the ring was stopped, or
+ * hut_ring_wake(). Consumer only.
+ */
+void hut_ring_wait(hut_ring_t *ring);
+
+void hut_ring_wake(hut_ring_t *ring);
+
+/* Stops the ring for good, waking the consumer up. */
+void hut_ring_stop(hut_ring_t *ring);
+
+int hut_ring_stopped(hut_ring_t *ring);
+
+#endif /* HUT_RING_H */
@@ -0,0 +1,277 @@
+#include "hut/zone/hut_zone.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tinycthread.h>
+
+#include "hut/util/hut_crc.h"
+#include "hut/util/hut_file.h"
+
+#define HUT_ZONE_MAGIC "HUTZONE\1"
+
+/* Zones start on a 1 MiB boundary past the header and the zone table. */
+#define HUT_ZONE_ALIGN (1u << 20)
+
+/*
+ * On-disk structures, in host byte order.
+ *
+ *   header | zone table | zones ...
+ */
+
+typedef struct hut_zone_header_s {
+  char magic[8];
+  uint64_t zone_size;
+  uint32_t zone_count;
+  uint32_t crc;
+} hut_zone_header_t;
+
+typedef struct hut_zone_entry_s {
+  uint64_t wp;
+  uint32_t state;
+  uint32_t crc;
+} hut_zone_entry_t;
+
+struct hut_zone_dev_s {
+  int fd;
+  mtx_t lock;
+  uint64_t zone_size;
+  uint32_t zone_count;
+  uint32_t max_open;
+  uint32_t open_count;
+  uint64_t zones_off;
+  hut_zone_entry_t *zones;
+};
+
+static uint64_t hut_zone_table_off(uint32_t zone) {
+  return HUT_ZONE_BLOCK + (uint64_t) zone * sizeof(hut_zone_entry_t);
+}
+
+static int hut_zone_persist(hut_zone_dev_t *dev, uint32_t zone) {
+  hut_zone_entry_t *e = &dev->zones[zone];
+
+  e->crc = hut_crc32c(0, e, offsetof(hut_zone_entry_t, crc));
+  if (hut_file_pwrite(dev->fd, e, sizeof(*e), hut_zone_table_off(zone))
+      || fdatasync(dev->fd))
+    return HUT_ERR_IO;
+  return HUT_OK;
+}
+
+static int hut_zone_load(hut_zone_dev_t *dev) {
+  hut_zone_entry_t *e;
+  uint32_t i;
+
+  if (hut_file_pread(dev->fd, dev->zones, dev->zone_count * sizeof(*dev->zones),
+                     hut_zone_table_off(0)))
+    return HUT_ERR_IO;
+  for (i = 0; i < dev->zone_count; i++) {
+    e = &dev->zones[i];
+    if (e->crc != hut_crc32c(0, e, offsetof(hut_zone_entry_t, crc))
+        || e->state > HUT_ZONE_FULL || e->wp > dev->zone_size)
+      return HUT_ERR_CORRUPT;
+    if (e->state == HUT_ZONE_OPEN)
+      dev->open_count++;
+  }
+  return HUT_OK;
+}
+
+static int hut_zone_format(hut_zone_dev_t *dev) {
+  hut_zone_header_t h;
+  uint32_t i;
+
+  for (i = 0; i < dev->zone_count; i++)
+    dev->zones[i].crc = hut_crc32c(0, &dev->zones[i], offsetof(hut_zone_entry_t, crc));
+  if (hut_file_pwrite(dev->fd, dev->zones, dev->zone_count * sizeof(*dev->zones),
+                      hut_zone_table_off(0))
+      || ftruncate(dev->fd, (off_t) (dev->zones_off + dev->zone_size * dev->zone_count)))
+    return HUT_ERR_IO;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, HUT_ZONE_MAGIC, sizeof(h.magic));
+  h.zone_size = dev->zone_size;
+  h.zone_count = dev->zone_count;
+  h.crc = hut_crc32c(0, &h, offsetof(hut_zone_header_t, crc));
+  if (hut_file_pwrite(dev->fd, &h, sizeof(h), 0) || fsync(dev->fd))
+    return HUT_ERR_IO;
+  return HUT_OK;
+}
+
+int hut_zone_open(const char *path, uint64_t zone_size, uint32_t zone_count,
+                  uint32_t max_open, hut_zone_dev_t **out) {
+  hut_zone_header_t h;
+  hut_zone_dev_t *dev;
+  int created = 0, rc;
+
+  if (!zone_size || zone_size % HUT_ZONE_BLOCK || !zone_count || !max_open)
+    return HUT_ERR_INVALID;
+  if (!(dev = calloc(1, sizeof(*dev))))
+    return HUT_ERR_NOMEM;
+  mtx_init(&dev->lock, mtx_plain);
+  dev->zone_size = zone_size;
+  dev->zone_count = zone_count;
+  dev->max_open = max_open;
+  dev->zones_off = (hut_zone_table_off(zone_count) + HUT_ZONE_ALIGN - 1)
+                   & ~(uint64_t) (HUT_ZONE_ALIGN - 1);
+
+  if ((dev->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644)) >= 0)
+    created = 1;
+  else if (errno != EEXIST || (dev->fd = open(path, O_RDWR)) < 0) {
+    rc = HUT_ERR_IO;
+    goto fail;
+  }
+  if (!(dev->zones = calloc(zone_count, sizeof(*dev->zones)))) {
+    rc = HUT_ERR_NOMEM;
+    goto fail;
+  }
+
+  if (created) {
+    if ((rc = hut_zone_format(dev))) {
+      unlink(path);
+      goto fail;
+    }
+  } else {
+    if (hut_file_pread(dev->fd, &h, sizeof(h), 0)) {
+      rc = HUT_ERR_IO;
+      goto fail;
+    }
+    if (memcmp(h.magic, HUT_ZONE_MAGIC, sizeof(h.magic))
+        || h.crc != hut_crc32c(0, &h, offsetof(hut_zone_header_t, crc))) {
+      rc = HUT_ERR_CORRUPT;
+      goto fail;
+    }
+    if (h.zone_size != zone_size || h.zone_count != zone_count) {
+      rc = HUT_ERR_INVALID;
+      goto fail;
+    }
+    if ((rc = hut_zone_load(dev)))
+      goto fail;
+  }
+
+  *out = dev;
+  return HUT_OK;
+
+fail:
+  hut_zone_close(dev);
+  return rc;
+}
+
+void hut_zone_close(hut_zone_dev_t *dev) {
+  if (!dev)
+    return;
+  if (dev->fd >= 0)
+    close(dev->fd);
+  mtx_destroy(&dev->lock);
+  free(dev->zones);
+  free(dev);
+}
+
+/* Moves an empty zone to open, with the lock held. */
+static int hut_zone_do_open(hut_zone_dev_t *dev, uint32_t zone) {
+  if (dev->open_count >= dev->max_open)
+    return HUT_ERR_BUSY;
+  dev->zones[zone].state = HUT_ZONE_OPEN;
+  dev->open_count++;
+  return hut_zone_persist(dev, zone);
+}
+
+int hut_zone_open_empty(hut_zone_dev_t *dev, uint32_t reserve, uint32_t *zone) {
+  uint32_t i, first = 0, empty = 0;
+  int rc = HUT_ERR_FULL;
+
+  mtx_lock(&dev->lock);
+  for (i = 0; i < dev->zone_count; i++)
+    if (dev->zones[i].state == HUT_ZONE_EMPTY && !empty++)
+      first = i;
+  if (empty > reserve && !(rc = hut_zone_do_open(dev, first)))
+    *zone = first;
+  mtx_unlock(&dev->lock);
+  return rc;
+}
+
+int hut_zone_write(hut_zone_dev_t *dev, uint32_t zone, uint64_t off,
+                   const void *buf, size_t len) {
+  hut_zone_entry_t *e;
+  int rc = HUT_OK;
+
+  if (zone >= dev->zone_count || off % HUT_ZONE_BLOCK || len % HUT_ZONE_BLOCK)
+    return HUT_ERR_INVALID;
+
+  mtx_lock(&dev->lock);
+  e = &dev->zones[zone];
+  if (e->state == HUT_ZONE_FULL || off != e->wp)
+    rc = HUT_ERR_INVALID;
+  else if (off + len > dev->zone_size)
+    rc = HUT_ERR_FULL;
+  else if (e->state == HUT_ZONE_EMPTY)
+    rc = hut_zone_do_open(dev, zone);
+  if (!rc && !(rc = hut_file_pwrite(dev->fd, buf, len, dev->zones_off + zone * dev->zone_size + off)))
+    e->wp += len;
+  mtx_unlock(&dev->lock);
+  return rc;
+}
+
+int hut_zone_finish(hut_zone_dev_t *dev, uint32_t zone) {
+  hut_zone_entry_t *e;
+  int rc;
+
+  if (zone >= dev->zone_count)
+    return HUT_ERR_INVALID;
+  mtx_lock(&dev->lock);
+  e = &dev->zones[zone];
+  if (e->state == HUT_ZONE_OPEN)
+    dev->open_count--;
+  e->state = HUT_ZONE_FULL;
+  rc = fdatasync(dev->fd) ? HUT_ERR_IO : hut_zone_persist(dev, zone);
+  mtx_unlock(&dev->lock);
+  return rc;
+}
+
+int hut_zone_reset(hut_zone_dev_t *dev, uint32_t zone) {
+  hut_zone_entry_t *e;
+  int rc;
+
+  if (zone >= dev->zone_count)
+    return HUT_ERR_INVALID;
+  mtx_lock(&dev->lock);
+  e = &dev->zones[zone];
+  if (e->state == HUT_ZONE_OPEN)
+    dev->open_count--;
+  e->state = HUT_ZONE_EMPTY;
+  e->wp = 0;
+  /* A drive drops the data of a reset zone, do the same. */
+  rc = hut_file_punch(dev->fd, dev->zones_off + zone * dev->zone_size, dev->zone_size);
+  if (!rc || rc == HUT_ERR_NOTSUP)
+    rc = hut_zone_persist(dev, zone);
+  mtx_unlock(&dev->lock);
+  return rc;
+}
+
+int hut_zone_info(hut_zone_dev_t *dev, uint32_t zone, hut_zone_info_t *info) {
+  if (zone >= dev->zone_count)
+    return HUT_ERR_INVALID;
+  mtx_lock(&dev->lock);
+  info->state = (hut_zone_state_t) dev->zones[zone].state;
+  info->wp = dev->zones[zone].wp;
+  mtx_unlock(&dev->lock);
+  return HUT_OK;
+}
+
+int hut_zone_fd(const hut_zone_dev_t *dev) {
+  return dev->fd;
+}
+
+uint64_t hut_zone_offset(const hut_zone_dev_t *dev, uint32_t zone) {
+  return dev->zones_off + zone * dev->zone_size;
+}
+
+uint64_t hut_zone_size(const hut_zone_dev_t *dev) {
+  return dev->zone_size;
+}
+
+uint32_t hut_zone_count(const hut_zone_dev_t *dev) {
+  return dev->zone_count;
+}
@@ -0,0 +1,78 @@
+#ifndef HUT_ZONE_H
+#define HUT_ZONE_H
+
+#include <stdint.h>
+
+#include "hut/hut.h"
+
+/*
+ * File-backed emulation of a zoned block device, following the rules of
+ * zoned namespaces:
+ *
+ *   - a device is split into equally sized zones, each with a write
+ *     pointer, and a zone may only be written at its write pointer, in
+ *     whole blocks,
+ *   - writing to an empty zone opens it, and at most `max_open` zones may
+ *     be open at once; finishing a zone makes it full and read-only,
+ *   - space is only ever reclaimed by resetting a whole zone, which drops
+ *     its data and rewinds the write pointer.
+ *
+ * Zones are laid out back to back in a single file after a small table of
+ * write pointers and states, which is persisted on every state change so
+ * that reopening the device reports what a drive would, but for the write
+ * pointers of zones left open, which stay where they were when opened:
+ * writes are only synced when a zone is finished. Written zones can be
+ * read and mapped through hut_zone_fd() at hut_zone_offset().
+ */
+
+#define HUT_ZONE_BLOCK 4096
+
+typedef struct hut_zone_dev_s hut_zone_dev_t;
+
+typedef enum hut_zone_state_e {
+  HUT_ZONE_EMPTY = 0,
+  HUT_ZONE_OPEN  = 1,
+  HUT_ZONE_FULL  = 2
+} hut_zone_state_t;
+
+typedef struct hut_zone_info_s {
+  hut_zone_state_t state;
+  uint64_t wp;                  /* bytes written into the zone */
+} hut_zone_info_t;
+
+/*
+ * Opens the emulated device at `path`, creating it with the given geometry
+ * if missing. An existing device keeps its geometry, HUT_ERR_INVALID if it
+ * does not match.
+ */
+int hut_zone_open(const char *path, uint64_t zone_size, uint32_t zone_count,
+                  uint32_t max_open, hut_zone_dev_t **out);
+
+void hut_zone_close(hut_zone_dev_t *dev);
+
+/*
+ * Opens an empty zone as long as `reserve` more are left empty, HUT_ERR_FULL
+ * otherwise, HUT_ERR_BUSY at the open limit.
+ */
+int hut_zone_open_empty(hut_zone_dev_t *dev, uint32_t reserve, uint32_t *zone);
+
+/* HUT_ERR_INVALID unless `off` is the write pointer and both are block aligned. */
+int hut_zone_write(hut_zone_dev_t *dev, uint32_t zone, uint64_t off,
+                   const void *buf, size_t len);
+
+/* Syncs the zone and makes it full, closing it. */
+int hut_zone_finish(hut_zone_dev_t *dev, uint32_t zone);
+
+int hut_zone_reset(hut_zone_dev_t *dev, uint32_t zone);
+
+int hut_zone_info(hut_zone_dev_t *dev, uint32_t zone, hut_zone_info_t *info);
+
+int hut_zone_fd(const hut_zone_dev_t *dev);
+
+uint64_t hut_zone_offset(const hut_zone_dev_t *dev, uint32_t zone);
+
+uint64_t hut_zone_size(const hut_zone_dev_t *dev);
+
+uint32_t hut_zone_count(const hut_zone_dev_t *dev);
+
+#endif /* HUT_ZONE_H */
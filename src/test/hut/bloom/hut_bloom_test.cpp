@@ -0,0 +1,146 @@
+#include "hut_test.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/bloom/hut_bloom.h"
+#include "hut/segment/hut_segment.h"
+#include "hut/util/hut_hash.h"
+}
+
+/*
+ * Bloom filters: no false negatives, false positives about as rare as
+ * their size promises, and the filters sealed segments carry, which are
+ * off unless asked for.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+const unsigned kKeys = 10000;
+
+/* Share of `probes` keys never added that the filter lets through. */
+double false_positives(const void *filter, size_t len, unsigned probes) {
+  unsigned hits = 0;
+
+  for (unsigned i = 0; i < probes; i++)
+    hits += hut_bloom_may_contain(filter, len, hut_hash64(kKeys + i)) != 0;
+  return static_cast<double>(hits) / probes;
+}
+
+class Filter : public ::testing::TestWithParam<unsigned> {
+protected:
+  void SetUp() override {
+    len_ = hut_bloom_size(kKeys, GetParam());
+    filter_ = aligned_alloc(HUT_BLOOM_BLOCK_SIZE, len_);
+    ASSERT_TRUE(filter_ != NULL);
+    memset(filter_, 0, len_);
+    for (unsigned i = 0; i < kKeys; i++)
+      hut_bloom_add(filter_, len_, hut_hash64(i));
+  }
+
+  void TearDown() override { free(filter_); }
+
+  void *filter_ = NULL;
+  size_t len_ = 0;
+};
+
+TEST_P(Filter, NoFalseNegatives) {
+  for (unsigned i = 0; i < kKeys; i++)
+    ASSERT_TRUE(hut_bloom_may_contain(filter_, len_, hut_hash64(i))) << i;
+}
+
+/*
+ * Split blocks give up some accuracy for one cache line a probe, more so
+ * the fuller or emptier they are: about twice what a standard filter of
+ * the same size would let through at 10 bits, worse at the ends.
+ */
+TEST_P(Filter, FalsePositives) {
+  double bound = GetParam() == 4 ? 0.4 : GetParam() == 10 ? 0.02 : 0.004;
+
+  EXPECT_LT(false_positives(filter_, len_, 100000), bound);
+}
+
+INSTANTIATE_TEST_CASE_P(BitsPerKey, Filter, ::testing::Values(4u, 10u, 16u));
+
+TEST(BloomSize, WholeBlocks) {
+  EXPECT_EQ(static_cast<size_t>(HUT_BLOOM_BLOCK_SIZE), hut_bloom_size(0, 10));
+  EXPECT_EQ(static_cast<size_t>(HUT_BLOOM_BLOCK_SIZE), hut_bloom_size(1, 10));
+  EXPECT_EQ(0u, hut_bloom_size(12345, 10) % HUT_BLOOM_BLOCK_SIZE);
+  EXPECT_GE(hut_bloom_size(12345, 10) * 8, 123450u);
+}
+
+TEST(BloomOptions, OffByDefault) {
+  hut_options_t opts;
+
+  hut_options_init(&opts);
+  EXPECT_EQ(0u, opts.bloom_bits_per_key);
+}
+
+/* Sealed segments, with and without a filter, and once reopened. */
+class SegmentFilter : public ::testing::TestWithParam<unsigned> {
+protected:
+  void SetUp() override {
+    hut_segment_seal_options_t opts;
+    hut_segment_t *seg;
+    uint64_t off;
+
+    ASSERT_EQ(HUT_OK, hut_segment_create(dir_.path(), 1, 4u << 20, HUT_HUGE_PAGES_NONE, &seg));
+    for (unsigned i = 0; i < kKeys; i += 2)
+      ASSERT_EQ(HUT_OK, hut_segment_append(seg, key(i).data(), key(i).size(), "v", 1, 0, i,
+                                           &off));
+    memset(&opts, 0, sizeof(opts));
+    opts.bloom_bits_per_key = GetParam();
+    ASSERT_EQ(HUT_OK, hut_segment_seal(seg, &opts, &sealed_));
+    hut_segment_close(seg);
+  }
+
+  void TearDown() override {
+    if (sealed_)
+      hut_segment_close(sealed_);
+  }
+
+  static std::string key(unsigned i) { return "key" + std::to_string(i); }
+
+  static uint64_t hash(unsigned i) {
+    std::string k = key(i);
+    return hut_hash_bytes(k.data(), k.size(), 0);
+  }
+
+  /* Whether every key added may be there, and how many others may. */
+  void check(hut_segment_t *seg) {
+    unsigned hits = 0;
+
+    for (unsigned i = 0; i < kKeys; i += 2) {
+      ASSERT_TRUE(hut_segment_may_contain(seg, hash(i))) << key(i);
+      hits += hut_segment_may_contain(seg, hash(i + 1)) != 0;
+    }
+    if (GetParam())
+      EXPECT_LT(hits, kKeys / 2 / 20);
+    else
+      EXPECT_EQ(kKeys / 2, hits);
+  }
+
+  TempDir dir_;
+  hut_segment_t *sealed_ = NULL;
+};
+
+TEST_P(SegmentFilter, MayContain) {
+  hut_segment_t *seg;
+
+  check(sealed_);
+  hut_segment_close(sealed_);
+  sealed_ = NULL;
+  ASSERT_EQ(HUT_OK, hut_segment_open(dir_.path(), 1, HUT_HUGE_PAGES_NONE, &seg));
+  check(seg);
+  hut_segment_close(seg);
+}
+
+INSTANTIATE_TEST_CASE_P(BitsPerKey, SegmentFilter, ::testing::Values(0u, 10u));
+
+} // namespace
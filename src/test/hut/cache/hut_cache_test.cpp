@@ -0,0 +1,182 @@
+#include "hut_test.hpp"
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/cache/hut_cache.h"
+}
+
+/*
+ * The record cache: hits and misses, the capacity bound, entries pinned
+ * past their eviction, TinyLFU keeping a hot set through a scan, and
+ * shards shared by threads.
+ */
+
+namespace {
+
+/* Contents tied to the key, to tell entries apart. */
+std::string data(uint64_t key, size_t len) {
+  std::string d(len, '\0');
+
+  for (size_t i = 0; i < len; i++)
+    d[i] = static_cast<char>('a' + (key + i) % 26);
+  return d;
+}
+
+std::string contents(const hut_cache_entry_t *e) {
+  return std::string(static_cast<const char *>(hut_cache_entry_data(e)), hut_cache_entry_len(e));
+}
+
+class Cache : public ::testing::Test {
+protected:
+  void TearDown() override { hut_cache_destroy(cache_); }
+
+  void create(size_t capacity, unsigned shards) {
+    ASSERT_EQ(HUT_OK, hut_cache_create(capacity, shards, &cache_));
+  }
+
+  /* Looks `key` up, inserting it on a miss; whether it hit. */
+  bool access(uint64_t key, size_t len) {
+    hut_cache_entry_t *e = hut_cache_lookup(cache_, key);
+    bool hit = e != NULL;
+
+    if (!e) {
+      std::string d = data(key, len);
+      e = hut_cache_insert(cache_, key, d.data(), d.size());
+    }
+    EXPECT_TRUE(e != NULL);
+    if (e) {
+      EXPECT_EQ(data(key, len), contents(e)) << key;
+      hut_cache_release(e);
+    }
+    return hit;
+  }
+
+  hut_cache_t *cache_ = NULL;
+};
+
+TEST_F(Cache, NoShards) {
+  EXPECT_EQ(HUT_ERR_INVALID, hut_cache_create(1u << 20, 0, &cache_));
+}
+
+TEST_F(Cache, HitsAndMisses) {
+  hut_cache_stats_t stats;
+
+  create(1u << 20, 4);
+  EXPECT_FALSE(access(1, 100));
+  EXPECT_TRUE(access(1, 100));
+  EXPECT_TRUE(access(1, 100));
+  EXPECT_FALSE(access(2, 100));
+
+  hut_cache_stats(cache_, &stats);
+  EXPECT_EQ(2u, stats.hits);
+  EXPECT_EQ(2u, stats.misses);
+  EXPECT_EQ(2u, stats.inserts);
+  EXPECT_EQ(2u, stats.entries);
+  EXPECT_DOUBLE_EQ(0.5, stats.hit_ratio);
+}
+
+/* Two readers decompressing the same record end up sharing one entry. */
+TEST_F(Cache, InsertRaceKeepsFirst) {
+  hut_cache_entry_t *a, *b;
+
+  create(1u << 20, 1);
+  a = hut_cache_insert(cache_, 7, "first", 5);
+  b = hut_cache_insert(cache_, 7, "second", 6);
+  ASSERT_TRUE(a && b);
+  EXPECT_EQ(a, b);
+  EXPECT_EQ("first", contents(b));
+  hut_cache_release(a);
+  hut_cache_release(b);
+}
+
+TEST_F(Cache, Bounded) {
+  const size_t capacity = 256u << 10;
+  hut_cache_stats_t stats;
+
+  create(capacity, 4);
+  for (uint64_t key = 0; key < 10000; key++)
+    access(key, 100 + key % 1000);
+  hut_cache_stats(cache_, &stats);
+  EXPECT_LE(stats.bytes, capacity);
+  EXPECT_GT(stats.bytes, capacity / 2);
+  EXPECT_LT(stats.entries, 10000u);
+  EXPECT_GT(stats.evictions + stats.admission_rejects, 0u);
+}
+
+TEST_F(Cache, TooLargeIsDetached) {
+  hut_cache_entry_t *e;
+  std::string big = data(1, 128u << 10);
+
+  create(64u << 10, 1);
+  ASSERT_TRUE((e = hut_cache_insert(cache_, 1, big.data(), big.size())) != NULL);
+  EXPECT_EQ(big, contents(e));
+  hut_cache_release(e);
+  EXPECT_TRUE(hut_cache_lookup(cache_, 1) == NULL);
+}
+
+/* Evicted or rejected, a pinned entry stays readable until released. */
+TEST_F(Cache, PinnedOutlivesEviction) {
+  std::vector<hut_cache_entry_t *> pinned;
+
+  create(64u << 10, 1);
+  for (uint64_t key = 0; key < 2000; key++) {
+    std::string d = data(key, 500);
+    hut_cache_entry_t *e = hut_cache_insert(cache_, key, d.data(), d.size());
+
+    ASSERT_TRUE(e != NULL);
+    if (key % 100 == 0)
+      pinned.push_back(e);
+    else
+      hut_cache_release(e);
+  }
+  for (size_t i = 0; i < pinned.size(); i++) {
+    EXPECT_EQ(data(i * 100, 500), contents(pinned[i]));
+    hut_cache_release(pinned[i]);
+  }
+}
+
+/*
+ * A hot set used over and over survives a scan of twice the capacity in
+ * keys used once: they lose admission against what they would evict.
+ * The set fills the main area past its protected part, whose entries
+ * segmented LRU alone would already keep, to about 88%.
+ */
+TEST_F(Cache, HotSetSurvivesScan) {
+  const uint64_t hot = 900, cold = 2000;
+  unsigned hits = 0;
+
+  create(1u << 20, 1);
+  for (int round = 0; round < 5; round++)
+    for (uint64_t key = 0; key < hot; key++)
+      access(key, 1000);
+  for (uint64_t key = hot; key < hot + cold; key++)
+    access(key, 1000);
+  for (uint64_t key = 0; key < hot; key++)
+    hits += access(key, 1000);
+  EXPECT_GT(hits, hot * 95 / 100);
+}
+
+TEST_F(Cache, Concurrent) {
+  std::vector<std::thread> threads;
+
+  create(512u << 10, 4);
+  for (unsigned t = 0; t < 8; t++)
+    threads.emplace_back([this, t] {
+      uint64_t x = t + 1;
+
+      for (unsigned i = 0; i < 20000; i++) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+        access((x >> 33) % 3000, 200 + (x >> 33) % 3000 % 300);
+      }
+    });
+  for (unsigned t = 0; t < threads.size(); t++)
+    threads[t].join();
+}
+
+} // namespace
@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# Pipes hut_cli_test.script into hutcli against a fresh database, then
+# reads it back once reopened, matching what both print on stdout line
+# by line against the extended regular expressions of hut_cli_test.out.
+#
+#   hut_cli_test.sh HUTCLI
+#
+
+set -u
+
+cli=$1
+here=$(dirname "$0")
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+"$cli" --sync=1 --batch=3 "$tmp/db" < "$here/hut_cli_test.script" > "$tmp/out" || {
+  echo "hut_cli_test: script failed" >&2
+  exit 1
+}
+"$cli" "$tmp/db" get apple scan >> "$tmp/out" || {
+  echo "hut_cli_test: reopening failed" >&2
+  exit 1
+}
+
+n=0
+failed=0
+exec 3< "$here/hut_cli_test.out" 4< "$tmp/out"
+while IFS= read -r expected <&3; do
+  n=$((n + 1))
+  if ! IFS= read -r line <&4; then
+    echo "hut_cli_test: line $n: missing, expected /$expected/" >&2
+    exit 1
+  fi
+  if ! printf '%s\n' "$line" | grep -Eqx -e "$expected"; then
+    echo "hut_cli_test: line $n: '$line' does not match /$expected/" >&2
+    failed=1
+  fi
+done
+if IFS= read -r line <&4; then
+  echo "hut_cli_test: line $((n + 1)): '$line' unexpected" >&2
+  exit 1
+fi
+exit $failed
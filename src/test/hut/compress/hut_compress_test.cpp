@@ -0,0 +1,268 @@
+#include "hut_test.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/compress/hut_compress.h"
+#include "hut/segment/hut_segment.h"
+}
+
+/*
+ * Compression: the codecs on their own, and sealed segments compressed
+ * per value or per block, with and without a dictionary, checked to be
+ * so on disk, and read back from the cache and cold. Codecs left out of
+ * the build must fail with HUT_ERR_NOTSUP, which is all there is to check
+ * of them.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+const char *codec_name(hut_compression_t codec) {
+  return codec == HUT_COMPRESSION_LZ4 ? "lz4" : codec == HUT_COMPRESSION_ZSTD ? "zstd" : "none";
+}
+
+/* Text-like, so that codecs have something to find; a few past 16 KiB. */
+std::string value(unsigned i) {
+  std::string v;
+  size_t len = i % 50 ? 100 + i % 900 : 20000 + i;
+  char word[32];
+
+  while (v.size() < len) {
+    snprintf(word, sizeof(word), "word%u ", (i * 7 + static_cast<unsigned>(v.size())) % 97);
+    v += word;
+  }
+  v.resize(len);
+  return v;
+}
+
+std::string key(unsigned i) {
+  return "key" + std::to_string(i);
+}
+
+class Codec : public ::testing::TestWithParam<hut_compression_t> {};
+
+TEST_P(Codec, RoundTrip) {
+  hut_compression_t codec = GetParam();
+  std::string src = value(0) + value(1);
+  std::vector<char> dst(hut_compress_bound(codec, src.size()) + 1), back(src.size());
+  size_t len;
+  int rc;
+
+  rc = hut_compress(codec, 0, NULL, src.data(), src.size(), dst.data(), dst.size(), &len);
+  if (codec == HUT_COMPRESSION_NONE || !hut_compress_supported(codec)) {
+    EXPECT_EQ(HUT_ERR_NOTSUP, rc);
+    EXPECT_EQ(HUT_ERR_NOTSUP, hut_decompress(codec, NULL, src.data(), src.size(), back.data(),
+                                             back.size()));
+    return;
+  }
+  ASSERT_EQ(HUT_OK, rc);
+  EXPECT_LT(len, src.size());
+  ASSERT_EQ(HUT_OK, hut_decompress(codec, NULL, dst.data(), len, back.data(), back.size()));
+  EXPECT_EQ(src, std::string(back.data(), back.size()));
+
+  /* Cut short, or expecting more than there is. */
+  EXPECT_NE(HUT_OK, hut_decompress(codec, NULL, dst.data(), len / 2, back.data(), back.size()));
+  EXPECT_NE(HUT_OK, hut_decompress(codec, NULL, dst.data(), len, back.data(), back.size() - 1));
+}
+
+INSTANTIATE_TEST_CASE_P(Codecs, Codec,
+                        ::testing::Values(HUT_COMPRESSION_NONE, HUT_COMPRESSION_LZ4,
+                                          HUT_COMPRESSION_ZSTD));
+
+TEST(CompressDict, TrainAndUse) {
+  std::string samples, src = value(7);
+  std::vector<size_t> sizes;
+  std::vector<char> dst(hut_compress_bound(HUT_COMPRESSION_ZSTD, src.size())), back(src.size());
+  hut_compress_dict_t *dict;
+  size_t dict_len, len;
+  void *buf;
+
+  for (unsigned i = 0; i < 1000; i++) {
+    std::string v = value(i * 3 + 1);
+    samples += v;
+    sizes.push_back(v.size());
+  }
+  if (!hut_compress_supported(HUT_COMPRESSION_ZSTD)) {
+    EXPECT_EQ(HUT_ERR_NOTSUP, hut_compress_dict_train(samples.data(), sizes.data(),
+                                                      sizes.size(), 4096, &buf, &dict_len));
+    printf("zstd not built, dictionaries not tested\n");
+    return;
+  }
+  ASSERT_EQ(HUT_OK, hut_compress_dict_train(samples.data(), sizes.data(), sizes.size(), 4096,
+                                            &buf, &dict_len));
+  EXPECT_LE(dict_len, 4096u);
+  ASSERT_EQ(HUT_OK, hut_compress_dict_create(buf, dict_len, 0, &dict));
+  free(buf);
+  ASSERT_EQ(HUT_OK, hut_compress(HUT_COMPRESSION_ZSTD, 0, dict, src.data(), src.size(),
+                                 dst.data(), dst.size(), &len));
+  ASSERT_EQ(HUT_OK, hut_decompress(HUT_COMPRESSION_ZSTD, dict, dst.data(), len, back.data(),
+                                   back.size()));
+  EXPECT_EQ(src, std::string(back.data(), back.size()));
+  hut_compress_dict_free(dict);
+}
+
+struct Param {
+  hut_compression_t codec;
+  size_t block_size;
+  size_t dict_size;
+};
+
+class Compressed : public ::testing::TestWithParam<Param> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.compression.codec = GetParam().codec;
+    opts_.compression.block_size = GetParam().block_size;
+    opts_.compression.dict_size = GetParam().dict_size;
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  /* False, with a note, when the codec is not built. */
+  bool open() {
+    int rc = hut_open(dir_.path(), &opts_, &db_);
+
+    if (!hut_compress_supported(GetParam().codec)) {
+      EXPECT_EQ(HUT_ERR_NOTSUP, rc);
+      printf("%s not built, not tested\n", codec_name(GetParam().codec));
+      db_ = NULL;
+      return false;
+    }
+    EXPECT_EQ(HUT_OK, rc);
+    return rc == HUT_OK;
+  }
+
+  void reopen() {
+    hut_close(db_);
+    db_ = NULL;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  /*
+   * Reopens the database, checking meanwhile that every segment it sealed
+   * is compressed, and takes less room on disk than its records, unless
+   * it has no codec.
+   */
+  void reopen_compressed() {
+    unsigned sealed = 0, compressed = 0;
+    uint64_t raw = 0, disk = 0;
+    struct dirent *ent;
+    hut_segment_t *seg;
+    unsigned id;
+    char end;
+    DIR *dir;
+
+    hut_close(db_);
+    db_ = NULL;
+    ASSERT_TRUE((dir = opendir(dir_.path())) != NULL);
+    while ((ent = readdir(dir))) {
+      if (sscanf(ent->d_name, "%8x.se%c", &id, &end) != 2 || end != 'g'
+          || strlen(ent->d_name) != 12)
+        continue;
+      EXPECT_EQ(HUT_OK, hut_segment_open(dir_.path(), id, HUT_HUGE_PAGES_NONE, &seg))
+          << ent->d_name;
+      if (!seg || !hut_segment_sealed(seg)) {
+        hut_segment_close(seg);
+        continue;
+      }
+      sealed++;
+      compressed += hut_segment_compressed(seg);
+      raw += hut_segment_size(seg);
+      disk += hut_segment_file_size(seg);
+      hut_segment_close(seg);
+    }
+    closedir(dir);
+
+    EXPECT_GT(sealed, 0u);
+    if (GetParam().codec == HUT_COMPRESSION_NONE) {
+      EXPECT_EQ(0u, compressed);
+      EXPECT_GE(disk, raw);
+    } else {
+      EXPECT_EQ(sealed, compressed);
+      EXPECT_LT(disk, raw);
+    }
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  /* Every third deleted, every fifth overwritten. */
+  void check(unsigned n) {
+    std::string got;
+
+    for (unsigned i = 0; i < n; i++) {
+      if (i % 3 == 0) {
+        EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, key(i), &got)) << key(i);
+        continue;
+      }
+      ASSERT_EQ(HUT_OK, hut_test::get(db_, key(i), &got)) << key(i);
+      EXPECT_EQ(i % 5 == 0 ? value(i + 1) : value(i), got) << key(i);
+    }
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+TEST_P(Compressed, SealedRecordsReadBack) {
+  const unsigned n = 2000;
+
+  if (!open())
+    return;
+  for (unsigned i = 0; i < n; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i)));
+  for (unsigned i = 0; i < n; i++) {
+    if (i % 3 == 0)
+      ASSERT_EQ(HUT_OK, hut_test::del(db_, key(i)));
+    else if (i % 5 == 0)
+      ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i + 1)));
+  }
+
+  /* Twice each, the second time from the cache. */
+  check(n);
+  check(n);
+  reopen_compressed();
+  check(n);
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  check(n);
+  reopen_compressed();
+  check(n);
+}
+
+/* Without a cache every read decompresses. */
+TEST_P(Compressed, ColdReads) {
+  const unsigned n = 500;
+
+  opts_.cache_size = 0;
+  if (!open())
+    return;
+  for (unsigned i = 0; i < n; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), i % 5 == 0 ? value(i + 1) : value(i)));
+  for (unsigned i = 0; i < n; i += 3)
+    ASSERT_EQ(HUT_OK, hut_test::del(db_, key(i)));
+  reopen_compressed();
+  check(n);
+  check(n);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Codecs, Compressed,
+    ::testing::Values(Param{HUT_COMPRESSION_NONE, 0, 0}, Param{HUT_COMPRESSION_LZ4, 0, 0},
+                      Param{HUT_COMPRESSION_LZ4, 16u << 10, 0}, Param{HUT_COMPRESSION_ZSTD, 0, 0},
+                      Param{HUT_COMPRESSION_ZSTD, 16u << 10, 0},
+                      Param{HUT_COMPRESSION_ZSTD, 0, 4096},
+                      Param{HUT_COMPRESSION_ZSTD, 16u << 10, 4096}));
+
+} // namespace
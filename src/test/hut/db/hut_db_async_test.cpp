@@ -0,0 +1,223 @@
+#include "hut_test.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+/*
+ * Async gets: every callback runs once, on the calling thread, with what
+ * hut_get() would have returned, for records in memory and on disk,
+ * larger than the speculative read and missing, with many in flight.
+ * Where io_uring is not available they run synchronously, which the
+ * same expectations hold for.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+struct Result {
+  unsigned *pending = NULL;
+  int calls = 0;
+  int status = 1;
+  std::string value;
+  std::thread::id thread;
+};
+
+void done(void *arg, int status, hut_value_t *value) {
+  Result *result = static_cast<Result *>(arg);
+
+  result->calls++;
+  --*result->pending;
+  result->status = status;
+  result->thread = std::this_thread::get_id();
+  if (value) {
+    result->value.assign(static_cast<const char *>(value->data), value->len);
+    hut_value_release(value);
+  }
+}
+
+std::string key(unsigned i) {
+  return "key" + std::to_string(i);
+}
+
+/* Some past the 4 KiB read first. */
+std::string value(unsigned i) {
+  return std::string(i % 10 ? 100 + i : 6000 + i, 'a' + i % 26);
+}
+
+struct Param {
+  hut_io_backend_t backend;
+  unsigned shards;
+};
+
+class Async : public ::testing::TestWithParam<Param> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.io.backend = GetParam().backend;
+    opts_.io.queue_depth = 16;
+    opts_.shards = GetParam().shards;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  /* Gets `keys`, keeping up to `depth` in flight. */
+  std::vector<Result> get_all(const std::vector<std::string> &keys, unsigned depth) {
+    std::vector<Result> results(keys.size());
+    unsigned pending = 0;
+
+    for (unsigned i = 0; i < keys.size(); i++) {
+      results[i].pending = &pending;
+      pending++;
+      EXPECT_EQ(HUT_OK, hut_get_async(db_, keys[i].data(), keys[i].size(), done, &results[i]));
+      while (pending >= depth)
+        hut_poll(db_, 1);
+    }
+    while (pending)
+      hut_poll(db_, 1);
+    return results;
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+TEST_P(Async, GetsWhatGetWould) {
+  const unsigned n = 1000;
+  std::vector<std::string> keys;
+  std::vector<Result> results;
+
+  for (unsigned i = 0; i < n; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i)));
+  for (unsigned i = 0; i < n; i++) {
+    keys.push_back(key(i));
+    keys.push_back("missing" + std::to_string(i));
+  }
+
+  /* Most records sealed and read from the files, and again after a reopen. */
+  for (int pass = 0; pass < 2; pass++) {
+    results = get_all(keys, 64);
+    for (unsigned i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(1, results[i].calls) << keys[i];
+      EXPECT_EQ(std::this_thread::get_id(), results[i].thread);
+      if (i % 2) {
+        EXPECT_EQ(HUT_ERR_NOTFOUND, results[i].status) << keys[i];
+      } else {
+        ASSERT_EQ(HUT_OK, results[i].status) << keys[i];
+        EXPECT_EQ(value(i / 2), results[i].value) << keys[i];
+      }
+    }
+    hut_close(db_);
+    db_ = NULL;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+}
+
+TEST_P(Async, DeletedAndOverwritten) {
+  std::vector<std::string> keys;
+  std::vector<Result> results;
+
+  for (unsigned i = 0; i < 300; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i)));
+  for (unsigned i = 0; i < 300; i += 3) {
+    ASSERT_EQ(HUT_OK, hut_test::del(db_, key(i)));
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i + 1), "new"));
+  }
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  for (unsigned i = 0; i < 300; i++)
+    keys.push_back(key(i));
+
+  results = get_all(keys, 8);
+  for (unsigned i = 0; i < 300; i++) {
+    ASSERT_EQ(1, results[i].calls);
+    if (i % 3 == 0) {
+      EXPECT_EQ(HUT_ERR_NOTFOUND, results[i].status) << keys[i];
+    } else {
+      ASSERT_EQ(HUT_OK, results[i].status) << keys[i];
+      EXPECT_EQ(i % 3 == 1 ? "new" : value(i), results[i].value) << keys[i];
+    }
+  }
+}
+
+/* Recorded as gets, with the bytes of those found. */
+TEST_P(Async, Timed) {
+  std::vector<std::string> keys;
+  hut_stats_t stats;
+  uint64_t bytes = 0;
+
+  hut_close(db_);
+  opts_.stats = 1;
+  ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  for (unsigned i = 0; i < 200; i++) {
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i)));
+    keys.push_back(key(i));
+    bytes += key(i).size() + value(i).size();
+  }
+  keys.push_back("missing");
+
+  get_all(keys, 16);
+  ASSERT_EQ(HUT_OK, hut_stats_get(db_, &stats));
+  EXPECT_EQ(keys.size(), stats.latency[HUT_STATS_GET].count);
+  EXPECT_EQ(bytes, stats.bytes_read);
+}
+
+/*
+ * Sealed records read through the ring go through the record cache, too
+ * small here to take them all; mapped reads never do.
+ */
+TEST_P(Async, CacheStats) {
+  std::vector<std::string> keys;
+  hut_stats_t stats;
+
+  hut_close(db_);
+  opts_.stats = 1;
+  opts_.cache_size = 128u << 10;
+  ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  for (unsigned i = 0; i < 500; i++) {
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i)));
+    keys.push_back(key(i));
+  }
+  get_all(keys, 16);
+  get_all(keys, 16);
+  ASSERT_EQ(HUT_OK, hut_stats_get(db_, &stats));
+  if (GetParam().backend == HUT_IO_URING && !stats.cache_misses) {
+    printf("io_uring not available, cache not tested\n");
+    return;
+  }
+  if (GetParam().backend == HUT_IO_MMAP) {
+    EXPECT_EQ(0u, stats.cache_hits + stats.cache_misses);
+    EXPECT_EQ(0.0, stats.cache_hit_ratio);
+    EXPECT_EQ(0u, stats.cache_admission_rejects);
+    return;
+  }
+  EXPECT_GT(stats.cache_hits, 0u);
+  EXPECT_GT(stats.cache_misses, 0u);
+  EXPECT_DOUBLE_EQ(static_cast<double>(stats.cache_hits)
+                       / static_cast<double>(stats.cache_hits + stats.cache_misses),
+                   stats.cache_hit_ratio);
+  EXPECT_GT(stats.cache_admission_rejects, 0u);
+}
+
+TEST_P(Async, InvalidKey) {
+  Result result;
+  unsigned pending = 0;
+
+  result.pending = &pending;
+  EXPECT_EQ(HUT_ERR_INVALID, hut_get_async(db_, "", 0, done, &result));
+  EXPECT_EQ(0, result.calls);
+  EXPECT_EQ(0, hut_poll(db_, 0));
+}
+
+INSTANTIATE_TEST_CASE_P(Backends, Async,
+                        ::testing::Values(Param{HUT_IO_URING, 0}, Param{HUT_IO_URING, 4},
+                                          Param{HUT_IO_MMAP, 0}));
+
+} // namespace
@@ -0,0 +1,167 @@
+#include "hut_test.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+/*
+ * Compaction and recovery: what was deleted or overwritten stays so
+ * across compactions, reopens, writes racing them and a crash halfway
+ * through removing victims.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+const std::string kFiller(1000, 'f');
+
+/* Overwrites one key until the active segment has rolled at least once. */
+void roll(hut_db_t *db) {
+  for (int i = 0; i < 200; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db, "filler", kFiller));
+}
+
+class Compact : public ::testing::TestWithParam<unsigned> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.bloom_bits_per_key = GetParam();
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  void reopen() {
+    hut_close(db_);
+    db_ = NULL;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+TEST_P(Compact, DeletesAndOverwritesSurviveReopen) {
+  std::string value;
+
+  for (int i = 0; i < 100; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, "key" + std::to_string(i), "old"));
+  roll(db_);
+  for (int i = 0; i < 100; i++)
+    ASSERT_EQ(HUT_OK, i % 2 ? hut_test::del(db_, "key" + std::to_string(i))
+                            : hut_test::put(db_, "key" + std::to_string(i), "new"));
+  roll(db_);
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 100; i++) {
+      int rc = hut_test::get(db_, "key" + std::to_string(i), &value);
+      if (i % 2) {
+        EXPECT_EQ(HUT_ERR_NOTFOUND, rc) << "key" << i;
+      } else {
+        ASSERT_EQ(HUT_OK, rc) << "key" << i;
+        EXPECT_EQ("new", value);
+      }
+    }
+    reopen();
+  }
+}
+
+/*
+ * The put ends up in a compaction output, with a higher id than the
+ * segment the delete then goes to, so the tombstone's segment is removed
+ * first. A crash right after must not bring the put back.
+ */
+TEST_P(Compact, TombstoneOutlivesOtherVictims) {
+  hut_test::files_t before, after;
+  std::string value, first;
+
+  ASSERT_EQ(HUT_OK, hut_test::put(db_, "key", "value"));
+  roll(db_);
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  ASSERT_EQ(HUT_OK, hut_test::del(db_, "key"));
+  roll(db_);
+
+  before = hut_test::read_files(dir_.path());
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, "key", &value));
+  hut_close(db_);
+  db_ = NULL;
+
+  /* Put back every victim but the first removed. */
+  after = hut_test::read_files(dir_.path());
+  for (hut_test::files_t::const_iterator f = before.begin(); f != before.end(); ++f) {
+    if (after.count(f->first))
+      continue;
+    if (first.empty()) {
+      first = f->first;
+      continue;
+    }
+    hut_test::write_file(dir_.join(f->first), f->second);
+  }
+  ASSERT_FALSE(first.empty());
+
+  ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, "key", &value));
+  ASSERT_EQ(HUT_OK, hut_test::get(db_, "filler", &value));
+  EXPECT_EQ(kFiller, value);
+}
+
+/*
+ * Writes go on while records are copied: those overwritten or deleted
+ * after their copy keep the index pointing at their newest version.
+ */
+TEST_P(Compact, WritesRaceCompaction) {
+  const int keys = 500, gens = 20;
+  std::atomic<bool> stop(false);
+  hut_verify_t report;
+  std::string value;
+  unsigned failed = 0, compactions = 0, written_failed = 0;
+
+  std::thread compactor([&] {
+    while (!stop) {
+      failed += hut_compact(db_, 0.2) != HUT_OK;
+      compactions++;
+    }
+  });
+  for (int gen = 0; gen < gens; gen++)
+    for (int i = 0; i < keys; i++) {
+      std::string k = "key" + std::to_string(i);
+      int rc = (i + gen) % 7 ? hut_test::put(db_, k, std::to_string(gen) + kFiller)
+                             : hut_test::del(db_, k);
+      written_failed += rc != HUT_OK && rc != HUT_ERR_NOTFOUND;
+    }
+  stop = true;
+  compactor.join();
+  EXPECT_EQ(0u, written_failed);
+  EXPECT_EQ(0u, failed);
+  EXPECT_GT(compactions, 0u);
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < keys; i++) {
+      int rc = hut_test::get(db_, "key" + std::to_string(i), &value);
+      if ((i + gens - 1) % 7 == 0) {
+        EXPECT_EQ(HUT_ERR_NOTFOUND, rc) << "key" << i;
+      } else {
+        ASSERT_EQ(HUT_OK, rc) << "key" << i;
+        EXPECT_EQ(std::to_string(gens - 1) + kFiller, value);
+      }
+    }
+    ASSERT_EQ(HUT_OK, hut_verify(db_, &report));
+    EXPECT_EQ(report.live_records, report.index_entries);
+    reopen();
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(BloomBits, Compact, ::testing::Values(0u, 10u));
+
+} // namespace
@@ -0,0 +1,185 @@
+#include "hut_test.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+/*
+ * Gets without the lock, synchronous and asynchronous, racing a writer
+ * that keeps overwriting every key and a compaction that keeps moving
+ * them: every get must find its key, with a value written for it, and
+ * never one older than a get before it saw.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+const unsigned kKeys = 1000;
+
+std::string key(unsigned i) {
+  return "key" + std::to_string(i);
+}
+
+/* "<key>:<generation>", padded so that segments roll often. */
+std::string value(unsigned i, unsigned gen) {
+  std::string v = key(i) + ":" + std::to_string(gen) + ":";
+
+  v.resize(200, 'v');
+  return v;
+}
+
+/* The generation in a value of key `i`, -1 when it is not one. */
+long generation(unsigned i, const void *data, size_t len) {
+  std::string v(static_cast<const char *>(data), len), prefix = key(i) + ":";
+  unsigned long gen;
+
+  if (len != 200 || v.compare(0, prefix.size(), prefix)
+      || sscanf(v.c_str() + prefix.size(), "%lu:", &gen) != 1)
+    return -1;
+  return static_cast<long>(gen);
+}
+
+struct Reader {
+  std::vector<long> seen;       /* newest generation by key */
+  unsigned errors = 0;
+  unsigned long gets = 0;
+  unsigned inflight = 0;
+
+  Reader() : seen(kKeys, -1) {}
+
+  /* `floor` is the newest seen when the get started. */
+  void check(unsigned i, long floor, int status, const void *data, size_t len) {
+    long gen = status ? -1 : generation(i, data, len);
+
+    gets++;
+    if (gen < 0 || gen < floor)
+      errors++;
+    else if (gen > seen[i])
+      seen[i] = gen;
+  }
+};
+
+struct AsyncGet {
+  Reader *reader;
+  unsigned key;
+  long floor;
+};
+
+void async_done(void *arg, int status, hut_value_t *value) {
+  AsyncGet *get = static_cast<AsyncGet *>(arg);
+
+  get->reader->check(get->key, get->floor, status, value ? value->data : NULL,
+                     value ? value->len : 0);
+  get->reader->inflight--;
+  if (value)
+    hut_value_release(value);
+  delete get;
+}
+
+class Concurrent : public ::testing::TestWithParam<unsigned> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.shards = GetParam();
+    opts_.io.backend = HUT_IO_URING;
+    opts_.io.queue_depth = 64;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+    for (unsigned i = 0; i < kKeys; i++)
+      ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i, 0)));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  void run(void (*read)(hut_db_t *db, Reader *reader, std::atomic<bool> *stop)) {
+    std::vector<Reader> readers(4);
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned> compactions(0);
+    unsigned gen, failed = 0;
+
+    for (unsigned r = 0; r < readers.size(); r++)
+      threads.emplace_back(read, db_, &readers[r], &stop);
+    threads.emplace_back([&] {
+      while (!stop)
+        if (hut_compact(db_, 0.3) == HUT_OK)
+          compactions++;
+    });
+    for (gen = 1; gen <= 10; gen++)
+      for (unsigned i = 0; i < kKeys; i++)
+        failed += hut_test::put(db_, key(i), value(i, gen)) != HUT_OK;
+    stop = true;
+    for (unsigned t = 0; t < threads.size(); t++)
+      threads[t].join();
+
+    EXPECT_EQ(0u, failed);
+    for (unsigned r = 0; r < readers.size(); r++) {
+      EXPECT_GT(readers[r].gets, 0u);
+      EXPECT_EQ(0u, readers[r].errors) << "reader " << r;
+    }
+    EXPECT_GT(compactions.load(), 0u);
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+void read_sync(hut_db_t *db, Reader *reader, std::atomic<bool> *stop) {
+  hut_value_t v;
+  unsigned i = 0;
+  int rc;
+
+  while (!*stop) {
+    i = (i + 7919) % kKeys;
+    rc = hut_get(db, key(i).data(), key(i).size(), &v);
+    reader->check(i, reader->seen[i], rc, rc ? NULL : v.data, rc ? 0 : v.len);
+    if (!rc)
+      hut_value_release(&v);
+  }
+}
+
+void read_async(hut_db_t *db, Reader *reader, std::atomic<bool> *stop) {
+  unsigned i = 0;
+
+  while (!*stop) {
+    AsyncGet *get = new AsyncGet;
+    std::string k;
+
+    i = (i + 7919) % kKeys;
+    k = key(i);
+    get->reader = reader;
+    get->key = i;
+    get->floor = reader->seen[i];
+    reader->inflight++;
+    if (hut_get_async(db, k.data(), k.size(), async_done, get)) {
+      reader->inflight--;
+      reader->errors++;
+      delete get;
+    }
+    if (reader->inflight >= 32)
+      hut_poll(db, 1);
+  }
+  while (reader->inflight)
+    hut_poll(db, 1);
+}
+
+TEST_P(Concurrent, Gets) {
+  run(read_sync);
+}
+
+TEST_P(Concurrent, AsyncGets) {
+  run(read_async);
+}
+
+INSTANTIATE_TEST_CASE_P(Shards, Concurrent, ::testing::Values(0u, 4u));
+
+} // namespace
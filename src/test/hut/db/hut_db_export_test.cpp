@@ -0,0 +1,190 @@
+#include "hut_test.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+/*
+ * Snapshot exports: key ranges, what the callbacks are given, and the
+ * snapshot staying exact while a writer overwrites and deletes.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+std::string key(unsigned i) {
+  char buf[16];
+
+  snprintf(buf, sizeof(buf), "key%07u", i);
+  return buf;
+}
+
+/* Values of the keys exported, by key index; "" for none, "dup" for twice. */
+struct Seen {
+  explicit Seen(unsigned n) : values(n), flushes(0), bad(0) {}
+
+  std::vector<std::string> values;
+  std::atomic<unsigned> flushes;
+  std::atomic<unsigned> bad;
+  hut_db_t *db;
+};
+
+int record(void *arg, unsigned, const void *k, size_t klen, const void *v, size_t vlen, int) {
+  Seen *seen = static_cast<Seen *>(arg);
+  unsigned i;
+
+  if (klen != 10 || sscanf(static_cast<const char *>(k) + 3, "%7u", &i) != 1
+      || i >= seen->values.size() || !vlen) {
+    seen->bad++;
+    return HUT_OK;
+  }
+  /* Each key goes to one thread only, no two threads write the same slot. */
+  if (!seen->values[i].empty())
+    seen->values[i] = "dup";
+  else
+    seen->values[i].assign(static_cast<const char *>(v), vlen);
+  return HUT_OK;
+}
+
+int flush(void *arg, unsigned) {
+  static_cast<Seen *>(arg)->flushes++;
+  return HUT_OK;
+}
+
+class Export : public ::testing::TestWithParam<unsigned> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.segment_size = 4u << 20;
+    opts_.shards = GetParam();
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  void fill(unsigned n) {
+    for (unsigned i = 0; i < n; i++)
+      ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), "VALUE"));
+  }
+
+  hut_export_t options(Seen *seen, unsigned threads) {
+    hut_export_t opts;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.threads = threads;
+    opts.fn = record;
+    opts.flush = flush;
+    opts.arg = seen;
+    seen->db = db_;
+    return opts;
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+TEST_P(Export, Empty) {
+  Seen seen(1);
+  hut_export_t opts = options(&seen, 2);
+
+  ASSERT_EQ(HUT_OK, hut_export(db_, &opts));
+  EXPECT_EQ("", seen.values[0]);
+  /* No more threads than segments to go through. */
+  EXPECT_GE(seen.flushes.load(), 1u);
+  EXPECT_LE(seen.flushes.load(), 2u);
+}
+
+TEST_P(Export, Range) {
+  Seen seen(1000);
+  hut_export_t opts = options(&seen, 3);
+  std::string start = key(100), end = key(200);
+
+  fill(1000);
+  opts.start = start.data();
+  opts.start_len = start.size();
+  opts.end = end.data();
+  opts.end_len = end.size();
+  ASSERT_EQ(HUT_OK, hut_export(db_, &opts));
+  EXPECT_EQ(0u, seen.bad.load());
+  for (unsigned i = 0; i < 1000; i++)
+    EXPECT_EQ(i >= 100 && i < 200 ? "VALUE" : "", seen.values[i]) << key(i);
+  EXPECT_GE(seen.flushes.load(), 1u);
+  EXPECT_LE(seen.flushes.load(), 3u);
+}
+
+int try_compact(void *arg, unsigned thread, const void *k, size_t klen, const void *v,
+                size_t vlen, int pinned) {
+  Seen *seen = static_cast<Seen *>(arg);
+
+  if (hut_compact(seen->db, 0) != HUT_ERR_BUSY)
+    seen->bad++;
+  return record(arg, thread, k, klen, v, vlen, pinned);
+}
+
+TEST_P(Export, CompactionWaits) {
+  Seen seen(10);
+  hut_export_t opts = options(&seen, 1);
+
+  fill(10);
+  opts.fn = try_compact;
+  ASSERT_EQ(HUT_OK, hut_export(db_, &opts));
+  EXPECT_EQ(0u, seen.bad.load());
+  EXPECT_EQ(HUT_OK, hut_compact(db_, 0));
+}
+
+/*
+ * The writer touches every key once, in an order of its own, putting
+ * "NEW" or deleting, so the snapshot must be what some prefix of its
+ * writes made: exactly the keys it got to first are changed.
+ */
+TEST_P(Export, SnapshotDuringWrites) {
+  const unsigned n = 200000;
+  Seen seen(n);
+  hut_export_t opts = options(&seen, 4);
+  std::vector<unsigned> order(n);
+  std::atomic<bool> started(false);
+  unsigned changed = 0;
+  int rc;
+
+  fill(n);
+  for (unsigned i = 0; i < n; i++)
+    order[i] = static_cast<unsigned>((i * 2654435761ull) % n);
+
+  std::thread writer([&] {
+    for (unsigned i = 0; i < n; i++) {
+      started = true;
+      if (i % 2)
+        hut_test::put(db_, key(order[i]), "NEW");
+      else
+        hut_test::del(db_, key(order[i]));
+    }
+  });
+  while (!started)
+    std::this_thread::yield();
+  rc = hut_export(db_, &opts);
+  writer.join();
+  ASSERT_EQ(HUT_OK, rc);
+
+  EXPECT_EQ(0u, seen.bad.load());
+  for (unsigned i = 0; i < n; i++)
+    changed += seen.values[i] != "VALUE";
+  for (unsigned i = 0; i < n; i++) {
+    std::string want = i >= changed ? "VALUE" : i % 2 ? "NEW" : "";
+    ASSERT_EQ(want, seen.values[order[i]]) << "write " << i << " of " << changed;
+  }
+  RecordProperty("writes_before_snapshot", changed);
+}
+
+INSTANTIATE_TEST_CASE_P(Shards, Export, ::testing::Values(0u, 4u));
+
+} // namespace
@@ -0,0 +1,262 @@
+#include "hut_test.hpp"
+
+#include <string>
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+
+/*
+ * Bulk loading: what commit and abort make visible, how loaded keys sort
+ * with puts and deletes made meanwhile, and recovery of a LOAD directory
+ * left behind by a crash.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+const std::string kFiller(1000, 'f');
+
+std::string key(int i) {
+  return "key" + std::to_string(i);
+}
+
+std::string value(int i) {
+  return std::string(100, 'a' + i % 26) + std::to_string(i);
+}
+
+int add(hut_loader_t *loader, const std::string &k, const std::string &v) {
+  return hut_loader_add(loader, k.data(), k.size(), v.data(), v.size());
+}
+
+class Load : public ::testing::TestWithParam<unsigned> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.shards = GetParam();
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  void reopen() {
+    hut_close(db_);
+    db_ = NULL;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void expect(const std::string &k, const std::string &v) {
+    std::string got;
+    ASSERT_EQ(HUT_OK, hut_test::get(db_, k, &got)) << k;
+    EXPECT_EQ(v, got) << k;
+  }
+
+  void expect_missing(const std::string &k) {
+    std::string got;
+    EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, k, &got)) << k;
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+TEST_P(Load, CommitMakesKeysVisible) {
+  hut_loader_t *loader;
+
+  ASSERT_EQ(HUT_OK, hut_loader_create(db_, 2, &loader));
+  for (int i = 0; i < 2000; i++)
+    ASSERT_EQ(HUT_OK, add(loader, key(i), value(i)));
+  expect_missing(key(0));
+  ASSERT_EQ(HUT_OK, hut_loader_commit(loader));
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 2000; i++)
+      expect(key(i), value(i));
+    reopen();
+  }
+}
+
+TEST_P(Load, AbortDropsKeys) {
+  hut_loader_t *loader;
+
+  ASSERT_EQ(HUT_OK, hut_loader_create(db_, 2, &loader));
+  for (int i = 0; i < 2000; i++)
+    ASSERT_EQ(HUT_OK, add(loader, key(i), value(i)));
+  hut_loader_abort(loader);
+  reopen();
+  for (int i = 0; i < 2000; i += 100)
+    expect_missing(key(i));
+
+  /* Another load may start once one is done with. */
+  ASSERT_EQ(HUT_OK, hut_loader_create(db_, 1, &loader));
+  ASSERT_EQ(HUT_OK, add(loader, key(0), value(0)));
+  ASSERT_EQ(HUT_OK, hut_loader_commit(loader));
+  expect(key(0), value(0));
+}
+
+TEST_P(Load, WritesAfterAddWin) {
+  hut_loader_t *loader;
+
+  ASSERT_EQ(HUT_OK, hut_test::put(db_, "deleted", "old"));
+  ASSERT_EQ(HUT_OK, hut_test::put(db_, "overwritten", "old"));
+  ASSERT_EQ(HUT_OK, hut_loader_create(db_, 1, &loader));
+  ASSERT_EQ(HUT_OK, add(loader, "deleted", "loaded"));
+  ASSERT_EQ(HUT_OK, add(loader, "overwritten", "loaded"));
+  ASSERT_EQ(HUT_OK, add(loader, "untouched", "loaded"));
+  ASSERT_EQ(HUT_OK, hut_test::del(db_, "deleted"));
+  ASSERT_EQ(HUT_OK, hut_test::put(db_, "overwritten", "new"));
+  ASSERT_EQ(HUT_OK, hut_loader_commit(loader));
+
+  for (int pass = 0; pass < 2; pass++) {
+    expect_missing("deleted");
+    expect("overwritten", "new");
+    expect("untouched", "loaded");
+    reopen();
+  }
+}
+
+TEST_P(Load, WritesBeforeAddLose) {
+  hut_loader_t *loader;
+
+  ASSERT_EQ(HUT_OK, hut_test::put(db_, "deleted", "old"));
+  ASSERT_EQ(HUT_OK, hut_test::del(db_, "deleted"));
+  ASSERT_EQ(HUT_OK, hut_test::put(db_, "overwritten", "old"));
+  ASSERT_EQ(HUT_OK, hut_loader_create(db_, 1, &loader));
+  ASSERT_EQ(HUT_OK, add(loader, "deleted", "loaded"));
+  ASSERT_EQ(HUT_OK, add(loader, "overwritten", "loaded"));
+  ASSERT_EQ(HUT_OK, hut_loader_commit(loader));
+
+  for (int pass = 0; pass < 2; pass++) {
+    expect("deleted", "loaded");
+    expect("overwritten", "loaded");
+    reopen();
+  }
+}
+
+TEST_P(Load, DeleteOfKeyOnlyLoadedFails) {
+  hut_loader_t *loader;
+
+  ASSERT_EQ(HUT_OK, hut_loader_create(db_, 1, &loader));
+  ASSERT_EQ(HUT_OK, add(loader, "loaded", "loaded"));
+  EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::del(db_, "loaded"));
+  ASSERT_EQ(HUT_OK, hut_loader_commit(loader));
+
+  for (int pass = 0; pass < 2; pass++) {
+    expect("loaded", "loaded");
+    reopen();
+  }
+}
+
+/* The tombstone is alone in its segment, but still shadows the load. */
+TEST_P(Load, DeleteAfterAddSurvivesCompaction) {
+  hut_loader_t *loader;
+
+  ASSERT_EQ(HUT_OK, hut_test::put(db_, "deleted", "old"));
+  ASSERT_EQ(HUT_OK, hut_loader_create(db_, 1, &loader));
+  ASSERT_EQ(HUT_OK, add(loader, "deleted", "loaded"));
+  ASSERT_EQ(HUT_OK, hut_test::del(db_, "deleted"));
+  for (int i = 0; i < 1000; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, "filler", kFiller));
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  ASSERT_EQ(HUT_OK, hut_loader_commit(loader));
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+
+  for (int pass = 0; pass < 2; pass++) {
+    expect_missing("deleted");
+    reopen();
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Shards, Load, ::testing::Values(0u, 4u));
+
+/*
+ * A crash between writing the commit and installing the load, or before
+ * the commit, rebuilt from the files of a load run to the end: the
+ * segments it moved in go back to LOAD.
+ */
+class LoadRecovery : public ::testing::Test {
+protected:
+  void SetUp() override {
+    hut_loader_t *loader;
+    hut_test::files_t before, after;
+    hut_db_t *db;
+
+    opts_ = hut_test::small_options();
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db));
+    ASSERT_EQ(HUT_OK, hut_test::put(db, "deleted", "old"));
+    ASSERT_EQ(HUT_OK, hut_test::put(db, "kept", "old"));
+    hut_close(db);
+    before = hut_test::read_files(dir_.path());
+
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db));
+    ASSERT_EQ(HUT_OK, hut_loader_create(db, 2, &loader));
+    for (int i = 0; i < 2000; i++)
+      ASSERT_EQ(HUT_OK, add(loader, key(i), value(i)));
+    ASSERT_EQ(HUT_OK, add(loader, "deleted", "loaded"));
+    ASSERT_EQ(HUT_OK, hut_test::del(db, "deleted"));
+    ASSERT_EQ(HUT_OK, hut_loader_commit(loader));
+    hut_close(db);
+    after = hut_test::read_files(dir_.path());
+
+    ASSERT_EQ(0, mkdir(crash_.join("LOAD").c_str(), 0755));
+    for (hut_test::files_t::const_iterator f = after.begin(); f != after.end(); ++f) {
+      if (before.count(f->first))
+        continue;
+      hut_test::write_file(crash_.join("LOAD/" + f->first), f->second);
+      staged_++;
+    }
+    /* With the delete, which went to the active segment. */
+    base_ = before.size();
+    for (hut_test::files_t::const_iterator f = before.begin(); f != before.end(); ++f)
+      hut_test::write_file(crash_.join(f->first), after.count(f->first) ? after[f->first]
+                                                                         : f->second);
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  TempDir dir_, crash_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+  int staged_ = 0;
+  size_t base_ = 0;
+};
+
+TEST_F(LoadRecovery, CommittedLoadIsInstalled) {
+  std::string got;
+  struct stat st;
+
+  ASSERT_GT(staged_, 1);
+  hut_test::write_file(crash_.join("LOAD/COMMIT"), "");
+  ASSERT_EQ(HUT_OK, hut_open(crash_.path(), &opts_, &db_));
+  for (int i = 0; i < 2000; i++) {
+    ASSERT_EQ(HUT_OK, hut_test::get(db_, key(i), &got)) << key(i);
+    EXPECT_EQ(value(i), got);
+  }
+  EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, "deleted", &got));
+  ASSERT_EQ(HUT_OK, hut_test::get(db_, "kept", &got));
+  EXPECT_EQ("old", got);
+  EXPECT_NE(0, stat(crash_.join("LOAD").c_str(), &st));
+}
+
+TEST_F(LoadRecovery, UncommittedLoadIsDropped) {
+  std::string got;
+  struct stat st;
+
+  ASSERT_EQ(HUT_OK, hut_open(crash_.path(), &opts_, &db_));
+  for (int i = 0; i < 2000; i += 100)
+    EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, key(i), &got)) << key(i);
+  EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, "deleted", &got));
+  ASSERT_EQ(HUT_OK, hut_test::get(db_, "kept", &got));
+  EXPECT_EQ("old", got);
+  EXPECT_NE(0, stat(crash_.join("LOAD").c_str(), &st));
+  EXPECT_EQ(base_, hut_test::read_files(crash_.path()).size());
+}
+
+} // namespace
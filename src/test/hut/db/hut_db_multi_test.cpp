@@ -0,0 +1,259 @@
+#include "hut_test.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+/*
+ * Batched gets: hut_multi_get() answering every key as hut_get() would,
+ * in batches shorter and longer than the group it interleaves, from the
+ * active segment and sealed ones, sharded or not, and racing a writer
+ * and compaction.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+const unsigned kKeys = 3000;
+
+std::string key(unsigned i) {
+  return "key" + std::to_string(i);
+}
+
+/* "<key>:<generation>:", padded so that segments roll often. */
+std::string value(unsigned i, unsigned gen) {
+  std::string v = key(i) + ":" + std::to_string(gen) + ":";
+
+  v.resize(100 + i % 200, 'v');
+  return v;
+}
+
+struct Param {
+  hut_runtime_t runtime;
+  unsigned shards;
+};
+
+class MultiGet : public ::testing::TestWithParam<Param> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.runtime = GetParam().runtime;
+    opts_.shards = GetParam().shards;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  void reopen() {
+    hut_close(db_);
+    db_ = NULL;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  /* Every third deleted, every fifth overwritten. */
+  void fill() {
+    for (unsigned i = 0; i < kKeys; i++)
+      ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i, 0)));
+    for (unsigned i = 0; i < kKeys; i++) {
+      if (i % 3 == 0)
+        ASSERT_EQ(HUT_OK, hut_test::del(db_, key(i)));
+      else if (i % 5 == 0)
+        ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i, 1)));
+    }
+  }
+
+  /* Gets `keys` in one batch and compares each answer with hut_get(). */
+  void check(const std::vector<std::string> &keys) {
+    std::vector<const void *> ptrs(keys.size());
+    std::vector<size_t> lens(keys.size());
+    std::vector<hut_value_t> values(keys.size());
+    std::vector<int> statuses(keys.size());
+    std::string got;
+
+    for (size_t i = 0; i < keys.size(); i++) {
+      ptrs[i] = keys[i].data();
+      lens[i] = keys[i].size();
+    }
+    ASSERT_EQ(HUT_OK, hut_multi_get(db_, keys.size(), ptrs.data(), lens.data(), values.data(),
+                                    statuses.data()));
+    for (size_t i = 0; i < keys.size(); i++) {
+      EXPECT_EQ(hut_test::get(db_, keys[i], &got), statuses[i]) << "'" << keys[i] << "'";
+      if (statuses[i])
+        continue;
+      EXPECT_EQ(got, std::string(static_cast<const char *>(values[i].data), values[i].len))
+          << keys[i];
+      hut_value_release(&values[i]);
+    }
+  }
+
+  /* Batches of every size around the group width, then one of all keys. */
+  void check_all() {
+    std::vector<std::string> keys;
+
+    for (unsigned n = 1; n <= 40; n++) {
+      keys.clear();
+      for (unsigned i = 0; i < n; i++)
+        keys.push_back(key((n * 97 + i * 31) % kKeys));
+      check(keys);
+    }
+
+    /* Duplicates, keys never written, and an empty one. */
+    keys.clear();
+    for (unsigned i = 0; i < kKeys + 100; i++)
+      keys.push_back(key(i));
+    keys.push_back(key(1));
+    keys.push_back(key(1));
+    keys.push_back("");
+    keys.push_back("nokey");
+    check(keys);
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+TEST_P(MultiGet, InvalidArguments) {
+  const void *k = "key";
+  size_t len = 3;
+  hut_value_t v;
+  int status;
+
+  EXPECT_EQ(HUT_OK, hut_multi_get(db_, 0, NULL, NULL, NULL, NULL));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_multi_get(db_, 1, NULL, &len, &v, &status));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_multi_get(db_, 1, &k, NULL, &v, &status));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_multi_get(db_, 1, &k, &len, NULL, &status));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_multi_get(db_, 1, &k, &len, &v, NULL));
+}
+
+TEST_P(MultiGet, MatchesGet) {
+  fill();
+  check_all();
+  reopen();
+  check_all();
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  check_all();
+}
+
+/* Every key recorded as a get, with the bytes of those found. */
+TEST_P(MultiGet, Timed) {
+  std::vector<const void *> ptrs;
+  std::vector<size_t> lens;
+  std::vector<std::string> keys;
+  std::vector<hut_value_t> values(101);
+  std::vector<int> statuses(101);
+  hut_stats_t stats;
+  uint64_t bytes = 0;
+
+  hut_close(db_);
+  opts_.stats = 1;
+  ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  for (unsigned i = 0; i < 100; i++) {
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i, 0)));
+    keys.push_back(key(i));
+    bytes += key(i).size() + value(i, 0).size();
+  }
+  keys.push_back("nokey");
+  for (unsigned i = 0; i < keys.size(); i++) {
+    ptrs.push_back(keys[i].data());
+    lens.push_back(keys[i].size());
+  }
+
+  ASSERT_EQ(HUT_OK, hut_multi_get(db_, keys.size(), ptrs.data(), lens.data(), values.data(),
+                                  statuses.data()));
+  for (unsigned i = 0; i < 100; i++)
+    hut_value_release(&values[i]);
+  ASSERT_EQ(HUT_OK, hut_stats_get(db_, &stats));
+  EXPECT_EQ(keys.size(), stats.latency[HUT_STATS_GET].count);
+  EXPECT_EQ(bytes, stats.bytes_read);
+}
+
+/*
+ * Batches racing a writer that keeps overwriting every key and compaction
+ * that keeps moving them: every key is found, with a value written for
+ * it, and never one older than the batch before saw.
+ */
+TEST_P(MultiGet, RacingWrites) {
+  const unsigned batch = 64, gens = 5;
+  std::vector<std::thread> threads;
+  std::atomic<bool> stop(false);
+  std::vector<unsigned> errors(4), batches(4);
+  unsigned failed = 0;
+
+  for (unsigned i = 0; i < kKeys; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i, 0)));
+
+  for (unsigned r = 0; r < errors.size(); r++)
+    threads.emplace_back([&, r] {
+      std::vector<long> seen(kKeys, -1);
+      std::vector<std::string> keys(batch);
+      std::vector<const void *> ptrs(batch);
+      std::vector<size_t> lens(batch);
+      std::vector<hut_value_t> values(batch);
+      std::vector<int> statuses(batch);
+      unsigned next = r * 1009;
+
+      while (!stop) {
+        for (unsigned b = 0; b < batch; b++) {
+          next = (next + 7919) % kKeys;
+          keys[b] = key(next);
+          ptrs[b] = keys[b].data();
+          lens[b] = keys[b].size();
+        }
+        if (hut_multi_get(db_, batch, ptrs.data(), lens.data(), values.data(), statuses.data())) {
+          errors[r]++;
+          continue;
+        }
+        batches[r]++;
+        for (unsigned b = 0; b < batch; b++) {
+          std::string prefix = keys[b] + ":", v;
+          unsigned i, gen;
+
+          if (statuses[b]) {
+            errors[r]++;
+            continue;
+          }
+          v.assign(static_cast<const char *>(values[b].data), values[b].len);
+          hut_value_release(&values[b]);
+          sscanf(keys[b].c_str(), "key%u", &i);
+          if (v.compare(0, prefix.size(), prefix)
+              || sscanf(v.c_str() + prefix.size(), "%u:", &gen) != 1 || v != value(i, gen)
+              || static_cast<long>(gen) < seen[i])
+            errors[r]++;
+          else
+            seen[i] = gen;
+        }
+      }
+    });
+  threads.emplace_back([&] {
+    while (!stop)
+      hut_compact(db_, 0.3);
+  });
+  for (unsigned gen = 1; gen <= gens; gen++)
+    for (unsigned i = 0; i < kKeys; i++)
+      failed += hut_test::put(db_, key(i), value(i, gen)) != HUT_OK;
+  stop = true;
+  for (unsigned t = 0; t < threads.size(); t++)
+    threads[t].join();
+
+  EXPECT_EQ(0u, failed);
+  for (unsigned r = 0; r < errors.size(); r++) {
+    EXPECT_GT(batches[r], 0u);
+    EXPECT_EQ(0u, errors[r]) << "reader " << r;
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Shards, MultiGet,
+                        ::testing::Values(Param{HUT_RUNTIME_SHARED, 0},
+                                          Param{HUT_RUNTIME_SHARED, 4},
+                                          Param{HUT_RUNTIME_THREAD_PER_CORE, 2}));
+
+} // namespace
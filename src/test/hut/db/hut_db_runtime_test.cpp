@@ -0,0 +1,103 @@
+#include "hut_test.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+/*
+ * Runtimes that hand requests to other threads, thread-per-core and the
+ * write queue: callers wait on a message on their stack, often long
+ * enough to sleep, and must each get their own answer back, with more
+ * callers than there are threads answering.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+struct Param {
+  hut_runtime_t runtime;
+  int write_queue;
+  unsigned shards;
+};
+
+std::string key(unsigned thread, unsigned i) {
+  return "key" + std::to_string(thread) + "." + std::to_string(i);
+}
+
+std::string value(unsigned thread, unsigned i, unsigned pass) {
+  return std::string(50 + i % 100, 'a' + (thread + i + pass) % 26);
+}
+
+class Runtime : public ::testing::TestWithParam<Param> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.runtime = GetParam().runtime;
+    opts_.write_queue = GetParam().write_queue;
+    opts_.shards = GetParam().shards;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+/* Each thread its own keys, so that every answer is known. */
+TEST_P(Runtime, CallersGetTheirOwnAnswers) {
+  const unsigned threads = 8, keys = 500;
+  std::vector<std::thread> workers;
+  std::vector<unsigned> errors(threads);
+
+  for (unsigned t = 0; t < threads; t++)
+    workers.emplace_back([&, t] {
+      std::string got;
+
+      for (unsigned pass = 0; pass < 3; pass++)
+        for (unsigned i = 0; i < keys; i++) {
+          errors[t] += hut_test::put(db_, key(t, i), value(t, i, pass)) != HUT_OK;
+          errors[t] += hut_test::get(db_, key(t, i), &got) != HUT_OK
+                       || got != value(t, i, pass);
+          if (i % 7 == pass) {
+            errors[t] += hut_test::del(db_, key(t, i)) != HUT_OK;
+            errors[t] += hut_test::get(db_, key(t, i), &got) != HUT_ERR_NOTFOUND;
+            errors[t] += hut_test::del(db_, key(t, i)) != HUT_ERR_NOTFOUND;
+          }
+        }
+    });
+  for (unsigned t = 0; t < threads; t++) {
+    workers[t].join();
+    EXPECT_EQ(0u, errors[t]) << "thread " << t;
+  }
+
+  hut_close(db_);
+  db_ = NULL;
+  ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  for (unsigned t = 0; t < threads; t++)
+    for (unsigned i = 0; i < keys; i++) {
+      std::string got;
+
+      if (i % 7 == 2) {
+        EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, key(t, i), &got)) << key(t, i);
+      } else {
+        ASSERT_EQ(HUT_OK, hut_test::get(db_, key(t, i), &got)) << key(t, i);
+        EXPECT_EQ(value(t, i, 2), got) << key(t, i);
+      }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Runtimes, Runtime,
+                        ::testing::Values(Param{HUT_RUNTIME_THREAD_PER_CORE, 0, 2},
+                                          Param{HUT_RUNTIME_THREAD_PER_CORE, 0, 0},
+                                          Param{HUT_RUNTIME_SHARED, 1, 0},
+                                          Param{HUT_RUNTIME_SHARED, 1, 4}));
+
+} // namespace
@@ -0,0 +1,224 @@
+#include "hut_test.hpp"
+
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "hut/hut.hpp"
+
+/*
+ * The C++20 layer: the synchronous calls, errors turned into exceptions,
+ * and every awaitable driven by coroutines against a real database, with
+ * many gets suspended at once and resumed from poll() on their thread.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+/* Runs eagerly to completion, resumed by whatever it awaits. */
+struct task {
+  struct promise_type {
+    task get_return_object() noexcept { return task(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+std::string key(unsigned i) {
+  return "key" + std::to_string(i);
+}
+
+/* Some past the 4 KiB read first. */
+std::string value(unsigned i) {
+  return std::string(i % 10 ? 100 + i : 6000 + i, 'a' + i % 26);
+}
+
+struct Lookup {
+  bool done = false;
+  bool found = false;
+  std::string value;
+  std::thread::id thread;
+};
+
+task lookup(hut::db &db, std::string k, Lookup *out, unsigned *pending) {
+  std::optional<hut::value> v = co_await db.get_async(k);
+
+  out->found = v.has_value();
+  if (v)
+    out->value = v->str();
+  out->thread = std::this_thread::get_id();
+  out->done = true;
+  --*pending;
+}
+
+task write(hut::db &db, unsigned i, std::vector<int> *results) {
+  std::string k = key(i), v = value(i);
+
+  results->push_back(co_await db.put_async(k, v));
+  if (i % 3 == 0) {
+    results->push_back(co_await db.del_async(k));
+    results->push_back(co_await db.del_async(k));
+  }
+}
+
+struct Param {
+  hut_io_backend_t backend;
+  hut_runtime_t runtime;
+  unsigned shards;
+};
+
+class Hpp : public ::testing::TestWithParam<Param> {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.io.backend = GetParam().backend;
+    opts_.io.queue_depth = 16;
+    opts_.runtime = GetParam().runtime;
+    opts_.shards = GetParam().shards;
+    opts_.stats = 1;
+    db_ = hut::db(dir_.path(), opts_);
+  }
+
+  void reopen() {
+    db_.close();
+    db_ = hut::db(dir_.path(), opts_);
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut::db db_;
+};
+
+TEST_P(Hpp, Sync) {
+  std::vector<std::string_view> keys;
+  std::map<std::string, std::string> seen;
+  std::optional<hut::value> v;
+  hut_stats_t stats;
+
+  for (unsigned i = 0; i < 100; i++)
+    db_.put(key(i), value(i));
+  EXPECT_TRUE(db_.del(key(0)));
+  EXPECT_FALSE(db_.del(key(0)));
+  EXPECT_FALSE(db_.get(key(0)).has_value());
+  ASSERT_TRUE((v = db_.get(key(1))).has_value());
+  EXPECT_EQ(value(1), v->view());
+
+  /* Values stay pinned, and move, past their database's writes. */
+  hut::value moved(std::move(*v));
+  db_.put(key(1), "other");
+  EXPECT_EQ(value(1), moved.str());
+  EXPECT_EQ(0u, v->size());
+  moved.reset();
+
+  keys = {"key0", "key1", "key2", "nokey"};
+  std::vector<std::optional<hut::value>> got = db_.multi_get(keys);
+  ASSERT_EQ(4u, got.size());
+  EXPECT_FALSE(got[0].has_value());
+  EXPECT_EQ("other", got[1]->view());
+  EXPECT_EQ(value(2), got[2]->view());
+  EXPECT_FALSE(got[3].has_value());
+  got.clear();
+
+  db_.scan([&](std::string_view k, std::string_view val) {
+    seen[std::string(k)] = std::string(val);
+    return true;
+  });
+  EXPECT_EQ(99u, seen.size());
+  EXPECT_EQ(value(50), seen[key(50)]);
+
+  db_.sync();
+  db_.compact(0);
+  EXPECT_EQ(0u, db_.verify().corrupt_records);
+  stats = db_.stats();
+  EXPECT_EQ(101u, stats.latency[HUT_STATS_PUT].count);
+}
+
+TEST_P(Hpp, Errors) {
+  unsigned calls = 0;
+
+  try {
+    db_.put("", "value");
+    FAIL() << "no exception";
+  } catch (const hut::error &e) {
+    EXPECT_EQ(HUT_ERR_INVALID, e.status());
+  }
+  EXPECT_THROW(db_.get(""), hut::error);
+
+  /* The callback's own exceptions stop the scan and come out of it. */
+  for (unsigned i = 0; i < 10; i++)
+    db_.put(key(i), value(i));
+  EXPECT_THROW(db_.scan([&](std::string_view, std::string_view) -> bool {
+    calls++;
+    throw std::logic_error("stop");
+  }),
+               std::logic_error);
+  EXPECT_EQ(1u, calls);
+
+  calls = 0;
+  db_.scan([&](std::string_view, std::string_view) { return ++calls < 3; });
+  EXPECT_EQ(3u, calls);
+}
+
+TEST_P(Hpp, Writes) {
+  std::vector<int> results;
+
+  for (unsigned i = 0; i < 300; i++)
+    write(db_, i, &results);
+  EXPECT_EQ(500u, results.size());
+  for (unsigned i = 0, r = 0; i < 300; i++) {
+    EXPECT_TRUE(results[r++]) << key(i);
+    if (i % 3 == 0) {
+      EXPECT_TRUE(results[r++]) << key(i);
+      EXPECT_FALSE(results[r++]) << key(i);
+    }
+    EXPECT_EQ(i % 3 != 0, db_.get(key(i)).has_value()) << key(i);
+  }
+}
+
+/* From disk once reopened, with up to `depth` coroutines suspended. */
+TEST_P(Hpp, Gets) {
+  const unsigned n = 2000, depth = 64;
+  std::vector<Lookup> lookups(n + 10);
+  unsigned pending = 0;
+
+  for (unsigned i = 0; i < n; i++)
+    db_.put(key(i), value(i));
+  for (unsigned i = 0; i < n; i += 7)
+    db_.del(key(i));
+  reopen();
+
+  for (unsigned i = 0; i < lookups.size(); i++) {
+    pending++;
+    lookup(db_, key(i), &lookups[i], &pending);
+    while (pending >= depth)
+      db_.poll(1);
+  }
+  while (pending)
+    db_.poll(1);
+
+  for (unsigned i = 0; i < lookups.size(); i++) {
+    ASSERT_TRUE(lookups[i].done) << key(i);
+    EXPECT_EQ(std::this_thread::get_id(), lookups[i].thread);
+    EXPECT_EQ(i < n && i % 7, lookups[i].found) << key(i);
+    if (lookups[i].found)
+      EXPECT_EQ(value(i), lookups[i].value) << key(i);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Backends, Hpp,
+    ::testing::Values(Param{HUT_IO_MMAP, HUT_RUNTIME_SHARED, 0},
+                      Param{HUT_IO_URING, HUT_RUNTIME_SHARED, 0},
+                      Param{HUT_IO_URING, HUT_RUNTIME_SHARED, 4},
+                      Param{HUT_IO_URING, HUT_RUNTIME_THREAD_PER_CORE, 2}));
+
+} // namespace
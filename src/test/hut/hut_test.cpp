@@ -0,0 +1,92 @@
+#include "hut_test.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+namespace hut_test {
+
+namespace {
+
+int remove_entry(const char *path, const struct stat *, int, struct FTW *) {
+  return remove(path);
+}
+
+} // namespace
+
+TempDir::TempDir() {
+  const char *tmp = getenv("TMPDIR");
+  std::string pattern = std::string(tmp && *tmp ? tmp : "/tmp") + "/hut_test.XXXXXX";
+
+  if (!mkdtemp(&pattern[0]))
+    throw std::runtime_error("mkdtemp failed");
+  path_ = pattern;
+}
+
+TempDir::~TempDir() {
+  nftw(path_.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+files_t read_files(const std::string &dir) {
+  files_t files;
+  DIR *d = opendir(dir.c_str());
+  struct dirent *ent;
+  struct stat st;
+
+  if (!d)
+    return files;
+  while ((ent = readdir(d))) {
+    std::string path = dir + "/" + ent->d_name;
+    if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+      continue;
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::ostringstream data;
+    data << in.rdbuf();
+    files[ent->d_name] = data.str();
+  }
+  closedir(d);
+  return files;
+}
+
+void write_file(const std::string &path, const std::string &data) {
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+
+  out.write(data.data(), data.size());
+}
+
+hut_options_t small_options() {
+  hut_options_t opts;
+
+  hut_options_init(&opts);
+  opts.segment_size = 64u << 10;
+  opts.cache_size = 1u << 20;
+  opts.stats = 0;
+  return opts;
+}
+
+int put(hut_db_t *db, const std::string &key, const std::string &value) {
+  return hut_put(db, key.data(), key.size(), value.data(), value.size());
+}
+
+int del(hut_db_t *db, const std::string &key) {
+  return hut_del(db, key.data(), key.size());
+}
+
+int get(hut_db_t *db, const std::string &key, std::string *value) {
+  hut_value_t v;
+  int rc = hut_get(db, key.data(), key.size(), &v);
+
+  if (rc)
+    return rc;
+  value->assign(static_cast<const char *>(v.data), v.len);
+  hut_value_release(&v);
+  return HUT_OK;
+}
+
+} // namespace hut_test
@@ -0,0 +1,53 @@
+#ifndef HUT_TEST_HPP
+#define HUT_TEST_HPP
+
+#include <map>
+#include <string>
+
+extern "C" {
+#include "hut/hut.h"
+}
+
+/*
+ * Helpers shared by the unit tests: a scratch directory per test, and
+ * string wrappers around the calls most tests make.
+ */
+
+namespace hut_test {
+
+/* A fresh directory, removed with everything in it once out of scope. */
+class TempDir {
+public:
+  TempDir();
+  ~TempDir();
+
+  const char *path() const { return path_.c_str(); }
+  std::string join(const std::string &name) const { return path_ + "/" + name; }
+
+private:
+  TempDir(const TempDir &);
+  TempDir &operator=(const TempDir &);
+
+  std::string path_;
+};
+
+/* File contents by name, of regular files right under `dir`. */
+typedef std::map<std::string, std::string> files_t;
+
+files_t read_files(const std::string &dir);
+
+void write_file(const std::string &path, const std::string &data);
+
+/* Options small enough for tests to roll segments quickly. */
+hut_options_t small_options();
+
+int put(hut_db_t *db, const std::string &key, const std::string &value);
+
+int del(hut_db_t *db, const std::string &key);
+
+/* Returns the status, setting `value` on HUT_OK. */
+int get(hut_db_t *db, const std::string &key, std::string *value);
+
+} // namespace hut_test
+
+#endif /* HUT_TEST_HPP */
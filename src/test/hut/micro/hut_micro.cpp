@@ -0,0 +1,146 @@
+#include "hut_micro.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace hut_micro {
+
+namespace {
+
+struct options {
+  double min_time = 0.1;        /* per repeat, in seconds */
+  unsigned repeats = 5;
+  double tolerance = 0.2;       /* slowdown allowed against the baseline */
+  std::string baseline;
+  std::string save;
+};
+
+options opts;
+std::map<std::string, double> baseline;
+std::map<std::string, double> results;
+
+uint64_t now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t time_loop(const loop_fn &loop, uint64_t n) {
+  uint64_t start = now();
+
+  loop(n);
+  return now() - start;
+}
+
+/* Matches `--name=`, pointing `*value` past it. */
+bool flag(const char *arg, const char *name, const char **value) {
+  size_t len = strlen(name);
+
+  if (strncmp(arg, "--", 2) || strncmp(arg + 2, name, len) || arg[2 + len] != '=')
+    return false;
+  *value = arg + 3 + len;
+  return true;
+}
+
+/* Takes the harness options out of argv, leaving googletest's. */
+bool parse(int *argc, char **argv) {
+  const char *v;
+  int i, j;
+
+  for (i = j = 1; i < *argc; i++) {
+    if (flag(argv[i], "min_time", &v))
+      opts.min_time = atof(v);
+    else if (flag(argv[i], "repeats", &v))
+      opts.repeats = (unsigned) atoi(v);
+    else if (flag(argv[i], "tolerance", &v))
+      opts.tolerance = atof(v);
+    else if (flag(argv[i], "baseline", &v))
+      opts.baseline = v;
+    else if (flag(argv[i], "save", &v))
+      opts.save = v;
+    else
+      argv[j++] = argv[i];
+  }
+  *argc = j;
+  argv[j] = NULL;
+  return opts.min_time > 0 && opts.repeats > 0 && opts.tolerance >= 0;
+}
+
+bool load_baseline() {
+  std::ifstream in(opts.baseline);
+  std::string name;
+  double ns;
+
+  if (!in)
+    return false;
+  while (in >> name >> ns)
+    baseline[name] = ns;
+  return in.eof();
+}
+
+bool save_results() {
+  std::ofstream out(opts.save);
+
+  for (const auto &r : results)
+    out << r.first << " " << r.second << "\n";
+  return static_cast<bool>(out);
+}
+
+} // namespace
+
+double measure(const char *name, const loop_fn &loop) {
+  uint64_t target = (uint64_t) (opts.min_time * 1e9), n = 1, elapsed;
+  double best = 0, ns;
+  unsigned i;
+
+  /* Warms up while growing the count up to about `min_time`. */
+  while ((elapsed = time_loop(loop, n)) < target / 10 && n < (UINT64_C(1) << 40))
+    n *= 10;
+  if (elapsed < target)
+    n = (uint64_t) ((double) n * (double) target / (double) (elapsed ? elapsed : 1)) + 1;
+
+  for (i = 0; i < opts.repeats; i++) {
+    ns = (double) time_loop(loop, n) / (double) n;
+    if (!i || ns < best)
+      best = ns;
+  }
+  results[name] = best;
+  printf("%-32s %12.2f ns/op %14llu iterations\n", name, best, (unsigned long long) n);
+  ::testing::Test::RecordProperty(name, std::to_string(best));
+
+  auto it = baseline.find(name);
+  if (it != baseline.end())
+    EXPECT_LE(best, it->second * (1 + opts.tolerance))
+      << name << " regressed from " << it->second << " ns/op";
+  return best;
+}
+
+} // namespace hut_micro
+
+int main(int argc, char **argv) {
+  int rc;
+
+  if (!hut_micro::parse(&argc, argv)) {
+    fprintf(stderr, "hutmicrobench: invalid option\n");
+    return 2;
+  }
+  if (!hut_micro::opts.baseline.empty() && !hut_micro::load_baseline()) {
+    fprintf(stderr, "hutmicrobench: cannot read %s\n", hut_micro::opts.baseline.c_str());
+    return 2;
+  }
+  ::testing::InitGoogleTest(&argc, argv);
+  rc = RUN_ALL_TESTS();
+  if (!hut_micro::opts.save.empty() && !hut_micro::save_results()) {
+    fprintf(stderr, "hutmicrobench: cannot write %s\n", hut_micro::opts.save.c_str());
+    return 2;
+  }
+  return rc;
+}
@@ -0,0 +1,40 @@
+#ifndef HUT_MICRO_HPP
+#define HUT_MICRO_HPP
+
+#include <cstdint>
+#include <functional>
+
+/*
+ * Micro-benchmark harness, run as googletest tests.
+ *
+ * measure() calibrates how many iterations a loop needs to run for
+ * `min_time` seconds, times that many `repeats` times and reports the
+ * fastest repeat in ns per iteration, which is the least noisy figure on
+ * a shared machine. Results go to stdout and to the test's properties,
+ * for --gtest_output=xml, and are checked against a baseline file when
+ * one is given, failing the test on a slowdown past `tolerance`.
+ *
+ *   hutmicrobench [--min_time=S] [--repeats=N] [--baseline=FILE]
+ *                 [--tolerance=F] [--save=FILE] [--gtest_...]
+ *
+ * Baselines are what --save writes: one line per benchmark, its name and
+ * its ns per iteration.
+ */
+
+namespace hut_micro {
+
+/* Runs `n` iterations. */
+typedef std::function<void(uint64_t n)> loop_fn;
+
+/* Returns the ns per iteration, recording them under `name`. */
+double measure(const char *name, const loop_fn &loop);
+
+/* Keeps the compiler from optimizing `value`, and what it came from, away. */
+template <class T>
+inline void keep(const T &value) {
+  __asm__ __volatile__("" : : "r,m"(value) : "memory");
+}
+
+} // namespace hut_micro
+
+#endif /* HUT_MICRO_HPP */
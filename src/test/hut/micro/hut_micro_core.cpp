@@ -0,0 +1,224 @@
+#include "hut_micro.hpp"
+
+#include <cstring>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/db/hut_db.h"
+#include "hut/index/hut_index.h"
+#include "hut/segment/hut_segment.h"
+#include "hut/util/hut_crc.h"
+#include "hut/util/hut_hash.h"
+#include "hut/util/hut_pool.h"
+}
+
+/*
+ * Micro-benchmarks of the primitives on the get and put paths: index
+ * probes, checksums, write buffer allocation, record framing, segment
+ * pinning and key comparison.
+ */
+
+namespace {
+
+const unsigned kKeys = 1u << 20;
+const unsigned kKeySize = 16;
+const unsigned kValueSize = 100;
+
+/* Hashes of keys cycled through, enough of them to defeat the branch predictor. */
+std::vector<uint64_t> probe_hashes(uint64_t seed) {
+  std::vector<uint64_t> hashes(1u << 16);
+
+  for (size_t i = 0; i < hashes.size(); i++)
+    hashes[i] = hut_hash64(seed + hut_hash64(i) % kKeys);
+  return hashes;
+}
+
+class IndexProbe : public ::testing::Test {
+protected:
+  void SetUp() override {
+    uint64_t i;
+
+    ASSERT_EQ(HUT_OK, hut_index_create(kKeys, HUT_HUGE_PAGES_NONE, -1, &index_));
+    for (i = 0; i < kKeys; i++)
+      ASSERT_EQ(HUT_OK, hut_index_insert(index_, hut_hash64(i), i));
+  }
+
+  void TearDown() override { hut_index_destroy(index_); }
+
+  hut_index_t *index_ = nullptr;
+};
+
+TEST_F(IndexProbe, Hit) {
+  std::vector<uint64_t> hashes = probe_hashes(0);
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES];
+
+  hut_micro::measure("index/probe_hit", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      hut_micro::keep(hut_index_find(index_, hashes[i & 0xffff], addrs, HUT_DB_MAX_CANDIDATES));
+  });
+}
+
+TEST_F(IndexProbe, Miss) {
+  std::vector<uint64_t> hashes = probe_hashes(kKeys);
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES];
+
+  hut_micro::measure("index/probe_miss", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      hut_micro::keep(hut_index_find(index_, hashes[i & 0xffff], addrs, HUT_DB_MAX_CANDIDATES));
+  });
+}
+
+TEST_F(IndexProbe, HitConcurrent) {
+  std::vector<uint64_t> hashes = probe_hashes(0);
+  uint64_t addrs[HUT_DB_MAX_CANDIDATES];
+  unsigned count;
+
+  hut_micro::measure("index/probe_hit_concurrent", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      hut_index_find_concurrent(index_, hashes[i & 0xffff], addrs, HUT_DB_MAX_CANDIDATES,
+                                &count);
+      hut_micro::keep(count);
+    }
+  });
+}
+
+TEST(Crc, Record) {
+  std::vector<char> buf(kKeySize + kValueSize, 'x');
+
+  hut_micro::measure("crc32c/116", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      hut_micro::keep(hut_crc32c(0, buf.data(), buf.size()));
+  });
+}
+
+TEST(Crc, Block) {
+  std::vector<char> buf(4096, 'x');
+
+  hut_micro::measure("crc32c/4096", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      hut_micro::keep(hut_crc32c(0, buf.data(), buf.size()));
+  });
+}
+
+TEST(Pool, GetPut) {
+  hut_pool_t *pool;
+
+  ASSERT_EQ(HUT_OK, hut_pool_create(1u << 20, 4, &pool));
+  hut_micro::measure("pool/get_put", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      void *buf = hut_pool_get(pool);
+
+      hut_micro::keep(buf);
+      hut_pool_put(pool, buf);
+    }
+  });
+  hut_pool_destroy(pool);
+}
+
+/* Records appended to, and read back from, a segment in memory. */
+class SegmentRecord : public ::testing::Test {
+protected:
+  void SetUp() override {
+    memset(key_, 'k', sizeof(key_));
+    memset(value_, 'v', sizeof(value_));
+    ASSERT_EQ(HUT_OK, create());
+  }
+
+  void TearDown() override { hut_segment_close(seg_); }
+
+  int create() {
+    hut_segment_close(seg_);
+    seg_ = nullptr;
+    return hut_segment_create_memory("/tmp", 1, 64u << 20, HUT_HUGE_PAGES_NONE, &seg_);
+  }
+
+  /* Appends key `i`, starting over in a new segment once full. */
+  uint64_t append(uint64_t i) {
+    uint64_t off;
+    int rc;
+
+    memcpy(key_, &i, sizeof(i));
+    while ((rc = hut_segment_append(seg_, key_, kKeySize, value_, kValueSize, 0, i + 1, &off))
+           == HUT_ERR_FULL)
+      if (create())
+        abort();
+    return off;
+  }
+
+  hut_segment_t *seg_ = nullptr;
+  char key_[kKeySize];
+  char value_[kValueSize];
+};
+
+TEST_F(SegmentRecord, Append) {
+  hut_micro::measure("segment/append", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      hut_micro::keep(append(i));
+  });
+}
+
+/* What every index candidate costs a lookup: reading its record and comparing keys. */
+TEST_F(SegmentRecord, ReadCompare) {
+  std::vector<uint64_t> offs(1u << 16);
+  hut_segment_record_t rec;
+  char probe[kKeySize];
+
+  for (size_t j = 0; j < offs.size(); j++)
+    offs[j] = append(j);
+  memcpy(probe, key_, sizeof(probe));
+  hut_micro::measure("segment/read_compare", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      if (hut_segment_read(seg_, offs[i & 0xffff], &rec))
+        abort();
+      hut_micro::keep(rec.klen == kKeySize && !memcmp(rec.key, probe, kKeySize));
+      hut_segment_record_release(&rec);
+    }
+  });
+}
+
+TEST(Key, Hash) {
+  char key[kKeySize];
+
+  memset(key, 'k', sizeof(key));
+  hut_micro::measure("key/hash", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      memcpy(key, &i, sizeof(i));
+      hut_micro::keep(hut_hash_bytes(key, sizeof(key), 0));
+    }
+  });
+}
+
+TEST(Key, Compare) {
+  std::vector<char> keys(64 * kKeySize, 'k');
+  char probe[kKeySize];
+
+  for (unsigned i = 0; i < 64; i++)
+    keys[i * kKeySize + kKeySize - 1] = (char) i;
+  memcpy(probe, &keys[63 * kKeySize], kKeySize);
+  hut_micro::measure("key/compare", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+      hut_micro::keep(memcmp(&keys[(i & 63) * kKeySize], probe, kKeySize));
+  });
+}
+
+/*
+ * Readers pin the segment a record is in for as long as they use it; the
+ * table's own reference keeps it from ever going.
+ */
+TEST(SegmentPin, PinUnpin) {
+  hut_db_segment_t dbseg;
+
+  memset(&dbseg, 0, sizeof(dbseg));
+  dbseg.refs = 1;
+  hut_micro::measure("segment/pin_unpin", [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      if (!hut_db_segment_try_ref(&dbseg))
+        abort();
+      hut_db_segment_unref(&dbseg);
+    }
+  });
+}
+
+} // namespace
@@ -0,0 +1,271 @@
+#include "hut_test.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/sched/hut_sched.h"
+#include "hut/util/hut_deque.h"
+}
+
+/*
+ * The work-stealing deque, its owner alone and racing thieves, and the
+ * scheduler built on it: priorities, tasks spread over workers, and the
+ * tasks still queued when it is destroyed called as cancelled.
+ */
+
+namespace {
+
+void *item(uintptr_t i) {
+  return reinterpret_cast<void *>(i + 1);
+}
+
+uintptr_t index(void *p) {
+  return reinterpret_cast<uintptr_t>(p) - 1;
+}
+
+/* Well past the initial array, which then grows a few times. */
+TEST(Deque, OwnerTakesLastPushed) {
+  const uintptr_t n = 1000;
+  hut_deque_t d;
+
+  ASSERT_EQ(HUT_OK, hut_deque_init(&d));
+  EXPECT_TRUE(hut_deque_take(&d) == NULL);
+  EXPECT_TRUE(hut_deque_steal(&d) == NULL);
+  for (uintptr_t i = 0; i < n; i++)
+    ASSERT_EQ(HUT_OK, hut_deque_push(&d, item(i)));
+  for (uintptr_t i = n; i-- > n / 2;)
+    ASSERT_EQ(i, index(hut_deque_take(&d)));
+
+  /* Thieves take from the other end. */
+  EXPECT_EQ(0u, index(hut_deque_steal(&d)));
+  for (uintptr_t i = n; i < 2 * n; i++)
+    ASSERT_EQ(HUT_OK, hut_deque_push(&d, item(i)));
+  for (uintptr_t i = 2 * n; i-- > n;)
+    ASSERT_EQ(i, index(hut_deque_take(&d)));
+  for (uintptr_t i = n / 2; i-- > 1;)
+    ASSERT_EQ(i, index(hut_deque_take(&d)));
+  EXPECT_TRUE(hut_deque_take(&d) == NULL);
+  hut_deque_destroy(&d);
+}
+
+/* Every item pushed is taken exactly once, by its owner or a thief. */
+TEST(Deque, Thieves) {
+  const uintptr_t n = 200000;
+  const unsigned thieves = 4;
+  std::vector<std::atomic<unsigned>> seen(n);
+  std::vector<std::thread> threads;
+  std::atomic<bool> done(false);
+  hut_deque_t d;
+  void *p;
+
+  ASSERT_EQ(HUT_OK, hut_deque_init(&d));
+  for (unsigned t = 0; t < thieves; t++)
+    threads.emplace_back([&] {
+      void *p;
+
+      while (!done)
+        if ((p = hut_deque_steal(&d)))
+          seen[index(p)]++;
+    });
+  /* Bursts of pushes, growing the array, then takes down to a few. */
+  for (uintptr_t i = 0; i < n;) {
+    for (uintptr_t end = i + 1 + i % 700; i < end && i < n; i++)
+      ASSERT_EQ(HUT_OK, hut_deque_push(&d, item(i)));
+    for (unsigned k = 0; k < 300 && (p = hut_deque_take(&d)); k++)
+      seen[index(p)]++;
+  }
+  while ((p = hut_deque_take(&d)))
+    seen[index(p)]++;
+  done = true;
+  for (unsigned t = 0; t < threads.size(); t++)
+    threads[t].join();
+
+  for (uintptr_t i = 0; i < n; i++)
+    ASSERT_EQ(1u, seen[i]) << i;
+  hut_deque_destroy(&d);
+}
+
+/* Holds a worker until released. */
+struct Gate {
+  std::atomic<bool> entered{false};
+  std::atomic<bool> open{false};
+
+  void wait() {
+    entered = true;
+    while (!open)
+      std::this_thread::yield();
+  }
+
+  void wait_entered() {
+    while (!entered)
+      std::this_thread::yield();
+  }
+};
+
+struct Recorder {
+  std::mutex lock;
+  std::vector<int> order;
+  std::atomic<unsigned> ran{0};
+  std::atomic<unsigned> cancelled{0};
+};
+
+struct Task {
+  Recorder *rec;
+  int id;
+};
+
+void record(void *arg, int cancelled) {
+  Task *task = static_cast<Task *>(arg);
+
+  if (cancelled) {
+    task->rec->cancelled++;
+    return;
+  }
+  std::lock_guard<std::mutex> guard(task->rec->lock);
+  task->rec->order.push_back(task->id);
+  task->rec->ran++;
+}
+
+void blocker(void *arg, int cancelled) {
+  if (!cancelled)
+    static_cast<Gate *>(arg)->wait();
+}
+
+/* What the one worker finds queued, most urgent first. */
+TEST(Sched, Priorities) {
+  const hut_sched_priority_t prios[] = {HUT_SCHED_LOW, HUT_SCHED_NORMAL, HUT_SCHED_HIGH,
+                                        HUT_SCHED_LOW, HUT_SCHED_HIGH, HUT_SCHED_NORMAL};
+  std::vector<Task> tasks(6);
+  hut_sched_t *sched;
+  Recorder rec;
+  Gate gate;
+
+  EXPECT_EQ(HUT_ERR_INVALID, hut_sched_create(0, &sched));
+  ASSERT_EQ(HUT_OK, hut_sched_create(1, &sched));
+  EXPECT_EQ(HUT_ERR_INVALID,
+            hut_sched_submit(sched, static_cast<hut_sched_priority_t>(HUT_SCHED_PRIORITIES),
+                             record, &tasks[0]));
+  ASSERT_EQ(HUT_OK, hut_sched_submit(sched, HUT_SCHED_HIGH, blocker, &gate));
+  gate.wait_entered();
+  for (unsigned i = 0; i < tasks.size(); i++) {
+    tasks[i].rec = &rec;
+    tasks[i].id = prios[i] * 10 + i;
+    ASSERT_EQ(HUT_OK, hut_sched_submit(sched, prios[i], record, &tasks[i]));
+  }
+  gate.open = true;
+  while (rec.ran < tasks.size())
+    std::this_thread::yield();
+  hut_sched_destroy(sched);
+
+  /* In submission order within a priority, from the shared queue. */
+  EXPECT_EQ((std::vector<int>{2, 4, 11, 15, 20, 23}), rec.order);
+  EXPECT_EQ(0u, rec.cancelled);
+}
+
+struct Spawner {
+  hut_sched_t *sched;
+  std::vector<Task> *tasks;
+  std::atomic<unsigned> *failed;
+};
+
+/* Pushed to the deque of its worker, for the others to steal from. */
+void spawn(void *arg, int cancelled) {
+  Spawner *s = static_cast<Spawner *>(arg);
+
+  if (cancelled)
+    return;
+  for (unsigned i = 0; i < s->tasks->size(); i++)
+    if (hut_sched_submit(s->sched, HUT_SCHED_NORMAL, record, &(*s->tasks)[i]))
+      (*s->failed)++;
+}
+
+TEST(Sched, TasksSpreadOverWorkers) {
+  std::vector<Task> tasks(20000);
+  std::atomic<unsigned> failed(0);
+  std::vector<unsigned> seen(tasks.size());
+  hut_sched_t *sched;
+  Spawner spawner;
+  Recorder rec;
+
+  ASSERT_EQ(HUT_OK, hut_sched_create(4, &sched));
+  for (unsigned i = 0; i < tasks.size(); i++) {
+    tasks[i].rec = &rec;
+    tasks[i].id = i;
+  }
+  spawner.sched = sched;
+  spawner.tasks = &tasks;
+  spawner.failed = &failed;
+  ASSERT_EQ(HUT_OK, hut_sched_submit(sched, HUT_SCHED_NORMAL, spawn, &spawner));
+  while (rec.ran + failed < tasks.size())
+    std::this_thread::yield();
+  hut_sched_destroy(sched);
+
+  EXPECT_EQ(0u, failed);
+  for (unsigned i = 0; i < rec.order.size(); i++)
+    seen[rec.order[i]]++;
+  for (unsigned i = 0; i < seen.size(); i++)
+    ASSERT_EQ(1u, seen[i]) << i;
+}
+
+struct Holder {
+  hut_sched_t *sched;
+  std::vector<Task> *tasks;
+  Gate *gate;
+};
+
+/* Queues tasks on its own deque, then keeps its worker busy. */
+void hold(void *arg, int cancelled) {
+  Holder *h = static_cast<Holder *>(arg);
+
+  if (cancelled)
+    return;
+  for (unsigned i = 0; i < h->tasks->size(); i++)
+    hut_sched_submit(h->sched, HUT_SCHED_LOW, record, &(*h->tasks)[i]);
+  h->gate->wait();
+}
+
+/*
+ * Tasks queued on the deque of the one worker and on the shared queue
+ * are all called as cancelled once it is destroyed, and none is run.
+ */
+TEST(Sched, DestroyCancelsQueued) {
+  std::vector<Task> own(10), shared(10);
+  hut_sched_t *sched;
+  Holder holder;
+  Recorder rec;
+  Gate gate;
+
+  ASSERT_EQ(HUT_OK, hut_sched_create(1, &sched));
+  for (unsigned i = 0; i < own.size(); i++) {
+    own[i].rec = &rec;
+    own[i].id = i;
+    shared[i].rec = &rec;
+    shared[i].id = 100 + i;
+  }
+  holder.sched = sched;
+  holder.tasks = &own;
+  holder.gate = &gate;
+  ASSERT_EQ(HUT_OK, hut_sched_submit(sched, HUT_SCHED_HIGH, hold, &holder));
+  gate.wait_entered();
+  for (unsigned i = 0; i < shared.size(); i++)
+    ASSERT_EQ(HUT_OK, hut_sched_submit(sched, HUT_SCHED_NORMAL, record, &shared[i]));
+
+  /* Released once destroying has stopped the worker from taking more. */
+  std::thread opener([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    gate.open = true;
+  });
+  hut_sched_destroy(sched);
+  opener.join();
+
+  EXPECT_EQ(0u, rec.ran);
+  EXPECT_EQ(own.size() + shared.size(), rec.cancelled);
+}
+
+} // namespace
@@ -0,0 +1,158 @@
+#include "hut_test.hpp"
+
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/trace/hut_trace.h"
+#include "hut/util/hut_hash.h"
+}
+
+/*
+ * The trace file: rings wrapping around and keeping their newest events,
+ * every field decoded back as recorded, rings handed out per thread, the
+ * files it refuses, and what a database traces, TRACE.old included.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+TEST(Trace, RingWrapsAround) {
+  const uint64_t base = 1000000000;
+  hut_trace_dump_t dump;
+  hut_trace_t *trace;
+  TempDir dir;
+
+  /* Rounded up to 8 events per ring. */
+  ASSERT_EQ(HUT_OK, hut_trace_create(dir.join("TRACE").c_str(), 2, 5, &trace));
+  for (unsigned i = 0; i < 20; i++)
+    hut_trace_record(trace, HUT_STATS_PUT + i % 2, base + i * 1000, base + i * 1000 + 10 + i,
+                     0x1000 + i, 100 + i, i % 3 ? HUT_OK : HUT_ERR_NOTFOUND,
+                     i % 4 ? 0 : HUT_TRACE_GC);
+
+  /* Readable while still open, from the file alone. */
+  ASSERT_EQ(HUT_OK, hut_trace_load(dir.join("TRACE").c_str(), &dump));
+  EXPECT_EQ(1u, dump.threads);
+  EXPECT_EQ(static_cast<int>(syscall(SYS_gettid)), dump.tids[0]);
+  EXPECT_GT(dump.start, 0u);
+  ASSERT_EQ(8u, dump.count);
+  for (unsigned n = 0; n < dump.count; n++) {
+    const hut_trace_event_t &e = dump.events[n];
+    unsigned i = 12 + n;
+
+    EXPECT_EQ(i + 1, e.seq);
+    EXPECT_EQ(0x1000u + i, e.hash);
+    EXPECT_EQ(10u + i, e.latency);
+    EXPECT_EQ(100u + i, e.arg);
+    EXPECT_EQ(HUT_STATS_PUT + i % 2, e.type);
+    EXPECT_EQ(i % 4 ? 0 : HUT_TRACE_GC, e.flags);
+    EXPECT_EQ(i % 3 ? HUT_OK : HUT_ERR_NOTFOUND, e.status);
+    EXPECT_EQ(0u, e.thread);
+    if (n)
+      EXPECT_EQ(1000u, e.time - dump.events[n - 1].time);
+  }
+  hut_trace_dump_free(&dump);
+  hut_trace_close(trace);
+}
+
+TEST(Trace, RingPerThread) {
+  hut_trace_dump_t dump;
+  hut_trace_t *trace;
+  TempDir dir;
+
+  ASSERT_EQ(HUT_OK, hut_trace_create(dir.join("TRACE").c_str(), 2, 4, &trace));
+  hut_trace_record(trace, HUT_STATS_GET, 100, 200, 1, 0, HUT_OK, 0);
+  std::thread([&] {
+    hut_trace_record(trace, HUT_STATS_DEL, 150, 160, 2, 0, HUT_OK, 0);
+  }).join();
+  /* No ring left for a third, which goes untraced. */
+  std::thread([&] {
+    hut_trace_record(trace, HUT_STATS_DEL, 170, 180, 3, 0, HUT_OK, 0);
+  }).join();
+  hut_trace_record(trace, HUT_STATS_GET, 300, UINT64_C(300) + UINT32_MAX + 1, 4, 0, HUT_OK, 0);
+  hut_trace_close(trace);
+
+  ASSERT_EQ(HUT_OK, hut_trace_load(dir.join("TRACE").c_str(), &dump));
+  EXPECT_EQ(2u, dump.threads);
+  ASSERT_EQ(3u, dump.count);
+  EXPECT_EQ(1u, dump.events[0].hash);
+  EXPECT_EQ(0u, dump.events[0].thread);
+  EXPECT_EQ(2u, dump.events[1].hash);
+  EXPECT_EQ(1u, dump.events[1].thread);
+  EXPECT_EQ(HUT_STATS_DEL, dump.events[1].type);
+  EXPECT_NE(dump.tids[0], dump.tids[1]);
+  /* Latencies saturate. */
+  EXPECT_EQ(4u, dump.events[2].hash);
+  EXPECT_EQ(UINT32_MAX, dump.events[2].latency);
+  hut_trace_dump_free(&dump);
+}
+
+TEST(Trace, RefusesOthers) {
+  hut_trace_dump_t dump;
+  hut_trace_t *trace;
+  std::string data;
+  TempDir dir;
+
+  EXPECT_EQ(HUT_ERR_INVALID, hut_trace_create(dir.join("TRACE").c_str(), 0, 4, &trace));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_trace_create(dir.join("TRACE").c_str(), 257, 4, &trace));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_trace_create(dir.join("TRACE").c_str(), 1, 0, &trace));
+  EXPECT_EQ(HUT_ERR_IO, hut_trace_load(dir.join("TRACE").c_str(), &dump));
+
+  hut_test::write_file(dir.join("TRACE"), "short");
+  EXPECT_EQ(HUT_ERR_CORRUPT, hut_trace_load(dir.join("TRACE").c_str(), &dump));
+
+  ASSERT_EQ(HUT_OK, hut_trace_create(dir.join("TRACE").c_str(), 1, 4, &trace));
+  hut_trace_close(trace);
+  data = hut_test::read_files(dir.path())["TRACE"];
+  data[0] = 'X';
+  hut_test::write_file(dir.join("TRACE"), data);
+  EXPECT_EQ(HUT_ERR_CORRUPT, hut_trace_load(dir.join("TRACE").c_str(), &dump));
+}
+
+/* The newest of the operations, with their key hashes, kept across a reopen. */
+TEST(Trace, Database) {
+  hut_options_t opts = hut_test::small_options();
+  hut_trace_dump_t dump;
+  std::string value;
+  hut_db_t *db;
+  TempDir dir;
+
+  opts.trace_events = 16;
+  opts.trace_threads = 2;
+  ASSERT_EQ(HUT_OK, hut_open(dir.path(), &opts, &db));
+  for (unsigned i = 0; i < 100; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db, "key" + std::to_string(i), std::string(10 + i, 'v')));
+  EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db, "nokey", &value));
+  hut_close(db);
+  ASSERT_EQ(HUT_OK, hut_open(dir.path(), &opts, &db));
+  hut_close(db);
+
+  ASSERT_EQ(HUT_OK, hut_trace_load(dir.join("TRACE.old").c_str(), &dump));
+  ASSERT_EQ(16u, dump.count);
+  for (unsigned n = 0; n < 15; n++) {
+    std::string k = "key" + std::to_string(85 + n);
+
+    EXPECT_EQ(HUT_STATS_PUT, dump.events[n].type);
+    EXPECT_EQ(hut_hash_bytes(k.data(), k.size(), 0), dump.events[n].hash) << k;
+    EXPECT_EQ(95u + n, dump.events[n].arg);
+    EXPECT_EQ(HUT_OK, dump.events[n].status);
+  }
+  EXPECT_EQ(HUT_STATS_GET, dump.events[15].type);
+  EXPECT_EQ(hut_hash_bytes("nokey", 5, 0), dump.events[15].hash);
+  EXPECT_EQ(HUT_ERR_NOTFOUND, dump.events[15].status);
+  hut_trace_dump_free(&dump);
+
+  /* The new one, with nothing traced. */
+  ASSERT_EQ(HUT_OK, hut_trace_load(dir.join("TRACE").c_str(), &dump));
+  EXPECT_EQ(0u, dump.count);
+  hut_trace_dump_free(&dump);
+}
+
+} // namespace
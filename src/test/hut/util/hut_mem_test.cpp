@@ -0,0 +1,125 @@
+#include "hut_test.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/util/hut_mem.h"
+}
+
+/*
+ * Huge pages: memory and file maps in every mode, placed where the
+ * kernel can back them with huge pages, and whole databases opened with
+ * each, which must work the same wherever huge pages are short or
+ * missing, as they are on most test machines for hugetlbfs.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+class Mem : public ::testing::TestWithParam<hut_huge_pages_t> {};
+
+TEST_P(Mem, Alloc) {
+  const size_t sizes[] = {1, 4096, HUT_MEM_HUGE_PAGE, 3 * HUT_MEM_HUGE_PAGE + 1};
+  const int nodes[] = {-1, 0, 63};
+  hut_huge_pages_t huge = GetParam();
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++)
+    for (size_t n = 0; n < sizeof(nodes) / sizeof(*nodes); n++) {
+      char *p = static_cast<char *>(hut_mem_alloc(sizes[s], huge, nodes[n]));
+
+      ASSERT_TRUE(p != NULL) << sizes[s] << " bytes on node " << nodes[n];
+      if (huge != HUT_HUGE_PAGES_NONE)
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(p) % HUT_MEM_HUGE_PAGE);
+      EXPECT_EQ(0, p[0]);
+      EXPECT_EQ(0, p[sizes[s] - 1]);
+      memset(p, 0x5a, sizes[s]);
+      hut_mem_free(p, sizes[s], huge);
+    }
+  hut_mem_free(NULL, 1, huge);
+}
+
+/* Offsets past a huge page boundary, for the map to start as far past one. */
+TEST_P(Mem, MapFile) {
+  const size_t len = 3 * HUT_MEM_HUGE_PAGE;
+  const uint64_t offs[] = {0, 4096, HUT_MEM_HUGE_PAGE + 8192};
+  std::string data(len + HUT_MEM_HUGE_PAGE + 8192, '\0');
+  hut_huge_pages_t huge = GetParam();
+  TempDir dir;
+  char *p;
+  int fd;
+
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = static_cast<char>(i * 7 / 4096);
+  hut_test::write_file(dir.join("file"), data);
+  ASSERT_GE(fd = open(dir.join("file").c_str(), O_RDWR), 0);
+
+  for (size_t i = 0; i < sizeof(offs) / sizeof(*offs); i++) {
+    p = static_cast<char *>(hut_mem_map_file(len, PROT_READ | PROT_WRITE, fd, offs[i], huge));
+    ASSERT_TRUE(p != NULL) << offs[i];
+    if (huge != HUT_HUGE_PAGES_NONE)
+      EXPECT_EQ(offs[i] % HUT_MEM_HUGE_PAGE, reinterpret_cast<uintptr_t>(p) % HUT_MEM_HUGE_PAGE);
+    EXPECT_EQ(0, memcmp(p, data.data() + offs[i], len)) << offs[i];
+    p[0] = 'x';
+    munmap(p, len);
+    data[offs[i]] = 'x';
+  }
+  close(fd);
+  EXPECT_EQ(data, hut_test::read_files(dir.path())["file"]);
+}
+
+std::string key(unsigned i) {
+  return "key" + std::to_string(i);
+}
+
+std::string value(unsigned i, unsigned gen) {
+  return std::string(200 + i % 100, static_cast<char>('a' + (i + gen) % 26));
+}
+
+/* Index, segments and cache all on huge pages, sealed, compacted and reopened. */
+TEST_P(Mem, Database) {
+  const unsigned n = 20000;
+  hut_options_t opts = hut_test::small_options();
+  hut_verify_t report;
+  std::string got;
+  hut_db_t *db;
+  TempDir dir;
+
+  opts.huge_pages = GetParam();
+  ASSERT_EQ(HUT_OK, hut_open(dir.path(), &opts, &db));
+  for (unsigned i = 0; i < n; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db, key(i), value(i, 0)));
+  for (unsigned i = 0; i < n; i += 2)
+    ASSERT_EQ(HUT_OK, i % 4 ? hut_test::del(db, key(i)) : hut_test::put(db, key(i), value(i, 1)));
+  ASSERT_EQ(HUT_OK, hut_compact(db, 0.3));
+  hut_close(db);
+
+  ASSERT_EQ(HUT_OK, hut_open(dir.path(), &opts, &db));
+  for (unsigned i = 0; i < n; i++) {
+    int rc = hut_test::get(db, key(i), &got);
+
+    if (i % 4 == 2) {
+      EXPECT_EQ(HUT_ERR_NOTFOUND, rc) << key(i);
+      continue;
+    }
+    ASSERT_EQ(HUT_OK, rc) << key(i);
+    EXPECT_EQ(value(i, i % 2 ? 0 : 1), got) << key(i);
+  }
+  EXPECT_EQ(HUT_OK, hut_verify(db, &report));
+  EXPECT_GT(report.segments, 1u);
+  hut_close(db);
+}
+
+INSTANTIATE_TEST_CASE_P(HugePages, Mem,
+                        ::testing::Values(HUT_HUGE_PAGES_NONE, HUT_HUGE_PAGES_TRANSPARENT,
+                                          HUT_HUGE_PAGES_HUGETLB));
+
+} // namespace
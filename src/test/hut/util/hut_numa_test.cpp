@@ -0,0 +1,138 @@
+#include "hut_test.hpp"
+
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <sched.h>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/util/hut_mem.h"
+#include "hut/util/hut_numa.h"
+}
+
+/*
+ * NUMA: the topology as read from sysfs, binding and pinning that do
+ * nothing harmful where they cannot do what they are asked, and sharded
+ * databases opened with `numa` set, which must work the same on a single
+ * node as on many.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+TEST(Numa, Topology) {
+  unsigned nodes = hut_numa_node_count(), cpus = hut_numa_cpu_count();
+
+  EXPECT_GE(nodes, 1u);
+  EXPECT_GE(cpus, 1u);
+  for (unsigned cpu = 0; cpu < cpus; cpu++) {
+    EXPECT_GE(hut_numa_cpu_node(cpu), 0) << cpu;
+    EXPECT_LT(hut_numa_cpu_node(cpu), static_cast<int>(nodes)) << cpu;
+  }
+  /* Unknown CPUs are on node 0. */
+  EXPECT_EQ(0, hut_numa_cpu_node(100000));
+}
+
+/* Pages end up somewhere, whichever node was asked for. */
+TEST(Numa, Bind) {
+  const size_t len = 4 * HUT_MEM_HUGE_PAGE;
+  const int nodes[] = {-1, 0, static_cast<int>(hut_numa_node_count()) - 1,
+                       static_cast<int>(hut_numa_node_count()), 63, 64, 1000};
+
+  for (size_t i = 0; i < sizeof(nodes) / sizeof(*nodes); i++) {
+    char *p = static_cast<char *>(hut_mem_alloc(len, HUT_HUGE_PAGES_NONE, -1));
+
+    ASSERT_TRUE(p != NULL);
+    hut_numa_bind(p, len, nodes[i]);
+    memset(p, 0x5a, len);
+    EXPECT_EQ(0x5a, p[len - 1]) << nodes[i];
+    hut_mem_free(p, len, HUT_HUGE_PAGES_NONE);
+  }
+}
+
+/* To the last CPU the process may run on. */
+TEST(Numa, Pin) {
+  int rc = -1, cpu = -1, last = -1;
+  cpu_set_t set;
+
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(set), &set));
+  for (int i = 0; i < CPU_SETSIZE; i++)
+    if (CPU_ISSET(i, &set))
+      last = i;
+  ASSERT_GE(last, 0);
+  std::thread([&] {
+    rc = hut_numa_pin(static_cast<unsigned>(last));
+    cpu = sched_getcpu();
+  }).join();
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(last, cpu);
+  /* No such CPU. */
+  std::thread([&] { rc = hut_numa_pin(CPU_SETSIZE - 1); }).join();
+  EXPECT_NE(0, rc);
+}
+
+struct Param {
+  hut_runtime_t runtime;
+  unsigned shards;
+  hut_huge_pages_t huge;
+};
+
+class NumaDb : public ::testing::TestWithParam<Param> {};
+
+std::string key(unsigned i) {
+  return "key" + std::to_string(i);
+}
+
+std::string value(unsigned i) {
+  return std::string(100 + i % 200, static_cast<char>('a' + i % 26));
+}
+
+/* Shards spread over the nodes there are, by core when pinned. */
+TEST_P(NumaDb, Works) {
+  const unsigned n = 10000;
+  hut_options_t opts = hut_test::small_options();
+  hut_verify_t report;
+  std::string got;
+  hut_db_t *db;
+  TempDir dir;
+
+  opts.numa = 1;
+  opts.runtime = GetParam().runtime;
+  opts.shards = GetParam().shards;
+  opts.huge_pages = GetParam().huge;
+  ASSERT_EQ(HUT_OK, hut_open(dir.path(), &opts, &db));
+  for (unsigned i = 0; i < n; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db, key(i), value(i)));
+  for (unsigned i = 0; i < n; i += 3)
+    ASSERT_EQ(HUT_OK, hut_test::del(db, key(i)));
+  ASSERT_EQ(HUT_OK, hut_compact(db, 0.2));
+  hut_close(db);
+
+  ASSERT_EQ(HUT_OK, hut_open(dir.path(), &opts, &db));
+  for (unsigned i = 0; i < n; i++) {
+    int rc = hut_test::get(db, key(i), &got);
+
+    if (i % 3 == 0) {
+      EXPECT_EQ(HUT_ERR_NOTFOUND, rc) << key(i);
+      continue;
+    }
+    ASSERT_EQ(HUT_OK, rc) << key(i);
+    EXPECT_EQ(value(i), got) << key(i);
+  }
+  EXPECT_EQ(HUT_OK, hut_verify(db, &report));
+  hut_close(db);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Shards, NumaDb,
+    ::testing::Values(Param{HUT_RUNTIME_SHARED, 0, HUT_HUGE_PAGES_NONE},
+                      Param{HUT_RUNTIME_SHARED, 4, HUT_HUGE_PAGES_NONE},
+                      Param{HUT_RUNTIME_SHARED, 4, HUT_HUGE_PAGES_HUGETLB},
+                      Param{HUT_RUNTIME_THREAD_PER_CORE, 2, HUT_HUGE_PAGES_NONE},
+                      Param{HUT_RUNTIME_THREAD_PER_CORE, 2, HUT_HUGE_PAGES_TRANSPARENT}));
+
+} // namespace
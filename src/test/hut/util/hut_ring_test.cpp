@@ -0,0 +1,83 @@
+#include "hut_test.hpp"
+
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/util/hut_ring.h"
+}
+
+/*
+ * The request ring: order and bounds for one producer, every push popped
+ * once with many, and a consumer about to sleep never missing a stop.
+ */
+
+namespace {
+
+TEST(Ring, FifoAndFull) {
+  hut_ring_t *ring;
+  uintptr_t i;
+
+  ASSERT_EQ(HUT_OK, hut_ring_create(5, &ring));
+  EXPECT_TRUE(hut_ring_pop(ring) == NULL);
+  for (i = 1; i <= 8; i++)
+    ASSERT_EQ(HUT_OK, hut_ring_push(ring, reinterpret_cast<void *>(i)));
+  EXPECT_EQ(HUT_ERR_FULL, hut_ring_push(ring, reinterpret_cast<void *>(i)));
+  for (i = 1; i <= 8; i++)
+    EXPECT_EQ(i, reinterpret_cast<uintptr_t>(hut_ring_pop(ring)));
+  EXPECT_TRUE(hut_ring_pop(ring) == NULL);
+  hut_ring_destroy(ring);
+}
+
+TEST(Ring, ManyProducers) {
+  const unsigned producers = 4, each = 50000;
+  std::vector<unsigned> seen(producers * each);
+  std::vector<std::thread> threads;
+  hut_ring_t *ring;
+  unsigned got = 0;
+  void *data;
+
+  ASSERT_EQ(HUT_OK, hut_ring_create(64, &ring));
+  for (unsigned p = 0; p < producers; p++)
+    threads.emplace_back([=] {
+      for (uintptr_t i = p * each; i < (p + 1) * each; i++)
+        while (hut_ring_push(ring, reinterpret_cast<void *>(i + 1)))
+          std::this_thread::yield();
+    });
+  while (got < producers * each) {
+    if ((data = hut_ring_pop(ring))) {
+      seen[reinterpret_cast<uintptr_t>(data) - 1]++;
+      got++;
+    } else {
+      hut_ring_wait(ring);
+    }
+  }
+  for (unsigned t = 0; t < threads.size(); t++)
+    threads[t].join();
+  for (unsigned i = 0; i < seen.size(); i++)
+    ASSERT_EQ(1u, seen[i]) << i;
+  hut_ring_destroy(ring);
+}
+
+/* Stopping while the consumer heads for sleep; a lost wake hangs here. */
+TEST(Ring, StopWakesConsumer) {
+  for (unsigned round = 0; round < 2000; round++) {
+    hut_ring_t *ring;
+
+    ASSERT_EQ(HUT_OK, hut_ring_create(8, &ring));
+    std::thread consumer([=] {
+      while (!hut_ring_stopped(ring))
+        if (!hut_ring_pop(ring))
+          hut_ring_wait(ring);
+    });
+    if (round % 2)
+      std::this_thread::yield();
+    hut_ring_stop(ring);
+    consumer.join();
+    hut_ring_destroy(ring);
+  }
+}
+
+} // namespace
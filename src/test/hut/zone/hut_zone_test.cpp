@@ -0,0 +1,210 @@
+#include "hut_test.hpp"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hut/zone/hut_zone.h"
+}
+
+/*
+ * Zoned storage: the emulated device keeping to the rules of a zoned
+ * drive across reopens, and a database sealing into it, running it full
+ * and getting the space back through compaction.
+ */
+
+namespace {
+
+using hut_test::TempDir;
+
+const uint64_t kZoneSize = 256u << 10;
+
+class Device : public ::testing::Test {
+protected:
+  void SetUp() override {
+    path_ = dir_.join("ZONES");
+    ASSERT_EQ(HUT_OK, hut_zone_open(path_.c_str(), kZoneSize, 8, 2, &dev_));
+  }
+
+  void TearDown() override { hut_zone_close(dev_); }
+
+  hut_zone_info_t info(uint32_t zone) {
+    hut_zone_info_t i;
+
+    EXPECT_EQ(HUT_OK, hut_zone_info(dev_, zone, &i));
+    return i;
+  }
+
+  int write(uint32_t zone, uint64_t off, size_t len) {
+    std::string buf(len, 'z');
+    return hut_zone_write(dev_, zone, off, buf.data(), buf.size());
+  }
+
+  TempDir dir_;
+  std::string path_;
+  hut_zone_dev_t *dev_ = NULL;
+};
+
+TEST_F(Device, Geometry) {
+  hut_zone_dev_t *other;
+
+  EXPECT_EQ(kZoneSize, hut_zone_size(dev_));
+  EXPECT_EQ(8u, hut_zone_count(dev_));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_zone_open(dir_.join("X").c_str(), 1000, 8, 2, &other));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_zone_open(path_.c_str(), kZoneSize * 2, 8, 2, &other));
+  EXPECT_EQ(HUT_ERR_INVALID, hut_zone_open(path_.c_str(), kZoneSize, 4, 2, &other));
+}
+
+TEST_F(Device, WritesAtTheWritePointerOnly) {
+  uint32_t zone;
+
+  ASSERT_EQ(HUT_OK, hut_zone_open_empty(dev_, 0, &zone));
+  EXPECT_EQ(HUT_ZONE_OPEN, info(zone).state);
+  ASSERT_EQ(HUT_OK, write(zone, 0, 2 * HUT_ZONE_BLOCK));
+  EXPECT_EQ(2u * HUT_ZONE_BLOCK, info(zone).wp);
+
+  EXPECT_EQ(HUT_ERR_INVALID, write(zone, 0, HUT_ZONE_BLOCK));
+  EXPECT_EQ(HUT_ERR_INVALID, write(zone, 3 * HUT_ZONE_BLOCK, HUT_ZONE_BLOCK));
+  EXPECT_EQ(HUT_ERR_INVALID, write(zone, 2 * HUT_ZONE_BLOCK, 100));
+  EXPECT_EQ(HUT_ERR_FULL, write(zone, 2 * HUT_ZONE_BLOCK, kZoneSize));
+  EXPECT_EQ(2u * HUT_ZONE_BLOCK, info(zone).wp);
+
+  ASSERT_EQ(HUT_OK, hut_zone_finish(dev_, zone));
+  EXPECT_EQ(HUT_ZONE_FULL, info(zone).state);
+  EXPECT_EQ(HUT_ERR_INVALID, write(zone, 2 * HUT_ZONE_BLOCK, HUT_ZONE_BLOCK));
+
+  ASSERT_EQ(HUT_OK, hut_zone_reset(dev_, zone));
+  EXPECT_EQ(HUT_ZONE_EMPTY, info(zone).state);
+  EXPECT_EQ(0u, info(zone).wp);
+  EXPECT_EQ(HUT_OK, write(zone, 0, HUT_ZONE_BLOCK));
+}
+
+TEST_F(Device, OpenLimitAndReserve) {
+  uint32_t a, b, c;
+
+  ASSERT_EQ(HUT_OK, hut_zone_open_empty(dev_, 0, &a));
+  ASSERT_EQ(HUT_OK, hut_zone_open_empty(dev_, 0, &b));
+  EXPECT_NE(a, b);
+  EXPECT_EQ(HUT_ERR_BUSY, hut_zone_open_empty(dev_, 0, &c));
+  ASSERT_EQ(HUT_OK, hut_zone_finish(dev_, a));
+  ASSERT_EQ(HUT_OK, hut_zone_finish(dev_, b));
+
+  /* Six empty left. */
+  EXPECT_EQ(HUT_ERR_FULL, hut_zone_open_empty(dev_, 6, &c));
+  EXPECT_EQ(HUT_OK, hut_zone_open_empty(dev_, 5, &c));
+}
+
+TEST_F(Device, StatePersists) {
+  uint32_t open, full;
+
+  ASSERT_EQ(HUT_OK, hut_zone_open_empty(dev_, 0, &full));
+  ASSERT_EQ(HUT_OK, write(full, 0, 3 * HUT_ZONE_BLOCK));
+  ASSERT_EQ(HUT_OK, hut_zone_finish(dev_, full));
+  ASSERT_EQ(HUT_OK, hut_zone_open_empty(dev_, 0, &open));
+  ASSERT_EQ(HUT_OK, write(open, 0, HUT_ZONE_BLOCK));
+  hut_zone_close(dev_);
+  dev_ = NULL;
+
+  ASSERT_EQ(HUT_OK, hut_zone_open(path_.c_str(), kZoneSize, 8, 2, &dev_));
+  EXPECT_EQ(HUT_ZONE_FULL, info(full).state);
+  EXPECT_EQ(3u * HUT_ZONE_BLOCK, info(full).wp);
+
+  /* Left as opened, for the database to reset as an interrupted seal. */
+  EXPECT_EQ(HUT_ZONE_OPEN, info(open).state);
+  EXPECT_EQ(0u, info(open).wp);
+  ASSERT_EQ(HUT_OK, hut_zone_reset(dev_, open));
+  EXPECT_EQ(HUT_OK, write(open, 0, HUT_ZONE_BLOCK));
+}
+
+class Zoned : public ::testing::Test {
+protected:
+  void SetUp() override {
+    opts_ = hut_test::small_options();
+    opts_.segment_size = kZoneSize;
+    opts_.zones.zone_size = kZoneSize;
+    opts_.zones.zone_count = 12;
+    opts_.zones.max_open = 4;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+
+  void TearDown() override {
+    if (db_)
+      hut_close(db_);
+  }
+
+  static std::string key(unsigned i) { return "key" + std::to_string(i); }
+
+  static std::string value(unsigned i, unsigned gen) {
+    std::string v = std::to_string(gen) + ":";
+
+    v.resize(1000, static_cast<char>('a' + (i + gen) % 26));
+    return v;
+  }
+
+  TempDir dir_;
+  hut_options_t opts_;
+  hut_db_t *db_ = NULL;
+};
+
+/*
+ * Overwriting a small set of keys writes the device several times over,
+ * which only works as long as compaction resets the zones freed.
+ */
+TEST_F(Zoned, CompactionFreesZones) {
+  const unsigned keys = 100, gens = 60;
+  unsigned fulls = 0;
+  std::string got;
+  int rc;
+
+  for (unsigned gen = 0; gen < gens; gen++)
+    for (unsigned i = 0; i < keys; i++) {
+      if ((rc = hut_test::put(db_, key(i), value(i, gen))) == HUT_ERR_FULL) {
+        fulls++;
+        ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+        rc = hut_test::put(db_, key(i), value(i, gen));
+      }
+      ASSERT_EQ(HUT_OK, rc) << "generation " << gen << ", " << key(i);
+    }
+  EXPECT_GT(fulls, 0u);
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (unsigned i = 0; i < keys; i++) {
+      ASSERT_EQ(HUT_OK, hut_test::get(db_, key(i), &got)) << key(i);
+      EXPECT_EQ(value(i, gens - 1), got) << key(i);
+    }
+    hut_close(db_);
+    db_ = NULL;
+    ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+  }
+}
+
+TEST_F(Zoned, DeletesSurviveReopen) {
+  std::string got;
+
+  for (unsigned i = 0; i < 1000; i++)
+    ASSERT_EQ(HUT_OK, hut_test::put(db_, key(i), value(i, 0)));
+  for (unsigned i = 0; i < 1000; i += 2)
+    ASSERT_EQ(HUT_OK, hut_test::del(db_, key(i)));
+  ASSERT_EQ(HUT_OK, hut_compact(db_, 0));
+  hut_close(db_);
+  db_ = NULL;
+  ASSERT_EQ(HUT_OK, hut_open(dir_.path(), &opts_, &db_));
+
+  for (unsigned i = 0; i < 1000; i++) {
+    if (i % 2 == 0) {
+      EXPECT_EQ(HUT_ERR_NOTFOUND, hut_test::get(db_, key(i), &got)) << key(i);
+    } else {
+      ASSERT_EQ(HUT_OK, hut_test::get(db_, key(i), &got)) << key(i);
+      EXPECT_EQ(value(i, 0), got);
+    }
+  }
+}
+
+TEST_F(Zoned, NoLoader) {
+  hut_loader_t *loader;
+
+  EXPECT_EQ(HUT_ERR_NOTSUP, hut_loader_create(db_, 1, &loader));
+}
+
+} // namespace